@@ -0,0 +1,9 @@
+#pragma once
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+//! Path normalization and mount prefix matching.
+void benchPaths();
+
+//! FileContext request overhead, measured against the RAM device so no syscalls are involved.
+void benchContext();
@@ -0,0 +1,99 @@
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+// Microbenchmark for the cost of going through a FileContext. Everything lives on a RAM
+// device, so the numbers are the request round trip rather than the storage.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <laminaFS.h>
+
+#include "bench.h"
+
+using namespace laminaFS;
+
+namespace {
+constexpr uint32_t kFileCount = 1000;
+constexpr uint32_t kFileBytes = 64;
+constexpr uint32_t kBatchSize = 64;
+
+template <typename Func>
+double timeNanosPerRequest(uint32_t requests, Func &&func) {
+	auto start = std::chrono::steady_clock::now();
+	func();
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	return std::chrono::duration<double, std::nano>(elapsed).count() / requests;
+}
+}
+
+void benchContext() {
+	FileContext ctx(laminaFS::DefaultAllocator);
+
+	ErrorCode resultCode;
+	ctx.createMount(FileContext::kRamDeviceIndex, "/ram", "", resultCode);
+	if (resultCode != LFS_OK) {
+		printf("couldn't mount the RAM device: %d\n", resultCode);
+		return;
+	}
+
+	std::vector<std::string> paths;
+	std::string contents(kFileBytes, 'x');
+	for (uint32_t i = 0; i < kFileCount; ++i) {
+		paths.push_back("/ram/file_" + std::to_string(i) + ".bin");
+
+		WorkItem *item = ctx.writeFile(paths.back().c_str(), contents.data(), contents.size());
+		WaitForWorkItem(item);
+		ctx.releaseWorkItem(item);
+	}
+
+	printf("FileContext over the RAM device (%u files of %u bytes):\n", kFileCount, kFileBytes);
+
+	double nanos = timeNanosPerRequest(kFileCount, [&]() {
+		for (const std::string &path : paths) {
+			WorkItem *item = ctx.fileExists(path.c_str());
+			WaitForWorkItem(item);
+			ctx.releaseWorkItem(item);
+		}
+	});
+	printf("  %-24s %10.0f ns/request\n", "fileExists", nanos);
+
+	nanos = timeNanosPerRequest(kFileCount, [&]() {
+		for (const std::string &path : paths) {
+			WorkItem *item = ctx.readFile(path.c_str(), false);
+			WaitForWorkItem(item);
+			WorkItemFreeBuffer(item);
+			ctx.releaseWorkItem(item);
+		}
+	});
+	printf("  %-24s %10.0f ns/request\n", "readFile", nanos);
+
+	nanos = timeNanosPerRequest(kFileCount, [&]() {
+		for (const std::string &path : paths) {
+			WorkItem *item = ctx.writeFile(path.c_str(), contents.data(), contents.size());
+			WaitForWorkItem(item);
+			ctx.releaseWorkItem(item);
+		}
+	});
+	printf("  %-24s %10.0f ns/request\n", "writeFile", nanos);
+
+	// keeping several requests in flight shows the throughput of the processing thread
+	nanos = timeNanosPerRequest(kFileCount, [&]() {
+		WorkItem *items[kBatchSize];
+		for (uint32_t start = 0; start < kFileCount; start += kBatchSize) {
+			uint32_t count = std::min(kBatchSize, kFileCount - start);
+			for (uint32_t i = 0; i < count; ++i) {
+				items[i] = ctx.readFile(paths[start + i].c_str(), false);
+			}
+			for (uint32_t i = 0; i < count; ++i) {
+				WaitForWorkItem(items[i]);
+				WorkItemFreeBuffer(items[i]);
+				ctx.releaseWorkItem(items[i]);
+			}
+		}
+	});
+	printf("  %-24s %10.0f ns/request\n", "readFile, batches of 64", nanos);
+}
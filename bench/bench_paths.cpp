@@ -0,0 +1,126 @@
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+// Microbenchmark for path normalization and mount prefix matching.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "util/PathScan.h"
+
+using namespace laminaFS;
+
+namespace {
+const char *kDirectories[] = {"assets", "textures", "characters", "environment", "generated", "lod0", "lod1", "materials", "shaders", "variants"};
+const char *kMounts[] = {"/assets/textures/characters", "/assets/textures/environment", "/assets/generated", "/assets"};
+
+constexpr uint32_t kPathCount = 100000;
+constexpr uint32_t kIterations = 20;
+
+// generated asset paths, some of which need actual normalization work
+std::vector<std::string> makePaths() {
+	std::mt19937 rng(42);
+	std::vector<std::string> paths;
+	paths.reserve(kPathCount);
+
+	for (uint32_t i = 0; i < kPathCount; ++i) {
+		std::string path = "/assets";
+		uint32_t depth = 4 + rng() % 8;
+		for (uint32_t d = 0; d < depth; ++d) {
+			path += '/';
+			path += kDirectories[rng() % (sizeof(kDirectories) / sizeof(*kDirectories))];
+			path += '_';
+			path += std::to_string(rng() % 10000);
+		}
+
+		switch (rng() % 8) {
+		case 0: path += "//extra"; break;
+		case 1: path += "/./extra"; break;
+		case 2: path += "/../extra"; break;
+		default: break;
+		}
+
+		path += "/file.dds";
+		paths.push_back(path);
+	}
+
+	return paths;
+}
+
+template <typename Func>
+double timeNanosPerPath(Func &&func) {
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < kIterations; ++i) {
+		func();
+	}
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	return std::chrono::duration<double, std::nano>(elapsed).count() / (static_cast<double>(kIterations) * kPathCount);
+}
+}
+
+void benchPaths() {
+	std::vector<std::string> paths = makePaths();
+	std::vector<char> scratch;
+
+	uint64_t totalLen = 0;
+	for (const std::string &path : paths) {
+		totalLen += path.size();
+	}
+	printf("%u paths, average length %.1f\n\n", kPathCount, static_cast<double>(totalLen) / kPathCount);
+
+	const util::SimdLevel levels[] = {util::SimdLevel::Scalar, util::SimdLevel::SSE2, util::SimdLevel::AVX2};
+	const char *levelNames[] = {"scalar", "SSE2", "AVX2"};
+
+	// the result is accumulated so the work can't be optimized out
+	volatile uint64_t sink = 0;
+
+	printf("normalize:\n");
+	double reference = timeNanosPerPath([&]() {
+		for (const std::string &path : paths) {
+			scratch.assign(path.c_str(), path.c_str() + path.size() + 1);
+			util::normalizePath(scratch.data());
+			sink = sink + scratch[1];
+		}
+	});
+	printf("  %-16s %8.2f ns/path\n", "byte at a time", reference);
+
+	for (uint32_t level = 0; level < 3 && levels[level] <= util::simdLevel(); ++level) {
+		double nanos = timeNanosPerPath([&]() {
+			for (const std::string &path : paths) {
+				scratch.assign(path.c_str(), path.c_str() + path.size() + 1);
+				util::normalizePathFast(scratch.data(), levels[level]);
+				sink = sink + scratch[1];
+			}
+		});
+		printf("  %-16s %8.2f ns/path (%.2fx)\n", levelNames[level], nanos, reference / nanos);
+	}
+
+	printf("\nmount prefix match (%u mounts):\n", static_cast<uint32_t>(sizeof(kMounts) / sizeof(*kMounts)));
+	reference = timeNanosPerPath([&]() {
+		for (const std::string &path : paths) {
+			for (const char *mount : kMounts) {
+				const char *found = strstr(path.c_str(), mount);
+				sink = sink + (found == path.c_str() ? 1 : 0);
+			}
+		}
+	});
+	printf("  %-16s %8.2f ns/path\n", "strstr", reference);
+
+	for (uint32_t level = 0; level < 3 && levels[level] <= util::simdLevel(); ++level) {
+		double nanos = timeNanosPerPath([&]() {
+			for (const std::string &path : paths) {
+				uint32_t pathLen = static_cast<uint32_t>(path.size());
+				for (const char *mount : kMounts) {
+					uint32_t mountLen = static_cast<uint32_t>(strlen(mount));
+					sink = sink + (pathLen > mountLen && util::prefixEquals(path.c_str(), mount, mountLen, levels[level]) ? 1 : 0);
+				}
+			}
+		});
+		printf("  %-16s %8.2f ns/path (%.2fx)\n", levelNames[level], nanos, reference / nanos);
+	}
+}
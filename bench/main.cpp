@@ -0,0 +1,13 @@
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#include <cstdio>
+
+#include "bench.h"
+
+int main(int, char *[]) {
+	benchPaths();
+	printf("\n");
+	benchContext();
+	return 0;
+}
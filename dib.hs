@@ -56,9 +56,43 @@ testsInfo config = (getCompiler $ platform config) {
 tests config = addDependency (makeCTarget $ testsInfo config) $ liblaminaFS config
 cleanTests config = makeCleanTarget $ testsInfo config
 
+-- Benchmark targets
+benchInfo config = (getCompiler $ platform config) {
+  outputName = "bench" <> exeExt config,
+  targetName = "bench-" <> platform config <> "-" <> buildType config,
+  srcDir = "bench",
+  commonCompileFlags = "-Wall -Wextra -Werror " <> buildFlags config <> sanitizerFlags config,
+  cCompileFlags = "--std=c11",
+  cxxCompileFlags = "--std=c++17 -Wold-style-cast",
+  linkFlags = "-L./lib/" <> platform config <> "-" <> buildType config <> " -llaminaFS -lstdc++ -lpthread" <> sanitizerFlags config,
+  extraLinkDeps = ["lib/" <> platform config <> "-" <> buildType config <> "/liblaminaFS" <> soExt config],
+  outputLocation = ObjAndBinDirs ("obj/" <> platform config <> "-" <> buildType config) ("bin/" <> platform config <> "-" <> buildType config),
+  includeDirs = ["src", "bench"]
+}
+
+bench config = addDependency (makeCTarget $ benchInfo config) $ liblaminaFS config
+cleanBench config = makeCleanTarget $ benchInfo config
+
+-- Tool targets
+lfspackInfo config = (getCompiler $ platform config) {
+  outputName = "lfspack" <> exeExt config,
+  targetName = "lfspack-" <> platform config <> "-" <> buildType config,
+  srcDir = "tools/lfspack",
+  commonCompileFlags = "-Wall -Wextra -Werror " <> buildFlags config <> sanitizerFlags config,
+  cCompileFlags = "--std=c11",
+  cxxCompileFlags = "--std=c++17 -Wold-style-cast",
+  linkFlags = "-L./lib/" <> platform config <> "-" <> buildType config <> " -llaminaFS -lstdc++ -lpthread" <> sanitizerFlags config,
+  extraLinkDeps = ["lib/" <> platform config <> "-" <> buildType config <> "/liblaminaFS" <> soExt config],
+  outputLocation = ObjAndBinDirs ("obj/" <> platform config <> "-" <> buildType config) ("bin/" <> platform config <> "-" <> buildType config),
+  includeDirs = ["src", "tools/lfspack"]
+}
+
+lfspack config = addDependency (makeCTarget $ lfspackInfo config) $ liblaminaFS config
+cleanLfspack config = makeCleanTarget $ lfspackInfo config
+
 -- Targets
-allTarget config = makePhonyTarget "all" [liblaminaFS config, tests config]
-targets config = [allTarget config,  liblaminaFS config, cleanLamina config, tests config, cleanTests config]
+allTarget config = makePhonyTarget "all" [liblaminaFS config, tests config, lfspack config]
+targets config = [allTarget config,  liblaminaFS config, cleanLamina config, tests config, cleanTests config, bench config, cleanBench config, lfspack config, cleanLfspack config]
 
 -- Configuration related functions
 getBuildPlatform d = handleArgResult $ makeArgDictLookupFuncChecked "PLATFORM" "local" ["local", "mingw32"] d
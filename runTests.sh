@@ -1,2 +1,2 @@
 #!/bin/sh
-LD_LIBRARY_PATH=./lib/local-release/ ./bin/local-release/test
+LFSPACK=./bin/local-release/lfspack LD_LIBRARY_PATH=./lib/local-release/ ./bin/local-release/test
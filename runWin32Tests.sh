@@ -1,2 +1,2 @@
 #!/bin/sh
-wine ./bin/mingw32-release/test.exe
+LFSPACK='bin\mingw32-release\lfspack.exe' wine ./bin/mingw32-release/test.exe
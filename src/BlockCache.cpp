@@ -0,0 +1,308 @@
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#include "BlockCache.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace laminaFS;
+
+size_t BlockCache::KeyHash::operator()(const Key &key) const {
+	uint64_t hash = key._pathHash ^ (reinterpret_cast<uintptr_t>(key._owner) * 0x9e3779b97f4a7c15ULL);
+	hash ^= (key._block + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2));
+	return static_cast<size_t>(hash);
+}
+
+BlockCache::BlockCache(lfs_allocator_t &alloc, uint64_t budgetBytes, uint32_t blockSize, uint32_t shardCount)
+: _alloc(alloc)
+{
+	_blockSize = std::max(blockSize, 512u);
+	_shardCount = std::max(shardCount, 1u);
+	_shardBudget = budgetBytes / _shardCount;
+
+	_shards = static_cast<Shard**>(_alloc.alloc(_alloc.allocator, sizeof(Shard*) * _shardCount, alignof(Shard*)));
+	for (uint32_t i = 0; i < _shardCount; ++i) {
+		_shards[i] = new(_alloc.alloc(_alloc.allocator, sizeof(Shard), alignof(Shard))) Shard(_alloc);
+	}
+
+	_hits = 0;
+	_misses = 0;
+	_evictions = 0;
+}
+
+BlockCache::~BlockCache() {
+	clear();
+
+	for (uint32_t i = 0; i < _shardCount; ++i) {
+		_shards[i]->~Shard();
+		_alloc.free(_alloc.allocator, _shards[i]);
+	}
+	_alloc.free(_alloc.allocator, _shards);
+}
+
+BlockCacheStats BlockCache::getStats() {
+	BlockCacheStats stats;
+	stats.hits = _hits;
+	stats.misses = _misses;
+	stats.evictions = _evictions;
+	stats.bytesUsed = 0;
+	stats.budgetBytes = _shardBudget * _shardCount;
+
+	for (uint32_t i = 0; i < _shardCount; ++i) {
+		std::lock_guard<std::mutex> lock(_shards[i]->_mutex);
+		stats.bytesUsed += _shards[i]->_bytes;
+	}
+
+	uint64_t lookups = stats.hits + stats.misses;
+	stats.hitRatio = lookups ? static_cast<double>(stats.hits) / static_cast<double>(lookups) : 0.0;
+
+	return stats;
+}
+
+void BlockCache::clear() {
+	for (uint32_t i = 0; i < _shardCount; ++i) {
+		Shard &shard = *_shards[i];
+		std::lock_guard<std::mutex> lock(shard._mutex);
+		while (shard._head) {
+			remove(shard, shard._head);
+		}
+	}
+}
+
+BlockCache::FileState BlockCache::lookupFile(const void *owner, uint64_t pathHash, const char *path, uint64_t &size) {
+	Shard &shard = getShard(pathHash);
+	std::lock_guard<std::mutex> lock(shard._mutex);
+
+	Node *node = findFile(shard, owner, pathHash, path);
+	if (node) {
+		touch(shard, node);
+		size = node->_size;
+		return node->_exists ? FILE_PRESENT : FILE_MISSING;
+	}
+
+	return FILE_UNKNOWN;
+}
+
+void BlockCache::insertFile(const void *owner, uint64_t pathHash, const char *path, bool exists, uint64_t size) {
+	Shard &shard = getShard(pathHash);
+	std::lock_guard<std::mutex> lock(shard._mutex);
+
+	// this also takes care of hash collisions, the newest path wins
+	Node *existing = find(shard, Key{owner, pathHash, kFileInfoBlock});
+	if (existing) {
+		removeFile(shard, existing);
+	}
+
+	size_t pathBytes = strlen(path) + 1;
+	char *pathCopy = static_cast<char*>(_alloc.alloc(_alloc.allocator, pathBytes, alignof(char)));
+	if (!pathCopy) {
+		return;
+	}
+	memcpy(pathCopy, path, pathBytes);
+
+	Node *node = new(_alloc.alloc(_alloc.allocator, sizeof(Node), alignof(Node))) Node();
+	node->_key = Key{owner, pathHash, kFileInfoBlock};
+	node->_path = pathCopy;
+	node->_exists = exists;
+	node->_size = exists ? size : 0;
+	insert(shard, node);
+}
+
+bool BlockCache::readBlock(const void *owner, uint64_t pathHash, const char *path, uint64_t block, uint64_t offset, uint64_t bytes, void *dest) {
+	Shard &shard = getShard(pathHash);
+	std::lock_guard<std::mutex> lock(shard._mutex);
+
+	Node *node = findFile(shard, owner, pathHash, path) ? find(shard, Key{owner, pathHash, block}) : nullptr;
+	if (node && offset + bytes <= node->_bytes) {
+		touch(shard, node);
+		memcpy(dest, static_cast<const uint8_t*>(SharedBufferGetData(node->_buffer)) + offset, bytes);
+		++_hits;
+		return true;
+	}
+
+	++_misses;
+	return false;
+}
+
+bool BlockCache::hasBlock(const void *owner, uint64_t pathHash, const char *path, uint64_t block) {
+	Shard &shard = getShard(pathHash);
+	std::lock_guard<std::mutex> lock(shard._mutex);
+	return findFile(shard, owner, pathHash, path) && find(shard, Key{owner, pathHash, block});
+}
+
+SharedBuffer *BlockCache::acquireBlock(const void *owner, uint64_t pathHash, const char *path, uint64_t block) {
+	Shard &shard = getShard(pathHash);
+	std::lock_guard<std::mutex> lock(shard._mutex);
+
+	Node *node = findFile(shard, owner, pathHash, path) ? find(shard, Key{owner, pathHash, block}) : nullptr;
+	if (node) {
+		touch(shard, node);
+		SharedBufferRetain(node->_buffer);
+		++_hits;
+		return node->_buffer;
+	}
+
+	++_misses;
+	return nullptr;
+}
+
+void BlockCache::insertBlock(const void *owner, uint64_t pathHash, const char *path, uint64_t block, SharedBuffer *buffer) {
+	uint64_t bytes = SharedBufferGetSize(buffer);
+	if (bytes > _blockSize || bytes > _shardBudget) {
+		return;
+	}
+
+	Shard &shard = getShard(pathHash);
+	std::lock_guard<std::mutex> lock(shard._mutex);
+
+	// blocks are only useful if we know about the file they belong to
+	if (!findFile(shard, owner, pathHash, path)) {
+		return;
+	}
+
+	Node *existing = find(shard, Key{owner, pathHash, block});
+	if (existing) {
+		remove(shard, existing);
+	}
+
+	Node *node = new(_alloc.alloc(_alloc.allocator, sizeof(Node), alignof(Node))) Node();
+	node->_key = Key{owner, pathHash, block};
+	node->_bytes = bytes;
+	node->_buffer = buffer;
+	SharedBufferRetain(buffer);
+	insert(shard, node);
+}
+
+void BlockCache::invalidateFile(uint64_t pathHash) {
+	Shard &shard = getShard(pathHash);
+	std::lock_guard<std::mutex> lock(shard._mutex);
+
+	// file info and blocks all share the path hash, so they go in a single pass
+	Node *node = shard._head;
+	while (node) {
+		Node *next = node->_next;
+		if (node->_key._pathHash == pathHash) {
+			remove(shard, node);
+		}
+		node = next;
+	}
+}
+
+void BlockCache::invalidateOwner(const void *owner) {
+	for (uint32_t i = 0; i < _shardCount; ++i) {
+		Shard &shard = *_shards[i];
+		std::lock_guard<std::mutex> lock(shard._mutex);
+
+		Node *node = shard._head;
+		while (node) {
+			Node *next = node->_next;
+			if (node->_key._owner == owner) {
+				remove(shard, node);
+			}
+			node = next;
+		}
+	}
+}
+
+BlockCache::Node *BlockCache::find(Shard &shard, const Key &key) {
+	auto it = shard._nodes.find(key);
+	return it != shard._nodes.end() ? it->second : nullptr;
+}
+
+BlockCache::Node *BlockCache::findFile(Shard &shard, const void *owner, uint64_t pathHash, const char *path) {
+	Node *node = find(shard, Key{owner, pathHash, kFileInfoBlock});
+	return node && strcmp(node->_path, path) == 0 ? node : nullptr;
+}
+
+void BlockCache::insert(Shard &shard, Node *node) {
+	shard._nodes[node->_key] = node;
+
+	node->_prev = nullptr;
+	node->_next = shard._head;
+	if (shard._head) {
+		shard._head->_prev = node;
+	}
+	shard._head = node;
+	if (!shard._tail) {
+		shard._tail = node;
+	}
+
+	shard._bytes += nodeCost(node);
+	evict(shard);
+}
+
+void BlockCache::remove(Shard &shard, Node *node) {
+	shard._nodes.erase(node->_key);
+
+	if (node->_prev) {
+		node->_prev->_next = node->_next;
+	} else {
+		shard._head = node->_next;
+	}
+
+	if (node->_next) {
+		node->_next->_prev = node->_prev;
+	} else {
+		shard._tail = node->_prev;
+	}
+
+	shard._bytes -= nodeCost(node);
+
+	SharedBufferRelease(node->_buffer);
+	if (node->_path) {
+		_alloc.free(_alloc.allocator, node->_path);
+	}
+	node->~Node();
+	_alloc.free(_alloc.allocator, node);
+}
+
+void BlockCache::removeFile(Shard &shard, Node *info) {
+	Key key = info->_key;
+	uint64_t blockCount = (info->_size + _blockSize - 1) / _blockSize;
+	remove(shard, info);
+
+	for (uint64_t i = 0; i < blockCount; ++i) {
+		key._block = i;
+		Node *block = find(shard, key);
+		if (block) {
+			remove(shard, block);
+		}
+	}
+}
+
+void BlockCache::touch(Shard &shard, Node *node) {
+	if (shard._head == node) {
+		return;
+	}
+
+	// unlink
+	node->_prev->_next = node->_next;
+	if (node->_next) {
+		node->_next->_prev = node->_prev;
+	} else {
+		shard._tail = node->_prev;
+	}
+
+	// move to front
+	node->_prev = nullptr;
+	node->_next = shard._head;
+	shard._head->_prev = node;
+	shard._head = node;
+}
+
+void BlockCache::evict(Shard &shard) {
+	while (shard._bytes > _shardBudget && shard._tail && shard._tail != shard._head) {
+		Node *victim = shard._tail;
+		if (victim->_key._block == kFileInfoBlock) {
+			removeFile(shard, victim);
+		} else {
+			remove(shard, victim);
+		}
+		++_evictions;
+	}
+}
+
+uint64_t BlockCache::nodeCost(const Node *node) const {
+	return sizeof(Node) + node->_bytes + (node->_path ? strlen(node->_path) + 1 : 0);
+}
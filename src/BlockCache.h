@@ -0,0 +1,194 @@
+#pragma once
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+#include "shared_types.h"
+#include "SharedBuffer.h"
+#include "util/AllocatorAdapter.h"
+
+namespace laminaFS {
+
+typedef lfs_block_cache_stats_t BlockCacheStats;
+
+//! BlockCache is a sharded LRU cache of file contents, split into fixed-size blocks.
+//! Blocks are keyed by (mount, path, block index). A single cache may be shared
+//! between multiple FileContexts; it must outlive all contexts it is attached to.
+//!
+//! In addition to blocks, the cache remembers the size of each file it has seen
+//! on a mount, as well as which mounts don't contain a file. This lets fully
+//! cached reads complete without touching the device at all.
+//!
+//! The cache is only kept coherent with modifications made through the contexts
+//! it's attached to. Files changed outside of LaminaFS may be served stale.
+class BlockCache {
+public:
+	BlockCache(lfs_allocator_t &alloc, uint64_t budgetBytes, uint32_t blockSize = kDefaultBlockSize, uint32_t shardCount = kDefaultShardCount);
+	~BlockCache();
+
+	BlockCache(const BlockCache &) = delete;
+	BlockCache &operator=(const BlockCache &) = delete;
+
+	//! The state of a file, as known by the cache.
+	enum FileState {
+		FILE_UNKNOWN,
+		FILE_MISSING,
+		FILE_PRESENT
+	};
+
+	//! Returns the Allocator interface used to initialize this cache.
+	//! @return the Allocator
+	lfs_allocator_t &getAllocator() { return _alloc; }
+
+	//! Gets the block size.
+	//! @return the block size in bytes
+	uint32_t getBlockSize() const { return _blockSize; }
+
+	//! Gets the largest read that will be served through the cache.
+	//! @return the size in bytes
+	uint64_t getMaxCachedRead() const { return _shardBudget; }
+
+	//! Gets cache statistics.
+	//! @return the statistics
+	BlockCacheStats getStats();
+
+	//! Removes all blocks from the cache.
+	void clear();
+
+	//! Looks up what the cache knows about a file on a given mount.
+	//! @param owner the mount
+	//! @param pathHash the hash of the file's path
+	//! @param path the file's path on the mount
+	//! @param size the size of the file, if present
+	//! @return the file state
+	FileState lookupFile(const void *owner, uint64_t pathHash, const char *path, uint64_t &size);
+
+	//! Records the existence and size of a file on a given mount. If another path with the
+	//! same hash is cached, it's replaced along with its blocks.
+	//! @param owner the mount
+	//! @param pathHash the hash of the file's path
+	//! @param path the file's path on the mount
+	//! @param exists whether or not the file exists on the mount
+	//! @param size the size of the file
+	void insertFile(const void *owner, uint64_t pathHash, const char *path, bool exists, uint64_t size);
+
+	//! Copies a part of a cached block.
+	//! @param owner the mount
+	//! @param pathHash the hash of the file's path
+	//! @param path the file's path on the mount
+	//! @param block the block index
+	//! @param offset the offset within the block to start copying from
+	//! @param bytes the number of bytes to copy
+	//! @param dest the destination buffer
+	//! @return whether or not the block was found
+	bool readBlock(const void *owner, uint64_t pathHash, const char *path, uint64_t block, uint64_t offset, uint64_t bytes, void *dest);
+
+	//! Checks whether a block is cached, without affecting statistics or recency.
+	//! @param owner the mount
+	//! @param pathHash the hash of the file's path
+	//! @param path the file's path on the mount
+	//! @param block the block index
+	//! @return whether or not the block is cached
+	bool hasBlock(const void *owner, uint64_t pathHash, const char *path, uint64_t block);
+
+	//! Gets a reference to a cached block without copying it.
+	//! @param owner the mount
+	//! @param pathHash the hash of the file's path
+	//! @param path the file's path on the mount
+	//! @param block the block index
+	//! @return the block with an added reference that must be released by the caller, or nullptr if not cached
+	SharedBuffer *acquireBlock(const void *owner, uint64_t pathHash, const char *path, uint64_t block);
+
+	//! Inserts a block into the cache. The cache adds its own reference to the buffer.
+	//! Only the final block of a file can be smaller than the block size. The buffer's size
+	//! is what's charged to the budget, so it shouldn't be a view of a larger buffer.
+	//! @param owner the mount
+	//! @param pathHash the hash of the file's path
+	//! @param path the file's path on the mount
+	//! @param block the block index
+	//! @param buffer the block data
+	void insertBlock(const void *owner, uint64_t pathHash, const char *path, uint64_t block, SharedBuffer *buffer);
+
+	//! Removes all information about a path on all mounts.
+	//! @param pathHash the hash of the file's path
+	void invalidateFile(uint64_t pathHash);
+
+	//! Removes all information about a mount.
+	//! @param owner the mount
+	void invalidateOwner(const void *owner);
+
+	//! Default size of a block.
+	static constexpr uint32_t kDefaultBlockSize = 64 * 1024;
+
+	//! Default number of shards.
+	static constexpr uint32_t kDefaultShardCount = 16;
+
+private:
+	static constexpr uint64_t kFileInfoBlock = ~0ULL;
+
+	struct Key {
+		const void *_owner;
+		uint64_t _pathHash;
+		uint64_t _block;
+
+		bool operator==(const Key &other) const {
+			return _owner == other._owner && _pathHash == other._pathHash && _block == other._block;
+		}
+	};
+
+	struct KeyHash {
+		size_t operator()(const Key &key) const;
+	};
+
+	struct Node {
+		Key _key;
+		Node *_prev = nullptr;
+		Node *_next = nullptr;
+		SharedBuffer *_buffer = nullptr;
+		char *_path = nullptr; // only set on file info nodes
+		uint64_t _size = 0;
+		uint64_t _bytes = 0;
+		bool _exists = false;
+	};
+
+	typedef std::unordered_map<Key, Node*, KeyHash, std::equal_to<Key>, AllocatorAdapter<std::pair<const Key, Node*>>> NodeMap;
+
+	struct Shard {
+		Shard(lfs_allocator_t &alloc) : _nodes(AllocatorAdapter<std::pair<const Key, Node*>>(alloc)) {}
+
+		std::mutex _mutex;
+		NodeMap _nodes;
+		Node *_head = nullptr;
+		Node *_tail = nullptr;
+		uint64_t _bytes = 0;
+	};
+
+	Shard &getShard(uint64_t pathHash) { return *_shards[pathHash % _shardCount]; }
+
+	Node *find(Shard &shard, const Key &key);
+	Node *findFile(Shard &shard, const void *owner, uint64_t pathHash, const char *path);
+	void insert(Shard &shard, Node *node);
+	void remove(Shard &shard, Node *node);
+	void removeFile(Shard &shard, Node *info);
+	void touch(Shard &shard, Node *node);
+	void evict(Shard &shard);
+	uint64_t nodeCost(const Node *node) const;
+
+	lfs_allocator_t _alloc;
+	Shard **_shards = nullptr;
+	uint64_t _shardBudget = 0;
+	uint32_t _blockSize = 0;
+	uint32_t _shardCount = 0;
+
+	std::atomic<uint64_t> _hits;
+	std::atomic<uint64_t> _misses;
+	std::atomic<uint64_t> _evictions;
+};
+
+}
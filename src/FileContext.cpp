@@ -6,14 +6,22 @@
 #endif
 
 #include "FileContext.h"
+#include "BlockCache.h"
+#include "SharedBuffer.h"
 
 #if !defined(LAMINAFS_DISABLE_DIRECTORY_DEVICE)
 #include "device/Directory.h"
 #endif
+#include "device/Pack.h"
+#include "device/Ram.h"
+#include "device/Zip.h"
 
 #include <algorithm>
 #include <atomic>
+#include <cstddef>
 #include <string.h>
+#include "util/Hash.h"
+#include "util/PathScan.h"
 #include <stdlib.h>
 
 #ifdef __linux__
@@ -34,6 +42,13 @@ enum lfs_file_operation_t {
 	LFS_OP_DELETE,
 	LFS_OP_CREATE_DIR,
 	LFS_OP_DELETE_DIR,
+	LFS_OP_PREFETCH,
+	LFS_OP_OPEN_READ,
+	LFS_OP_OPEN_WRITE,
+	LFS_OP_OPEN_APPEND,
+	LFS_OP_HANDLE_READ,
+	LFS_OP_HANDLE_WRITE,
+	LFS_OP_HANDLE_CLOSE,
 };
 
 struct lfs_work_item_t {
@@ -44,18 +59,149 @@ struct lfs_work_item_t {
 	FileContext* _context = nullptr;
 
 	char *_filename = nullptr;
+	const lfs_path_t *_pathHandle = nullptr;
+	bool _ownsFilename = false;
+
+	// the handle being used, or the one that was opened
+	void *_fileHandle = nullptr;
 
 	void *_buffer = nullptr;
 	uint64_t _bufferBytes = 0;
 	uint64_t _offset = 0;
 
+	// set once _buffer is owned by a reference counted buffer
+	std::atomic<lfs_shared_buffer_t*> _sharedBuffer{nullptr};
+
 	lfs_callback_buffer_action_t _callbackBufferAction;
 
+	// prefetch entries still to be processed, packed into _filename
+	const char *_prefetchCursor = nullptr;
+	uint32_t _prefetchRemaining = 0;
+
 	lfs_error_code_t _resultCode = LFS_OK;
+	uint32_t _readFlags = LFS_READ_DEFAULT;
+
+	// the metadata cache generation a query was queued in
+	uint64_t _cacheGeneration = 0;
+
+	// a request left pending by a device: the mount it's on, and what the device
+	// reported, which only becomes the result once the processing thread takes it back
+	void *_pendingMount = nullptr;
+	lfs_work_item_t *_nextCompletion = nullptr;
+	lfs_error_code_t _deviceResult = LFS_OK;
+	uint64_t _deviceBytes = 0;
+	void *_deviceBuffer = nullptr;
 	bool _nullTerminate = false;
+	bool _shared = false;
 	bool _completed = false;
 };
 
+namespace {
+uint64_t workItemPathHash(const WorkItem *workItem) {
+	return workItem->_pathHandle ? workItem->_pathHandle->_hash : util::hashString(workItem->_filename);
+}
+
+// mount table generations are unique across contexts, so a static path handle used with
+// several contexts can never match a mount resolved by a different one
+std::atomic<uint64_t> nextMountGeneration{1};
+
+void setSharedBuffer(WorkItem *workItem, SharedBuffer *buffer) {
+	workItem->_sharedBuffer = buffer;
+	workItem->_buffer = const_cast<void*>(SharedBufferGetData(buffer));
+}
+
+bool hasHandles(const FileContext::DeviceInterface *interface) {
+	return (interface->_capabilities & LFS_DEVICE_CAP_HANDLES) != 0;
+}
+
+// how much of a device interface a version knew about, see DeviceInterface::_version
+size_t interfaceBytes(uint32_t version) {
+	typedef FileContext::DeviceInterface DeviceInterface;
+	if (version < 2) {
+		return offsetof(DeviceInterface, _openHandle);
+	} else if (version < 3) {
+		return offsetof(DeviceInterface, _readFileAsync);
+	} else if (version < 4) {
+		return offsetof(DeviceInterface, _setDirectIO);
+	} else if (version < 5) {
+		return offsetof(DeviceInterface, _adviseFile);
+	}
+	return sizeof(DeviceInterface);
+}
+
+// read flags that are only hints, the rest change what a read does
+constexpr uint32_t kAccessHints = LFS_READ_SEQUENTIAL | LFS_READ_RANDOM | LFS_READ_WILLNEED | LFS_READ_DONTNEED;
+
+// hints given before data is read, LFS_READ_DONTNEED is given once it's been read
+constexpr uint32_t kHintsBeforeRead = LFS_READ_SEQUENTIAL | LFS_READ_RANDOM | LFS_READ_WILLNEED;
+}
+
+struct FileContext::ReadWorkers {
+	ReadWorkers(lfs_allocator_t &alloc, uint32_t threads, uint64_t chunkBytes)
+	: _pool(alloc, threads)
+	, _chunkBytes(chunkBytes)
+	{
+	}
+
+	util::WorkerPool _pool;
+	uint64_t _chunkBytes;
+};
+
+struct FileContext::OpenFile {
+	struct Buffer {
+		uint8_t *_data = nullptr;
+		uint64_t _offset = 0;
+		uint64_t _bytes = 0;
+
+		bool contains(uint64_t offset) const { return offset >= _offset && offset - _offset < _bytes; }
+	};
+
+	MountInfo *_mount = nullptr;
+	void *_deviceHandle = nullptr;
+	bool _deviceOpen = false;
+
+	// the normalized path and the device path, both stored after the struct
+	char *_path = nullptr;
+	char *_devicePath = nullptr;
+
+	lfs_open_mode_t _mode = LFS_OPEN_READ;
+	uint32_t _accessHints = LFS_READ_DEFAULT;
+	uint64_t _size = 0;
+	uint64_t _position = 0;
+
+	uint64_t _bufferBytes = 0;
+	Buffer _buffers[2];
+
+	OpenFile *_nextReadahead = nullptr;
+	bool _readaheadQueued = false;
+
+	int32_t findBuffer(uint64_t offset) const {
+		for (int32_t i = 0; i < 2; ++i) {
+			if (_buffers[i].contains(offset))
+				return i;
+		}
+		return -1;
+	}
+
+	// the part of the file to read next is whatever follows the buffer being consumed,
+	// and it goes into the other buffer
+	bool readaheadTarget(uint64_t &offset, uint32_t &index) const {
+		if (_bufferBytes == 0)
+			return false;
+
+		int32_t current = findBuffer(_position);
+		if (current >= 0) {
+			offset = _buffers[current]._offset + _buffers[current]._bytes;
+			index = 1 - current;
+		} else {
+			offset = _position;
+			index = _buffers[0]._offset <= _buffers[1]._offset ? 0 : 1;
+		}
+
+		return offset < _size && findBuffer(offset) < 0;
+	}
+};
+
 void *default_alloc_func(void *, size_t bytes, size_t alignment) {
 #ifdef _WIN32
 	return _aligned_malloc(bytes, alignment);
@@ -105,12 +251,39 @@ void *WorkItemGetBuffer(const WorkItem *workItem) {
 
 void WorkItemFreeBuffer(WorkItem *workItem) {
 	if (workItem && workItem->_buffer) {
-		workItem->_allocator.free(workItem->_allocator.allocator, workItem->_buffer);
+		SharedBuffer *shared = workItem->_sharedBuffer.exchange(nullptr);
+		if (shared) {
+			SharedBufferRelease(shared);
+		} else {
+			workItem->_allocator.free(workItem->_allocator.allocator, workItem->_buffer);
+		}
 		workItem->_buffer = nullptr;
 		std::atomic_thread_fence(std::memory_order_release);
 	}
 }
 
+SharedBuffer *WorkItemAcquireSharedBuffer(const WorkItem *workItem) {
+	if (!workItem || !workItem->_buffer) {
+		return nullptr;
+	}
+
+	WorkItem *item = const_cast<WorkItem*>(workItem);
+	SharedBuffer *shared = item->_sharedBuffer;
+
+	if (!shared) {
+		// hand ownership of the buffer over to a shared buffer, the work item keeps a reference
+		std::unique_lock<std::mutex> lock(item->_context->getCompletionMutex());
+		shared = item->_sharedBuffer;
+		if (!shared) {
+			shared = SharedBufferCreate(item->_allocator, item->_buffer, item->_bufferBytes);
+			item->_sharedBuffer = shared;
+		}
+	}
+
+	SharedBufferRetain(shared);
+	return shared;
+}
+
 uint64_t WorkItemGetBytes(const WorkItem *workItem) {
 	if (workItem) {
 		return workItem->_bufferBytes;
@@ -119,6 +292,14 @@ uint64_t WorkItemGetBytes(const WorkItem *workItem) {
 	}
 }
 
+FileHandle WorkItemGetFileHandle(const WorkItem *workItem) {
+	if (workItem && workItem->_operation >= LFS_OP_OPEN_READ && workItem->_operation <= LFS_OP_OPEN_APPEND) {
+		return workItem->_fileHandle;
+	} else {
+		return nullptr;
+	}
+}
+
 bool WorkItemCompleted(const WorkItem *workItem) {
 	if (workItem && !workItem->_callback) {
 		std::unique_lock<std::mutex> lock(workItem->_context->getCompletionMutex());
@@ -141,10 +322,13 @@ void WaitForWorkItem(const WorkItem *workItem) {
 
 FileContext::FileContext(Allocator &alloc, uint64_t maxQueuedWorkItems, uint64_t workItemPoolSize)
 : _interfaces(AllocatorAdapter<DeviceInterface*>(alloc))
-, _mounts(AllocatorAdapter<MountInfo*>(alloc))
+, _paths(AllocatorAdapter<std::pair<const uint64_t, lfs_path_t*>>(alloc))
+, _metadataCache(alloc)
+, _accessTrace(alloc)
 , _workItemPool(alloc, workItemPoolSize)
 , _workItemQueueSemaphore()
 , _workItemQueue(alloc, maxQueuedWorkItems, &_workItemQueueSemaphore)
+, _backgroundQueue(alloc, maxQueuedWorkItems, &_workItemQueueSemaphore)
 , _alloc(alloc)
 {
 #if !defined(LAMINAFS_DISABLE_DIRECTORY_DEVICE)
@@ -158,31 +342,195 @@ FileContext::FileContext(Allocator &alloc, uint64_t maxQueuedWorkItems, uint64_t
 	i._deleteFile = &DirectoryDevice::deleteFile;
 	i._createDir = &DirectoryDevice::createDir;
 	i._deleteDir = &DirectoryDevice::deleteDir;
+	i._prefetchFile = &DirectoryDevice::prefetchFile;
+	i._mapFile = &DirectoryDevice::mapFile;
+	i._enumerate = &DirectoryDevice::enumerate;
+	i._openHandle = &DirectoryDevice::openHandle;
+	i._readHandle = &DirectoryDevice::readHandle;
+	i._writeHandle = &DirectoryDevice::writeHandle;
+	i._closeHandle = &DirectoryDevice::closeHandle;
+	i._readHandleV = &DirectoryDevice::readHandleV;
+	i._setDirectIO = &DirectoryDevice::setDirectIO;
+	i._adviseFile = &DirectoryDevice::adviseFile;
+	i._adviseHandle = &DirectoryDevice::adviseHandle;
 
 	registerDeviceInterface(i);
 #endif
 
+#if !defined(LAMINAFS_DISABLE_PACK_DEVICE)
+	DeviceInterface pack;
+	pack._create = &PackDevice::create;
+	pack._destroy = &PackDevice::destroy;
+	pack._fileExists = &PackDevice::fileExists;
+	pack._fileSize = &PackDevice::fileSize;
+	pack._readFile = &PackDevice::readFile;
+	pack._prefetchFile = &PackDevice::prefetchFile;
+	pack._adviseFile = &PackDevice::adviseFile;
+	pack._mapFile = &PackDevice::mapFile;
+	pack._enumerate = &PackDevice::enumerate;
+
+	registerDeviceInterface(pack);
+#endif
+
+#if !defined(LAMINAFS_DISABLE_ZIP_DEVICE)
+	DeviceInterface zip;
+	zip._create = &ZipDevice::create;
+	zip._destroy = &ZipDevice::destroy;
+	zip._fileExists = &ZipDevice::fileExists;
+	zip._fileSize = &ZipDevice::fileSize;
+	zip._readFile = &ZipDevice::readFile;
+	zip._prefetchFile = &ZipDevice::prefetchFile;
+	zip._mapFile = &ZipDevice::mapFile;
+	zip._adviseFile = &ZipDevice::adviseFile;
+	zip._enumerate = &ZipDevice::enumerate;
+
+	registerDeviceInterface(zip);
+#endif
+
+#if !defined(LAMINAFS_DISABLE_RAM_DEVICE)
+	DeviceInterface ram;
+	ram._create = &RamDevice::create;
+	ram._destroy = &RamDevice::destroy;
+	ram._fileExists = &RamDevice::fileExists;
+	ram._fileSize = &RamDevice::fileSize;
+	ram._readFile = &RamDevice::readFile;
+	ram._writeFile = &RamDevice::writeFile;
+	ram._deleteFile = &RamDevice::deleteFile;
+	ram._createDir = &RamDevice::createDir;
+	ram._deleteDir = &RamDevice::deleteDir;
+	ram._enumerate = &RamDevice::enumerate;
+
+	registerDeviceInterface(ram);
+#endif
+
+	_mountReaders[0] = 0;
+	_mountReaders[1] = 0;
+	_mountEpoch = 0;
+	_mounts = allocMountTable(0);
+
+	_blockCache = nullptr;
 	_processing = false;
 	startProcessingThread();
 }
 
 FileContext::~FileContext() {
 	stopProcessingThread();
+	setParallelReads(0);
 
-	_mountLock.lock();
-	for (MountInfo *m : _mounts) {
-		_alloc.free(_alloc.allocator, m->_prefix);
-		m->_interface->_destroy(m->_device);
-
-		m->~MountInfo();
-		_alloc.free(_alloc.allocator, m);
+	MountTable *mounts = _mounts.exchange(nullptr);
+	for (MountInfo *m : *mounts) {
+		destroyMount(m);
 	}
-	_mountLock.unlock();
+	_alloc.free(_alloc.allocator, mounts);
 
 	for (DeviceInterface *i : _interfaces) {
 		i->~DeviceInterface();
 		_alloc.free(_alloc.allocator, i);
 	}
+
+	for (auto &entry : _paths) {
+		lfs_path_t *handle = entry.second;
+		while (handle) {
+			lfs_path_t *next = handle->_next;
+			_alloc.free(_alloc.allocator, const_cast<char*>(handle->_path));
+			handle->~lfs_path_t();
+			_alloc.free(_alloc.allocator, handle);
+			handle = next;
+		}
+	}
+}
+
+void FileContext::acquireMountUser(MountInfo *mount) {
+	std::lock_guard<std::mutex> lock(_mountUserLock);
+	++mount->_users;
+}
+
+void FileContext::releaseMountUser(MountInfo *mount) {
+	bool destroy = false;
+	{
+		std::lock_guard<std::mutex> lock(_mountUserLock);
+		destroy = --mount->_users == 0 && mount->_released;
+	}
+
+	if (destroy) {
+		destroyMount(mount);
+	}
+}
+
+void FileContext::noteFileWritten(MountInfo *mount, const char *devicePath) {
+	if (mount->_pathFilter) {
+		uint64_t hash = util::hashString(devicePath);
+		if (!mount->_pathFilter->mayContain(hash) && mount->_pathFilterSaved.exchange(false) && mount->_interface->_deleteFile) {
+			// the saved filter would hide this file from later mounts
+			mount->_interface->_deleteFile(mount->_device, LFS_PATH_FILTER_FILE);
+		}
+		mount->_pathFilter->add(hash);
+	}
+
+	if (mount->_caseIndex) {
+		mount->_caseIndex->insert(devicePath);
+		invalidateCaseVariants(mount);
+	}
+}
+
+void FileContext::completeDeviceRequest(DeviceRequest *request, ErrorCode result, uint64_t bytes, void *buffer) {
+	WorkItem *workItem = reinterpret_cast<WorkItem*>(request);
+	workItem->_deviceResult = result;
+	workItem->_deviceBytes = bytes;
+	workItem->_deviceBuffer = buffer;
+
+	FileContext *ctx = workItem->_context;
+	WorkItem *head = ctx->_deviceCompletions.load(std::memory_order_relaxed);
+	do {
+		workItem->_nextCompletion = head;
+	} while (!ctx->_deviceCompletions.compare_exchange_weak(head, workItem, std::memory_order_release, std::memory_order_relaxed));
+
+	ctx->_workItemQueueSemaphore.notify();
+}
+
+void FileContext::beginDeviceRequest(WorkItem *workItem, MountInfo *mount) {
+	workItem->_pendingMount = mount;
+	acquireMountUser(mount);
+	++_pendingDeviceRequests;
+}
+
+void FileContext::finishDeviceRequests(WorkItem *completed) {
+	// completions are pushed onto the front, so put them back in the order they happened
+	WorkItem *ordered = nullptr;
+	while (completed) {
+		WorkItem *next = completed->_nextCompletion;
+		completed->_nextCompletion = ordered;
+		ordered = completed;
+		completed = next;
+	}
+
+	while (ordered) {
+		WorkItem *workItem = ordered;
+		ordered = workItem->_nextCompletion;
+		workItem->_nextCompletion = nullptr;
+
+		MountInfo *mount = static_cast<MountInfo*>(workItem->_pendingMount);
+		workItem->_pendingMount = nullptr;
+		workItem->_resultCode = workItem->_deviceResult;
+		workItem->_bufferBytes = workItem->_deviceBytes;
+
+		if (workItem->_operation == LFS_OP_READ) {
+			workItem->_buffer = workItem->_deviceBuffer;
+
+			if (workItem->_resultCode == LFS_OK) {
+				_accessTrace.record(workItem->_filename, workItem->_offset, workItem->_bufferBytes);
+			}
+		} else if (workItem->_resultCode == LFS_OK) {
+			const char *path = workItem->_filename;
+			noteFileWritten(mount, resolveDevicePath(mount, mount->_prefixLen == 1 ? path : path + mount->_prefixLen));
+		}
+
+		updateCaches(workItem, true);
+		releaseMountUser(mount);
+		--_pendingDeviceRequests;
+
+		completeWorkItem(workItem);
+	}
 }
 
 void FileContext::startProcessingThread() {
@@ -210,13 +558,41 @@ int32_t FileContext::registerDeviceInterface(DeviceInterface &interface) {
 		interface._readFile != nullptr)
 	{
 		result = static_cast<int32_t>(_interfaces.size());
-		DeviceInterface *newInterface = new(_alloc.alloc(_alloc.allocator, sizeof(DeviceInterface), alignof(DeviceInterface))) DeviceInterface(interface);
+		DeviceInterface *newInterface = new(_alloc.alloc(_alloc.allocator, sizeof(DeviceInterface), alignof(DeviceInterface))) DeviceInterface();
+
+		// older interfaces may be smaller, so only what their version knew about is copied
+		// and the rest stays empty
+		memcpy(static_cast<void*>(newInterface), &interface, interfaceBytes(interface._version));
+
+		// handles are all or nothing, anything less is streamed by path like older devices
+		bool handles = newInterface->_openHandle && newInterface->_readHandle && newInterface->_writeHandle && newInterface->_closeHandle;
+		if (!handles) {
+			newInterface->_readHandleV = nullptr;
+			newInterface->_adviseHandle = nullptr;
+		}
+
+		// async writes are only used next to the plain ones, which decide the mount permissions
+		if (!newInterface->_writeFile) {
+			newInterface->_writeFileAsync = nullptr;
+		}
+
+		newInterface->_capabilities = (handles ? LFS_DEVICE_CAP_HANDLES | LFS_DEVICE_CAP_READ_INTO : 0) |
+			(newInterface->_readHandleV ? LFS_DEVICE_CAP_VECTORED : 0) |
+			(newInterface->_mapFile ? LFS_DEVICE_CAP_MMAP : 0) |
+			(newInterface->_readFileAsync || newInterface->_writeFileAsync ? LFS_DEVICE_CAP_ASYNC : 0) |
+			(newInterface->_setDirectIO ? LFS_DEVICE_CAP_DIRECT_IO : 0) |
+			(newInterface->_adviseFile || newInterface->_adviseHandle ? LFS_DEVICE_CAP_ACCESS_HINTS : 0);
+
 		_interfaces.push_back(newInterface);
 	}
 
 	return result;
 }
 
+uint32_t FileContext::getDeviceCapabilities(uint32_t deviceType) const {
+	return deviceType < _interfaces.size() ? _interfaces[deviceType]->_capabilities : 0;
+}
+
 Mount FileContext::createMount(uint32_t deviceType, const char *mountPoint, const char *devicePath, ErrorCode &resultCode, uint32_t mountPermissions) {
 	if (deviceType >= _interfaces.size()) {
 		resultCode = LFS_INVALID_DEVICE;
@@ -232,18 +608,43 @@ Mount FileContext::createMount(uint32_t deviceType, const char *mountPoint, cons
 		(interface->_createDir != nullptr ? LFS_MOUNT_CREATE_DIR : 0) |
 		(interface->_deleteDir != nullptr ? LFS_MOUNT_DELETE_DIR : 0);
 
-	uint32_t calculatedPermissions = mountPermissions == LFS_MOUNT_DEFAULT ? supportedPermissions : (mountPermissions & supportedPermissions);
+	uint32_t requestedPermissions = mountPermissions & LFS_MOUNT_ALL_PERMISSIONS;
+	uint32_t calculatedPermissions = requestedPermissions == LFS_MOUNT_DEFAULT ? supportedPermissions : (requestedPermissions & supportedPermissions);
 	if (calculatedPermissions == 0) {
 		resultCode = LFS_PERMISSIONS_ERROR;
 		return nullptr;
 	}
 
+	if ((mountPermissions & LFS_MOUNT_DIRECT_IO) && !interface->_setDirectIO) {
+		resultCode = LFS_UNSUPPORTED;
+		return nullptr;
+	}
+
 	ErrorCode result = LFS_OK;
 	MountInfo *m = new(_alloc.alloc(_alloc.allocator, sizeof(MountInfo), alignof(MountInfo))) MountInfo();
 
 	result = interface->_create(&_alloc, devicePath, &m->_device);
 	m->_interface = interface;
 
+	if (result == LFS_OK && m->_device && (mountPermissions & LFS_MOUNT_DIRECT_IO)) {
+		result = interface->_setDirectIO(m->_device, true);
+
+		if (result != LFS_OK) {
+			interface->_destroy(m->_device);
+			m->_device = nullptr;
+		}
+	}
+
+	if (result == LFS_OK && m->_device) {
+		result = initMountLookup(m, mountPermissions);
+
+		if (result != LFS_OK) {
+			interface->_destroy(m->_device);
+			m->_device = nullptr;
+			freeMountLookup(m);
+		}
+	}
+
 	if (result == LFS_OK && m->_device) {
 		size_t mountLen = strlen(mountPoint);
 		m->_prefix = reinterpret_cast<char*>(_alloc.alloc(_alloc.allocator, sizeof(char) * (mountLen + 1), alignof(char)));
@@ -251,9 +652,15 @@ Mount FileContext::createMount(uint32_t deviceType, const char *mountPoint, cons
 		strcpy(m->_prefix, mountPoint);
 		m->_permissions = calculatedPermissions;
 
-		_mountLock.lock();
-		_mounts.push_back(m);
-		_mountLock.unlock();
+		{
+			std::lock_guard<std::mutex> lock(_mountWriteLock);
+			const MountTable *current = _mounts;
+			MountTable *table = allocMountTable(current->_count + 1);
+			std::copy(current->begin(), current->end(), table->_mounts);
+			table->_mounts[current->_count] = m;
+			publishMountTable(table);
+		}
+		_metadataCache.clear();
 		LOG("mounted device %u:%s on %s\n", deviceType, devicePath, mountPoint);
 	} else {
 		m->~MountInfo();
@@ -267,33 +674,194 @@ Mount FileContext::createMount(uint32_t deviceType, const char *mountPoint, cons
 }
 
 bool FileContext::releaseMount(Mount mount) {
-	bool result = false;
-	stopProcessingThread();
+	MountInfo *released = nullptr;
+
+	{
+		std::lock_guard<std::mutex> lock(_mountWriteLock);
+		const MountTable *current = _mounts;
+		MountInfo **it = std::find(current->begin(), current->end(), mount);
 
-	_mountLock.lock();
-	auto it = std::find(_mounts.begin(), _mounts.end(), mount);
-	if (it != _mounts.end()) {
-		(*it)->_interface->_destroy((*it)->_device);
-		_alloc.free(_alloc.allocator, (*it)->_prefix);
+		if (it != current->end()) {
+			released = *it;
 
-		(*it)->~MountInfo();
-		_alloc.free(_alloc.allocator, *it);
+			MountTable *table = allocMountTable(current->_count - 1);
+			MountInfo **out = std::copy(current->begin(), it, table->_mounts);
+			std::copy(it + 1, current->end(), out);
 
-		_mounts.erase(it);
-		result = true;
+			// once this returns nothing can be using the mount anymore
+			publishMountTable(table);
+		}
+	}
+
+	if (released) {
+		if (_blockCache) {
+			_blockCache.load()->invalidateOwner(released);
+		}
+
+		// nothing new can start using it anymore, the last open handle or pending request destroys it
+		bool destroy = false;
+		{
+			std::lock_guard<std::mutex> lock(_mountUserLock);
+			released->_released = true;
+			destroy = released->_users == 0;
+		}
+
+		if (destroy) {
+			destroyMount(released);
+		}
+		_metadataCache.clear();
+	}
+
+	return released != nullptr;
+}
+
+FileContext::MountTableReader::MountTableReader(FileContext *ctx) {
+	// readers announce themselves on the current epoch's counter before looking at the table,
+	// so a writer that has moved on to the next epoch only needs to wait for this one to drain.
+	// If the epoch moved while announcing, the counter may already have been waited on and
+	// the table loaded here freed by a later writer that waits on the other one, so retry.
+	for (;;) {
+		uint64_t epoch = ctx->_mountEpoch.load();
+		_readers = &ctx->_mountReaders[epoch & 1];
+		_readers->fetch_add(1);
+
+		if (ctx->_mountEpoch.load() == epoch) {
+			break;
+		}
+
+		_readers->fetch_sub(1);
+	}
+
+	_table = ctx->_mounts;
+}
+
+FileContext::MountTableReader::~MountTableReader() {
+	release();
+}
+
+void FileContext::MountTableReader::release() {
+	if (_readers) {
+		_readers->fetch_sub(1);
+		_readers = nullptr;
+		_table = nullptr;
+	}
+}
+
+FileContext::MountTable *FileContext::allocMountTable(uint32_t count) {
+	MountTable *table = static_cast<MountTable*>(_alloc.alloc(_alloc.allocator, sizeof(MountTable) + sizeof(MountInfo*) * count, alignof(MountTable)));
+	table->_mounts = reinterpret_cast<MountInfo**>(table + 1);
+	table->_count = count;
+	table->_generation = nextMountGeneration.fetch_add(1);
+	return table;
+}
+
+void FileContext::publishMountTable(MountTable *table) {
+	MountTable *previous = _mounts;
+	_mounts = table;
+	uint64_t epoch = _mountEpoch.fetch_add(1);
+
+	// readers that started after the epoch changed can only see the new table
+	while (_mountReaders[epoch & 1].load() != 0) {
+		std::this_thread::yield();
+	}
+
+	_alloc.free(_alloc.allocator, previous);
+}
+
+ErrorCode FileContext::initMountLookup(MountInfo *mount, uint32_t flags) {
+	DeviceInterface *interface = mount->_interface;
+	bool buildPathFilter = false;
+
+	if (flags & LFS_MOUNT_PATH_FILTER) {
+		mount->_pathFilter = new(_alloc.alloc(_alloc.allocator, sizeof(util::BloomFilter), alignof(util::BloomFilter))) util::BloomFilter(_alloc);
+
+		// a saved filter avoids walking the whole device
+		void *saved = nullptr;
+		ErrorCode savedResult = LFS_NOT_FOUND;
+		uint64_t savedBytes = interface->_readFile(mount->_device, LFS_PATH_FILTER_FILE, 0, UINT64_MAX, &_alloc, &saved, false, &savedResult);
+		buildPathFilter = savedResult != LFS_OK || !mount->_pathFilter->deserialize(saved, savedBytes);
+		mount->_pathFilterSaved = !buildPathFilter;
+
+		if (saved) {
+			_alloc.free(_alloc.allocator, saved);
+		}
+	}
+
+	if (flags & LFS_MOUNT_CASE_INSENSITIVE) {
+		mount->_caseIndex = new(_alloc.alloc(_alloc.allocator, sizeof(util::CaseFoldedIndex), alignof(util::CaseFoldedIndex))) util::CaseFoldedIndex(_alloc);
+	} else if (!buildPathFilter) {
+		return LFS_OK;
+	}
+
+	if (!interface->_enumerate) {
+		return LFS_UNSUPPORTED;
+	}
+
+	struct EnumerateState {
+		util::CaseFoldedIndex *_caseIndex;
+		std::vector<uint64_t, AllocatorAdapter<uint64_t>> *_pathHashes;
+	};
+
+	std::vector<uint64_t, AllocatorAdapter<uint64_t>> pathHashes{AllocatorAdapter<uint64_t>(_alloc)};
+	EnumerateState state{mount->_caseIndex, buildPathFilter ? &pathHashes : nullptr};
+
+	ErrorCode result = interface->_enumerate(mount->_device, [](const char *path, void *userData) {
+		EnumerateState *state = static_cast<EnumerateState*>(userData);
+		if (state->_caseIndex) {
+			state->_caseIndex->insert(path);
+		}
+		if (state->_pathHashes) {
+			state->_pathHashes->push_back(util::hashString(path));
+		}
+	}, &state);
+
+	if (result == LFS_OK && buildPathFilter) {
+		if (mount->_pathFilter->reset(pathHashes.size())) {
+			for (uint64_t hash : pathHashes) {
+				mount->_pathFilter->add(hash);
+			}
+		} else {
+			result = LFS_GENERIC_ERROR;
+		}
 	}
-	_mountLock.unlock();
 
-	startProcessingThread();
 	return result;
 }
 
-FileContext::MountInfo* FileContext::findNextMountAndPath(const char *path, const char **devicePath, const MountInfo* searchStart) {
+void FileContext::freeMountLookup(MountInfo *mount) {
+	if (mount->_caseIndex) {
+		mount->_caseIndex->~CaseFoldedIndex();
+		_alloc.free(_alloc.allocator, mount->_caseIndex);
+		mount->_caseIndex = nullptr;
+	}
+
+	if (mount->_pathFilter) {
+		mount->_pathFilter->~BloomFilter();
+		_alloc.free(_alloc.allocator, mount->_pathFilter);
+		mount->_pathFilter = nullptr;
+	}
+}
+
+void FileContext::destroyMount(MountInfo *mount) {
+	mount->_interface->_destroy(mount->_device);
+	_alloc.free(_alloc.allocator, mount->_prefix);
+	freeMountLookup(mount);
+
+	mount->~MountInfo();
+	_alloc.free(_alloc.allocator, mount);
+}
+
+FileContext::MountInfo* FileContext::findNextMountAndPath(const MountTable *mounts, const char *path, const char **devicePath, const MountInfo* searchStart, bool checkPathFilters) {
 	*devicePath = nullptr;
 	const MountInfo* onlyAfter = searchStart;
+	uint32_t pathLen = static_cast<uint32_t>(strlen(path));
+
+	// mounts on the same mount point share a device path, so only hash it again when it changes
+	const char *hashedPath = nullptr;
+	uint64_t hash = 0;
 
 	// search mounts from the end
-	for (auto mount = _mounts.rbegin(); mount != _mounts.rend(); ++mount) {
+	for (auto mount = mounts->rbegin(); mount != mounts->rend(); ++mount) {
 		if (((*mount)->_permissions & LFS_MOUNT_READ) == 0)
 			continue;
 		if (onlyAfter) {
@@ -302,9 +870,20 @@ FileContext::MountInfo* FileContext::findNextMountAndPath(const char *path, cons
 			continue;
 		}
 
-		const char *foundMount = strstr(path, (*mount)->_prefix);
-		if (foundMount && foundMount == path && (path[(*mount)->_prefixLen] == '/' || (*mount)->_prefixLen == 1)) {
-			*devicePath = (*mount)->_prefixLen == 1 ? path : path + (*mount)->_prefixLen;
+		if (matchesMount(*mount, path, pathLen)) {
+			const char *mountPath = resolveDevicePath(*mount, (*mount)->_prefixLen == 1 ? path : path + (*mount)->_prefixLen);
+
+			if (checkPathFilters && (*mount)->_pathFilter) {
+				if (mountPath != hashedPath) {
+					hashedPath = mountPath;
+					hash = util::hashString(mountPath);
+				}
+
+				if (!pathFilterMayContain(*mount, hash))
+					continue;
+			}
+
+			*devicePath = mountPath;
 			return *mount;
 		}
 	}
@@ -313,20 +892,60 @@ FileContext::MountInfo* FileContext::findNextMountAndPath(const char *path, cons
 	return nullptr;
 }
 
-FileContext::MountInfo* FileContext::findMutableMountAndPath(const char *path, const char **devicePath, uint32_t op) {
+FileContext::MountInfo* FileContext::findFirstMountAndPath(const MountTable *mounts, const WorkItem *workItem, const char **devicePath) {
+	const lfs_path_t *handle = workItem->_pathHandle;
+	MountInfo *mount = nullptr;
+	bool resolved = false;
+
+	if (handle) {
+		uint64_t resolvedMount = handle->_resolvedMount;
+		uint32_t slot = static_cast<uint32_t>(resolvedMount & kResolvedMountMask);
+
+		if (slot != 0 && (resolvedMount >> 16) == (mounts->_generation & (UINT64_MAX >> 16))) {
+			if (slot == kResolvedNoMount) {
+				*devicePath = nullptr;
+				return nullptr;
+			}
+
+			mount = mounts->_mounts[slot - 1];
+			*devicePath = resolveDevicePath(mount, mount->_prefixLen == 1 ? workItem->_filename : workItem->_filename + mount->_prefixLen);
+			resolved = true;
+		}
+	}
+
+	if (!resolved) {
+		mount = findNextMountAndPath(mounts, workItem->_filename, devicePath, nullptr, false);
+
+		// remember the result for as long as the mounts don't change
+		if (handle && mounts->_count < kResolvedNoMount) {
+			uint64_t slot = mount ? static_cast<uint64_t>(std::find(mounts->begin(), mounts->end(), mount) - mounts->begin()) + 1 : kResolvedNoMount;
+			handle->_resolvedMount = (mounts->_generation << 16) | slot;
+		}
+	}
+
+	// the remembered mount ignores path filters, since writes can change them without changing the mounts
+	if (mount && mount->_pathFilter) {
+		uint64_t hash = handle && *devicePath == handle->_path ? handle->_hash : util::hashString(*devicePath);
+		if (!pathFilterMayContain(mount, hash)) {
+			return findNextMountAndPath(mounts, workItem->_filename, devicePath, mount);
+		}
+	}
+
+	return mount;
+}
+
+FileContext::MountInfo* FileContext::findMutableMountAndPath(const MountTable *mounts, const char *path, const char **devicePath, uint32_t op) {
 	LOG("searching for writable mount for %s\n", path);
 
 	*devicePath = nullptr;
-
-	std::shared_lock<std::shared_mutex> lock(_mountLock);
+	uint32_t pathLen = static_cast<uint32_t>(strlen(path));
 
 	// search mounts from the end
-	for (auto mount = _mounts.rbegin(); mount != _mounts.rend(); ++mount) {
-		const char *foundMount = strstr(path, (*mount)->_prefix);
-		if (foundMount && foundMount == path && (path[(*mount)->_prefixLen] == '/' || (*mount)->_prefixLen == 1)) {
+	for (auto mount = mounts->rbegin(); mount != mounts->rend(); ++mount) {
+		if (matchesMount(*mount, path, pathLen)) {
 			LOG("  found matching mount %s\n", (*mount)->_prefix);
 
-			*devicePath = (*mount)->_prefixLen == 1 ? path : path + (*mount)->_prefixLen;
+			*devicePath = resolveDevicePath(*mount, (*mount)->_prefixLen == 1 ? path : path + (*mount)->_prefixLen);
 
 			if ( ((op == LFS_OP_WRITE || op == LFS_OP_APPEND) && (((*mount)->_permissions & LFS_MOUNT_WRITE_FILE) == 0))
 			|| (op == LFS_OP_DELETE && (((*mount)->_permissions & LFS_MOUNT_DELETE_FILE) == 0))
@@ -344,63 +963,45 @@ FileContext::MountInfo* FileContext::findMutableMountAndPath(const char *path, c
 	return nullptr;
 }
 
-void FileContext::normalizePath(char *path) {
-	uint32_t writePos = 0;
-	uint32_t readPos = 0;
-	uint32_t inputLen = static_cast<uint32_t>(strlen(path));
-
-	while (writePos < inputLen) {
-		bool found = false;
-		do {
-			found = false;
-
-			if (path[readPos] == '/') {
-				if (path[readPos + 1] == '/') {
-					// handle multiple slashes "//", "///", etc...
-					++readPos;
-					found = true;
-				} else if (path[readPos + 1] == '.') {
-					if (path[readPos + 2] == '.' && (path[readPos + 3] == 0 || path[readPos + 3] == '/')) {
-						// handle parent directory "/.."
-						readPos += 3;
-						while (writePos > 0 && path[writePos - 1] != '/') {
-							--writePos;
-						}
-
-						if (writePos != 0) {
-							--writePos;
-						}
-						found = true;
-					} else if (path[readPos + 2] == '/' || path[readPos + 2] == 0) {
-						// handle "this" directory "/."
-						readPos += 2;
-						found = true;
-					}
-				}
-			}
-		} while (found);
+bool FileContext::matchesMount(const MountInfo *mount, const char *path, uint32_t pathLen) {
+	// the root mount matches every absolute path, anything else has to match up to a separator
+	if (mount->_prefixLen == 1)
+		return path[0] == '/';
 
-		path[writePos] = path[readPos];
+	return pathLen > mount->_prefixLen && path[mount->_prefixLen] == '/' && util::prefixEquals(path, mount->_prefix, mount->_prefixLen);
+}
 
-		if (path[writePos] == 0) {
-			break;
-		}
+bool FileContext::pathFilterMayContain(const MountInfo *mount, uint64_t devicePathHash) {
+	_pathFilterQueries.fetch_add(1, std::memory_order_relaxed);
 
-		++writePos;
-		++readPos;
+	if (!mount->_pathFilter->mayContain(devicePathHash)) {
+		_pathFilterRejected.fetch_add(1, std::memory_order_relaxed);
+		return false;
 	}
 
-	// remove trailing slash
-	if (writePos > 1 && path[writePos - 1] == '/') {
-		path[writePos - 1] = 0;
+	return true;
+}
+
+void FileContext::notePathFilterMiss(const MountInfo *mount) {
+	if (mount->_pathFilter) {
+		_pathFilterFalsePositives.fetch_add(1, std::memory_order_relaxed);
 	}
+}
 
-	// fixup root slash
-	if (path[0] == 0 && inputLen >= 1) {
-		path[0] = '/';
-		path[1] = 0;
+const char *FileContext::resolveDevicePath(const MountInfo *mount, const char *devicePath) {
+	if (mount->_caseIndex) {
+		// files missing from the index are passed through, so new files can still be created
+		const char *actualPath = mount->_caseIndex->find(devicePath);
+		if (actualPath) {
+			return actualPath;
+		}
 	}
 
+	return devicePath;
+}
+
+void FileContext::normalizePath(char *path) {
+	util::normalizePathFast(path);
 }
 
 void FileContext::releaseWorkItem(WorkItem *workItem) {
@@ -411,20 +1012,30 @@ void FileContext::releaseWorkItem(WorkItem *workItem) {
 
 void FileContext::releaseWorkItemInternal(WorkItem *workItem) {
 	if (workItem) {
-		_alloc.free(_alloc.allocator, workItem->_filename);
+		if (workItem->_ownsFilename) {
+			_alloc.free(_alloc.allocator, workItem->_filename);
+		}
 		_workItemPool.free(workItem);
 	}
 }
 
-void FileContext::initWorkItem(WorkItem *item, const char *path, uint32_t op, WorkItemCallback callback, void *callbackUserData, CallbackBufferAction bufferAction) {
+void FileContext::initWorkItem(WorkItem *item, const char *path, PathHandle handle, uint32_t op, WorkItemCallback callback, void *callbackUserData, CallbackBufferAction bufferAction) {
 	item->_operation = static_cast<lfs_file_operation_t>(op);
 
-	size_t pathLen = strlen(path) + 1;
-	char *normalizedPath = reinterpret_cast<char*>(_alloc.alloc(_alloc.allocator, sizeof(char) * pathLen, alignof(char)));
-	strcpy(normalizedPath, path);
-	normalizePath(normalizedPath);
-
-	item->_filename = normalizedPath;
+	if (handle) {
+		// interned paths are already normalized and outlive the work item, they are never written through
+		item->_filename = const_cast<char*>(handle->_path);
+		item->_pathHandle = handle;
+	} else {
+		size_t pathLen = strlen(path) + 1;
+		char *normalizedPath = reinterpret_cast<char*>(_alloc.alloc(_alloc.allocator, sizeof(char) * pathLen, alignof(char)));
+		strcpy(normalizedPath, path);
+		normalizePath(normalizedPath);
+
+		item->_filename = normalizedPath;
+		item->_pathHandle = nullptr;
+		item->_ownsFilename = true;
+	}
 
 	item->_callback = callback;
 	item->_callbackUserData = callbackUserData;
@@ -434,82 +1045,991 @@ void FileContext::initWorkItem(WorkItem *item, const char *path, uint32_t op, Wo
 }
 
 WorkItem *FileContext::allocWorkItemCommon(const char *path, uint32_t op, WorkItemCallback callback, void *callbackUserData, CallbackBufferAction bufferAction) {
+	return allocWorkItemInternal(path, nullptr, op, callback, callbackUserData, bufferAction);
+}
+
+WorkItem *FileContext::allocWorkItemCommon(PathHandle handle, uint32_t op, WorkItemCallback callback, void *callbackUserData, CallbackBufferAction bufferAction) {
+	return allocWorkItemInternal(nullptr, handle, op, callback, callbackUserData, bufferAction);
+}
+
+WorkItem *FileContext::allocWorkItemInternal(const char *path, PathHandle handle, uint32_t op, WorkItemCallback callback, void *callbackUserData, CallbackBufferAction bufferAction) {
 	WorkItem *item = _workItemPool.alloc();
 
 	if (item) {
-		initWorkItem(item, path, op, callback, callbackUserData, bufferAction);
+		initWorkItem(item, path, handle, op, callback, callbackUserData, bufferAction);
+
+		// invalidate up front so that cached queries issued after this can't see stale data,
+		// the path stays out of the metadata cache until this completes
+		updateCaches(item, false);
 	} else {
 		LOG("error: unable to allocate work item, work item pool capacity was %u", static_cast<uint32_t>(_workItemPool.getCapacity()));
 
 		// We'll assume we want a callback with an error here.
 		if (callback) {
 			WorkItem errorItem;
-			initWorkItem(&errorItem, path, op, callback, callbackUserData, bufferAction);
+			initWorkItem(&errorItem, path, handle, op, callback, callbackUserData, bufferAction);
 			errorItem._completed = true;
 			errorItem._resultCode = LFS_OUT_OF_WORK_ITEMS;
 
 			callback(&errorItem, callbackUserData);
 
-			_alloc.free(_alloc.allocator, errorItem._filename);
+			if (!handle) {
+				_alloc.free(_alloc.allocator, errorItem._filename);
+			}
 		}
 	}
 
 	return item;
 }
 
-WorkItem *FileContext::readFile(const char *filepath, bool nullTerminate, Allocator *alloc) {
-	return readFileSegment(filepath, 0, static_cast<uint64_t>(-1), nullTerminate, alloc);
-}
+void FileContext::completeWorkItem(WorkItem *workItem) {
+	finishCacheChanges(workItem);
+
+	{
+		std::unique_lock<std::mutex> lock(_completionMutex);
+		workItem->_completed = true;
+	}
 
-WorkItem *FileContext::readFileSegment(const char *filepath, uint64_t offset, uint64_t maxBytes, bool nullTerminate, Allocator *alloc) {
-	WorkItem *item = allocWorkItemCommon(filepath, LFS_OP_READ, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER);
+	if (workItem->_callback) {
+		workItem->_callback(workItem, workItem->_callbackUserData);
 
-	if (item) {
-		item->_allocator = alloc ? *alloc : _alloc;
-		item->_nullTerminate = nullTerminate;
-		item->_bufferBytes = maxBytes;
-		item->_offset = offset;
+		if (workItem->_callbackBufferAction == LFS_FREE_BUFFER) {
+			WorkItemFreeBuffer(workItem);
+		}
 
-		_workItemQueue.push(item);
+		releaseWorkItemInternal(workItem);
+	} else {
+		_completionConditionVariable.notify_all();
 	}
-
-	return item;
 }
 
-void FileContext::readFileWithCallback(const char *filepath, bool nullTerminate, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData, Allocator *alloc) {
-	readFileSegmentWithCallback(filepath, 0, static_cast<uint64_t>(-1), nullTerminate, callback, bufferAction, callbackUserData, alloc);
-}
+bool FileContext::completeFromMetadataCache(WorkItem *workItem) {
+	if (!_metadataCache.isEnabled()) {
+		return false;
+	}
 
-void FileContext::readFileSegmentWithCallback(const char *filepath, uint64_t offset, uint64_t maxBytes, bool nullTerminate, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData, Allocator *alloc) {
-	WorkItem *item = allocWorkItemCommon(filepath, LFS_OP_READ, callback, callbackUserData, bufferAction);
+	bool hit = false;
+	bool exists = false;
+	uint64_t size = 0;
 
-	if (item) {
-		item->_allocator = alloc ? *alloc : _alloc;
-		item->_nullTerminate = nullTerminate;
-		item->_bufferBytes = maxBytes;
-		item->_offset = offset;
+	if (workItem->_operation == LFS_OP_EXISTS) {
+		hit = _metadataCache.lookupExists(workItem->_filename, workItemPathHash(workItem), exists);
+	} else if (workItem->_operation == LFS_OP_SIZE) {
+		hit = _metadataCache.lookupSize(workItem->_filename, workItemPathHash(workItem), exists, size);
+		workItem->_bufferBytes = size;
+	}
+
+	if (hit) {
+		workItem->_resultCode = exists ? LFS_OK : LFS_NOT_FOUND;
+		completeWorkItem(workItem);
+	}
+
+	return hit;
+}
+
+void FileContext::updateCaches(WorkItem *workItem, bool processed) {
+	BlockCache *blockCache = _blockCache;
+
+	switch (workItem->_operation) {
+	case LFS_OP_EXISTS:
+	case LFS_OP_SIZE:
+		if (!processed) {
+			// a change that starts or finishes before this is answered makes the answer unsafe to keep
+			workItem->_cacheGeneration = _metadataCache.isEnabled() ? _metadataCache.generation() : UINT64_MAX;
+		} else if (workItem->_operation == LFS_OP_EXISTS) {
+			_metadataCache.storeExists(workItem->_filename, workItemPathHash(workItem), workItem->_cacheGeneration, workItem->_resultCode == LFS_OK);
+		} else if (workItem->_resultCode == LFS_OK || workItem->_resultCode == LFS_NOT_FOUND) {
+			_metadataCache.storeSize(workItem->_filename, workItemPathHash(workItem), workItem->_cacheGeneration, workItem->_resultCode == LFS_OK, workItem->_bufferBytes);
+		}
+		break;
+	case LFS_OP_WRITE:
+	case LFS_OP_APPEND:
+	case LFS_OP_WRITE_SEGMENT:
+	case LFS_OP_DELETE:
+	case LFS_OP_OPEN_WRITE:
+	case LFS_OP_OPEN_APPEND:
+	case LFS_OP_HANDLE_WRITE:
+		if (!processed) {
+			_metadataCache.beginChange(workItemPathHash(workItem));
+		}
+		if (blockCache) {
+			blockCache->invalidateFile(workItemPathHash(workItem));
+		}
+		break;
+	case LFS_OP_CREATE_DIR:
+		if (!processed) {
+			_metadataCache.beginClear();
+		}
+		break;
+	case LFS_OP_DELETE_DIR:
+		if (!processed) {
+			_metadataCache.beginClear();
+		}
+		if (blockCache) {
+			MountTableReader mounts(this);
+			for (MountInfo *mount : *mounts.get()) {
+				blockCache->invalidateOwner(mount);
+			}
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void FileContext::finishCacheChanges(WorkItem *workItem) {
+	switch (workItem->_operation) {
+	case LFS_OP_WRITE:
+	case LFS_OP_APPEND:
+	case LFS_OP_WRITE_SEGMENT:
+	case LFS_OP_DELETE:
+	case LFS_OP_OPEN_WRITE:
+	case LFS_OP_OPEN_APPEND:
+	case LFS_OP_HANDLE_WRITE:
+		_metadataCache.endChange(workItemPathHash(workItem));
+		break;
+	case LFS_OP_CREATE_DIR:
+	case LFS_OP_DELETE_DIR:
+		_metadataCache.endClear();
+		break;
+	default:
+		break;
+	}
+}
+
+void FileContext::invalidateCaseVariants(const MountInfo *mount) {
+	// the caches are keyed by the requested path, and any spelling of it could be cached
+	_metadataCache.clear();
+
+	BlockCache *blockCache = _blockCache;
+	if (blockCache) {
+		blockCache->invalidateOwner(mount);
+	}
+}
+
+ErrorCode FileContext::writePathFilter(Mount mount) {
+	MountTableReader reader(this);
+	const MountTable *mounts = reader.get();
+
+	MountInfo *const *it = std::find(mounts->begin(), mounts->end(), mount);
+	if (it == mounts->end()) {
+		return LFS_INVALID_DEVICE;
+	}
+
+	MountInfo *m = *it;
+	if (!m->_pathFilter || !m->_interface->_writeFile || (m->_permissions & LFS_MOUNT_WRITE_FILE) == 0) {
+		return LFS_UNSUPPORTED;
+	}
+
+	uint64_t bytes = m->_pathFilter->serializedSize();
+	void *buffer = _alloc.alloc(_alloc.allocator, bytes, alignof(uint64_t));
+	m->_pathFilter->serialize(buffer);
+
+	ErrorCode result = LFS_OK;
+	m->_interface->_writeFile(m->_device, LFS_PATH_FILTER_FILE, 0, buffer, bytes, LFS_WRITE_TRUNCATE, &result);
+	if (result == LFS_OK) {
+		m->_pathFilterSaved = true;
+	}
+
+	_alloc.free(_alloc.allocator, buffer);
+	return result;
+}
+
+PathFilterStats FileContext::getPathFilterStats() {
+	PathFilterStats stats;
+	stats.queries = _pathFilterQueries.load(std::memory_order_relaxed);
+	stats.rejected = _pathFilterRejected.load(std::memory_order_relaxed);
+	stats.falsePositives = _pathFilterFalsePositives.load(std::memory_order_relaxed);
+	stats.entries = 0;
+	stats.bytes = 0;
+
+	MountTableReader reader(this);
+	for (MountInfo *mount : *reader.get()) {
+		if (mount->_pathFilter) {
+			stats.entries += mount->_pathFilter->entries();
+			stats.bytes += mount->_pathFilter->bytes();
+		}
+	}
+
+	return stats;
+}
+
+void FileContext::setBlockCache(BlockCache *cache) {
+	BlockCache *previous = _blockCache.exchange(cache);
+
+	if (previous && previous != cache) {
+		MountTableReader mounts(this);
+		for (MountInfo *mount : *mounts.get()) {
+			previous->invalidateOwner(mount);
+		}
+	}
+}
+
+void FileContext::setParallelReads(uint32_t threads, uint64_t chunkBytes) {
+	ReadWorkers *workers = nullptr;
+	if (threads > 0 && chunkBytes > 0) {
+		void *memory = _alloc.alloc(_alloc.allocator, sizeof(ReadWorkers), alignof(ReadWorkers));
+		workers = memory ? new(memory) ReadWorkers(_alloc, threads, chunkBytes) : nullptr;
+	}
+
+	ReadWorkers *previous = _readWorkers.exchange(workers);
+	if (!previous) {
+		return;
+	}
+
+	// the processing thread may have picked up the old workers before the exchange
+	while (_readWorkersInUse.load() == previous) {
+		std::this_thread::yield();
+	}
+
+	previous->~ReadWorkers();
+	_alloc.free(_alloc.allocator, previous);
+}
+
+bool FileContext::readParallel(MountInfo *mount, const char *devicePath, uint64_t maxBytes, WorkItem *workItem) {
+	const DeviceInterface *interface = mount->_interface;
+	if (!_readWorkers.load() || !hasHandles(interface)) {
+		return false;
+	}
+
+	// announce the workers before using them, and make sure they weren't replaced in between
+	ReadWorkers *workers = _readWorkers.load();
+	for (;;) {
+		_readWorkersInUse = workers;
+		ReadWorkers *current = _readWorkers.load();
+		if (current == workers) {
+			break;
+		}
+		workers = current;
+	}
+
+	bool handled = workers && readParallel(mount, devicePath, maxBytes, workItem, *workers);
+	_readWorkersInUse = nullptr;
+	return handled;
+}
+
+bool FileContext::readParallel(MountInfo *mount, const char *devicePath, uint64_t maxBytes, WorkItem *workItem, ReadWorkers &workers) {
+	const DeviceInterface *interface = mount->_interface;
+
+	ErrorCode result = LFS_OK;
+	uint64_t fileSize = interface->_fileSize(mount->_device, devicePath, &result);
+	if (result != LFS_OK) {
+		workItem->_resultCode = result;
+		return true;
+	}
+
+	uint64_t offset = workItem->_offset;
+	uint64_t bytes = offset < fileSize ? std::min(fileSize - offset, maxBytes) : 0;
+	if (bytes / 2 < workers._chunkBytes) {
+		return false;
+	}
+
+	void *handle = nullptr;
+	workItem->_resultCode = interface->_openHandle(mount->_device, devicePath, LFS_OPEN_READ, &handle);
+	if (workItem->_resultCode != LFS_OK) {
+		return true;
+	}
+
+	// the path was already advised, but the access pattern can belong to the handle
+	if (interface->_adviseHandle && (workItem->_readFlags & (LFS_READ_SEQUENTIAL | LFS_READ_RANDOM))) {
+		interface->_adviseHandle(mount->_device, handle, workItem->_readFlags & (LFS_READ_SEQUENTIAL | LFS_READ_RANDOM));
+	}
+
+	// aligned so chunks on direct I/O mounts can be read in place
+	uint8_t *buffer = static_cast<uint8_t*>(workItem->_allocator.alloc(workItem->_allocator.allocator, bytes + (workItem->_nullTerminate ? 1 : 0), LFS_DIRECT_IO_ALIGNMENT));
+	if (!buffer) {
+		interface->_closeHandle(mount->_device, handle);
+		workItem->_resultCode = LFS_GENERIC_ERROR;
+		return true;
+	}
+
+	// a chunk coming up short means the file shrank, so the read ends where the first one did
+	std::atomic<uint64_t> end{bytes};
+	std::atomic<int> failure{LFS_OK};
+	uint64_t chunkBytes = std::max(workers._chunkBytes, bytes / UINT32_MAX + 1);
+
+	workers._pool.parallelFor(static_cast<uint32_t>((bytes + chunkBytes - 1) / chunkBytes), [&](uint32_t index) {
+		uint64_t start = index * chunkBytes;
+		uint64_t size = std::min(chunkBytes, bytes - start);
+
+		ErrorCode chunkResult = LFS_OK;
+		uint64_t chunkRead = interface->_readHandle(mount->_device, handle, offset + start, size, buffer + start, &chunkResult);
+		if (chunkResult != LFS_OK) {
+			failure = chunkResult;
+		} else if (chunkRead < size) {
+			uint64_t current = end;
+			while (start + chunkRead < current && !end.compare_exchange_weak(current, start + chunkRead)) {
+			}
+		}
+	});
+
+	interface->_closeHandle(mount->_device, handle);
+
+	workItem->_resultCode = static_cast<ErrorCode>(failure.load());
+	if (workItem->_resultCode != LFS_OK) {
+		workItem->_allocator.free(workItem->_allocator.allocator, buffer);
+		return true;
+	}
+
+	workItem->_buffer = buffer;
+	workItem->_bufferBytes = end;
+	if (workItem->_nullTerminate) {
+		buffer[workItem->_bufferBytes] = 0;
+	}
+
+	return true;
+}
+
+void FileContext::adviseRead(MountInfo *mount, const char *devicePath, uint64_t maxBytes, WorkItem *workItem, uint32_t hints) {
+	uint32_t flags = workItem->_readFlags & hints;
+	if (flags && mount->_interface->_adviseFile) {
+		mount->_interface->_adviseFile(mount->_device, devicePath, workItem->_offset, maxBytes, flags);
+	}
+}
+
+void FileContext::adviseOpenFile(OpenFile *file, uint32_t hints) {
+	uint32_t flags = file->_accessHints & hints;
+	if (!flags) {
+		return;
+	}
+
+	// streams without a device handle read by path, so the hints go to the whole file
+	const DeviceInterface *interface = file->_mount->_interface;
+	if (file->_deviceOpen && interface->_adviseHandle) {
+		interface->_adviseHandle(file->_mount->_device, file->_deviceHandle, flags);
+	} else if (!file->_deviceOpen && interface->_adviseFile) {
+		interface->_adviseFile(file->_mount->_device, file->_devicePath, 0, UINT64_MAX, flags);
+	}
+}
+
+bool FileContext::resolveCachedFile(BlockCache *cache, MountInfo *mount, const char *devicePath, uint64_t pathHash, uint64_t &fileSize, ErrorCode &result) {
+	BlockCache::FileState state = cache->lookupFile(mount, pathHash, devicePath, fileSize);
+	result = LFS_OK;
+
+	if (state == BlockCache::FILE_UNKNOWN) {
+		fileSize = mount->_interface->_fileSize(mount->_device, devicePath, &result);
+
+		if (result == LFS_NOT_FOUND) {
+			cache->insertFile(mount, pathHash, devicePath, false, 0);
+			return false;
+		} else if (result != LFS_OK) {
+			return false;
+		}
+
+		cache->insertFile(mount, pathHash, devicePath, true, fileSize);
+	} else if (state == BlockCache::FILE_MISSING) {
+		result = LFS_NOT_FOUND;
+		return false;
+	}
+
+	return true;
+}
+
+bool FileContext::mapFile(MountInfo *mount, const char *devicePath, uint64_t maxBytes, WorkItem *workItem) {
+	if (!mount->_interface->_mapFile) {
+		return false;
+	}
+
+	SharedBuffer *buffer = nullptr;
+	// the data is still to be read through the mapping, so it's needed for now either way
+	uint32_t flags = workItem->_readFlags & ~static_cast<uint32_t>(LFS_READ_DONTNEED);
+	ErrorCode result = mount->_interface->_mapFile(mount->_device, devicePath, workItem->_offset, maxBytes, &workItem->_allocator, flags, &buffer);
+	if (result == LFS_UNSUPPORTED || result == LFS_NOT_FOUND) {
+		// the regular read path reads it instead, or moves on to the next mount
+		return false;
+	}
+
+	workItem->_resultCode = result;
+	workItem->_bufferBytes = 0;
+	if (buffer) {
+		setSharedBuffer(workItem, buffer);
+		workItem->_bufferBytes = SharedBufferGetSize(buffer);
+	}
+
+	return true;
+}
+
+bool FileContext::readFromBlockCache(const MountTable *mounts, WorkItem *workItem) {
+	BlockCache *cache = _blockCache;
+	if (!cache) {
+		return false;
+	}
+
+	uint64_t pathHash = workItemPathHash(workItem);
+
+	const char *devicePath;
+	for (MountInfo *mount = findFirstMountAndPath(mounts, workItem, &devicePath); mount; mount = findNextMountAndPath(mounts, workItem->_filename, &devicePath, mount)) {
+		uint64_t fileSize = 0;
+		ErrorCode result = LFS_OK;
+
+		if (!resolveCachedFile(cache, mount, devicePath, pathHash, fileSize, result)) {
+			if (result == LFS_NOT_FOUND) {
+				continue;
+			}
+
+			// let the regular read path deal with the error
+			return false;
+		}
+
+		uint64_t offset = workItem->_offset;
+		uint64_t maxBytes = workItem->_bufferBytes;
+		uint64_t bytes = offset < fileSize ? std::min(fileSize - offset, maxBytes) : 0;
+
+		// large reads bypass the cache
+		if (bytes > cache->getMaxCachedRead()) {
+			return false;
+		}
+
+		workItem->_resultCode = LFS_OK;
+		workItem->_bufferBytes = bytes;
+		workItem->_buffer = nullptr;
+
+		if (bytes == 0) {
+			return true;
+		}
+
+		if (!readCachedBlocks(cache, mount, devicePath, pathHash, fileSize, offset, bytes, workItem)) {
+			// the file changed underneath us, so the regular read path starts over
+			workItem->_bufferBytes = maxBytes;
+			return false;
+		}
+		return true;
+	}
+
+	workItem->_resultCode = LFS_NOT_FOUND;
+	workItem->_bufferBytes = 0;
+	return true;
+}
+
+bool FileContext::readCachedBlocks(BlockCache *cache, MountInfo *mount, const char *devicePath, uint64_t pathHash, uint64_t fileSize, uint64_t offset, uint64_t bytes, WorkItem *workItem) {
+	uint64_t blockSize = cache->getBlockSize();
+	uint64_t firstBlock = offset / blockSize;
+	uint64_t lastBlock = (offset + bytes - 1) / blockSize;
+
+	// without a work item, we're only populating the cache
+	bool populateOnly = workItem == nullptr;
+
+	// shared reads that fit in a single block are handed a view of the cached block
+	bool zeroCopy = !populateOnly && workItem->_shared && firstBlock == lastBlock;
+	if (zeroCopy) {
+		SharedBuffer *block = cache->acquireBlock(mount, pathHash, devicePath, firstBlock);
+		if (block) {
+			setSharedBuffer(workItem, SharedBufferCreateView(block, offset - firstBlock * blockSize, bytes));
+			SharedBufferRelease(block);
+			return true;
+		}
+	}
+
+	uint8_t *dest = nullptr;
+	if (!zeroCopy && !populateOnly) {
+		Allocator &alloc = workItem->_allocator;
+		dest = static_cast<uint8_t*>(alloc.alloc(alloc.allocator, bytes + (workItem->_nullTerminate ? 1 : 0), 1));
+		if (!dest) {
+			workItem->_resultCode = LFS_GENERIC_ERROR;
+			workItem->_bufferBytes = 0;
+			return true;
+		}
+	}
+
+	uint64_t missStart = zeroCopy ? firstBlock : lastBlock + 1;
+
+	for (uint64_t block = firstBlock; block <= lastBlock + 1; ++block) {
+		bool hit = false;
+		if (!zeroCopy && block <= lastBlock) {
+			if (populateOnly) {
+				hit = cache->hasBlock(mount, pathHash, devicePath, block);
+			} else {
+				uint64_t blockStart = block * blockSize;
+				uint64_t copyStart = std::max(blockStart, offset);
+				uint64_t copyEnd = std::min(blockStart + blockSize, offset + bytes);
+				hit = cache->readBlock(mount, pathHash, devicePath, block, copyStart - blockStart, copyEnd - copyStart, dest + (copyStart - offset));
+			}
+
+			if (!hit && missStart > lastBlock) {
+				missStart = block;
+			}
+		}
+
+		// read runs of missing blocks from the device in one go
+		if ((hit || block > lastBlock) && missStart <= lastBlock) {
+			uint64_t runStart = missStart * blockSize;
+			uint64_t runBytes = std::min(block * blockSize, fileSize) - runStart;
+			missStart = lastBlock + 1;
+
+			void *runBuffer = nullptr;
+			ErrorCode result = LFS_OK;
+			uint64_t runRead = mount->_interface->_readFile(mount->_device, devicePath, runStart, runBytes, &_alloc, &runBuffer, false, &result);
+
+			if (result != LFS_OK || runRead != runBytes) {
+				if (runBuffer) {
+					_alloc.free(_alloc.allocator, runBuffer);
+				}
+
+				// the file changed underneath us, forget about it
+				cache->invalidateFile(pathHash);
+
+				if (dest) {
+					workItem->_allocator.free(workItem->_allocator.allocator, dest);
+				}
+				return false;
+			}
+
+			// a view would keep the whole run alive while only its own bytes count against the
+			// budget, so runs of several blocks are split into separate copies
+			SharedBuffer *run = SharedBufferCreate(_alloc, runBuffer, runBytes);
+			if (runBytes <= blockSize) {
+				cache->insertBlock(mount, pathHash, devicePath, runStart / blockSize, run);
+			} else {
+				for (uint64_t pos = 0; pos < runBytes; pos += blockSize) {
+					uint64_t copyBytes = std::min(blockSize, runBytes - pos);
+					void *copy = _alloc.alloc(_alloc.allocator, copyBytes, 1);
+					if (!copy) {
+						break;
+					}
+
+					memcpy(copy, static_cast<uint8_t*>(runBuffer) + pos, copyBytes);
+					SharedBuffer *block = SharedBufferCreate(_alloc, copy, copyBytes);
+					cache->insertBlock(mount, pathHash, devicePath, (runStart + pos) / blockSize, block);
+					SharedBufferRelease(block);
+				}
+			}
+
+			if (!populateOnly) {
+				uint64_t copyStart = std::max(runStart, offset);
+				uint64_t copyEnd = std::min(runStart + runBytes, offset + bytes);
+				if (zeroCopy) {
+					setSharedBuffer(workItem, SharedBufferCreateView(run, copyStart - runStart, copyEnd - copyStart));
+				} else {
+					memcpy(dest + (copyStart - offset), static_cast<uint8_t*>(runBuffer) + (copyStart - runStart), copyEnd - copyStart);
+				}
+			}
+
+			SharedBufferRelease(run);
+		}
+	}
+
+	if (dest) {
+		if (workItem->_nullTerminate) {
+			dest[bytes] = 0;
+		}
+
+		workItem->_buffer = dest;
+	}
+
+	return true;
+}
+
+WorkItem *FileContext::readFile(const char *filepath, bool nullTerminate, Allocator *alloc, uint32_t flags) {
+	return readFileSegment(filepath, 0, static_cast<uint64_t>(-1), nullTerminate, alloc, flags);
+}
+
+WorkItem *FileContext::readFileSegment(const char *filepath, uint64_t offset, uint64_t maxBytes, bool nullTerminate, Allocator *alloc, uint32_t flags) {
+	return submitRead(allocWorkItemCommon(filepath, LFS_OP_READ, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER), offset, maxBytes, nullTerminate, false, alloc, flags & kAccessHints);
+}
+
+void FileContext::readFileWithCallback(const char *filepath, bool nullTerminate, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData, Allocator *alloc, uint32_t flags) {
+	readFileSegmentWithCallback(filepath, 0, static_cast<uint64_t>(-1), nullTerminate, callback, bufferAction, callbackUserData, alloc, flags);
+}
+
+void FileContext::readFileSegmentWithCallback(const char *filepath, uint64_t offset, uint64_t maxBytes, bool nullTerminate, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData, Allocator *alloc, uint32_t flags) {
+	submitRead(allocWorkItemCommon(filepath, LFS_OP_READ, callback, callbackUserData, bufferAction), offset, maxBytes, nullTerminate, false, alloc, flags & kAccessHints);
+}
+
+WorkItem *FileContext::readFileShared(const char *filepath, Allocator *alloc, uint32_t flags) {
+	return readFileSegmentShared(filepath, 0, static_cast<uint64_t>(-1), alloc, flags);
+}
+
+WorkItem *FileContext::readFileSegmentShared(const char *filepath, uint64_t offset, uint64_t maxBytes, Allocator *alloc, uint32_t flags) {
+	return submitRead(allocWorkItemCommon(filepath, LFS_OP_READ, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER), offset, maxBytes, false, true, alloc, flags);
+}
+
+void FileContext::readFileSegmentSharedWithCallback(const char *filepath, uint64_t offset, uint64_t maxBytes, WorkItemCallback callback, void *callbackUserData, Allocator *alloc, uint32_t flags) {
+	submitRead(allocWorkItemCommon(filepath, LFS_OP_READ, callback, callbackUserData, LFS_FREE_BUFFER), offset, maxBytes, false, true, alloc, flags);
+}
+
+WorkItem *FileContext::prefetch(const char **paths, uint32_t count, Priority priority) {
+	WorkItem *item = allocPrefetchWorkItem(paths, count, nullptr, nullptr);
+
+	if (item && item->_prefetchCursor) {
+		queuePrefetch(item, priority);
+	}
+
+	return item;
+}
+
+void FileContext::prefetchWithCallback(const char **paths, uint32_t count, Priority priority, WorkItemCallback callback, void *callbackUserData) {
+	WorkItem *item = allocPrefetchWorkItem(paths, count, callback, callbackUserData);
+
+	if (item && item->_prefetchCursor) {
+		queuePrefetch(item, priority);
+	}
+}
+
+void FileContext::beginAccessTrace(uint32_t maxEntries) {
+	_accessTrace.begin(maxEntries);
+}
+
+uint64_t FileContext::endAccessTrace(void **buffer, Allocator *alloc) {
+	return _accessTrace.end(alloc ? *alloc : _alloc, buffer);
+}
+
+WorkItem *FileContext::replayAccessTrace(const void *trace, uint64_t traceBytes, Priority priority) {
+	WorkItem *item = allocReplayWorkItem(trace, traceBytes, nullptr, nullptr);
+
+	if (item && item->_prefetchCursor) {
+		queuePrefetch(item, priority);
+	}
+
+	return item;
+}
+
+void FileContext::replayAccessTraceWithCallback(const void *trace, uint64_t traceBytes, Priority priority, WorkItemCallback callback, void *callbackUserData) {
+	WorkItem *item = allocReplayWorkItem(trace, traceBytes, callback, callbackUserData);
+
+	if (item && item->_prefetchCursor) {
+		queuePrefetch(item, priority);
+	}
+}
+
+WorkItem *FileContext::allocPrefetchWorkItem(const char **paths, uint32_t count, WorkItemCallback callback, void *callbackUserData) {
+	size_t packedBytes = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		packedBytes += kPrefetchEntryHeaderBytes + strlen(paths[i]) + 1;
+	}
+
+	WorkItem *item = allocPrefetchWorkItemCommon(packedBytes, callback, callbackUserData);
+
+	if (item && item->_prefetchCursor) {
+		char *cursor = item->_filename;
+		for (uint32_t i = 0; i < count; ++i) {
+			packPrefetchEntry(cursor, paths[i], strlen(paths[i]), 0, UINT64_MAX);
+		}
+		item->_prefetchRemaining = count;
+	}
+
+	return item;
+}
+
+WorkItem *FileContext::allocReplayWorkItem(const void *trace, uint64_t traceBytes, WorkItemCallback callback, void *callbackUserData) {
+	// consecutive reads of adjoining ranges of the same file are merged into one prefetch
+	struct Range {
+		const char *_path = nullptr;
+		uint16_t _pathLen = 0;
+		uint64_t _offset = 0;
+		uint64_t _bytes = 0;
+	};
+
+	auto merge = [](Range &pending, const char *path, uint16_t pathLen, const util::AccessTrace::Entry &entry) {
+		if (pending._path && pending._pathLen == pathLen && memcmp(pending._path, path, pathLen) == 0 && pending._offset + pending._bytes == entry._offset) {
+			pending._bytes += entry._bytes;
+			return true;
+		}
+		return false;
+	};
+
+	size_t packedBytes = 0;
+	uint32_t count = 0;
+	Range pending;
+	bool valid = util::AccessTrace::forEach(_alloc, trace, traceBytes, [&](const char *path, uint16_t pathLen, const util::AccessTrace::Entry &entry) {
+		if (!merge(pending, path, pathLen, entry)) {
+			packedBytes += kPrefetchEntryHeaderBytes + pathLen + 1;
+			++count;
+			pending = Range{path, pathLen, entry._offset, entry._bytes};
+		}
+	});
+
+	WorkItem *item = allocPrefetchWorkItemCommon(packedBytes, callback, callbackUserData);
+
+	if (!item || !item->_prefetchCursor) {
+		return item;
+	} else if (!valid) {
+		// nothing to queue, complete right away
+		item->_prefetchCursor = nullptr;
+		item->_resultCode = LFS_GENERIC_ERROR;
+		completeWorkItem(item);
+		return callback ? nullptr : item;
+	} else {
+		char *cursor = item->_filename;
+		pending = Range();
+		util::AccessTrace::forEach(_alloc, trace, traceBytes, [&](const char *path, uint16_t pathLen, const util::AccessTrace::Entry &entry) {
+			if (!merge(pending, path, pathLen, entry)) {
+				if (pending._path) {
+					packPrefetchEntry(cursor, pending._path, pending._pathLen, pending._offset, pending._bytes);
+				}
+				pending = Range{path, pathLen, entry._offset, entry._bytes};
+			}
+		});
+
+		if (pending._path) {
+			packPrefetchEntry(cursor, pending._path, pending._pathLen, pending._offset, pending._bytes);
+		}
+		item->_prefetchRemaining = count;
+	}
+
+	return item;
+}
+
+WorkItem *FileContext::allocPrefetchWorkItemCommon(size_t packedBytes, WorkItemCallback callback, void *callbackUserData) {
+	WorkItem *item = allocWorkItemCommon("/", LFS_OP_PREFETCH, callback, callbackUserData, LFS_DO_NOT_FREE_BUFFER);
+
+	if (item) {
+		// each entry is packed as [offset][bytes][normalized path]
+		char *packed = reinterpret_cast<char*>(_alloc.alloc(_alloc.allocator, std::max<size_t>(packedBytes, 1), alignof(char)));
+		item->_prefetchRemaining = 0;
+		item->_bufferBytes = 0;
+
+		if (!packed) {
+			// nothing to queue, complete right away
+			item->_prefetchCursor = nullptr;
+			item->_resultCode = LFS_GENERIC_ERROR;
+			completeWorkItem(item);
+			return callback ? nullptr : item;
+		}
+
+		_alloc.free(_alloc.allocator, item->_filename);
+		item->_filename = packed;
+		item->_prefetchCursor = item->_filename;
+	}
+
+	return item;
+}
+
+void FileContext::packPrefetchEntry(char *&cursor, const char *path, size_t pathLen, uint64_t offset, uint64_t bytes) {
+	uint64_t range[2] = {offset, bytes};
+	memcpy(cursor, range, sizeof(range));
+	cursor += sizeof(range);
+
+	memcpy(cursor, path, pathLen);
+	cursor[pathLen] = 0;
+	normalizePath(cursor);
+
+	// normalizing can shorten the path, and the entries are read back by their terminators
+	cursor += strlen(cursor) + 1;
+}
+
+void FileContext::queuePrefetch(WorkItem *workItem, Priority priority) {
+	if (priority == LFS_PRIORITY_BACKGROUND) {
+		_backgroundQueue.push(workItem);
+	} else {
+		_workItemQueue.push(workItem);
+	}
+}
+
+bool FileContext::prefetchFile(const MountTable *mounts, const char *path, uint64_t offset, uint64_t bytes) {
+	BlockCache *cache = _blockCache;
+	uint64_t pathHash = cache ? util::hashString(path) : 0;
+
+	const char *devicePath;
+	MountInfo *mount = nullptr;
+	while ((mount = findNextMountAndPath(mounts, path, &devicePath, mount)) != nullptr) {
+		if (cache) {
+			uint64_t fileSize = 0;
+			ErrorCode result = LFS_OK;
+
+			if (!resolveCachedFile(cache, mount, devicePath, pathHash, fileSize, result)) {
+				if (result == LFS_NOT_FOUND) {
+					continue;
+				}
+				return false;
+			}
+
+			// only warm up as much as a cached read could use
+			uint64_t rangeBytes = offset < fileSize ? std::min(fileSize - offset, bytes) : 0;
+			rangeBytes = std::min(rangeBytes, cache->getMaxCachedRead());
+			if (rangeBytes) {
+				readCachedBlocks(cache, mount, devicePath, pathHash, fileSize, offset, rangeBytes, nullptr);
+			}
+			return true;
+		} else if (mount->_interface->_prefetchFile) {
+			ErrorCode result = mount->_interface->_prefetchFile(mount->_device, devicePath, offset, bytes);
+			if (result != LFS_NOT_FOUND) {
+				return result == LFS_OK;
+			}
+		} else if (mount->_interface->_fileExists(mount->_device, devicePath)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool FileContext::processPrefetch(const MountTable *mounts, WorkItem *workItem, bool singleStep) {
+	while (workItem->_prefetchRemaining > 0) {
+		uint64_t range[2];
+		memcpy(range, workItem->_prefetchCursor, sizeof(range));
+		const char *path = workItem->_prefetchCursor + sizeof(range);
+
+		if (prefetchFile(mounts, path, range[0], range[1])) {
+			++workItem->_bufferBytes;
+		}
+
+		workItem->_prefetchCursor = path + strlen(path) + 1;
+		--workItem->_prefetchRemaining;
+
+		if (singleStep) {
+			break;
+		}
+	}
+
+	workItem->_resultCode = LFS_OK;
+	return workItem->_prefetchRemaining == 0;
+}
+
+WorkItem *FileContext::writeFile(const char *filepath, const void *buffer, uint64_t bufferBytes) {
+	return submitWrite(allocWorkItemCommon(filepath, LFS_OP_WRITE, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER), 0, buffer, bufferBytes);
+}
+
+WorkItem *FileContext::writeFileSegment(const char *filepath, uint64_t offset, const void *buffer, uint64_t bufferBytes) {
+	return submitWrite(allocWorkItemCommon(filepath, LFS_OP_WRITE_SEGMENT, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER), offset, buffer, bufferBytes);
+}
+
+void FileContext::writeFileWithCallback(const char *filepath, const void *buffer, uint64_t bufferBytes, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData) {
+	submitWrite(allocWorkItemCommon(filepath, LFS_OP_WRITE, callback, callbackUserData, bufferAction), 0, buffer, bufferBytes);
+}
+
+void FileContext::writeFileSegmentWithCallback(const char *filepath, uint64_t offset, const void *buffer, uint64_t bufferBytes, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData) {
+	submitWrite(allocWorkItemCommon(filepath, LFS_OP_WRITE_SEGMENT, callback, callbackUserData, bufferAction), offset, buffer, bufferBytes);
+}
+
+WorkItem *FileContext::appendFile(const char *filepath, const void *buffer, uint64_t bufferBytes) {
+	return submitWrite(allocWorkItemCommon(filepath, LFS_OP_APPEND, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER), 0, buffer, bufferBytes);
+}
 
-		_workItemQueue.push(item);
-	}
+void FileContext::appendFileWithCallback(const char *filepath, const void *buffer, uint64_t bufferBytes, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData) {
+	submitWrite(allocWorkItemCommon(filepath, LFS_OP_APPEND, callback, callbackUserData, bufferAction), 0, buffer, bufferBytes);
 }
 
-WorkItem *FileContext::writeFile(const char *filepath, const void *buffer, uint64_t bufferBytes) {
-	WorkItem *item = writeFileSegment(filepath, 0, buffer, bufferBytes);
+WorkItem *FileContext::fileExists(const char *filepath) {
+	return submitQuery(allocWorkItemCommon(filepath, LFS_OP_EXISTS, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER));
+}
 
-	if (item) {
-		item->_operation = LFS_OP_WRITE;
+void FileContext::fileExistsWithCallback(const char *filepath, WorkItemCallback callback, void *callbackUserData) {
+	submitQuery(allocWorkItemCommon(filepath, LFS_OP_EXISTS, callback, callbackUserData, LFS_DO_NOT_FREE_BUFFER));
+}
+
+WorkItem *FileContext::fileSize(const char *filepath) {
+	return submitQuery(allocWorkItemCommon(filepath, LFS_OP_SIZE, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER));
+}
+
+void FileContext::fileSizeWithCallback(const char *filepath, WorkItemCallback callback, void *callbackUserData) {
+	submitQuery(allocWorkItemCommon(filepath, LFS_OP_SIZE, callback, callbackUserData, LFS_DO_NOT_FREE_BUFFER));
+}
+
+PathHandle FileContext::internPath(const char *path) {
+	size_t pathLen = strlen(path) + 1;
+	char *normalizedPath = reinterpret_cast<char*>(_alloc.alloc(_alloc.allocator, sizeof(char) * pathLen, alignof(char)));
+	strcpy(normalizedPath, path);
+	normalizePath(normalizedPath);
+
+	uint64_t hash = util::hashString(normalizedPath);
+
+	std::lock_guard<std::mutex> lock(_pathLock);
+	auto it = _paths.find(hash);
+	if (it != _paths.end()) {
+		for (lfs_path_t *existing = it->second; existing; existing = existing->_next) {
+			if (strcmp(existing->_path, normalizedPath) == 0) {
+				_alloc.free(_alloc.allocator, normalizedPath);
+				return existing;
+			}
+		}
 	}
 
-	return item;
+	lfs_path_t *handle = new(_alloc.alloc(_alloc.allocator, sizeof(lfs_path_t), alignof(lfs_path_t))) lfs_path_t(normalizedPath, hash);
+
+	if (it != _paths.end()) {
+		handle->_next = it->second;
+		it->second = handle;
+	} else {
+		_paths.emplace(hash, handle);
+	}
+
+	return handle;
 }
 
-WorkItem *FileContext::writeFileSegment(const char *filepath, uint64_t offset, const void *buffer, uint64_t bufferBytes) {
-	WorkItem *item = allocWorkItemCommon(filepath, LFS_OP_WRITE_SEGMENT, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER);
+const char *FileContext::getPathString(PathHandle path) {
+	return path->_path;
+}
+
+uint64_t FileContext::getPathHash(PathHandle path) {
+	return path->_hash;
+}
+
+WorkItem *FileContext::readFile(PathHandle path, bool nullTerminate, Allocator *alloc, uint32_t flags) {
+	return readFileSegment(path, 0, static_cast<uint64_t>(-1), nullTerminate, alloc, flags);
+}
+
+void FileContext::readFileWithCallback(PathHandle path, bool nullTerminate, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData, Allocator *alloc, uint32_t flags) {
+	readFileSegmentWithCallback(path, 0, static_cast<uint64_t>(-1), nullTerminate, callback, bufferAction, callbackUserData, alloc, flags);
+}
+
+WorkItem *FileContext::readFileSegment(PathHandle path, uint64_t offset, uint64_t maxBytes, bool nullTerminate, Allocator *alloc, uint32_t flags) {
+	return submitRead(allocWorkItemCommon(path, LFS_OP_READ, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER), offset, maxBytes, nullTerminate, false, alloc, flags & kAccessHints);
+}
+
+void FileContext::readFileSegmentWithCallback(PathHandle path, uint64_t offset, uint64_t maxBytes, bool nullTerminate, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData, Allocator *alloc, uint32_t flags) {
+	submitRead(allocWorkItemCommon(path, LFS_OP_READ, callback, callbackUserData, bufferAction), offset, maxBytes, nullTerminate, false, alloc, flags & kAccessHints);
+}
+
+WorkItem *FileContext::readFileShared(PathHandle path, Allocator *alloc, uint32_t flags) {
+	return readFileSegmentShared(path, 0, static_cast<uint64_t>(-1), alloc, flags);
+}
+
+WorkItem *FileContext::readFileSegmentShared(PathHandle path, uint64_t offset, uint64_t maxBytes, Allocator *alloc, uint32_t flags) {
+	return submitRead(allocWorkItemCommon(path, LFS_OP_READ, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER), offset, maxBytes, false, true, alloc, flags);
+}
+
+void FileContext::readFileSegmentSharedWithCallback(PathHandle path, uint64_t offset, uint64_t maxBytes, WorkItemCallback callback, void *callbackUserData, Allocator *alloc, uint32_t flags) {
+	submitRead(allocWorkItemCommon(path, LFS_OP_READ, callback, callbackUserData, LFS_FREE_BUFFER), offset, maxBytes, false, true, alloc, flags);
+}
+
+WorkItem *FileContext::writeFile(PathHandle path, const void *buffer, uint64_t bufferBytes) {
+	return submitWrite(allocWorkItemCommon(path, LFS_OP_WRITE, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER), 0, buffer, bufferBytes);
+}
+
+void FileContext::writeFileWithCallback(PathHandle path, const void *buffer, uint64_t bufferBytes, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData) {
+	submitWrite(allocWorkItemCommon(path, LFS_OP_WRITE, callback, callbackUserData, bufferAction), 0, buffer, bufferBytes);
+}
+
+WorkItem *FileContext::writeFileSegment(PathHandle path, uint64_t offset, const void *buffer, uint64_t bufferBytes) {
+	return submitWrite(allocWorkItemCommon(path, LFS_OP_WRITE_SEGMENT, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER), offset, buffer, bufferBytes);
+}
+
+void FileContext::writeFileSegmentWithCallback(PathHandle path, uint64_t offset, const void *buffer, uint64_t bufferBytes, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData) {
+	submitWrite(allocWorkItemCommon(path, LFS_OP_WRITE_SEGMENT, callback, callbackUserData, bufferAction), offset, buffer, bufferBytes);
+}
+
+WorkItem *FileContext::appendFile(PathHandle path, const void *buffer, uint64_t bufferBytes) {
+	return submitWrite(allocWorkItemCommon(path, LFS_OP_APPEND, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER), 0, buffer, bufferBytes);
+}
+
+void FileContext::appendFileWithCallback(PathHandle path, const void *buffer, uint64_t bufferBytes, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData) {
+	submitWrite(allocWorkItemCommon(path, LFS_OP_APPEND, callback, callbackUserData, bufferAction), 0, buffer, bufferBytes);
+}
+
+WorkItem *FileContext::fileExists(PathHandle path) {
+	return submitQuery(allocWorkItemCommon(path, LFS_OP_EXISTS, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER));
+}
+
+void FileContext::fileExistsWithCallback(PathHandle path, WorkItemCallback callback, void *callbackUserData) {
+	submitQuery(allocWorkItemCommon(path, LFS_OP_EXISTS, callback, callbackUserData, LFS_DO_NOT_FREE_BUFFER));
+}
+
+WorkItem *FileContext::fileSize(PathHandle path) {
+	return submitQuery(allocWorkItemCommon(path, LFS_OP_SIZE, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER));
+}
+
+void FileContext::fileSizeWithCallback(PathHandle path, WorkItemCallback callback, void *callbackUserData) {
+	submitQuery(allocWorkItemCommon(path, LFS_OP_SIZE, callback, callbackUserData, LFS_DO_NOT_FREE_BUFFER));
+}
 
+WorkItem *FileContext::submitRead(WorkItem *item, uint64_t offset, uint64_t maxBytes, bool nullTerminate, bool shared, Allocator *alloc, uint32_t flags) {
 	if (item) {
-		item->_buffer = const_cast<void*>(buffer);
-		item->_bufferBytes = bufferBytes;
+		item->_allocator = alloc ? *alloc : _alloc;
+		item->_nullTerminate = nullTerminate;
+		item->_bufferBytes = maxBytes;
 		item->_offset = offset;
+		item->_shared = shared;
+		item->_readFlags = flags;
 
 		_workItemQueue.push(item);
 	}
@@ -517,56 +2037,68 @@ WorkItem *FileContext::writeFileSegment(const char *filepath, uint64_t offset, c
 	return item;
 }
 
-void FileContext::writeFileWithCallback(const char *filepath, const void *buffer, uint64_t bufferBytes, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData) {
-	WorkItem *item = allocWorkItemCommon(filepath, LFS_OP_WRITE, callback, callbackUserData, bufferAction);
-
+WorkItem *FileContext::submitWrite(WorkItem *item, uint64_t offset, const void *buffer, uint64_t bufferBytes) {
 	if (item) {
 		item->_buffer = const_cast<void*>(buffer);
 		item->_bufferBytes = bufferBytes;
-		item->_offset = 0;
+		item->_offset = offset;
 
 		_workItemQueue.push(item);
 	}
-}
 
-void FileContext::writeFileSegmentWithCallback(const char *filepath, uint64_t offset, const void *buffer, uint64_t bufferBytes, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData) {
-	WorkItem *item = allocWorkItemCommon(filepath, LFS_OP_WRITE_SEGMENT, callback, callbackUserData, bufferAction);
-
-	if (item) {
-		item->_buffer = const_cast<void*>(buffer);
-		item->_bufferBytes = bufferBytes;
-		item->_offset = offset;
+	return item;
+}
 
+WorkItem *FileContext::submitQuery(WorkItem *item) {
+	if (item && !completeFromMetadataCache(item)) {
 		_workItemQueue.push(item);
 	}
+
+	return item;
 }
 
-WorkItem *FileContext::appendFile(const char *filepath, const void *buffer, uint64_t bufferBytes) {
-	WorkItem *item = allocWorkItemCommon(filepath, LFS_OP_APPEND, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER);
+WorkItem *FileContext::openFile(const char *filepath, lfs_open_mode_t mode, uint64_t bufferBytes, uint32_t flags) {
+	uint32_t op = mode == LFS_OPEN_WRITE ? LFS_OP_OPEN_WRITE : (mode == LFS_OPEN_APPEND ? LFS_OP_OPEN_APPEND : LFS_OP_OPEN_READ);
+	WorkItem *item = allocWorkItemCommon(filepath, op, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER);
 
 	if (item) {
-		item->_buffer = const_cast<void*>(buffer);
 		item->_bufferBytes = bufferBytes;
-
+		item->_readFlags = flags & kAccessHints;
 		_workItemQueue.push(item);
 	}
 
 	return item;
 }
 
-void FileContext::appendFileWithCallback(const char *filepath, const void *buffer, uint64_t bufferBytes, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData) {
-	WorkItem *item = allocWorkItemCommon(filepath, LFS_OP_APPEND, callback, callbackUserData, bufferAction);
+void FileContext::openFileWithCallback(const char *filepath, lfs_open_mode_t mode, uint64_t bufferBytes, WorkItemCallback callback, void *callbackUserData, uint32_t flags) {
+	uint32_t op = mode == LFS_OPEN_WRITE ? LFS_OP_OPEN_WRITE : (mode == LFS_OPEN_APPEND ? LFS_OP_OPEN_APPEND : LFS_OP_OPEN_READ);
+	WorkItem *item = allocWorkItemCommon(filepath, op, callback, callbackUserData, LFS_DO_NOT_FREE_BUFFER);
 
 	if (item) {
-		item->_buffer = const_cast<void*>(buffer);
 		item->_bufferBytes = bufferBytes;
-
+		item->_readFlags = flags & kAccessHints;
 		_workItemQueue.push(item);
 	}
 }
 
-WorkItem *FileContext::fileExists(const char *filepath) {
-	WorkItem *item = allocWorkItemCommon(filepath, LFS_OP_EXISTS, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER);
+WorkItem *FileContext::readFileHandle(FileHandle file, uint64_t maxBytes, Allocator *alloc) {
+	return submitRead(allocFileHandleWorkItem(static_cast<OpenFile*>(file), LFS_OP_HANDLE_READ, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER), 0, maxBytes, false, false, alloc);
+}
+
+void FileContext::readFileHandleWithCallback(FileHandle file, uint64_t maxBytes, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData, Allocator *alloc) {
+	submitRead(allocFileHandleWorkItem(static_cast<OpenFile*>(file), LFS_OP_HANDLE_READ, callback, callbackUserData, bufferAction), 0, maxBytes, false, false, alloc);
+}
+
+WorkItem *FileContext::writeFileHandle(FileHandle file, const void *buffer, uint64_t bufferBytes) {
+	return submitWrite(allocFileHandleWorkItem(static_cast<OpenFile*>(file), LFS_OP_HANDLE_WRITE, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER), 0, buffer, bufferBytes);
+}
+
+void FileContext::writeFileHandleWithCallback(FileHandle file, const void *buffer, uint64_t bufferBytes, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData) {
+	submitWrite(allocFileHandleWorkItem(static_cast<OpenFile*>(file), LFS_OP_HANDLE_WRITE, callback, callbackUserData, bufferAction), 0, buffer, bufferBytes);
+}
+
+WorkItem *FileContext::closeFileHandle(FileHandle file) {
+	WorkItem *item = allocFileHandleWorkItem(static_cast<OpenFile*>(file), LFS_OP_HANDLE_CLOSE, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER);
 
 	if (item) {
 		_workItemQueue.push(item);
@@ -575,29 +2107,357 @@ WorkItem *FileContext::fileExists(const char *filepath) {
 	return item;
 }
 
-void FileContext::fileExistsWithCallback(const char *filepath, WorkItemCallback callback, void *callbackUserData) {
-	WorkItem *item = allocWorkItemCommon(filepath, LFS_OP_EXISTS, callback, callbackUserData, LFS_DO_NOT_FREE_BUFFER);
+void FileContext::closeFileHandleWithCallback(FileHandle file, WorkItemCallback callback, void *callbackUserData) {
+	WorkItem *item = allocFileHandleWorkItem(static_cast<OpenFile*>(file), LFS_OP_HANDLE_CLOSE, callback, callbackUserData, LFS_DO_NOT_FREE_BUFFER);
 
 	if (item) {
 		_workItemQueue.push(item);
 	}
 }
 
-WorkItem *FileContext::fileSize(const char *filepath) {
-	WorkItem *item = allocWorkItemCommon(filepath, LFS_OP_SIZE, nullptr, nullptr, LFS_DO_NOT_FREE_BUFFER);
+WorkItem *FileContext::allocFileHandleWorkItem(OpenFile *file, uint32_t op, WorkItemCallback callback, void *callbackUserData, CallbackBufferAction bufferAction) {
+	auto init = [&](WorkItem *item) {
+		// the handle's path outlives any work issued on it, so it isn't copied
+		item->_operation = static_cast<lfs_file_operation_t>(op);
+		item->_filename = file->_path;
+		item->_fileHandle = file;
+		item->_callback = callback;
+		item->_callbackUserData = callbackUserData;
+		item->_callbackBufferAction = bufferAction;
+		item->_completed = false;
+		item->_context = this;
+	};
+
+	WorkItem *item = _workItemPool.alloc();
 
 	if (item) {
-		_workItemQueue.push(item);
+		init(item);
+		updateCaches(item, false);
+	} else {
+		LOG("error: unable to allocate work item, work item pool capacity was %u", static_cast<uint32_t>(_workItemPool.getCapacity()));
+
+		if (callback) {
+			WorkItem errorItem;
+			init(&errorItem);
+			errorItem._completed = true;
+			errorItem._resultCode = LFS_OUT_OF_WORK_ITEMS;
+
+			callback(&errorItem, callbackUserData);
+		}
 	}
 
 	return item;
 }
 
-void FileContext::fileSizeWithCallback(const char *filepath, WorkItemCallback callback, void *callbackUserData) {
-	WorkItem *item = allocWorkItemCommon(filepath, LFS_OP_SIZE, callback, callbackUserData, LFS_DO_NOT_FREE_BUFFER);
+void FileContext::openFileInternal(const MountTable *mounts, WorkItem *workItem) {
+	lfs_open_mode_t mode = LFS_OPEN_READ;
+	if (workItem->_operation == LFS_OP_OPEN_WRITE) {
+		mode = LFS_OPEN_WRITE;
+	} else if (workItem->_operation == LFS_OP_OPEN_APPEND) {
+		mode = LFS_OPEN_APPEND;
+	}
 
-	if (item) {
-		_workItemQueue.push(item);
+	uint64_t bufferBytes = mode == LFS_OPEN_READ ? workItem->_bufferBytes : 0;
+	workItem->_bufferBytes = 0;
+
+	const char *devicePath = nullptr;
+	MountInfo *mount = nullptr;
+	void *deviceHandle = nullptr;
+	bool deviceOpen = false;
+	uint64_t size = 0;
+
+	if (mode == LFS_OPEN_READ) {
+		workItem->_resultCode = LFS_NOT_FOUND;
+		for (mount = findFirstMountAndPath(mounts, workItem, &devicePath); mount; mount = findNextMountAndPath(mounts, workItem->_filename, &devicePath, mount)) {
+			size = mount->_interface->_fileSize(mount->_device, devicePath, &workItem->_resultCode);
+			if (workItem->_resultCode == LFS_OK && hasHandles(mount->_interface)) {
+				workItem->_resultCode = mount->_interface->_openHandle(mount->_device, devicePath, mode, &deviceHandle);
+				deviceOpen = workItem->_resultCode == LFS_OK;
+			}
+
+			if (workItem->_resultCode != LFS_NOT_FOUND) {
+				break;
+			}
+			notePathFilterMiss(mount);
+		}
+	} else {
+		mount = findMutableMountAndPath(mounts, workItem->_filename, &devicePath, mode == LFS_OPEN_WRITE ? LFS_OP_WRITE : LFS_OP_APPEND);
+		if (!mount) {
+			workItem->_resultCode = LFS_UNSUPPORTED;
+		} else if (hasHandles(mount->_interface)) {
+			workItem->_resultCode = mount->_interface->_openHandle(mount->_device, devicePath, mode, &deviceHandle);
+			deviceOpen = workItem->_resultCode == LFS_OK;
+		} else {
+			// nothing to keep open, but the file has to exist (and be truncated) by the time this completes
+			char empty = 0;
+			mount->_interface->_writeFile(mount->_device, devicePath, 0, &empty, 0, mode == LFS_OPEN_WRITE ? LFS_WRITE_TRUNCATE : LFS_WRITE_APPEND, &workItem->_resultCode);
+		}
+
+		if (workItem->_resultCode == LFS_OK && mode == LFS_OPEN_APPEND) {
+			size = mount->_interface->_fileSize(mount->_device, devicePath, &workItem->_resultCode);
+		}
+
+		if (workItem->_resultCode == LFS_OK) {
+			noteFileWritten(mount, devicePath);
+		}
+	}
+
+	if (workItem->_resultCode != LFS_OK) {
+		if (deviceOpen) {
+			mount->_interface->_closeHandle(mount->_device, deviceHandle);
+		}
+		return;
+	}
+
+	// the device path may point into the mount's case index, which can change while the file is open
+	size_t pathBytes = strlen(workItem->_filename) + 1;
+	size_t devicePathBytes = strlen(devicePath) + 1;
+	void *memory = _alloc.alloc(_alloc.allocator, sizeof(OpenFile) + pathBytes + devicePathBytes, alignof(OpenFile));
+	OpenFile *file = new(memory) OpenFile();
+
+	file->_path = reinterpret_cast<char*>(file + 1);
+	file->_devicePath = file->_path + pathBytes;
+	memcpy(file->_path, workItem->_filename, pathBytes);
+	memcpy(file->_devicePath, devicePath, devicePathBytes);
+
+	file->_mount = mount;
+	file->_deviceHandle = deviceHandle;
+	file->_deviceOpen = deviceOpen;
+	file->_mode = mode;
+	file->_accessHints = workItem->_readFlags;
+	file->_size = size;
+	file->_position = mode == LFS_OPEN_APPEND ? size : 0;
+	adviseOpenFile(file, kHintsBeforeRead);
+
+	if (bufferBytes > 0) {
+		file->_buffers[0]._data = static_cast<uint8_t*>(_alloc.alloc(_alloc.allocator, bufferBytes, 64));
+		file->_buffers[1]._data = static_cast<uint8_t*>(_alloc.alloc(_alloc.allocator, bufferBytes, 64));
+
+		// without both buffers everything is read straight from the device
+		if (file->_buffers[0]._data && file->_buffers[1]._data) {
+			file->_bufferBytes = bufferBytes;
+		}
+	}
+
+	acquireMountUser(mount);
+
+	workItem->_fileHandle = file;
+	workItem->_bufferBytes = size;
+}
+
+void FileContext::readFileHandleInternal(WorkItem *workItem) {
+	OpenFile *file = static_cast<OpenFile*>(workItem->_fileHandle);
+	uint64_t maxBytes = workItem->_bufferBytes;
+	workItem->_bufferBytes = 0;
+	workItem->_offset = file->_position;
+
+	if (file->_mode != LFS_OPEN_READ) {
+		workItem->_resultCode = LFS_UNSUPPORTED;
+		return;
+	}
+
+	workItem->_resultCode = LFS_OK;
+	uint64_t bytes = file->_position < file->_size ? std::min(maxBytes, file->_size - file->_position) : 0;
+
+	if (bytes > 0) {
+		uint8_t *buffer = static_cast<uint8_t*>(workItem->_allocator.alloc(workItem->_allocator.allocator, bytes, 1));
+		if (!buffer) {
+			workItem->_resultCode = LFS_GENERIC_ERROR;
+			return;
+		}
+
+		uint64_t bytesRead = readStream(file, file->_position, bytes, buffer, workItem->_resultCode);
+		if (bytesRead > 0) {
+			// a failure part of the way through still hands back what was read
+			workItem->_resultCode = LFS_OK;
+			workItem->_buffer = buffer;
+			workItem->_bufferBytes = bytesRead;
+			file->_position += bytesRead;
+		} else {
+			workItem->_allocator.free(workItem->_allocator.allocator, buffer);
+		}
+	}
+
+	queueReadahead(file);
+}
+
+void FileContext::writeFileHandleInternal(WorkItem *workItem) {
+	OpenFile *file = static_cast<OpenFile*>(workItem->_fileHandle);
+	MountInfo *mount = file->_mount;
+	uint64_t bytes = workItem->_bufferBytes;
+	workItem->_bufferBytes = 0;
+
+	if (file->_mode == LFS_OPEN_READ) {
+		workItem->_resultCode = LFS_UNSUPPORTED;
+		return;
+	}
+
+	if (file->_deviceOpen) {
+		workItem->_bufferBytes = mount->_interface->_writeHandle(mount->_device, file->_deviceHandle, file->_position, workItem->_buffer, bytes, &workItem->_resultCode);
+	} else {
+		workItem->_bufferBytes = mount->_interface->_writeFile(mount->_device, file->_devicePath, file->_position, workItem->_buffer, bytes, LFS_WRITE_SEGMENT, &workItem->_resultCode);
+	}
+
+	file->_position += workItem->_bufferBytes;
+}
+
+void FileContext::closeFileHandleInternal(OpenFile *file) {
+	if (file->_readaheadQueued) {
+		OpenFile **link = &_readaheadHead;
+		OpenFile *previous = nullptr;
+		while (*link != file) {
+			previous = *link;
+			link = &previous->_nextReadahead;
+		}
+
+		*link = file->_nextReadahead;
+		if (_readaheadTail == file) {
+			_readaheadTail = previous;
+		}
+	}
+
+	adviseOpenFile(file, LFS_READ_DONTNEED);
+
+	MountInfo *mount = file->_mount;
+	if (file->_deviceOpen) {
+		mount->_interface->_closeHandle(mount->_device, file->_deviceHandle);
+	}
+
+	_alloc.free(_alloc.allocator, file->_buffers[0]._data);
+	_alloc.free(_alloc.allocator, file->_buffers[1]._data);
+	file->~OpenFile();
+	_alloc.free(_alloc.allocator, file);
+
+	releaseMountUser(mount);
+}
+
+uint64_t FileContext::readStream(OpenFile *file, uint64_t offset, uint64_t bytes, uint8_t *buffer, ErrorCode &result) {
+	uint64_t bytesRead = 0;
+	result = LFS_OK;
+
+	while (bytesRead < bytes) {
+		uint64_t position = offset + bytesRead;
+		int32_t index = file->findBuffer(position);
+
+		if (index < 0) {
+			uint64_t remaining = bytes - bytesRead;
+			if (remaining >= file->_bufferBytes) {
+				// there's no point in going through a buffer for anything that would fill it,
+				// but a vectored read can fill one with what follows in the same call
+				uint64_t end = position + remaining;
+				lfs_io_vec_t vecs[2] = {{buffer + bytesRead, remaining}, {nullptr, 0}};
+				uint32_t count = 1;
+
+				index = file->_buffers[0]._offset <= file->_buffers[1]._offset ? 0 : 1;
+				if ((file->_mount->_interface->_capabilities & LFS_DEVICE_CAP_VECTORED) && end < file->_size && file->findBuffer(end) < 0) {
+					OpenFile::Buffer &next = file->_buffers[index];
+					next._offset = end;
+					next._bytes = 0;
+					vecs[1] = {next._data, std::min(file->_bufferBytes, file->_size - end)};
+					count = 2;
+				}
+
+				uint64_t deviceBytes = readStreamDeviceV(file, position, vecs, count, result);
+				if (count == 2 && deviceBytes > remaining) {
+					file->_buffers[index]._bytes = deviceBytes - remaining;
+				}
+
+				bytesRead += std::min(deviceBytes, remaining);
+				break;
+			}
+
+			// the buffer furthest behind is the one that isn't needed anymore
+			index = file->_buffers[0]._offset <= file->_buffers[1]._offset ? 0 : 1;
+			if (fillStreamBuffer(file, index, position, result) == 0) {
+				break;
+			}
+		}
+
+		const OpenFile::Buffer &source = file->_buffers[index];
+		uint64_t copyBytes = std::min(source._offset + source._bytes - position, bytes - bytesRead);
+		memcpy(buffer + bytesRead, source._data + (position - source._offset), copyBytes);
+		bytesRead += copyBytes;
+	}
+
+	return bytesRead;
+}
+
+uint64_t FileContext::readStreamDevice(OpenFile *file, uint64_t offset, uint64_t bytes, void *buffer, ErrorCode &result) {
+	MountInfo *mount = file->_mount;
+	if (file->_deviceOpen) {
+		return mount->_interface->_readHandle(mount->_device, file->_deviceHandle, offset, bytes, buffer, &result);
+	}
+
+	void *data = nullptr;
+	uint64_t bytesRead = mount->_interface->_readFile(mount->_device, file->_devicePath, offset, bytes, &_alloc, &data, false, &result);
+	if (!data) {
+		return 0;
+	}
+
+	bytesRead = result == LFS_OK ? std::min(bytesRead, bytes) : 0;
+	memcpy(buffer, data, bytesRead);
+	_alloc.free(_alloc.allocator, data);
+	return bytesRead;
+}
+
+uint64_t FileContext::readStreamDeviceV(OpenFile *file, uint64_t offset, const lfs_io_vec_t *vecs, uint32_t count, ErrorCode &result) {
+	MountInfo *mount = file->_mount;
+	if (file->_deviceOpen && mount->_interface->_readHandleV) {
+		return mount->_interface->_readHandleV(mount->_device, file->_deviceHandle, offset, vecs, count, &result);
+	}
+
+	uint64_t bytesRead = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		uint64_t vecBytes = readStreamDevice(file, offset + bytesRead, vecs[i].bytes, vecs[i].buffer, result);
+		bytesRead += vecBytes;
+		if (vecBytes < vecs[i].bytes) {
+			break;
+		}
+	}
+
+	return bytesRead;
+}
+
+uint64_t FileContext::fillStreamBuffer(OpenFile *file, uint32_t index, uint64_t offset, ErrorCode &result) {
+	OpenFile::Buffer &buffer = file->_buffers[index];
+	buffer._offset = offset;
+	buffer._bytes = readStreamDevice(file, offset, std::min(file->_bufferBytes, file->_size - offset), buffer._data, result);
+	return buffer._bytes;
+}
+
+void FileContext::queueReadahead(OpenFile *file) {
+	uint64_t offset = 0;
+	uint32_t index = 0;
+	if (file->_readaheadQueued || !file->readaheadTarget(offset, index)) {
+		return;
+	}
+
+	file->_readaheadQueued = true;
+	if (_readaheadTail) {
+		_readaheadTail->_nextReadahead = file;
+	} else {
+		_readaheadHead = file;
+	}
+	_readaheadTail = file;
+}
+
+void FileContext::processReadahead() {
+	OpenFile *file = _readaheadHead;
+	_readaheadHead = file->_nextReadahead;
+	if (!_readaheadHead) {
+		_readaheadTail = nullptr;
+	}
+
+	file->_nextReadahead = nullptr;
+	file->_readaheadQueued = false;
+
+	// reads may have caught up with it since it was queued
+	uint64_t offset = 0;
+	uint32_t index = 0;
+	if (file->readaheadTarget(offset, index)) {
+		// a failure shows up again when the data is actually read
+		ErrorCode result;
+		fillStreamBuffer(file, index, offset, result);
 	}
 }
 
@@ -656,51 +2516,82 @@ void FileContext::deleteDirWithCallback(const char *path, WorkItemCallback callb
 }
 
 void FileContext::processingFunc(FileContext *ctx) {
-	while(ctx->_processing) {
-		WorkItem *item = ctx->_workItemQueue.pop(nullptr);
-		if (item) {
+	// pending requests have to come back before the context can go away
+	while(ctx->_processing || ctx->_pendingDeviceRequests > 0) {
+		WorkItem *item = nullptr;
+		if (ctx->_deviceCompletions.load(std::memory_order_relaxed)) {
+			ctx->finishDeviceRequests(ctx->_deviceCompletions.exchange(nullptr, std::memory_order_acquire));
+		} else if ((item = ctx->_workItemQueue.pop(nullptr)) != nullptr) {
+			MountTableReader reader(ctx);
+			const MountTable *mounts = reader.get();
+
 			switch (item->_operation) {
 			case LFS_OP_EXISTS:
 			{
 				const char *devicePath;
-				MountInfo *mount = nullptr;
 				item->_resultCode = LFS_NOT_FOUND;
-				while ((mount = ctx->findNextMountAndPath(item->_filename, &devicePath, mount)) != nullptr) {
+				for (MountInfo *mount = ctx->findFirstMountAndPath(mounts, item, &devicePath); mount; mount = ctx->findNextMountAndPath(mounts, item->_filename, &devicePath, mount)) {
 					bool exists = mount->_interface->_fileExists(mount->_device, devicePath);
 					if (exists) {
 						item->_resultCode = LFS_OK;
 						break;
 					}
+					ctx->notePathFilterMiss(mount);
 				}
 				break;
 			}
 			case LFS_OP_SIZE:
 			{
 				const char *devicePath;
-				MountInfo *mount = nullptr;
 				item->_resultCode = LFS_NOT_FOUND;
 				item->_bufferBytes = 0;
-				while ((mount = ctx->findNextMountAndPath(item->_filename, &devicePath, mount)) != nullptr) {
+				for (MountInfo *mount = ctx->findFirstMountAndPath(mounts, item, &devicePath); mount; mount = ctx->findNextMountAndPath(mounts, item->_filename, &devicePath, mount)) {
 					item->_bufferBytes = mount->_interface->_fileSize(mount->_device, devicePath, &item->_resultCode);
 					if (item->_resultCode != LFS_NOT_FOUND) {
 						break;
 					}
+					ctx->notePathFilterMiss(mount);
 				}
 				break;
 			}
 			case LFS_OP_READ:
 			{
-				const char *devicePath;
-				MountInfo *mount = nullptr;
-				item->_resultCode = LFS_NOT_FOUND;
-				size_t maxBytes = item->_bufferBytes;
-				item->_bufferBytes = 0;
-				while ((mount = ctx->findNextMountAndPath(item->_filename, &devicePath, mount)) != nullptr) {
-					item->_bufferBytes = mount->_interface->_readFile(mount->_device, devicePath, item->_offset, maxBytes, &item->_allocator, &item->_buffer, item->_nullTerminate, &item->_resultCode);
-					if (item->_resultCode != LFS_NOT_FOUND) {
-						break;
+				bool mapped = (item->_readFlags & LFS_READ_MAPPED) != 0;
+				if (mapped || !ctx->readFromBlockCache(mounts, item)) {
+					const char *devicePath;
+					item->_resultCode = LFS_NOT_FOUND;
+					size_t maxBytes = item->_bufferBytes;
+					item->_bufferBytes = 0;
+					for (MountInfo *mount = ctx->findFirstMountAndPath(mounts, item, &devicePath); mount; mount = ctx->findNextMountAndPath(mounts, item->_filename, &devicePath, mount)) {
+						if (mapped && ctx->mapFile(mount, devicePath, maxBytes, item)) {
+							break;
+						}
+
+						ctx->adviseRead(mount, devicePath, maxBytes, item, kHintsBeforeRead);
+						if (!ctx->readParallel(mount, devicePath, maxBytes, item)) {
+							if (mount->_interface->_readFileAsync) {
+								item->_bufferBytes = mount->_interface->_readFileAsync(mount->_device, devicePath, item->_offset, maxBytes, &item->_allocator, &item->_buffer, item->_nullTerminate, reinterpret_cast<DeviceRequest*>(item), &item->_resultCode);
+							} else {
+								item->_bufferBytes = mount->_interface->_readFile(mount->_device, devicePath, item->_offset, maxBytes, &item->_allocator, &item->_buffer, item->_nullTerminate, &item->_resultCode);
+							}
+						}
+
+						if (item->_resultCode == LFS_PENDING) {
+							ctx->beginDeviceRequest(item, mount);
+							break;
+						} else if (item->_resultCode != LFS_NOT_FOUND) {
+							if (item->_resultCode == LFS_OK) {
+								ctx->adviseRead(mount, devicePath, maxBytes, item, LFS_READ_DONTNEED);
+							}
+							break;
+						}
+						ctx->notePathFilterMiss(mount);
 					}
 				}
+
+				if (item->_resultCode == LFS_OK) {
+					ctx->_accessTrace.record(item->_filename, item->_offset, item->_bufferBytes);
+				}
 				break;
 			}
 			case LFS_OP_WRITE:
@@ -708,7 +2599,7 @@ void FileContext::processingFunc(FileContext *ctx) {
 			case LFS_OP_APPEND:
 			{
 				const char *devicePath;
-				MountInfo *mount = ctx->findMutableMountAndPath(item->_filename, &devicePath, item->_operation);
+				MountInfo *mount = ctx->findMutableMountAndPath(mounts, item->_filename, &devicePath, item->_operation);
 				if (mount) {
 					lfs_write_mode_t writeMode = LFS_WRITE_TRUNCATE;
 					switch (item->_operation) {
@@ -725,7 +2616,17 @@ void FileContext::processingFunc(FileContext *ctx) {
 						break;
 					}
 
-					item->_bufferBytes = mount->_interface->_writeFile(mount->_device, devicePath, item->_offset, item->_buffer, item->_bufferBytes, writeMode, &item->_resultCode);
+					if (mount->_interface->_writeFileAsync) {
+						item->_bufferBytes = mount->_interface->_writeFileAsync(mount->_device, devicePath, item->_offset, item->_buffer, item->_bufferBytes, writeMode, reinterpret_cast<DeviceRequest*>(item), &item->_resultCode);
+					} else {
+						item->_bufferBytes = mount->_interface->_writeFile(mount->_device, devicePath, item->_offset, item->_buffer, item->_bufferBytes, writeMode, &item->_resultCode);
+					}
+
+					if (item->_resultCode == LFS_PENDING) {
+						ctx->beginDeviceRequest(item, mount);
+					} else if (item->_resultCode == LFS_OK) {
+						ctx->noteFileWritten(mount, devicePath);
+					}
 				} else {
 					item->_bufferBytes = 0;
 					item->_resultCode = LFS_UNSUPPORTED;
@@ -735,9 +2636,14 @@ void FileContext::processingFunc(FileContext *ctx) {
 			case LFS_OP_DELETE:
 			{
 				const char *devicePath;
-				MountInfo *mount = ctx->findMutableMountAndPath(item->_filename, &devicePath, item->_operation);
+				MountInfo *mount = ctx->findMutableMountAndPath(mounts, item->_filename, &devicePath, item->_operation);
 				if (mount) {
 					item->_resultCode = mount->_interface->_deleteFile(mount->_device, devicePath);
+
+					if (mount->_caseIndex && item->_resultCode == LFS_OK) {
+						mount->_caseIndex->erase(devicePath);
+						ctx->invalidateCaseVariants(mount);
+					}
 				} else {
 					item->_resultCode = LFS_UNSUPPORTED;
 				}
@@ -746,7 +2652,7 @@ void FileContext::processingFunc(FileContext *ctx) {
 			case LFS_OP_CREATE_DIR:
 			{
 				const char *devicePath;
-				MountInfo *mount = ctx->findMutableMountAndPath(item->_filename, &devicePath, item->_operation);
+				MountInfo *mount = ctx->findMutableMountAndPath(mounts, item->_filename, &devicePath, item->_operation);
 				if (mount) {
 					item->_resultCode = mount->_interface->_createDir(mount->_device, devicePath);
 				} else {
@@ -757,33 +2663,77 @@ void FileContext::processingFunc(FileContext *ctx) {
 			case LFS_OP_DELETE_DIR:
 			{
 				const char *devicePath;
-				MountInfo *mount = ctx->findMutableMountAndPath(item->_filename, &devicePath, item->_operation);
+				MountInfo *mount = ctx->findMutableMountAndPath(mounts, item->_filename, &devicePath, item->_operation);
 				if (mount) {
 					item->_resultCode = mount->_interface->_deleteDir(mount->_device, devicePath);
+
+					if (mount->_caseIndex && item->_resultCode == LFS_OK) {
+						mount->_caseIndex->eraseDirectory(devicePath);
+					}
 				} else {
 					item->_resultCode = LFS_UNSUPPORTED;
 				}
 				break;
 			}
-			};
-
+			case LFS_OP_PREFETCH:
 			{
-				std::unique_lock<std::mutex> lock(ctx->getCompletionMutex());
-				item->_completed = true;
+				ctx->processPrefetch(mounts, item, false);
+				break;
 			}
+			case LFS_OP_OPEN_READ:
+			case LFS_OP_OPEN_WRITE:
+			case LFS_OP_OPEN_APPEND:
+			{
+				ctx->openFileInternal(mounts, item);
+				break;
+			}
+			case LFS_OP_HANDLE_READ:
+			{
+				ctx->readFileHandleInternal(item);
 
-			if (item->_callback) {
-				item->_callback(item, item->_callbackUserData);
-
-				if (item->_callbackBufferAction == LFS_FREE_BUFFER) {
-					WorkItemFreeBuffer(item);
+				if (item->_resultCode == LFS_OK && item->_bufferBytes > 0) {
+					ctx->_accessTrace.record(item->_filename, item->_offset, item->_bufferBytes);
 				}
+				break;
+			}
+			case LFS_OP_HANDLE_WRITE:
+			{
+				ctx->writeFileHandleInternal(item);
+				break;
+			}
+			case LFS_OP_HANDLE_CLOSE:
+			{
+				ctx->closeFileHandleInternal(static_cast<OpenFile*>(item->_fileHandle));
+				item->_filename = nullptr;
+				item->_fileHandle = nullptr;
+				item->_resultCode = LFS_OK;
+				break;
+			}
+			};
 
-				ctx->releaseWorkItemInternal(item);
-			} else {
-				ctx->getCompletionConditionVariable().notify_all();
+			// the device hands it back through completeDeviceRequest()
+			if (item->_resultCode == LFS_PENDING) {
+				continue;
 			}
 
+			ctx->updateCaches(item, true);
+
+			// callbacks are free to change the mounts
+			reader.release();
+			ctx->completeWorkItem(item);
+		} else if (ctx->_readaheadHead) {
+			// readahead is idle time work too, but a stream is waiting on it sooner than a prefetch
+			ctx->processReadahead();
+		} else if (ctx->_currentBackgroundItem || (ctx->_currentBackgroundItem = ctx->_backgroundQueue.pop(nullptr)) != nullptr) {
+			// background work goes one file at a time so that new work doesn't wait on it
+			MountTableReader reader(ctx);
+			bool finished = ctx->processPrefetch(reader.get(), ctx->_currentBackgroundItem, true);
+			reader.release();
+
+			if (finished) {
+				ctx->completeWorkItem(ctx->_currentBackgroundItem);
+				ctx->_currentBackgroundItem = nullptr;
+			}
 		} else {
 			ctx->_workItemQueueSemaphore.wait();
 		}
@@ -5,15 +5,51 @@
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <iterator>
 #include <mutex>
-#include <shared_mutex>
 #include <vector>
 #include <thread>
+#include <unordered_map>
 
 #include "shared_types.h"
+#include "SharedBuffer.h"
+#include "util/AccessTrace.h"
+#include "util/AllocatorAdapter.h"
+#include "util/BloomFilter.h"
+#include "util/CaseFoldedIndex.h"
+#include "util/MetadataCache.h"
+#include "util/Path.h"
 #include "util/PoolAllocator.h"
 #include "util/RingBuffer.h"
 #include "util/Semaphore.h"
+#include "util/WorkerPool.h"
+
+//! An interned path, see FileContext::internPath() and LFS_PATH().
+struct lfs_path_t {
+	constexpr lfs_path_t(const char *path, uint64_t hash) : _path(path), _hash(hash) {}
+
+	const char *_path;
+	uint64_t _hash;
+
+	// the first readable mount matching the path, packed as the mount table generation
+	// and the mount index + 1 in the low 16 bits. Zero until it's been resolved.
+	mutable std::atomic<uint64_t> _resolvedMount{0};
+
+	// the next interned path with the same hash
+	lfs_path_t *_next = nullptr;
+};
+
+//! Gets a path handle for a string literal path. The path is normalized and hashed at
+//! compile time and the handle is statically allocated, so it can be used with any
+//! FileContext without calling FileContext::internPath().
+//! @param literal the path, must be a string literal
+//! @return a PathHandle
+#define LFS_PATH(literal) \
+	([]() -> ::laminaFS::PathHandle { \
+		static constexpr ::laminaFS::util::StaticPath<sizeof(literal)> kPath(literal); \
+		static lfs_path_t handle(kPath.c_str(), kPath.hash()); \
+		return &handle; \
+	}())
 
 namespace laminaFS {
 
@@ -23,42 +59,16 @@ typedef lfs_work_item_t WorkItem;
 typedef lfs_allocator_t Allocator;
 typedef lfs_work_item_callback_t WorkItemCallback;
 typedef lfs_callback_buffer_action_t CallbackBufferAction;
+typedef lfs_priority_t Priority;
 typedef void* Mount;
+typedef lfs_metadata_cache_stats_t MetadataCacheStats;
+typedef lfs_path_filter_stats_t PathFilterStats;
+typedef const lfs_path_t* PathHandle;
+typedef lfs_device_request_t DeviceRequest;
 
-extern Allocator DefaultAllocator;
-
-// C++ Allocator Adapter
-template <class T>
-struct AllocatorAdapter {
-	typedef T value_type;
-	AllocatorAdapter() noexcept : _alloc(DefaultAllocator) {}
-	AllocatorAdapter(Allocator &alloc) noexcept : _alloc(alloc) {}
-
-	template <class U>
-	AllocatorAdapter(const AllocatorAdapter<U>& other) noexcept {
-		_alloc = other._alloc;
-	}
-
-	T* allocate(std::size_t n) {
-		return static_cast<T*>(_alloc.alloc(_alloc.allocator, sizeof(T) * n, alignof(T)));
-	}
-
-	void deallocate(T* p, std::size_t) {
-		_alloc.free(_alloc.allocator, p);
-	}
-
-	Allocator _alloc;
-};
-
-template <class T, class U>
-bool operator==(const AllocatorAdapter<T> &a, const AllocatorAdapter<U> &b) {
-	return a._alloc == b._alloc;
-}
+class BlockCache;
 
-template <class T, class U>
-bool operator!=(const AllocatorAdapter<T> &a, const AllocatorAdapter<U> &b) {
-	return a._alloc != b._alloc;
-}
+extern Allocator DefaultAllocator;
 
 //! Gets the result code from a WorkItem
 //! @param workItem the WorkItem
@@ -76,9 +86,25 @@ extern void *WorkItemGetBuffer(const WorkItem *workItem);
 extern uint64_t WorkItemGetBytes(const WorkItem *workItem);
 
 //! Frees the output buffer that was allocated by the work item.
+//! If the buffer is shared, this releases the work item's reference to it.
 //! @param workItem the WorkItem
 extern void WorkItemFreeBuffer(WorkItem *workItem);
 
+//! Gets a reference counted handle to the output buffer of a WorkItem.
+//! Ownership of the buffer moves into the shared buffer; the WorkItem keeps one
+//! reference, which is released by WorkItemFreeBuffer(). Each call adds a
+//! reference that the caller must release with SharedBufferRelease(), so any
+//! number of consumers can hold on to the same bytes without copying them.
+//! This can be called from within a work item callback.
+//! @param workItem the WorkItem
+//! @return the shared buffer, or nullptr if there is no output buffer
+extern SharedBuffer *WorkItemAcquireSharedBuffer(const WorkItem *workItem);
+
+//! Gets the file handle opened by a FileContext::openFile() WorkItem.
+//! @param workItem the WorkItem
+//! @return the handle, or nullptr if the open failed or the WorkItem didn't open a file
+extern FileHandle WorkItemGetFileHandle(const WorkItem *workItem);
+
 //! Whether or not a work item has completed processing.
 //! @param workItem the WorkItem to query
 //! @eturn true if finished process (or for nullptr WorkItem), false otherwise
@@ -122,6 +148,34 @@ public:
 		typedef ErrorCode (*CreateDirFunc)(void *, const char *);
 		typedef ErrorCode (*DeleteDirFunc)(void *, const char *);
 
+		typedef ErrorCode (*PrefetchFileFunc)(void *, const char *, uint64_t, uint64_t);
+
+		typedef lfs_enumerate_callback_t EnumerateCallback;
+		typedef ErrorCode (*EnumerateFunc)(void *, EnumerateCallback, void *);
+
+		typedef ErrorCode (*MapFileFunc)(void *, const char *, uint64_t, uint64_t, lfs_allocator_t *, uint32_t, SharedBuffer **);
+
+		typedef ErrorCode (*OpenHandleFunc)(void *, const char *, lfs_open_mode_t, void **);
+		typedef size_t (*ReadHandleFunc)(void *, void *, uint64_t, uint64_t, void *, ErrorCode *);
+		typedef size_t (*WriteHandleFunc)(void *, void *, uint64_t, const void *, size_t, ErrorCode *);
+		typedef void (*CloseHandleFunc)(void *, void *);
+		typedef size_t (*ReadHandleVFunc)(void *, void *, uint64_t, const lfs_io_vec_t *, uint32_t, ErrorCode *);
+
+		typedef size_t (*ReadFileAsyncFunc)(void *, const char *, uint64_t, uint64_t, lfs_allocator_t *, void **, bool, DeviceRequest *, ErrorCode *);
+		typedef size_t (*WriteFileAsyncFunc)(void *, const char *, uint64_t, void *, size_t, lfs_write_mode_t, DeviceRequest *, ErrorCode *);
+
+		typedef ErrorCode (*SetDirectIOFunc)(void *, bool);
+
+		typedef ErrorCode (*AdviseFileFunc)(void *, const char *, uint64_t, uint64_t, uint32_t);
+		typedef void (*AdviseHandleFunc)(void *, void *, uint32_t);
+
+		// The version the interface was written against, always first so that it can be read
+		// before knowing how big the rest is. Registration doesn't read past _mapFile for
+		// versions before 2, past _capabilities before 3, past _writeFileAsync before 4, and
+		// past _setDirectIO before 5. Devices built against headers that had it anywhere else
+		// are only compatible at the source level and need to be rebuilt.
+		uint32_t _version = LFS_DEVICE_INTERFACE_VERSION;
+
 		// required
 		CreateFunc _create = nullptr;
 		DestroyFunc _destroy = nullptr;
@@ -135,6 +189,60 @@ public:
 		DeleteFileFunc _deleteFile = nullptr;
 		CreateDirFunc _createDir = nullptr;
 		DeleteDirFunc _deleteDir = nullptr;
+
+		// Hints that a range of a file will be read soon. Returns LFS_NOT_FOUND
+		// if the file doesn't exist on the device.
+		PrefetchFileFunc _prefetchFile = nullptr;
+
+		// Calls the callback with the path of every file on the device.
+		// Required for LFS_MOUNT_CASE_INSENSITIVE mounts.
+		EnumerateFunc _enumerate = nullptr;
+
+		// Maps a range of a file into a shared buffer for LFS_READ_MAPPED reads, passing
+		// on the read flags as hints. The buffer is nullptr for empty ranges. Returns
+		// LFS_UNSUPPORTED for files that can't be mapped, which are read normally instead.
+		MapFileFunc _mapFile = nullptr;
+
+		// Keeps a file open for a handle from FileContext::openFile(). Reads and writes
+		// through the handle go to the given offset, into or out of a caller-owned buffer.
+		// Parallel reads call _readHandle from several threads at once on the same handle.
+		// Opening for writing creates the file. All four are needed, devices without them
+		// are streamed from through _readFile and _writeFile instead.
+		OpenHandleFunc _openHandle = nullptr;
+		ReadHandleFunc _readHandle = nullptr;
+		WriteHandleFunc _writeHandle = nullptr;
+		CloseHandleFunc _closeHandle = nullptr;
+
+		// Reads consecutive bytes of a handle starting at the offset into several buffers,
+		// filling each before moving on to the next. Devices without it get one _readHandle
+		// call per buffer.
+		ReadHandleVFunc _readHandleV = nullptr;
+
+		// Filled in by registerDeviceInterface() from the functions the interface has.
+		uint32_t _capabilities = 0;
+
+		// Like _readFile and _writeFile, but they may set LFS_PENDING instead of finishing
+		// the request. The device then keeps the request and the arguments it needs, and
+		// hands it back through FileContext::completeDeviceRequest() once it's done, from
+		// any thread. Missing files must be reported right away so the next mount can be
+		// tried. Only requests for a whole read or write go through these; handles, the
+		// block cache and everything else still use the plain functions.
+		ReadFileAsyncFunc _readFileAsync = nullptr;
+		WriteFileAsyncFunc _writeFileAsync = nullptr;
+
+		// Switches a device to reading and writing around the OS file cache, called right
+		// after _create for LFS_MOUNT_DIRECT_IO mounts. The device deals with any alignment
+		// its storage needs.
+		SetDirectIOFunc _setDirectIO = nullptr;
+
+		// Pass lfs_read_flags_t access hints on to whatever caches the device reads
+		// through, for a range of a file or for everything read through a handle. The
+		// pattern hints and LFS_READ_WILLNEED come before a read, LFS_READ_DONTNEED after
+		// it. Hints are best effort, _adviseFile only reports LFS_NOT_FOUND for missing
+		// files, and can skip the pattern hints if it would have to apply them to state
+		// shared with other reads. Plain _prefetchFile is the same as LFS_READ_WILLNEED.
+		AdviseFileFunc _adviseFile = nullptr;
+		AdviseHandleFunc _adviseHandle = nullptr;
 	};
 
 	//! Registers a new device interface.
@@ -142,17 +250,33 @@ public:
 	//! @return the device type index, used for passing to createMount() or -1 on error
 	int32_t registerDeviceInterface(DeviceInterface &interface);
 
+	//! Finishes a request a device's _readFileAsync or _writeFileAsync left pending. This
+	//! can be called from any thread, the work item is completed on the processing thread.
+	//! @param request the request passed to the device function
+	//! @param result the result of the request
+	//! @param bytes the bytes read or written
+	//! @param buffer for reads, the buffer allocated with the allocator passed to the device function
+	static void completeDeviceRequest(DeviceRequest *request, ErrorCode result, uint64_t bytes, void *buffer);
+
+	//! Gets the features a device type provides natively.
+	//! @param deviceType the device type, as returned by registerDeviceInterface()
+	//! @return a combination of lfs_device_capabilities_t flags, 0 for an unknown device type
+	uint32_t getDeviceCapabilities(uint32_t deviceType) const;
+
 	//! Creates a new mount.
 	//! @param deviceType the device type, as returned by registerDeviceInterface()
 	//! @param mountPoint the virtual path to mount this device to
 	//! @param devicePath the path to pass into the device
 	//! @param returnCode the return code
-	//! @param mountPermissions the permissions to create the mount with
+	//! @param mountPermissions the permissions to create the mount with, optionally combined with LFS_MOUNT_CASE_INSENSITIVE
 	//! @return the mount
 	Mount createMount(uint32_t deviceType, const char *mountPoint, const char *devicePath, ErrorCode &returnCode, uint32_t mountPermissions = LFS_MOUNT_DEFAULT);
 
 	//! Releases a mount.
-	//! Finishes all processing work items and suspends processing while it runs.
+	//! The mount is removed from a new copy of the mount table, so processing carries on while
+	//! this runs. Work already resolving paths against the old table finishes before this
+	//! returns. Open file handles and pending requests that use the mount keep it alive, and
+	//! the device is destroyed once the last of them is done.
 	//! @param mount the mount to remove
 	//! @return whether or not the mount was found and removed
 	bool releaseMount(Mount mount);
@@ -161,8 +285,9 @@ public:
 	//! @param filepath the path to the file to read
 	//! @param nullTerminate whether or not to add a NULL to the end of the buffer so it can be directly used as a C-string.
 	//! @param alloc the allocator to use. If NULL will use the context's allocator.
+	//! @param flags access hints, a combination of LFS_READ_SEQUENTIAL, LFS_READ_RANDOM, LFS_READ_WILLNEED and LFS_READ_DONTNEED
 	//! @return a WorkItem representing the work to be done
-	WorkItem *readFile(const char *filepath, bool nullTerminate, Allocator *alloc = nullptr);
+	WorkItem *readFile(const char *filepath, bool nullTerminate, Allocator *alloc = nullptr, uint32_t flags = LFS_READ_DEFAULT);
 
 	//! Reads the entirety of a file.
 	//! @param filepath the path to the file to read
@@ -171,7 +296,8 @@ public:
 	//! @param bufferAction what to do with the buffer after the callback completes execution
 	//! @param callbackUserData user data pointer for callback
 	//! @param alloc the allocator to use. If NULL will use the context's allocator.
-	void readFileWithCallback(const char *filepath, bool nullTerminate, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData = nullptr, Allocator *alloc = nullptr);
+	//! @param flags access hints, a combination of LFS_READ_SEQUENTIAL, LFS_READ_RANDOM, LFS_READ_WILLNEED and LFS_READ_DONTNEED
+	void readFileWithCallback(const char *filepath, bool nullTerminate, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData = nullptr, Allocator *alloc = nullptr, uint32_t flags = LFS_READ_DEFAULT);
 
 	//! Reads a portion of a file.
 	//! @param filepath the path to the file to read
@@ -179,8 +305,9 @@ public:
 	//! @param maxBytes the maximum number of bytes to read
 	//! @param nullTerminate whether or not to add a NULL to the end of the buffer so it can be directly used as a C-string.
 	//! @param alloc the allocator to use. If NULL will use the context's allocator.
+	//! @param flags access hints, a combination of LFS_READ_SEQUENTIAL, LFS_READ_RANDOM, LFS_READ_WILLNEED and LFS_READ_DONTNEED
 	//! @return a WorkItem representing the work to be done
-	WorkItem *readFileSegment(const char *filepath, uint64_t offset, uint64_t maxBytes, bool nullTerminate, Allocator *alloc = nullptr);
+	WorkItem *readFileSegment(const char *filepath, uint64_t offset, uint64_t maxBytes, bool nullTerminate, Allocator *alloc = nullptr, uint32_t flags = LFS_READ_DEFAULT);
 
 	//! Reads a portion of a file.
 	//! @param filepath the path to the file to read
@@ -191,7 +318,88 @@ public:
 	//! @param bufferAction what to do with the buffer after the callback completes execution
 	//! @param callbackUserData optional user data pointer for callback
 	//! @param alloc the allocator to use. If NULL will use the context's allocator.
-	void readFileSegmentWithCallback(const char *filepath, uint64_t offset, uint64_t maxBytes, bool nullTerminate, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData = nullptr, Allocator *alloc = nullptr);
+	//! @param flags access hints, a combination of LFS_READ_SEQUENTIAL, LFS_READ_RANDOM, LFS_READ_WILLNEED and LFS_READ_DONTNEED
+	void readFileSegmentWithCallback(const char *filepath, uint64_t offset, uint64_t maxBytes, bool nullTerminate, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData = nullptr, Allocator *alloc = nullptr, uint32_t flags = LFS_READ_DEFAULT);
+
+	//! Reads the entirety of a file into a shared buffer. The buffer must be released with
+	//! WorkItemFreeBuffer() or obtained with WorkItemAcquireSharedBuffer(), never freed directly.
+	//! When served by the block cache, the result may be a view of cached memory rather than a copy.
+	//! Mapped reads bypass the block cache and leave the file mapped while the buffer is alive.
+	//! @param filepath the path to the file to read
+	//! @param alloc the allocator to use if a new buffer is needed. If NULL will use the context's allocator.
+	//! @param flags LFS_READ_MAPPED to map the file instead of copying it, combined with any access hints
+	//! @return a WorkItem representing the work to be done
+	WorkItem *readFileShared(const char *filepath, Allocator *alloc = nullptr, uint32_t flags = LFS_READ_DEFAULT);
+
+	//! Reads a portion of a file into a shared buffer. The buffer must be released with
+	//! WorkItemFreeBuffer() or obtained with WorkItemAcquireSharedBuffer(), never freed directly.
+	//! When served by the block cache, the result may be a view of cached memory rather than a copy.
+	//! Mapped reads bypass the block cache and leave the file mapped while the buffer is alive.
+	//! @param filepath the path to the file to read
+	//! @param offset the offset to start reading from
+	//! @param maxBytes the maximum number of bytes to read
+	//! @param alloc the allocator to use if a new buffer is needed. If NULL will use the context's allocator.
+	//! @param flags LFS_READ_MAPPED to map the file instead of copying it, combined with any access hints
+	//! @return a WorkItem representing the work to be done
+	WorkItem *readFileSegmentShared(const char *filepath, uint64_t offset, uint64_t maxBytes, Allocator *alloc = nullptr, uint32_t flags = LFS_READ_DEFAULT);
+
+	//! Reads a portion of a file into a shared buffer.
+	//! @param filepath the path to the file to read
+	//! @param offset the offset to start reading from
+	//! @param maxBytes the maximum number of bytes to read
+	//! @param callback callback, which can acquire a reference to the buffer with WorkItemAcquireSharedBuffer()
+	//! @param callbackUserData optional user data pointer for callback
+	//! @param alloc the allocator to use if a new buffer is needed. If NULL will use the context's allocator.
+	//! @param flags LFS_READ_MAPPED to map the file instead of copying it, combined with any access hints
+	void readFileSegmentSharedWithCallback(const char *filepath, uint64_t offset, uint64_t maxBytes, WorkItemCallback callback, void *callbackUserData = nullptr, Allocator *alloc = nullptr, uint32_t flags = LFS_READ_DEFAULT);
+
+	//! Warms up a set of files so that later reads complete faster, without producing
+	//! any result buffers. If a block cache is attached, the files are read into it.
+	//! Otherwise the devices are asked to start reading ahead (e.g. posix_fadvise()).
+	//! Background priority prefetches are only worked on while no other work is queued,
+	//! one file at a time. The number of files found is available through WorkItemGetBytes().
+	//! @param paths the paths of the files to prefetch
+	//! @param count the number of paths
+	//! @param priority the priority of the prefetch
+	//! @return a WorkItem representing the work to be done
+	WorkItem *prefetch(const char **paths, uint32_t count, Priority priority = LFS_PRIORITY_BACKGROUND);
+
+	//! Warms up a set of files so that later reads complete faster.
+	//! @param paths the paths of the files to prefetch
+	//! @param count the number of paths
+	//! @param priority the priority of the prefetch
+	//! @param callback callback
+	//! @param callbackUserData optional user data pointer for callback
+	void prefetchWithCallback(const char **paths, uint32_t count, Priority priority, WorkItemCallback callback, void *callbackUserData = nullptr);
+
+	//! Starts recording every successful read into an access trace, discarding any
+	//! previous recording. The trace can be saved and replayed with replayAccessTrace()
+	//! on a later run to warm up the same files in the same order.
+	//! @param maxEntries the maximum number of reads to record
+	void beginAccessTrace(uint32_t maxEntries = 65536);
+
+	//! Stops recording and returns the access trace.
+	//! @param buffer output buffer containing the trace, nullptr if nothing was recorded
+	//! @param alloc the allocator to allocate the buffer with. If NULL will use the context's allocator.
+	//! @return the size of the trace in bytes
+	uint64_t endAccessTrace(void **buffer, Allocator *alloc = nullptr);
+
+	//! Prefetches the reads recorded in an access trace, in the order they happened.
+	//! The trace buffer doesn't need to outlive this call. A malformed trace results
+	//! in LFS_GENERIC_ERROR. The number of files found is available through WorkItemGetBytes().
+	//! @param trace the trace
+	//! @param traceBytes the size of the trace
+	//! @param priority the priority of the prefetch
+	//! @return a WorkItem representing the work to be done
+	WorkItem *replayAccessTrace(const void *trace, uint64_t traceBytes, Priority priority = LFS_PRIORITY_BACKGROUND);
+
+	//! Prefetches the reads recorded in an access trace, in the order they happened.
+	//! @param trace the trace
+	//! @param traceBytes the size of the trace
+	//! @param priority the priority of the prefetch
+	//! @param callback callback
+	//! @param callbackUserData optional user data pointer for callback
+	void replayAccessTraceWithCallback(const void *trace, uint64_t traceBytes, Priority priority, WorkItemCallback callback, void *callbackUserData = nullptr);
 
 	//! Writes a buffer to a file.
 	//! @param filepath the path to the file to write
@@ -265,6 +473,169 @@ public:
 	//! @param callbackUserData optional user data pointer for callback
 	void fileSizeWithCallback(const char *filepath, WorkItemCallback callback, void *callbackUserData = nullptr);
 
+	//! The default size of each of the two readahead buffers of a file handle.
+	static constexpr uint64_t kDefaultStreamBufferBytes = 256 * 1024;
+
+	//! Opens a file for streaming. The mount is resolved once and the file is kept open on
+	//! the device, so later reads and writes through the handle skip both. Reads are
+	//! sequential and double-buffered: while one buffer is being consumed, the next part of
+	//! the file is read into the other one whenever the context has nothing else to do.
+	//! The size of a file opened for reading is taken when it's opened. Once the work item
+	//! completes, the handle is available through WorkItemGetFileHandle() and the size of
+	//! the file through WorkItemGetBytes(). Reads through a handle don't use the block
+	//! cache. Handles must be closed with closeFileHandle()
+	//! before the context is destroyed; a mount released while handles are open on it
+	//! stays alive until they are closed.
+	//! @param filepath the path to the file to open
+	//! @param mode LFS_OPEN_READ, or LFS_OPEN_WRITE or LFS_OPEN_APPEND to write to the file
+	//! @param bufferBytes the size of each readahead buffer, 0 reads straight from the device
+	//! @param flags access hints for everything done through the handle. LFS_READ_DONTNEED
+	//! is given when the handle is closed, so streamed data doesn't linger in the OS cache.
+	//! @return a WorkItem representing the work to be done
+	WorkItem *openFile(const char *filepath, lfs_open_mode_t mode = LFS_OPEN_READ, uint64_t bufferBytes = kDefaultStreamBufferBytes, uint32_t flags = LFS_READ_DEFAULT);
+
+	//! Opens a file for streaming.
+	//! @param filepath the path to the file to open
+	//! @param mode LFS_OPEN_READ, or LFS_OPEN_WRITE or LFS_OPEN_APPEND to write to the file
+	//! @param bufferBytes the size of each readahead buffer, 0 reads straight from the device
+	//! @param callback callback, which gets the handle with WorkItemGetFileHandle()
+	//! @param callbackUserData optional user data pointer for callback
+	//! @param flags access hints for everything done through the handle
+	void openFileWithCallback(const char *filepath, lfs_open_mode_t mode, uint64_t bufferBytes, WorkItemCallback callback, void *callbackUserData = nullptr, uint32_t flags = LFS_READ_DEFAULT);
+
+	//! Reads the next part of a file opened with LFS_OPEN_READ. Reads through the same
+	//! handle are processed in the order they're issued. Reading at the end of the file
+	//! succeeds with no buffer and 0 bytes.
+	//! @param file the file handle
+	//! @param maxBytes the maximum number of bytes to read
+	//! @param alloc the allocator to use. If NULL will use the context's allocator.
+	//! @return a WorkItem representing the work to be done
+	WorkItem *readFileHandle(FileHandle file, uint64_t maxBytes, Allocator *alloc = nullptr);
+
+	//! Reads the next part of a file opened with LFS_OPEN_READ.
+	//! @param file the file handle
+	//! @param maxBytes the maximum number of bytes to read
+	//! @param callback callback
+	//! @param bufferAction what to do with the buffer after the callback completes execution
+	//! @param callbackUserData optional user data pointer for callback
+	//! @param alloc the allocator to use. If NULL will use the context's allocator.
+	void readFileHandleWithCallback(FileHandle file, uint64_t maxBytes, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData = nullptr, Allocator *alloc = nullptr);
+
+	//! Writes a buffer after the data previously written through a handle opened with
+	//! LFS_OPEN_WRITE or LFS_OPEN_APPEND.
+	//! @param file the file handle
+	//! @param buffer the buffer to write
+	//! @param bufferBytes the number of bytes to write
+	//! @return a WorkItem representing the work to be done
+	WorkItem *writeFileHandle(FileHandle file, const void *buffer, uint64_t bufferBytes);
+
+	//! Writes a buffer after the data previously written through a handle.
+	//! @param file the file handle
+	//! @param buffer the buffer to write
+	//! @param bufferBytes the number of bytes to write
+	//! @param callback callback
+	//! @param bufferAction what to do with the buffer after the callback completes execution
+	//! @param callbackUserData optional user data pointer for callback
+	void writeFileHandleWithCallback(FileHandle file, const void *buffer, uint64_t bufferBytes, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData = nullptr);
+
+	//! Closes a file handle once the work issued on it before has been processed.
+	//! The handle must not be used after this is called.
+	//! @param file the file handle
+	//! @return a WorkItem representing the work to be done
+	WorkItem *closeFileHandle(FileHandle file);
+
+	//! Closes a file handle.
+	//! @param file the file handle
+	//! @param callback callback
+	//! @param callbackUserData optional user data pointer for callback
+	void closeFileHandleWithCallback(FileHandle file, WorkItemCallback callback, void *callbackUserData = nullptr);
+
+	//! Interns a path, so that it only has to be normalized, hashed and resolved once.
+	//! Equivalent paths return the same handle. Handles stay valid for the lifetime of
+	//! the context and can be passed to the read, write, exists and size functions in
+	//! place of a path string. Use LFS_PATH() for string literals instead.
+	//! @param path the path to intern
+	//! @return the path handle
+	PathHandle internPath(const char *path);
+
+	//! Gets the normalized path of a path handle.
+	//! @param path the path handle
+	//! @return the normalized path
+	static const char *getPathString(PathHandle path);
+
+	//! Gets the hash of a path handle's normalized path.
+	//! @param path the path handle
+	//! @return the hash
+	static uint64_t getPathHash(PathHandle path);
+
+	//! Reads the entirety of a file. See readFile(const char *, bool, Allocator *).
+	//! @param path a path handle from internPath()
+	WorkItem *readFile(PathHandle path, bool nullTerminate, Allocator *alloc = nullptr, uint32_t flags = LFS_READ_DEFAULT);
+
+	//! Reads the entirety of a file. See readFileWithCallback(const char *, bool, WorkItemCallback, CallbackBufferAction, void *, Allocator *).
+	//! @param path a path handle from internPath()
+	void readFileWithCallback(PathHandle path, bool nullTerminate, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData = nullptr, Allocator *alloc = nullptr, uint32_t flags = LFS_READ_DEFAULT);
+
+	//! Reads a portion of a file. See readFileSegment(const char *, uint64_t, uint64_t, bool, Allocator *).
+	//! @param path a path handle from internPath()
+	WorkItem *readFileSegment(PathHandle path, uint64_t offset, uint64_t maxBytes, bool nullTerminate, Allocator *alloc = nullptr, uint32_t flags = LFS_READ_DEFAULT);
+
+	//! Reads a portion of a file. See readFileSegmentWithCallback(const char *, uint64_t, uint64_t, bool, WorkItemCallback, CallbackBufferAction, void *, Allocator *).
+	//! @param path a path handle from internPath()
+	void readFileSegmentWithCallback(PathHandle path, uint64_t offset, uint64_t maxBytes, bool nullTerminate, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData = nullptr, Allocator *alloc = nullptr, uint32_t flags = LFS_READ_DEFAULT);
+
+	//! Reads the entirety of a file into a shared buffer. See readFileShared(const char *, Allocator *, uint32_t).
+	//! @param path a path handle from internPath()
+	WorkItem *readFileShared(PathHandle path, Allocator *alloc = nullptr, uint32_t flags = LFS_READ_DEFAULT);
+
+	//! Reads a portion of a file into a shared buffer. See readFileSegmentShared(const char *, uint64_t, uint64_t, Allocator *, uint32_t).
+	//! @param path a path handle from internPath()
+	WorkItem *readFileSegmentShared(PathHandle path, uint64_t offset, uint64_t maxBytes, Allocator *alloc = nullptr, uint32_t flags = LFS_READ_DEFAULT);
+
+	//! Reads a portion of a file into a shared buffer. See readFileSegmentSharedWithCallback(const char *, uint64_t, uint64_t, WorkItemCallback, void *, Allocator *, uint32_t).
+	//! @param path a path handle from internPath()
+	void readFileSegmentSharedWithCallback(PathHandle path, uint64_t offset, uint64_t maxBytes, WorkItemCallback callback, void *callbackUserData = nullptr, Allocator *alloc = nullptr, uint32_t flags = LFS_READ_DEFAULT);
+
+	//! Writes a buffer to a file. See writeFile(const char *, const void *, uint64_t).
+	//! @param path a path handle from internPath()
+	WorkItem *writeFile(PathHandle path, const void *buffer, uint64_t bufferBytes);
+
+	//! Writes a buffer to a file. See writeFileWithCallback(const char *, const void *, uint64_t, WorkItemCallback, CallbackBufferAction, void *).
+	//! @param path a path handle from internPath()
+	void writeFileWithCallback(PathHandle path, const void *buffer, uint64_t bufferBytes, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData = nullptr);
+
+	//! Writes a buffer to a portion of a file. See writeFileSegment(const char *, uint64_t, const void *, uint64_t).
+	//! @param path a path handle from internPath()
+	WorkItem *writeFileSegment(PathHandle path, uint64_t offset, const void *buffer, uint64_t bufferBytes);
+
+	//! Writes a buffer to a portion of a file. See writeFileSegmentWithCallback(const char *, uint64_t, const void *, uint64_t, WorkItemCallback, CallbackBufferAction, void *).
+	//! @param path a path handle from internPath()
+	void writeFileSegmentWithCallback(PathHandle path, uint64_t offset, const void *buffer, uint64_t bufferBytes, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData = nullptr);
+
+	//! Appends a buffer to a file. See appendFile(const char *, const void *, uint64_t).
+	//! @param path a path handle from internPath()
+	WorkItem *appendFile(PathHandle path, const void *buffer, uint64_t bufferBytes);
+
+	//! Appends a buffer to a file. See appendFileWithCallback(const char *, const void *, uint64_t, WorkItemCallback, CallbackBufferAction, void *).
+	//! @param path a path handle from internPath()
+	void appendFileWithCallback(PathHandle path, const void *buffer, uint64_t bufferBytes, WorkItemCallback callback, CallbackBufferAction bufferAction, void *callbackUserData = nullptr);
+
+	//! Checks if a file exists. See fileExists(const char *).
+	//! @param path a path handle from internPath()
+	WorkItem *fileExists(PathHandle path);
+
+	//! Checks if a file exists. See fileExistsWithCallback(const char *, WorkItemCallback, void *).
+	//! @param path a path handle from internPath()
+	void fileExistsWithCallback(PathHandle path, WorkItemCallback callback, void *callbackUserData = nullptr);
+
+	//! Gets the size of a file. See fileSize(const char *).
+	//! @param path a path handle from internPath()
+	WorkItem *fileSize(PathHandle path);
+
+	//! Gets the size of a file. See fileSizeWithCallback(const char *, WorkItemCallback, void *).
+	//! @param path a path handle from internPath()
+	void fileSizeWithCallback(PathHandle path, WorkItemCallback callback, void *callbackUserData = nullptr);
+
 	//! Deletes a file.
 	//! @param filepath the path to the file to delete
 	//! @return a WorkItem representing the work to be done
@@ -302,6 +673,57 @@ public:
 	//! @param workItem the WorkItem to release.
 	void releaseWorkItem(WorkItem *workItem);
 
+	//! Configures the metadata cache used by fileExists() and fileSize().
+	//! Cache hits complete immediately on the calling thread without being queued.
+	//! Entries are invalidated by writes, deletes, and directory operations made
+	//! through this context, as well as by mount changes. Changes made outside of
+	//! the context are only picked up after an entry's TTL expires.
+	//! @param milliseconds the time-to-live of a cache entry; 0 disables the cache
+	//! @param maxEntries the maximum number of entries to cache
+	void setMetadataCacheTTL(uint32_t milliseconds, uint32_t maxEntries = 4096) { _metadataCache.configure(milliseconds, maxEntries); }
+
+	//! Gets the metadata cache hit/miss statistics.
+	//! @return the statistics
+	MetadataCacheStats getMetadataCacheStats() { return _metadataCache.getStats(); }
+
+	//! Removes all entries from the metadata cache.
+	void clearMetadataCache() { _metadataCache.clear(); }
+
+	//! Saves the path filter of a mount created with LFS_MOUNT_PATH_FILTER to
+	//! LFS_PATH_FILTER_FILE on its device, so later mounts can load it instead of
+	//! enumerating the device. Writing a new file through a mount that loaded or saved the
+	//! filter deletes it again, but files added by anything else aren't noticed; see
+	//! LFS_MOUNT_PATH_FILTER.
+	//! @param mount the mount
+	//! @return the result code, LFS_UNSUPPORTED if the mount has no filter or can't be written to
+	ErrorCode writePathFilter(Mount mount);
+
+	//! Gets the path filter statistics.
+	//! @return the statistics
+	PathFilterStats getPathFilterStats();
+
+	//! Attaches a block cache to this context. Reads will be served from the cache
+	//! when possible, and will populate it otherwise. The cache may be shared
+	//! between contexts and must outlive this context. This should be called
+	//! before any reads are issued.
+	//! @param cache the cache, or nullptr to detach the current cache
+	void setBlockCache(BlockCache *cache);
+
+	//! Gets the attached block cache.
+	//! @return the cache, or nullptr if there is none
+	BlockCache *getBlockCache() { return _blockCache; }
+
+	//! The default size of the chunks parallel reads are split into.
+	static constexpr uint64_t kDefaultReadChunkBytes = 8 * 1024 * 1024;
+
+	//! Splits reads of at least two chunks into chunks that are read at the same time, straight
+	//! into the output buffer. This only applies to devices with handles, and the work item
+	//! completes once every chunk is in. Reads already in flight finish with the previous
+	//! setting, and this waits for a parallel read that's underway to finish.
+	//! @param threads the number of threads reading alongside the processing thread, 0 to turn parallel reads off
+	//! @param chunkBytes the size of the chunks
+	void setParallelReads(uint32_t threads, uint64_t chunkBytes = kDefaultReadChunkBytes);
+
 	//! Sets the log function.
 	//! @param func the logging function
 	void setLogFunc(LogFunc func) { _log = func; }
@@ -327,7 +749,31 @@ public:
 	static void normalizePath(char *path);
 
 	//! The type index of the Directory device. It will always be the first interface.
+	//! It keeps recently read files open, so a file deleted or replaced outside of the
+	//! mount, by another context or process, can be read stale until it's evicted or
+	//! written, deleted or unmounted through the mount.
 	static const uint32_t kDirectoryDeviceIndex = 0;
+
+	//! The type index of the Pack device. It follows the Directory device unless that is disabled.
+#if defined(LAMINAFS_DISABLE_DIRECTORY_DEVICE)
+	static const uint32_t kPackDeviceIndex = 0;
+#else
+	static const uint32_t kPackDeviceIndex = 1;
+#endif
+
+	//! The type index of the Zip device. It follows the Pack device unless that is disabled.
+#if defined(LAMINAFS_DISABLE_PACK_DEVICE)
+	static const uint32_t kZipDeviceIndex = kPackDeviceIndex;
+#else
+	static const uint32_t kZipDeviceIndex = kPackDeviceIndex + 1;
+#endif
+
+	//! The type index of the RAM device. It follows the Zip device unless that is disabled.
+#if defined(LAMINAFS_DISABLE_ZIP_DEVICE)
+	static const uint32_t kRamDeviceIndex = kZipDeviceIndex;
+#else
+	static const uint32_t kRamDeviceIndex = kZipDeviceIndex + 1;
+#endif
 private:
 	struct MountInfo {
 		char *_prefix;
@@ -335,26 +781,175 @@ private:
 		DeviceInterface *_interface;
 		uint32_t _prefixLen;
 		uint32_t _permissions;
+
+		// the actual case of every file on the device, only for case-insensitive mounts
+		util::CaseFoldedIndex *_caseIndex = nullptr;
+
+		// the device paths that may exist, only for mounts with a path filter
+		util::BloomFilter *_pathFilter = nullptr;
+
+		// whether LFS_PATH_FILTER_FILE on the device is known to match _pathFilter, once the
+		// filter gains a path it's deleted so later mounts enumerate the device again
+		std::atomic<bool> _pathFilterSaved{false};
+
+		// open file handles and pending device requests keep a released mount alive until
+		// the last one is done, both guarded by _mountUserLock
+		uint32_t _users = 0;
+		bool _released = false;
+	};
+
+	// a file handle from openFile(), only used on the processing thread
+	struct OpenFile;
+
+	// a parallel read pool and its chunk size, see _readWorkers
+	struct ReadWorkers;
+
+	// Immutable snapshot of the mounts. Changes to the mounts publish a new table and
+	// free the old one once no reader can still be using it.
+	struct MountTable {
+		MountInfo **_mounts;
+		uint32_t _count;
+		uint64_t _generation;
+
+		MountInfo **begin() const { return _mounts; }
+		MountInfo **end() const { return _mounts + _count; }
+		std::reverse_iterator<MountInfo**> rbegin() const { return std::reverse_iterator<MountInfo**>(end()); }
+		std::reverse_iterator<MountInfo**> rend() const { return std::reverse_iterator<MountInfo**>(begin()); }
+	};
+
+	// Keeps the current mount table alive for as long as it's in scope.
+	class MountTableReader {
+	public:
+		MountTableReader(FileContext *ctx);
+		~MountTableReader();
+
+		const MountTable *get() const { return _table; }
+
+		// Stops using the table early, it must not be accessed afterwards.
+		void release();
+
+	private:
+		std::atomic<uint32_t> *_readers;
+		const MountTable *_table;
 	};
 
-	MountInfo* findNextMountAndPath(const char *path, const char **devicePath, const MountInfo* searchStart);
-	MountInfo* findMutableMountAndPath(const char *path, const char **devicePath, uint32_t op);
+	MountTable *allocMountTable(uint32_t count);
+	void publishMountTable(MountTable *table);
+	void destroyMount(MountInfo *mount);
+
+	static constexpr uint64_t kResolvedMountMask = 0xFFFF;
+	static constexpr uint32_t kResolvedNoMount = 0xFFFF;
+
+	MountInfo* findFirstMountAndPath(const MountTable *mounts, const WorkItem *workItem, const char **devicePath);
+	MountInfo* findNextMountAndPath(const MountTable *mounts, const char *path, const char **devicePath, const MountInfo* searchStart, bool checkPathFilters = true);
+	MountInfo* findMutableMountAndPath(const MountTable *mounts, const char *path, const char **devicePath, uint32_t op);
+	static bool matchesMount(const MountInfo *mount, const char *path, uint32_t pathLen);
+	static const char *resolveDevicePath(const MountInfo *mount, const char *devicePath);
+	bool pathFilterMayContain(const MountInfo *mount, uint64_t devicePathHash);
+	void notePathFilterMiss(const MountInfo *mount);
+	ErrorCode initMountLookup(MountInfo *mount, uint32_t flags);
+	void freeMountLookup(MountInfo *mount);
+	void invalidateCaseVariants(const MountInfo *mount);
 
 	WorkItem *allocWorkItemCommon(const char *path, uint32_t op, WorkItemCallback callback, void *callbackUserData, CallbackBufferAction bufferAction);
-	void initWorkItem(WorkItem *item, const char *path, uint32_t op, WorkItemCallback callback, void *callbackUserData, CallbackBufferAction bufferAction);
+	WorkItem *allocWorkItemCommon(PathHandle path, uint32_t op, WorkItemCallback callback, void *callbackUserData, CallbackBufferAction bufferAction);
+	WorkItem *allocWorkItemInternal(const char *path, PathHandle handle, uint32_t op, WorkItemCallback callback, void *callbackUserData, CallbackBufferAction bufferAction);
+	void initWorkItem(WorkItem *item, const char *path, PathHandle handle, uint32_t op, WorkItemCallback callback, void *callbackUserData, CallbackBufferAction bufferAction);
+	WorkItem *submitRead(WorkItem *item, uint64_t offset, uint64_t maxBytes, bool nullTerminate, bool shared, Allocator *alloc, uint32_t flags = LFS_READ_DEFAULT);
+	WorkItem *submitWrite(WorkItem *item, uint64_t offset, const void *buffer, uint64_t bufferBytes);
+	WorkItem *submitQuery(WorkItem *item);
 	void releaseWorkItemInternal(WorkItem *workItem);
+	void completeWorkItem(WorkItem *workItem);
+
+	bool completeFromMetadataCache(WorkItem *workItem);
+	void updateCaches(WorkItem *workItem, bool processed);
+	// lets the metadata cache answer for paths again once a change to them completes
+	void finishCacheChanges(WorkItem *workItem);
+	bool resolveCachedFile(BlockCache *cache, MountInfo *mount, const char *devicePath, uint64_t pathHash, uint64_t &fileSize, ErrorCode &result);
+	// reads through the device's _mapFile, returns false if the regular read path should handle the mount
+	bool mapFile(MountInfo *mount, const char *devicePath, uint64_t maxBytes, WorkItem *workItem);
+	bool readFromBlockCache(const MountTable *mounts, WorkItem *workItem);
+	// returns false if the file no longer matches what's cached, after forgetting about it
+	bool readCachedBlocks(BlockCache *cache, MountInfo *mount, const char *devicePath, uint64_t pathHash, uint64_t fileSize, uint64_t offset, uint64_t bytes, WorkItem *workItem);
+
+	// reads in chunks on the read workers, returns false if the read should go to the device as a whole
+	bool readParallel(MountInfo *mount, const char *devicePath, uint64_t maxBytes, WorkItem *workItem);
+	bool readParallel(MountInfo *mount, const char *devicePath, uint64_t maxBytes, WorkItem *workItem, ReadWorkers &workers);
+
+	// passes the work item's access hints among the given ones on to the device
+	void adviseRead(MountInfo *mount, const char *devicePath, uint64_t maxBytes, WorkItem *workItem, uint32_t hints);
+	void adviseOpenFile(OpenFile *file, uint32_t hints);
+
+	static constexpr size_t kPrefetchEntryHeaderBytes = sizeof(uint64_t) * 2;
+
+	WorkItem *allocPrefetchWorkItem(const char **paths, uint32_t count, WorkItemCallback callback, void *callbackUserData);
+	WorkItem *allocReplayWorkItem(const void *trace, uint64_t traceBytes, WorkItemCallback callback, void *callbackUserData);
+	WorkItem *allocPrefetchWorkItemCommon(size_t packedBytes, WorkItemCallback callback, void *callbackUserData);
+	void packPrefetchEntry(char *&cursor, const char *path, size_t pathLen, uint64_t offset, uint64_t bytes);
+	void queuePrefetch(WorkItem *workItem, Priority priority);
+	bool prefetchFile(const MountTable *mounts, const char *path, uint64_t offset, uint64_t bytes);
+	bool processPrefetch(const MountTable *mounts, WorkItem *workItem, bool singleStep);
+
+	WorkItem *allocFileHandleWorkItem(OpenFile *file, uint32_t op, WorkItemCallback callback, void *callbackUserData, CallbackBufferAction bufferAction);
+	void openFileInternal(const MountTable *mounts, WorkItem *workItem);
+	void readFileHandleInternal(WorkItem *workItem);
+	void writeFileHandleInternal(WorkItem *workItem);
+	void closeFileHandleInternal(OpenFile *file);
+	uint64_t readStream(OpenFile *file, uint64_t offset, uint64_t bytes, uint8_t *buffer, ErrorCode &result);
+	uint64_t readStreamDevice(OpenFile *file, uint64_t offset, uint64_t bytes, void *buffer, ErrorCode &result);
+	uint64_t readStreamDeviceV(OpenFile *file, uint64_t offset, const lfs_io_vec_t *vecs, uint32_t count, ErrorCode &result);
+	uint64_t fillStreamBuffer(OpenFile *file, uint32_t index, uint64_t offset, ErrorCode &result);
+	void queueReadahead(OpenFile *file);
+	void processReadahead();
+
+	void acquireMountUser(MountInfo *mount);
+	void releaseMountUser(MountInfo *mount);
+	void noteFileWritten(MountInfo *mount, const char *devicePath);
+
+	void beginDeviceRequest(WorkItem *workItem, MountInfo *mount);
+	void finishDeviceRequests(WorkItem *completed);
 
 	void startProcessingThread();
 	void stopProcessingThread();
 	static void processingFunc(FileContext *ctx);
 
 	std::vector<DeviceInterface*, AllocatorAdapter<DeviceInterface*>> _interfaces;
-	std::vector<MountInfo*, AllocatorAdapter<MountInfo*>> _mounts;
-	std::shared_mutex _mountLock;
+	std::atomic<MountTable*> _mounts;
+	std::atomic<uint32_t> _mountReaders[2];
+	std::atomic<uint64_t> _mountEpoch;
+	std::mutex _mountWriteLock;
+
+	std::unordered_map<uint64_t, lfs_path_t*, std::hash<uint64_t>, std::equal_to<uint64_t>, AllocatorAdapter<std::pair<const uint64_t, lfs_path_t*>>> _paths;
+	std::mutex _pathLock;
+
+	util::MetadataCache _metadataCache;
+
+	std::atomic<uint64_t> _pathFilterQueries{0};
+	std::atomic<uint64_t> _pathFilterRejected{0};
+	std::atomic<uint64_t> _pathFilterFalsePositives{0};
+	util::AccessTrace _accessTrace;
+	std::atomic<BlockCache*> _blockCache;
+
+	// the pool and chunk size for parallel reads, replaced as a whole by setParallelReads(),
+	// which waits for readParallel() to stop using the one it replaced
+	std::atomic<ReadWorkers*> _readWorkers{nullptr};
+	std::atomic<ReadWorkers*> _readWorkersInUse{nullptr};
 
 	util::PoolAllocator<WorkItem> _workItemPool;
 	util::Semaphore _workItemQueueSemaphore;
 	util::RingBuffer<WorkItem*> _workItemQueue;
+	util::RingBuffer<WorkItem*> _backgroundQueue;
+	WorkItem *_currentBackgroundItem = nullptr;
+
+	// file handles waiting for their next buffer to be read
+	OpenFile *_readaheadHead = nullptr;
+	OpenFile *_readaheadTail = nullptr;
+	std::mutex _mountUserLock;
+
+	// requests the devices have finished, pushed from any thread and taken all at once by
+	// the processing thread, which is the only one to touch the pending count
+	std::atomic<WorkItem*> _deviceCompletions{nullptr};
+	uint32_t _pendingDeviceRequests = 0;
 
 	std::thread _processingThread;
 
@@ -0,0 +1,96 @@
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#include "SharedBuffer.h"
+
+#include <atomic>
+#include <new>
+
+using namespace laminaFS;
+
+struct lfs_shared_buffer_t {
+	std::atomic<uint32_t> _refCount;
+	void *_data = nullptr;
+	uint64_t _bytes = 0;
+
+	// views reference the memory of their parent instead of owning any
+	lfs_shared_buffer_t *_parent = nullptr;
+
+	lfs_shared_buffer_release_func_t _release = nullptr;
+	void *_releaseUserData = nullptr;
+	lfs_allocator_t _allocator;
+};
+
+namespace {
+SharedBuffer *allocSharedBuffer(lfs_allocator_t &alloc, void *data, uint64_t bytes) {
+	SharedBuffer *buffer = new(alloc.alloc(alloc.allocator, sizeof(SharedBuffer), alignof(SharedBuffer))) SharedBuffer();
+	buffer->_refCount = 1;
+	buffer->_data = data;
+	buffer->_bytes = bytes;
+	buffer->_allocator = alloc;
+	return buffer;
+}
+}
+
+namespace laminaFS {
+
+SharedBuffer *SharedBufferCreate(lfs_allocator_t &alloc, void *data, uint64_t bytes) {
+	return allocSharedBuffer(alloc, data, bytes);
+}
+
+SharedBuffer *SharedBufferCreateWithRelease(lfs_allocator_t &alloc, void *data, uint64_t bytes, SharedBufferReleaseFunc release, void *userData) {
+	SharedBuffer *buffer = allocSharedBuffer(alloc, data, bytes);
+	buffer->_release = release;
+	buffer->_releaseUserData = userData;
+	return buffer;
+}
+
+SharedBuffer *SharedBufferCreateView(SharedBuffer *parent, uint64_t offset, uint64_t bytes) {
+	if (!parent) {
+		return nullptr;
+	}
+
+	// always reference the buffer that owns the memory to keep chains short
+	SharedBuffer *owner = parent->_parent ? parent->_parent : parent;
+	SharedBufferRetain(owner);
+
+	SharedBuffer *view = allocSharedBuffer(owner->_allocator, static_cast<uint8_t*>(parent->_data) + offset, bytes);
+	view->_parent = owner;
+	return view;
+}
+
+void SharedBufferRetain(SharedBuffer *buffer) {
+	if (buffer) {
+		buffer->_refCount.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void SharedBufferRelease(SharedBuffer *buffer) {
+	if (buffer && buffer->_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		if (buffer->_parent) {
+			SharedBufferRelease(buffer->_parent);
+		} else if (buffer->_release) {
+			buffer->_release(buffer->_data, buffer->_bytes, buffer->_releaseUserData);
+		} else if (buffer->_data) {
+			buffer->_allocator.free(buffer->_allocator.allocator, buffer->_data);
+		}
+
+		lfs_allocator_t alloc = buffer->_allocator;
+		buffer->~SharedBuffer();
+		alloc.free(alloc.allocator, buffer);
+	}
+}
+
+const void *SharedBufferGetData(const SharedBuffer *buffer) {
+	return buffer ? buffer->_data : nullptr;
+}
+
+uint64_t SharedBufferGetSize(const SharedBuffer *buffer) {
+	return buffer ? buffer->_bytes : 0;
+}
+
+uint32_t SharedBufferGetRefCount(const SharedBuffer *buffer) {
+	return buffer ? buffer->_refCount.load(std::memory_order_relaxed) : 0;
+}
+
+}
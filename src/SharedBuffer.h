@@ -0,0 +1,62 @@
+#pragma once
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#include <cstdint>
+
+#include "shared_types.h"
+
+namespace laminaFS {
+
+typedef lfs_shared_buffer_t SharedBuffer;
+typedef lfs_shared_buffer_release_func_t SharedBufferReleaseFunc;
+
+//! Creates a reference counted buffer that takes ownership of memory allocated
+//! with the given allocator. The buffer starts with a reference count of one.
+//! @param alloc the allocator the data was allocated with, also used for the buffer itself
+//! @param data the data
+//! @param bytes the size of the data in bytes
+//! @return the buffer
+extern SharedBuffer *SharedBufferCreate(lfs_allocator_t &alloc, void *data, uint64_t bytes);
+
+//! Creates a reference counted buffer whose memory is released by a custom function.
+//! @param alloc the allocator used for the buffer itself
+//! @param data the data
+//! @param bytes the size of the data in bytes
+//! @param release called with data, bytes, and userData when the last reference is released
+//! @param userData user data pointer for the release function
+//! @return the buffer
+extern SharedBuffer *SharedBufferCreateWithRelease(lfs_allocator_t &alloc, void *data, uint64_t bytes, SharedBufferReleaseFunc release, void *userData);
+
+//! Creates a view of part of another buffer. The view holds a reference to the
+//! memory of the original buffer, which stays alive as long as the view does.
+//! @param parent the buffer to create a view of
+//! @param offset the offset of the view into the parent
+//! @param bytes the size of the view in bytes
+//! @return the view, with a reference count of one
+extern SharedBuffer *SharedBufferCreateView(SharedBuffer *parent, uint64_t offset, uint64_t bytes);
+
+//! Adds a reference to a buffer.
+//! @param buffer the buffer, may be nullptr
+extern void SharedBufferRetain(SharedBuffer *buffer);
+
+//! Removes a reference from a buffer, freeing it once no references remain.
+//! @param buffer the buffer, may be nullptr
+extern void SharedBufferRelease(SharedBuffer *buffer);
+
+//! Gets the data of a buffer. Shared data must be treated as read-only.
+//! @param buffer the buffer
+//! @return the data, or nullptr if no buffer
+extern const void *SharedBufferGetData(const SharedBuffer *buffer);
+
+//! Gets the size of a buffer.
+//! @param buffer the buffer
+//! @return the size in bytes, or 0 if no buffer
+extern uint64_t SharedBufferGetSize(const SharedBuffer *buffer);
+
+//! Gets the current reference count of a buffer.
+//! @param buffer the buffer
+//! @return the reference count, or 0 if no buffer
+extern uint32_t SharedBufferGetRefCount(const SharedBuffer *buffer);
+
+}
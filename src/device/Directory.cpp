@@ -7,6 +7,8 @@
 #endif
 
 #include "Directory.h"
+#include "device/MappedFile.h"
+#include "util/Hash.h"
 
 #include <algorithm>
 #include <cstdio>
@@ -26,6 +28,7 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #endif
 
@@ -61,6 +64,78 @@ ErrorCode convertError(DWORD error) {
 	return result;
 }
 
+// the most ReadFile() is asked for at once, it only takes a DWORD
+constexpr uint64_t kMaxReadBytes = 1u << 30;
+
+// reads at an offset until the buffer is full or the file ends
+size_t readAt(HANDLE file, void *buffer, uint64_t bytes, uint64_t offset, ErrorCode *outError) {
+	uint8_t *out = static_cast<uint8_t*>(buffer);
+	uint64_t bytesRead = 0;
+	*outError = LFS_OK;
+
+	while (bytesRead < bytes) {
+		OVERLAPPED position = {};
+		position.Offset = static_cast<DWORD>(offset + bytesRead);
+		position.OffsetHigh = static_cast<DWORD>((offset + bytesRead) >> 32);
+
+		DWORD chunkRead = 0;
+		if (!ReadFile(file, out + bytesRead, static_cast<DWORD>(std::min(bytes - bytesRead, kMaxReadBytes)), &chunkRead, &position)) {
+			if (GetLastError() != ERROR_HANDLE_EOF) {
+				*outError = convertError(GetLastError());
+			}
+			break;
+		}
+
+		if (chunkRead == 0) {
+			break;
+		}
+		bytesRead += chunkRead;
+	}
+
+	return static_cast<size_t>(bytesRead);
+}
+
+// walks a directory tree, both buffers hold the directory being walked and are restored on return
+void enumerateDirectory(WCHAR *windowsPath, size_t windowsLen, char *relativePath, size_t relativeLen, lfs_enumerate_callback_t callback, void *userData) {
+	if (windowsLen + 2 >= MAX_PATH_LEN)
+		return;
+
+	wcscpy(windowsPath + windowsLen, L"\\*");
+
+	WIN32_FIND_DATAW findData;
+	HANDLE find = FindFirstFileW(windowsPath, &findData);
+	if (find == INVALID_HANDLE_VALUE) {
+		windowsPath[windowsLen] = 0;
+		return;
+	}
+
+	do {
+		if (wcscmp(findData.cFileName, L".") == 0 || wcscmp(findData.cFileName, L"..") == 0)
+			continue;
+
+		size_t nameLen = wcslen(findData.cFileName);
+		char name[MAX_PATH_LEN];
+		int nameBytes = WideCharToMultiByte(CP_UTF8, 0, findData.cFileName, -1, name, MAX_PATH_LEN, nullptr, nullptr);
+		if (nameBytes == 0 || windowsLen + 1 + nameLen >= MAX_PATH_LEN || relativeLen + nameBytes >= MAX_PATH_LEN)
+			continue;
+
+		windowsPath[windowsLen] = L'\\';
+		wcscpy(windowsPath + windowsLen + 1, findData.cFileName);
+		relativePath[relativeLen] = '/';
+		strcpy(relativePath + relativeLen + 1, name);
+
+		if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+			enumerateDirectory(windowsPath, windowsLen + 1 + nameLen, relativePath, relativeLen + nameBytes, callback, userData);
+		} else {
+			callback(relativePath, userData);
+		}
+	} while (FindNextFileW(find, &findData));
+
+	FindClose(find);
+	windowsPath[windowsLen] = 0;
+	relativePath[relativeLen] = 0;
+}
+
 #else
 ErrorCode convertError(int error) {
 	ErrorCode result = LFS_GENERIC_ERROR;
@@ -86,10 +161,312 @@ ErrorCode convertError(int error) {
 
 	return result;
 }
+
+// reads at an offset until the buffer is full or the file ends, pread() can stop short
+size_t readAt(int file, void *buffer, uint64_t bytes, uint64_t offset, ErrorCode *outError) {
+	uint8_t *out = static_cast<uint8_t*>(buffer);
+	uint64_t bytesRead = 0;
+	*outError = LFS_OK;
+
+	while (bytesRead < bytes) {
+		ssize_t chunkRead = pread(file, out + bytesRead, bytes - bytesRead, static_cast<off_t>(offset + bytesRead));
+		if (chunkRead == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			*outError = convertError(errno);
+			break;
+		}
+
+		if (chunkRead == 0) {
+			break;
+		}
+		bytesRead += static_cast<uint64_t>(chunkRead);
+	}
+
+	return static_cast<size_t>(bytesRead);
+}
+
+// buffers handed to a single preadv() call
+constexpr uint32_t kMaxReadVecs = 16;
+
+// direct I/O moves whole blocks between aligned offsets and aligned buffers
+constexpr uint64_t kDirectAlignment = LFS_DIRECT_IO_ALIGNMENT;
+
+// the most a direct I/O bounce buffer holds, longer transfers go through it in pieces
+constexpr uint64_t kDirectBounceBytes = 1u << 20;
+
+uint64_t alignDown(uint64_t value) {
+	return value & ~(kDirectAlignment - 1);
+}
+
+uint64_t alignUp(uint64_t value) {
+	return alignDown(value + kDirectAlignment - 1);
+}
+
+bool isAligned(const void *buffer, uint64_t offset) {
+	return ((reinterpret_cast<uintptr_t>(buffer) | offset) & (kDirectAlignment - 1)) == 0;
+}
+
+ssize_t preadRetry(int file, void *buffer, uint64_t bytes, uint64_t offset) {
+	ssize_t result = -1;
+	do {
+		result = pread(file, buffer, bytes, static_cast<off_t>(offset));
+	} while (result == -1 && errno == EINTR);
+	return result;
+}
+
+ssize_t pwriteRetry(int file, const void *buffer, uint64_t bytes, uint64_t offset) {
+	ssize_t result = -1;
+	do {
+		result = pwrite(file, buffer, bytes, static_cast<off_t>(offset));
+	} while (result == -1 && errno == EINTR);
+	return result;
+}
+
+// aligned scratch space for the parts of a direct transfer the caller's buffer can't take,
+// only allocated once it's needed
+class BounceBuffer {
+public:
+	BounceBuffer(Allocator &alloc, uint64_t transferBytes)
+	: _alloc(alloc)
+	, _bytes(std::min(kDirectBounceBytes, alignUp(transferBytes) + kDirectAlignment))
+	{}
+
+	~BounceBuffer() {
+		if (_data) {
+			_alloc.free(_alloc.allocator, _data);
+		}
+	}
+
+	BounceBuffer(const BounceBuffer &) = delete;
+	BounceBuffer &operator=(const BounceBuffer &) = delete;
+
+	uint8_t *data() {
+		if (!_data) {
+			_data = static_cast<uint8_t*>(_alloc.alloc(_alloc.allocator, _bytes, kDirectAlignment));
+		}
+		return _data;
+	}
+
+	uint64_t bytes() const { return _bytes; }
+
+private:
+	Allocator &_alloc;
+	uint8_t *_data = nullptr;
+	uint64_t _bytes;
+};
+
+// readAt() for descriptors opened with O_DIRECT. Aligned stretches of the request are read
+// straight into the buffer, the rest is read in whole blocks and copied out.
+size_t readDirect(int file, void *buffer, uint64_t bytes, uint64_t offset, Allocator &alloc, ErrorCode *outError) {
+	uint8_t *out = static_cast<uint8_t*>(buffer);
+	uint64_t bytesRead = 0;
+	BounceBuffer bounce(alloc, bytes);
+	*outError = LFS_OK;
+
+	while (bytesRead < bytes) {
+		uint64_t position = offset + bytesRead;
+		uint64_t remaining = bytes - bytesRead;
+
+		if (remaining >= kDirectAlignment && isAligned(out + bytesRead, position)) {
+			ssize_t chunkRead = preadRetry(file, out + bytesRead, alignDown(remaining), position);
+			if (chunkRead == -1) {
+				*outError = convertError(errno);
+				break;
+			}
+
+			if (chunkRead == 0) {
+				break;
+			}
+			bytesRead += static_cast<uint64_t>(chunkRead);
+			continue;
+		}
+
+		uint8_t *scratch = bounce.data();
+		if (!scratch) {
+			*outError = LFS_GENERIC_ERROR;
+			break;
+		}
+
+		uint64_t start = alignDown(position);
+		uint64_t skip = position - start;
+		ssize_t chunkRead = preadRetry(file, scratch, std::min(alignUp(skip + remaining), bounce.bytes()), start);
+		if (chunkRead == -1) {
+			*outError = convertError(errno);
+			break;
+		}
+
+		if (static_cast<uint64_t>(chunkRead) <= skip) {
+			break;
+		}
+
+		uint64_t copied = std::min(static_cast<uint64_t>(chunkRead) - skip, remaining);
+		memcpy(out + bytesRead, scratch + skip, copied);
+		bytesRead += copied;
+	}
+
+	return static_cast<size_t>(bytesRead);
+}
+
+// reads one block for a direct write that only covers part of it, zeroes past the end of the file
+bool readBlock(int file, uint8_t *block, uint64_t offset, ErrorCode *outError) {
+	ssize_t blockRead = preadRetry(file, block, kDirectAlignment, offset);
+	if (blockRead == -1) {
+		*outError = convertError(errno);
+		return false;
+	}
+
+	memset(block + blockRead, 0, kDirectAlignment - static_cast<uint64_t>(blockRead));
+	return true;
+}
+
+// pwrite() for descriptors opened with O_DIRECT. Aligned stretches are written straight from
+// the buffer. Blocks it only partly covers are read, patched and written back whole, and
+// the file is cut back afterwards if that left padding past its end.
+size_t writeDirect(int file, const void *buffer, uint64_t bytes, uint64_t offset, Allocator &alloc, ErrorCode *outError) {
+	const uint8_t *in = static_cast<const uint8_t*>(buffer);
+	uint64_t bytesWritten = 0;
+	BounceBuffer bounce(alloc, bytes);
+	*outError = LFS_OK;
+
+	struct stat statInfo;
+	if (fstat(file, &statInfo) != 0) {
+		*outError = convertError(errno);
+		return 0;
+	}
+
+	uint64_t fileSize = static_cast<uint64_t>(statInfo.st_size);
+	uint64_t paddedEnd = 0;
+
+	while (bytesWritten < bytes) {
+		uint64_t position = offset + bytesWritten;
+		uint64_t remaining = bytes - bytesWritten;
+
+		if (remaining >= kDirectAlignment && isAligned(in + bytesWritten, position)) {
+			ssize_t chunkWritten = pwriteRetry(file, in + bytesWritten, alignDown(remaining), position);
+			if (chunkWritten == -1) {
+				*outError = convertError(errno);
+				break;
+			}
+
+			if (chunkWritten == 0) {
+				*outError = LFS_OUT_OF_SPACE;
+				break;
+			}
+
+			bytesWritten += static_cast<uint64_t>(chunkWritten);
+			continue;
+		}
+
+		uint8_t *scratch = bounce.data();
+		if (!scratch) {
+			*outError = LFS_GENERIC_ERROR;
+			break;
+		}
+
+		uint64_t start = alignDown(position);
+		uint64_t skip = position - start;
+		uint64_t length = std::min(alignUp(skip + remaining), bounce.bytes());
+		uint64_t copied = std::min(length - skip, remaining);
+
+		uint64_t lastBlock = length - kDirectAlignment;
+		if ((skip > 0 && !readBlock(file, scratch, start, outError)) ||
+			(((skip + copied) & (kDirectAlignment - 1)) != 0 && (lastBlock > 0 || skip == 0) && !readBlock(file, scratch + lastBlock, start + lastBlock, outError)))
+		{
+			break;
+		}
+
+		memcpy(scratch + skip, in + bytesWritten, copied);
+		ssize_t chunkWritten = pwriteRetry(file, scratch, length, start);
+		if (chunkWritten == -1) {
+			*outError = convertError(errno);
+			break;
+		}
+
+		if (static_cast<uint64_t>(chunkWritten) <= skip) {
+			*outError = LFS_OUT_OF_SPACE;
+			break;
+		}
+
+		bytesWritten += std::min(static_cast<uint64_t>(chunkWritten) - skip, copied);
+		paddedEnd = std::max(paddedEnd, start + static_cast<uint64_t>(chunkWritten));
+	}
+
+	uint64_t end = std::max(fileSize, offset + bytesWritten);
+	if (paddedEnd > end && ftruncate(file, static_cast<off_t>(end)) != 0 && *outError == LFS_OK) {
+		*outError = convertError(errno);
+	}
+
+	return static_cast<size_t>(bytesWritten);
+}
+
+// device paths are relative to the device's directory descriptor
+const char *relativePath(const char *filePath) {
+	while (*filePath == '/') {
+		++filePath;
+	}
+	return *filePath ? filePath : ".";
+}
+
+#ifdef O_PATH
+constexpr int kDirectoryOpenFlags = O_PATH | O_DIRECTORY | O_CLOEXEC;
+#else
+constexpr int kDirectoryOpenFlags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+#endif
+
+// passes read hints for a range of an open file on to the OS, they're best effort so
+// failures aren't interesting to the caller
+void adviseDescriptor(int file, uint64_t offset, uint64_t length, uint32_t flags) {
+#ifdef __APPLE__
+	if (flags & (LFS_READ_SEQUENTIAL | LFS_READ_RANDOM)) {
+		fcntl(file, F_RDAHEAD, (flags & LFS_READ_RANDOM) ? 0 : 1);
+	}
+
+	if (flags & LFS_READ_WILLNEED) {
+		struct radvisory advice;
+		advice.ra_offset = static_cast<off_t>(offset);
+		advice.ra_count = static_cast<int>(std::min<uint64_t>(length, INT32_MAX));
+		fcntl(file, F_RDADVISE, &advice);
+	}
+	// there's nothing to drop cached pages with
+#else
+	off_t start = static_cast<off_t>(offset);
+	off_t bytes = static_cast<off_t>(std::min<uint64_t>(length, INT64_MAX));
+
+	if (flags & LFS_READ_SEQUENTIAL) {
+		posix_fadvise(file, start, bytes, POSIX_FADV_SEQUENTIAL);
+	}
+	if (flags & LFS_READ_RANDOM) {
+		posix_fadvise(file, start, bytes, POSIX_FADV_RANDOM);
+	}
+	if (flags & LFS_READ_WILLNEED) {
+		posix_fadvise(file, start, bytes, POSIX_FADV_WILLNEED);
+	}
+	if (flags & LFS_READ_DONTNEED) {
+		posix_fadvise(file, start, bytes, POSIX_FADV_DONTNEED);
+	}
+#endif
+}
+
+int openRetry(int directory, const char *filePath, int openFlags) {
+	// XXX: open() can fail with EINTR, which means we're just going to retry until it works
+	int file = -1;
+	do {
+		file = openat(directory, relativePath(filePath), openFlags, 0644);
+	} while (file == -1 && errno == EINTR);
+
+	return file;
+}
 #endif
 }
 
-DirectoryDevice::DirectoryDevice(Allocator *allocator, const char *path) {
+DirectoryDevice::DirectoryDevice(Allocator *allocator, const char *path)
+#ifndef _WIN32
+: _fileCache(*allocator)
+#endif
+{
 	_alloc = allocator;
 
 	// TODO: realpath()
@@ -99,6 +476,11 @@ DirectoryDevice::DirectoryDevice(Allocator *allocator, const char *path) {
 }
 
 DirectoryDevice::~DirectoryDevice() {
+#ifndef _WIN32
+	if (_directory != -1) {
+		close(_directory);
+	}
+#endif
 	_alloc->free(_alloc->allocator, _devicePath);
 }
 
@@ -116,11 +498,15 @@ ErrorCode DirectoryDevice::create(Allocator *alloc, const char *path, void **dev
 		returnCode = LFS_NOT_FOUND;
 	}
 #else
-	struct stat statInfo;
-	int result = stat(path, &statInfo);
+	int directory = -1;
+	do {
+		directory = open(path, kDirectoryOpenFlags);
+	} while (directory == -1 && errno == EINTR);
 
-	if (result == 0 && S_ISDIR(statInfo.st_mode)) {
-		*device = new(alloc->alloc(alloc->allocator, sizeof(DirectoryDevice), alignof(DirectoryDevice))) DirectoryDevice(alloc, path);
+	if (directory != -1) {
+		DirectoryDevice *dir = new(alloc->alloc(alloc->allocator, sizeof(DirectoryDevice), alignof(DirectoryDevice))) DirectoryDevice(alloc, path);
+		dir->_directory = directory;
+		*device = dir;
 	} else {
 		*device = nullptr;
 		returnCode = LFS_NOT_FOUND;
@@ -156,17 +542,63 @@ void *DirectoryDevice::openFile(const char *filePath, uint32_t accessMode, uint3
 }
 #else
 int DirectoryDevice::openFile(const char *filePath, int openFlags) {
-	char *diskPath = getDevicePath(filePath);
+	if (!_directIO) {
+		return openRetry(_directory, filePath, openFlags);
+	}
 
-	// XXX: open() can fail with EINTR, which means we're just going to retry until it works
-	int file = -1;
-	do {
-		file = open(diskPath, openFlags, 0644);
-	} while (file == -1 && errno == EINTR);
+	// writes read back the blocks they only partly cover
+	if ((openFlags & O_ACCMODE) == O_WRONLY) {
+		openFlags = (openFlags & ~O_ACCMODE) | O_RDWR;
+	}
 
-	freeDevicePath(diskPath);
+#ifdef O_DIRECT
+	int file = openRetry(_directory, filePath, openFlags | O_DIRECT);
+
+	// file systems without direct I/O refuse the flag, files on those go through the cache
+	if (file == -1 && errno == EINVAL) {
+		file = openRetry(_directory, filePath, openFlags);
+	}
+#else
+	int file = openRetry(_directory, filePath, openFlags);
+#ifdef F_NOCACHE
+	if (file != -1) {
+		fcntl(file, F_NOCACHE, 1);
+	}
+#endif
+#endif
+
+	return file;
+}
+
+int DirectoryDevice::acquireFile(const char *filePath) {
+	uint64_t hash = util::hashString(filePath);
+	int file = _fileCache.acquire(filePath, hash);
+
+	// hits don't look at the path again, that's the point of caching the descriptor, so a file
+	// replaced outside of this device is read through the old descriptor until it's evicted
+	if (file == -1) {
+		file = openFile(filePath, O_RDONLY | O_CLOEXEC);
+		if (file != -1) {
+			file = _fileCache.insert(filePath, hash, file);
+		}
+	}
 	return file;
 }
+
+void DirectoryDevice::releaseFile(int file) {
+	_fileCache.release(file);
+}
+
+void DirectoryDevice::invalidateFile(const char *filePath) {
+	_fileCache.invalidate(filePath, util::hashString(filePath));
+}
+
+size_t DirectoryDevice::readFrom(int file, void *buffer, uint64_t bytes, uint64_t offset, ErrorCode *outError) {
+	if (_directIO) {
+		return readDirect(file, buffer, bytes, offset, *_alloc, outError);
+	}
+	return readAt(file, buffer, bytes, offset, outError);
+}
 #endif
 
 char *DirectoryDevice::getDevicePath(const char *filePath) {
@@ -192,9 +624,9 @@ void DirectoryDevice::freeDevicePath(char *path) {
 
 bool DirectoryDevice::fileExists(void *device, const char *filePath) {
 	DirectoryDevice *dev = static_cast<DirectoryDevice*>(device);
-	char *diskPath = dev->getDevicePath(filePath);
 
 #ifdef _WIN32
+	char *diskPath = dev->getDevicePath(filePath);
 	WCHAR windowsPath[MAX_PATH_LEN];
 	widen(diskPath, &windowsPath[0], MAX_PATH_LEN);
 	dev->freeDevicePath(diskPath);
@@ -204,9 +636,8 @@ bool DirectoryDevice::fileExists(void *device, const char *filePath) {
 	return result != INVALID_FILE_ATTRIBUTES && !(result & FILE_ATTRIBUTE_DIRECTORY);
 #else
 	struct stat statInfo;
-	int result = stat(diskPath, &statInfo);
+	int result = fstatat(dev->_directory, relativePath(filePath), &statInfo, 0);
 
-	dev->freeDevicePath(diskPath);
 	return result == 0 && S_ISREG(statInfo.st_mode);
 #endif
 }
@@ -231,10 +662,9 @@ size_t DirectoryDevice::fileSize(void *device, const char *filePath, ErrorCode *
 		*outError = convertError(GetLastError());
 	}
 #else
-	char *diskPath = dev->getDevicePath(filePath);
+	// no descriptor needed, so files without read permission still have a size
 	struct stat statInfo;
-	int result = stat(diskPath, &statInfo);
-	dev->freeDevicePath(diskPath);
+	int result = fstatat(dev->_directory, relativePath(filePath), &statInfo, 0);
 
 	if (result == 0 && S_ISREG(statInfo.st_mode)) {
 		*outError = LFS_OK;
@@ -248,6 +678,77 @@ size_t DirectoryDevice::fileSize(void *device, const char *filePath, ErrorCode *
 	return size;
 }
 
+ErrorCode DirectoryDevice::prefetchFile(void *device, const char *filePath, uint64_t offset, uint64_t bytes) {
+	return adviseFile(device, filePath, offset, bytes, LFS_READ_WILLNEED);
+}
+
+ErrorCode DirectoryDevice::adviseFile(void *device, const char *filePath, uint64_t offset, uint64_t bytes, uint32_t flags) {
+#ifdef _WIN32
+	// no hints available, just report whether the file exists
+	(void)offset;
+	(void)bytes;
+	(void)flags;
+	return fileExists(device, filePath) ? LFS_OK : LFS_NOT_FOUND;
+#else
+	DirectoryDevice *dir = static_cast<DirectoryDevice*>(device);
+	int file = dir->acquireFile(filePath);
+	if (file == -1) {
+		return convertError(errno);
+	}
+
+	// the access pattern would stick to the cached descriptor and carry over to every later
+	// read of the file, so it's only applied to descriptors a request owns, in adviseHandle()
+	flags &= ~static_cast<uint32_t>(LFS_READ_SEQUENTIAL | LFS_READ_RANDOM);
+
+	ErrorCode result = LFS_OK;
+	struct stat statInfo;
+	if (fstat(file, &statInfo) != 0) {
+		result = convertError(errno);
+	} else if (!S_ISREG(statInfo.st_mode)) {
+		result = LFS_NOT_FOUND;
+	} else if (offset < static_cast<uint64_t>(statInfo.st_size) && !dir->_directIO) {
+		// skipped under direct I/O, where the hints would pull the file into the cache anyway
+		adviseDescriptor(file, offset, std::min(bytes, static_cast<uint64_t>(statInfo.st_size) - offset), flags);
+	}
+
+	dir->releaseFile(file);
+	return result;
+#endif
+}
+
+ErrorCode DirectoryDevice::mapFile(void *device, const char *filePath, uint64_t offset, uint64_t maxBytes, Allocator *alloc, uint32_t flags, SharedBuffer **buffer) {
+	DirectoryDevice *dir = static_cast<DirectoryDevice*>(device);
+	*buffer = nullptr;
+
+	// mappings are always backed by the file cache
+	if (dir->_directIO) {
+		return LFS_UNSUPPORTED;
+	}
+
+	MappedFile file;
+#ifdef _WIN32
+	char *diskPath = dir->getDevicePath(filePath);
+	ErrorCode result = file.open(diskPath, offset, maxBytes);
+	dir->freeDevicePath(diskPath);
+#else
+	int descriptor = dir->acquireFile(filePath);
+	if (descriptor == -1) {
+		return convertError(errno);
+	}
+
+	ErrorCode result = file.open(descriptor, offset, maxBytes);
+	dir->releaseFile(descriptor);
+#endif
+
+	// empty ranges and anything that isn't a regular file go through readFile()
+	if (result == LFS_OK) {
+		file.advise(0, file._size, flags);
+		*buffer = file.view(*alloc, 0, file._size);
+	}
+
+	return result;
+}
+
 size_t DirectoryDevice::readFile(void *device, const char *filePath, uint64_t offset, uint64_t maxBytes, Allocator *alloc, void **buffer, bool nullTerminate, ErrorCode *outError) {
 	size_t bytesRead = 0;
 	DirectoryDevice *dir = static_cast<DirectoryDevice*>(device);
@@ -259,28 +760,20 @@ size_t DirectoryDevice::readFile(void *device, const char *filePath, uint64_t of
 		if (GetFileSizeEx(file, &result)) {
 			size_t fileSize = result.QuadPart;
 
-			if (fileSize) {
-				LARGE_INTEGER offsetStruct;
-				offsetStruct.QuadPart = offset;
-				if (SetFilePointer(file, offsetStruct.LowPart, &offsetStruct.HighPart, FILE_BEGIN) == INVALID_SET_FILE_POINTER){
-					CloseHandle(file);
-					return bytesRead;
-				}
-
+			if (fileSize > offset) {
 				fileSize = std::min(fileSize - offset, maxBytes);
 				*buffer = alloc->alloc(alloc->allocator, fileSize + (nullTerminate ? 1 : 0), 1);
 
-				DWORD bytesReadTemp = 0;
-				if (!ReadFile(file, *buffer, static_cast<DWORD>(fileSize), &bytesReadTemp, nullptr)) {
-					*outError = convertError(GetLastError());
+				bytesRead = readAt(file, *buffer, fileSize, offset, outError);
+				if (*outError != LFS_OK) {
+					alloc->free(alloc->allocator, *buffer);
+					*buffer = nullptr;
+					bytesRead = 0;
 				} else if (nullTerminate) {
-					(*reinterpret_cast<char**>(buffer))[bytesReadTemp] = 0;
+					(*reinterpret_cast<char**>(buffer))[bytesRead] = 0;
 				}
-
-				bytesRead = bytesReadTemp;
-				*outError = LFS_OK;
 			} else {
-				// Zero-byte file.
+				// Zero-byte file, or a read past the end.
 				*buffer = nullptr;
 				bytesRead = 0;
 				*outError = LFS_OK;
@@ -294,57 +787,50 @@ size_t DirectoryDevice::readFile(void *device, const char *filePath, uint64_t of
 		*outError = LFS_NOT_FOUND;
 	}
 #else
-	int file = dir->openFile(filePath, O_RDONLY);
+	int file = dir->acquireFile(filePath);
 
 	if (file != -1) {
-		uint64_t fileSize = static_cast<uint64_t>(lseek(file, 0, SEEK_END));
-		if (fileSize == static_cast<uint64_t>(-1)) {
+		struct stat statInfo;
+		if (fstat(file, &statInfo) != 0) {
 			*outError = convertError(errno);
-			close(file);
+			dir->releaseFile(file);
 			return 0;
 		}
 
-		if (fileSize) {
-			off_t seekedOffset = lseek(file, offset, SEEK_SET) == static_cast<off_t>(offset);
+		uint64_t fileSize = static_cast<uint64_t>(statInfo.st_size);
+		if (fileSize > offset) {
+			fileSize = std::min(fileSize - offset, maxBytes);
 
-			if (seekedOffset != static_cast<off_t>(-1)) {
-				fileSize = std::min(fileSize - offset, maxBytes);
-				*buffer = alloc->alloc(alloc->allocator, fileSize + (nullTerminate ? 1 : 0), 1);
+			// direct reads of aligned offsets land straight in an aligned buffer
+			*buffer = alloc->alloc(alloc->allocator, fileSize + (nullTerminate ? 1 : 0), dir->_directIO ? kDirectAlignment : 1);
+
+			if (*buffer) {
+				bytesRead = dir->readFrom(file, *buffer, fileSize, offset, outError);
 
-				if (*buffer) {
-					// XXX: attempt read and retry if necessary
-					ssize_t bytes = -1;
-					do {
-						bytes = read(file, *buffer, fileSize);
-					} while (bytes == -1 && errno == EINTR);
-
-					if (bytes == -1) {
-						alloc->free(alloc->allocator, *buffer);
-						*buffer = nullptr;
-
-						*outError = convertError(errno);
-						close(file);
-						return 0;
-					}
-
-					bytesRead = static_cast<uint64_t>(bytes);
-					*outError = LFS_OK;
-
-					if (nullTerminate) {
-						(*reinterpret_cast<char**>(buffer))[bytesRead] = 0;
-					}
-				} else {
-					// Zero-byte file.
+				if (*outError != LFS_OK) {
+					alloc->free(alloc->allocator, *buffer);
 					*buffer = nullptr;
-					bytesRead = 0;
-					*outError = LFS_OK;
+
+					dir->releaseFile(file);
+					return 0;
+				}
+
+				if (nullTerminate) {
+					(*reinterpret_cast<char**>(buffer))[bytesRead] = 0;
 				}
 			} else {
-				*outError = convertError(errno);
+				// Zero-byte file.
+				*buffer = nullptr;
+				bytesRead = 0;
+				*outError = LFS_OK;
 			}
+		} else {
+			// Zero-byte file, or a read past the end.
+			*buffer = nullptr;
+			*outError = LFS_OK;
 		}
 
-		close(file);
+		dir->releaseFile(file);
 	} else {
 		*outError = convertError(errno);
 	}
@@ -419,24 +905,42 @@ size_t DirectoryDevice::writeFile(void *device, const char *filePath, uint64_t o
 		break;
 	}
 
-	int file = dev->openFile(filePath, O_WRONLY | O_CREAT | openFlags);
+	// direct writes cover whole blocks at explicit offsets, so appends find the end themselves
+	if (dev->_directIO && writeMode == LFS_WRITE_APPEND) {
+		openFlags = 0;
+	}
 
-	if (file != -1) {
-		if (lseek(file, static_cast<off_t>(offset), SEEK_SET) == static_cast<off_t>(offset)) {
-			// XXX: attempt write and retry if necessary
-			ssize_t bytes = -1;
-			do {
-				bytes = write(file, buffer, bytesToWrite);
-			} while(bytes == -1 && errno == EINTR);
+	// cached descriptors are only ever read through, but drop this one anyway so the next
+	// read sees the file as it is now, even if it was replaced
+	dev->invalidateFile(filePath);
 
-			if (bytes == -1) {
-				*outError = convertError(errno);
+	int file = dev->openFile(filePath, O_WRONLY | O_CREAT | O_CLOEXEC | openFlags);
+
+	if (file != -1 && dev->_directIO) {
+		struct stat statInfo;
+		if (writeMode == LFS_WRITE_APPEND && fstat(file, &statInfo) != 0) {
+			*outError = convertError(errno);
+		} else {
+			uint64_t position = writeMode == LFS_WRITE_APPEND ? static_cast<uint64_t>(statInfo.st_size) : offset;
+			bytesWritten = writeDirect(file, buffer, bytesToWrite, position, *dev->_alloc, outError);
+		}
+		close(file);
+	} else if (file != -1) {
+		// XXX: attempt write and retry if necessary
+		ssize_t bytes = -1;
+		do {
+			if (writeMode == LFS_WRITE_APPEND) {
+				bytes = write(file, buffer, bytesToWrite);
 			} else {
-				bytesWritten = static_cast<uint64_t>(bytes);
-				*outError = LFS_OK;
+				bytes = pwrite(file, buffer, bytesToWrite, static_cast<off_t>(offset));
 			}
-		} else {
+		} while(bytes == -1 && errno == EINTR);
+
+		if (bytes == -1) {
 			*outError = convertError(errno);
+		} else {
+			bytesWritten = static_cast<uint64_t>(bytes);
+			*outError = LFS_OK;
 		}
 		close(file);
 	} else {
@@ -448,45 +952,47 @@ size_t DirectoryDevice::writeFile(void *device, const char *filePath, uint64_t o
 
 ErrorCode DirectoryDevice::deleteFile(void *device, const char *filePath) {
 	DirectoryDevice *dev = static_cast<DirectoryDevice*>(device);
-	char *diskPath = dev->getDevicePath(filePath);
 
 	ErrorCode resultCode = LFS_OK;
 #ifdef _WIN32
+	char *diskPath = dev->getDevicePath(filePath);
 	WCHAR windowsPath[MAX_PATH_LEN];
 	widen(diskPath, &windowsPath[0], MAX_PATH_LEN);
+	dev->freeDevicePath(diskPath);
 
 	if (!DeleteFileW(&windowsPath[0])) {
 		resultCode = convertError(GetLastError());
 	}
 #else
-	if (unlink(diskPath) != 0) {
+	dev->invalidateFile(filePath);
+
+	if (unlinkat(dev->_directory, relativePath(filePath), 0) != 0) {
 		resultCode = convertError(errno);
 	}
 #endif
 
-	dev->freeDevicePath(diskPath);
 	return resultCode;
 }
 
 ErrorCode DirectoryDevice::createDir(void *device, const char *path) {
 	DirectoryDevice *dev = static_cast<DirectoryDevice*>(device);
-	char *diskPath = dev->getDevicePath(path);
 
 	ErrorCode resultCode = LFS_OK;
 #ifdef _WIN32
+	char *diskPath = dev->getDevicePath(path);
 	WCHAR windowsPath[MAX_PATH_LEN];
 	widen(diskPath, &windowsPath[0], MAX_PATH_LEN);
+	dev->freeDevicePath(diskPath);
 
 	if (!CreateDirectoryW(&windowsPath[0], nullptr)) {
 		resultCode = convertError(GetLastError());
 	}
 #else
-	if (mkdir(diskPath, DEFFILEMODE | S_IXUSR | S_IXGRP | S_IRWXO) != 0) {
+	if (mkdirat(dev->_directory, relativePath(path), DEFFILEMODE | S_IXUSR | S_IXGRP | S_IRWXO) != 0) {
 		resultCode = convertError(errno);
 	}
 #endif
 
-	dev->freeDevicePath(diskPath);
 	return resultCode;
 }
 
@@ -532,6 +1038,9 @@ ErrorCode DirectoryDevice::deleteDir(void *device, const char *path) {
 		break;
 	};
 #else
+	// anything under the directory could be cached
+	dev->_fileCache.clear();
+
 	FTS *fts = nullptr;
 	char *fileList[] = {diskPath, nullptr};
 	bool error = false;
@@ -587,4 +1096,226 @@ ErrorCode DirectoryDevice::deleteDir(void *device, const char *path) {
 	return resultCode;
 }
 
+ErrorCode DirectoryDevice::enumerate(void *device, FileContext::DeviceInterface::EnumerateCallback callback, void *userData) {
+	DirectoryDevice *dev = static_cast<DirectoryDevice*>(device);
+
+#ifdef _WIN32
+	WCHAR windowsPath[MAX_PATH_LEN];
+	int len = widen(dev->_devicePath, &windowsPath[0], MAX_PATH_LEN);
+	if (len == 0) {
+		return convertError(GetLastError());
+	}
+
+	char relativePath[MAX_PATH_LEN] = {0};
+	enumerateDirectory(&windowsPath[0], static_cast<size_t>(len - 1), &relativePath[0], 0, callback, userData);
+	return LFS_OK;
+#else
+	FTS *fts = nullptr;
+	char *fileList[] = {dev->_devicePath, nullptr};
+	ErrorCode resultCode = LFS_OK;
+
+	if ((fts = fts_open(fileList, FTS_PHYSICAL | FTS_NOCHDIR | FTS_XDEV, nullptr))) {
+		errno = 0;
+		for (FTSENT *ent = fts_read(fts); ent; ent = fts_read(fts)) {
+			if (ent->fts_info != FTS_F && ent->fts_info != FTS_SL)
+				continue;
+
+			// fts_path starts with the device path, which may or may not end in a slash
+			const char *relativePath = ent->fts_path + dev->_pathLen;
+			if (*relativePath != '/') {
+				--relativePath;
+			}
+
+			callback(relativePath, userData);
+		}
+
+		if (errno != 0) {
+			resultCode = convertError(errno);
+		}
+		fts_close(fts);
+	} else {
+		resultCode = convertError(errno);
+	}
+
+	return resultCode;
+#endif
+}
+
+ErrorCode DirectoryDevice::openHandle(void *device, const char *filePath, lfs_open_mode_t mode, void **handle) {
+	DirectoryDevice *dev = static_cast<DirectoryDevice*>(device);
+	*handle = nullptr;
+
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	if (mode == LFS_OPEN_READ) {
+		file = dev->openFile(filePath, GENERIC_READ, OPEN_EXISTING);
+	} else {
+		file = dev->openFile(filePath, GENERIC_WRITE, mode == LFS_OPEN_WRITE ? CREATE_ALWAYS : OPEN_ALWAYS);
+	}
+
+	if (file == INVALID_HANDLE_VALUE) {
+		return convertError(GetLastError());
+	}
+
+	*handle = file;
+	return LFS_OK;
+#else
+	int file = -1;
+	if (mode == LFS_OPEN_READ) {
+		file = dev->openFile(filePath, O_RDONLY | O_CLOEXEC);
+	} else {
+		dev->invalidateFile(filePath);
+		file = dev->openFile(filePath, O_WRONLY | O_CREAT | O_CLOEXEC | (mode == LFS_OPEN_WRITE ? O_TRUNC : 0));
+	}
+
+	if (file == -1) {
+		return convertError(errno);
+	}
+
+	*handle = reinterpret_cast<void*>(static_cast<intptr_t>(file));
+	return LFS_OK;
+#endif
+}
+
+size_t DirectoryDevice::readHandle(void *device, void *handle, uint64_t offset, uint64_t bytes, void *buffer, ErrorCode *outError) {
+#ifdef _WIN32
+	(void)device;
+	return readAt(static_cast<HANDLE>(handle), buffer, bytes, offset, outError);
+#else
+	return static_cast<DirectoryDevice*>(device)->readFrom(static_cast<int>(reinterpret_cast<intptr_t>(handle)), buffer, bytes, offset, outError);
+#endif
+}
+
+size_t DirectoryDevice::writeHandle(void *device, void *handle, uint64_t offset, const void *buffer, size_t bytes, ErrorCode *outError) {
+#ifdef _WIN32
+	(void)device;
+
+	OVERLAPPED position = {};
+	position.Offset = static_cast<DWORD>(offset);
+	position.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+	DWORD bytesWritten = 0;
+	if (!WriteFile(static_cast<HANDLE>(handle), buffer, static_cast<DWORD>(bytes), &bytesWritten, &position)) {
+		*outError = convertError(GetLastError());
+		return 0;
+	}
+
+	*outError = LFS_OK;
+	return bytesWritten;
+#else
+	DirectoryDevice *dev = static_cast<DirectoryDevice*>(device);
+	int file = static_cast<int>(reinterpret_cast<intptr_t>(handle));
+
+	if (dev->_directIO) {
+		return writeDirect(file, buffer, bytes, offset, *dev->_alloc, outError);
+	}
+
+	ssize_t bytesWritten = -1;
+	do {
+		bytesWritten = pwrite(file, buffer, bytes, static_cast<off_t>(offset));
+	} while (bytesWritten == -1 && errno == EINTR);
+
+	if (bytesWritten == -1) {
+		*outError = convertError(errno);
+		return 0;
+	}
+
+	*outError = LFS_OK;
+	return static_cast<size_t>(bytesWritten);
+#endif
+}
+
+void DirectoryDevice::adviseHandle(void *device, void *handle, uint32_t flags) {
+#ifdef _WIN32
+	(void)device;
+	(void)handle;
+	(void)flags;
+#else
+	int file = static_cast<int>(reinterpret_cast<intptr_t>(handle));
+	struct stat statInfo;
+	if (!static_cast<DirectoryDevice*>(device)->_directIO && fstat(file, &statInfo) == 0 && statInfo.st_size > 0) {
+		adviseDescriptor(file, 0, static_cast<uint64_t>(statInfo.st_size), flags);
+	}
+#endif
+}
+
+size_t DirectoryDevice::readHandleV(void *device, void *handle, uint64_t offset, const lfs_io_vec_t *vecs, uint32_t count, ErrorCode *outError) {
+	size_t bytesRead = 0;
+	*outError = LFS_OK;
+
+#ifdef _WIN32
+	// overlapped scatter reads need unbuffered handles, so the buffers are read one at a time
+	bool perBuffer = true;
+#else
+	// each buffer gets its own alignment handling under direct I/O
+	bool perBuffer = static_cast<DirectoryDevice*>(device)->_directIO;
+#endif
+
+	if (perBuffer) {
+		for (uint32_t i = 0; i < count; ++i) {
+			size_t vecBytes = readHandle(device, handle, offset + bytesRead, vecs[i].bytes, vecs[i].buffer, outError);
+			bytesRead += vecBytes;
+			if (*outError != LFS_OK || vecBytes < vecs[i].bytes) {
+				break;
+			}
+		}
+		return bytesRead;
+	}
+
+#ifndef _WIN32
+	int file = static_cast<int>(reinterpret_cast<intptr_t>(handle));
+	struct iovec iov[kMaxReadVecs];
+
+	for (uint32_t first = 0; first < count; first += kMaxReadVecs) {
+		uint32_t batch = std::min(count - first, kMaxReadVecs);
+		size_t batchBytes = 0;
+		for (uint32_t i = 0; i < batch; ++i) {
+			iov[i].iov_base = vecs[first + i].buffer;
+			iov[i].iov_len = vecs[first + i].bytes;
+			batchBytes += vecs[first + i].bytes;
+		}
+
+		ssize_t result = -1;
+		do {
+			result = preadv(file, iov, static_cast<int>(batch), static_cast<off_t>(offset + bytesRead));
+		} while (result == -1 && errno == EINTR);
+
+		if (result == -1) {
+			*outError = convertError(errno);
+			break;
+		}
+
+		bytesRead += static_cast<size_t>(result);
+		if (static_cast<size_t>(result) < batchBytes) {
+			break;
+		}
+	}
+#endif
+
+	return bytesRead;
+}
+
+void DirectoryDevice::closeHandle(void *, void *handle) {
+#ifdef _WIN32
+	CloseHandle(static_cast<HANDLE>(handle));
+#else
+	close(static_cast<int>(reinterpret_cast<intptr_t>(handle)));
+#endif
+}
+
+ErrorCode DirectoryDevice::setDirectIO(void *device, bool enabled) {
+	DirectoryDevice *dev = static_cast<DirectoryDevice*>(device);
+#ifdef _WIN32
+	// FILE_FLAG_NO_BUFFERING would need the same alignment handling as O_DIRECT
+	if (enabled) {
+		return LFS_UNSUPPORTED;
+	}
+#else
+	// cached descriptors were opened the other way
+	dev->_fileCache.clear();
+#endif
+	dev->_directIO = enabled;
+	return LFS_OK;
+}
+
 #endif // LAMINAFS_DISABLE_DIRECTORY_DEVICE
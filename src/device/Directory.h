@@ -8,6 +8,7 @@
 #include <cstdint>
 
 #include "FileContext.h"
+#include "util/FileDescriptorCache.h"
 
 namespace laminaFS {
 
@@ -30,11 +31,38 @@ public:
 	static ErrorCode createDir(void *device, const char *path);
 	static ErrorCode deleteDir(void *device, const char *path);
 
+	static ErrorCode prefetchFile(void *device, const char *filePath, uint64_t offset, uint64_t bytes);
+	static ErrorCode adviseFile(void *device, const char *filePath, uint64_t offset, uint64_t bytes, uint32_t flags);
+	static ErrorCode mapFile(void *device, const char *filePath, uint64_t offset, uint64_t maxBytes, lfs_allocator_t *, uint32_t flags, SharedBuffer **buffer);
+
+	static ErrorCode enumerate(void *device, FileContext::DeviceInterface::EnumerateCallback callback, void *userData);
+
+	static ErrorCode openHandle(void *device, const char *filePath, lfs_open_mode_t mode, void **handle);
+	static size_t readHandle(void *device, void *handle, uint64_t offset, uint64_t bytes, void *buffer, ErrorCode *outError);
+	static size_t writeHandle(void *device, void *handle, uint64_t offset, const void *buffer, size_t bytes, ErrorCode *outError);
+	static void closeHandle(void *device, void *handle);
+	static void adviseHandle(void *device, void *handle, uint32_t flags);
+	static size_t readHandleV(void *device, void *handle, uint64_t offset, const lfs_io_vec_t *vecs, uint32_t count, ErrorCode *outError);
+
+	//! Opens files with O_DIRECT (F_NOCACHE on macOS), falling back to cached I/O on file
+	//! systems that refuse it. Reads and writes that aren't aligned to
+	//! LFS_DIRECT_IO_ALIGNMENT go through aligned bounce buffers. Unsupported on Windows.
+	static ErrorCode setDirectIO(void *device, bool enabled);
+
 private:
 #ifdef _WIN32
 	void *openFile(const char *filePath, uint32_t accessMode, uint32_t createMode);
 #else
 	int openFile(const char *filePath, int modeFlags);
+
+	// read-only descriptor from the cache, give it back with releaseFile(). Writes, deletes
+	// and directory changes made through this device invalidate it, nothing else does
+	int acquireFile(const char *filePath);
+	void releaseFile(int file);
+	void invalidateFile(const char *filePath);
+
+	// readAt() or its direct I/O equivalent
+	size_t readFrom(int file, void *buffer, uint64_t bytes, uint64_t offset, ErrorCode *outError);
 #endif
 	char *getDevicePath(const char *filePath);
 	void freeDevicePath(char *path);
@@ -42,6 +70,11 @@ private:
 	Allocator *_alloc;
 	char *_devicePath = nullptr;
 	uint32_t _pathLen = 0;
+#ifndef _WIN32
+	int _directory = -1; // every path is opened relative to this
+	util::FileDescriptorCache _fileCache;
+#endif
+	bool _directIO = false;
 };
 
 }
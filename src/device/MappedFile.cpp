@@ -0,0 +1,211 @@
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "MappedFile.h"
+#include "SharedBuffer.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#define UNICODE 1
+#define _UNICODE 1
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace laminaFS;
+
+namespace {
+#ifdef _WIN32
+constexpr uint32_t MAX_PATH_LEN = 1024;
+#endif
+
+void releaseMapping(void *data, uint64_t bytes, void *userData) {
+#ifdef _WIN32
+	(void)bytes;
+	UnmapViewOfFile(data);
+	CloseHandle(userData);
+#else
+	(void)userData;
+	munmap(data, bytes);
+#endif
+}
+
+uint64_t mappingAlignment() {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwAllocationGranularity;
+#else
+	return static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+lfs_error_code_t MappedFile::open(const char *path, uint64_t offset, uint64_t maxBytes) {
+	close();
+
+#ifdef _WIN32
+	uint64_t fileSize = 0;
+	WCHAR windowsPath[MAX_PATH_LEN];
+	MultiByteToWideChar(CP_UTF8, 0, path, -1, windowsPath, MAX_PATH_LEN);
+
+	HANDLE file = CreateFileW(&windowsPath[0], GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return GetLastError() == ERROR_ACCESS_DENIED ? LFS_PERMISSIONS_ERROR : LFS_NOT_FOUND;
+	}
+
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(file, &size) && static_cast<uint64_t>(size.QuadPart) > offset) {
+		fileSize = static_cast<uint64_t>(size.QuadPart);
+		_mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	}
+
+	// the mapping keeps the file open
+	CloseHandle(file);
+
+	if (_mapping) {
+		uint64_t bytes = std::min(fileSize - offset, maxBytes);
+		uint64_t viewOffset = offset / mappingAlignment() * mappingAlignment();
+		_view = MapViewOfFile(_mapping, FILE_MAP_READ, static_cast<DWORD>(viewOffset >> 32), static_cast<DWORD>(viewOffset), static_cast<SIZE_T>(offset + bytes - viewOffset));
+		if (_view) {
+			_viewBytes = offset + bytes - viewOffset;
+			_data = static_cast<const uint8_t*>(_view) + (offset - viewOffset);
+			_size = bytes;
+		}
+	}
+
+	if (!_data) {
+		close();
+		return LFS_UNSUPPORTED;
+	}
+
+	return LFS_OK;
+#else
+	int file = -1;
+	do {
+		file = ::open(path, O_RDONLY);
+	} while (file == -1 && errno == EINTR);
+
+	if (file == -1) {
+		return errno == ENOENT ? LFS_NOT_FOUND : LFS_PERMISSIONS_ERROR;
+	}
+
+	lfs_error_code_t result = open(file, offset, maxBytes);
+
+	// the mapping keeps the file open
+	::close(file);
+	return result;
+#endif
+}
+
+#ifndef _WIN32
+lfs_error_code_t MappedFile::open(int file, uint64_t offset, uint64_t maxBytes) {
+	close();
+
+	struct stat statInfo;
+	if (fstat(file, &statInfo) == 0 && S_ISREG(statInfo.st_mode) && static_cast<uint64_t>(statInfo.st_size) > offset) {
+		uint64_t bytes = std::min(static_cast<uint64_t>(statInfo.st_size) - offset, maxBytes);
+		uint64_t viewOffset = offset / mappingAlignment() * mappingAlignment();
+
+		void *data = mmap(nullptr, static_cast<size_t>(offset + bytes - viewOffset), PROT_READ, MAP_PRIVATE, file, static_cast<off_t>(viewOffset));
+		if (data != MAP_FAILED) {
+			_view = data;
+			_viewBytes = offset + bytes - viewOffset;
+			_data = static_cast<const uint8_t*>(data) + (offset - viewOffset);
+			_size = bytes;
+		}
+	}
+
+	return _data ? LFS_OK : LFS_UNSUPPORTED;
+}
+#endif
+
+void MappedFile::close() {
+	if (_shared) {
+		SharedBufferRelease(_shared);
+	} else if (_view) {
+#ifdef _WIN32
+		releaseMapping(_view, _viewBytes, _mapping);
+#else
+		releaseMapping(_view, _viewBytes, nullptr);
+#endif
+	}
+#ifdef _WIN32
+	else if (_mapping) {
+		CloseHandle(_mapping);
+	}
+	_mapping = nullptr;
+#endif
+
+	_data = nullptr;
+	_size = 0;
+	_view = nullptr;
+	_viewBytes = 0;
+	_shared = nullptr;
+}
+
+void MappedFile::advise(uint64_t offset, uint64_t bytes, uint32_t flags) const {
+	if (offset >= _size || bytes == 0)
+		return;
+
+	bytes = std::min(bytes, _size - offset);
+#ifdef _WIN32
+	// only prefetching has an equivalent for mapped memory
+	if (flags & LFS_READ_WILLNEED) {
+		WIN32_MEMORY_RANGE_ENTRY range;
+		range.VirtualAddress = const_cast<uint8_t*>(_data + offset);
+		range.NumberOfBytes = static_cast<SIZE_T>(bytes);
+		PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+	}
+#else
+	// madvise wants a page aligned start, the hints are best effort either way
+	uintptr_t pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+	uintptr_t start = reinterpret_cast<uintptr_t>(_data + offset);
+	uintptr_t alignedStart = start / pageSize * pageSize;
+	void *address = reinterpret_cast<void*>(alignedStart);
+	size_t length = static_cast<size_t>(start + bytes - alignedStart);
+
+	if (flags & LFS_READ_SEQUENTIAL) {
+		madvise(address, length, MADV_SEQUENTIAL);
+	}
+	if (flags & LFS_READ_RANDOM) {
+		madvise(address, length, MADV_RANDOM);
+	}
+	if (flags & LFS_READ_WILLNEED) {
+		madvise(address, length, MADV_WILLNEED);
+	}
+	// the mapping is read-only, so dropped pages are simply faulted back in from the file
+	if (flags & LFS_READ_DONTNEED) {
+		madvise(address, length, MADV_DONTNEED);
+	}
+#endif
+}
+
+SharedBuffer *MappedFile::view(lfs_allocator_t &alloc, uint64_t offset, uint64_t bytes) {
+	if (!_shared) {
+#ifdef _WIN32
+		_shared = SharedBufferCreateWithRelease(alloc, _view, _viewBytes, releaseMapping, _mapping);
+#else
+		_shared = SharedBufferCreateWithRelease(alloc, _view, _viewBytes, releaseMapping, nullptr);
+#endif
+	}
+
+	return SharedBufferCreateView(_shared, static_cast<uint64_t>(_data - static_cast<const uint8_t*>(_view)) + offset, bytes);
+}
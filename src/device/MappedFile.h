@@ -0,0 +1,69 @@
+#pragma once
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#include <cstdint>
+
+#include "shared_types.h"
+
+namespace laminaFS {
+
+//! A file, or a range of one, mapped read-only into memory. The archive devices map
+//! their whole archive, the Directory device maps the part of a file a mapped read asks for.
+struct MappedFile {
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	//! Maps a file, unmapping any previously mapped one.
+	//! @param path the path of the file on disk
+	//! @param offset the offset of the range to map
+	//! @param maxBytes the maximum size of the range to map
+	//! @return LFS_OK, LFS_NOT_FOUND, LFS_PERMISSIONS_ERROR, or LFS_UNSUPPORTED if the range is empty or it's not a regular file
+	lfs_error_code_t open(const char *path, uint64_t offset = 0, uint64_t maxBytes = UINT64_MAX);
+
+#ifndef _WIN32
+	//! Maps a file that's already open. The descriptor isn't needed after this returns.
+	//! @param file a descriptor open for reading
+	//! @param offset the offset of the range to map
+	//! @param maxBytes the maximum size of the range to map
+	//! @return LFS_OK, or LFS_UNSUPPORTED if the range is empty or it's not a regular file
+	lfs_error_code_t open(int file, uint64_t offset = 0, uint64_t maxBytes = UINT64_MAX);
+#endif
+
+	//! Unmaps the file. The mapping stays alive while views of it exist.
+	void close();
+
+	//! Passes read hints for a range of the mapping on to the OS.
+	//! @param offset the offset of the range
+	//! @param bytes the size of the range
+	//! @param flags the access hints among lfs_read_flags_t, other flags are ignored
+	void advise(uint64_t offset, uint64_t bytes, uint32_t flags) const;
+
+	//! Creates a shared buffer that refers to a range of the mapping rather than a copy of it.
+	//! The first view hands the mapping over to a reference counted buffer, so it outlives
+	//! close() until the last view is released. Not thread safe.
+	//! @param alloc the allocator for the shared buffers
+	//! @param offset the offset of the range, relative to _data
+	//! @param bytes the size of the range
+	//! @return the view, with a reference count of one
+	lfs_shared_buffer_t *view(lfs_allocator_t &alloc, uint64_t offset, uint64_t bytes);
+
+	const uint8_t *_data = nullptr;
+	uint64_t _size = 0;
+
+	// the mapping itself, which starts before _data when the mapped range isn't aligned
+	void *_view = nullptr;
+	uint64_t _viewBytes = 0;
+
+	// owns the mapping once a view has been created
+	lfs_shared_buffer_t *_shared = nullptr;
+
+#ifdef _WIN32
+	void *_mapping = nullptr;
+#endif
+};
+
+}
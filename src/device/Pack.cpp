@@ -0,0 +1,327 @@
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+#if !defined(LAMINAFS_DISABLE_PACK_DEVICE)
+
+#include "Pack.h"
+#include "util/Hash.h"
+#include "util/Lz.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+using namespace laminaFS;
+
+PackDevice::PackDevice(Allocator *allocator)
+: _alloc(allocator)
+{
+}
+
+PackDevice::~PackDevice() {
+	if (_workers) {
+		_workers->~WorkerPool();
+		_alloc->free(_alloc->allocator, _workers);
+	}
+}
+
+void PackDevice::init() {
+	const uint8_t *data = _file._data;
+
+	pack::Header header;
+	memcpy(&header, data, sizeof(header));
+
+	_entries = reinterpret_cast<const pack::Entry*>(data + header._tocOffset);
+	_entryCount = header._entryCount;
+	_strings = reinterpret_cast<const char*>(data + header._stringsOffset);
+
+	if (memcmp(header._magic, pack::kCompressedMagic, sizeof(pack::kCompressedMagic)) == 0) {
+		pack::CompressedHeader compressedHeader;
+		memcpy(&compressedHeader, data, sizeof(compressedHeader));
+		_blockSize = compressedHeader._blockSize;
+
+		uint32_t threads = std::min(std::max(std::thread::hardware_concurrency(), 1u), kMaxDecompressThreads);
+		_workers = new(_alloc->alloc(_alloc->allocator, sizeof(util::WorkerPool), alignof(util::WorkerPool))) util::WorkerPool(*_alloc, threads - 1);
+	}
+}
+
+bool PackDevice::validate(const uint8_t *data, uint64_t size) {
+	pack::Header header;
+	if (size < sizeof(header))
+		return false;
+
+	memcpy(&header, data, sizeof(header));
+	if (header._version != pack::kVersion)
+		return false;
+
+	uint32_t blockSize = 0;
+	if (memcmp(header._magic, pack::kCompressedMagic, sizeof(pack::kCompressedMagic)) == 0) {
+		pack::CompressedHeader compressedHeader;
+		if (size < sizeof(compressedHeader))
+			return false;
+
+		memcpy(&compressedHeader, data, sizeof(compressedHeader));
+		blockSize = compressedHeader._blockSize;
+		if (compressedHeader._codec != pack::kCodecLZ || blockSize < pack::kMinBlockSize || blockSize > pack::kMaxBlockSize)
+			return false;
+	} else if (memcmp(header._magic, pack::kMagic, sizeof(pack::kMagic)) != 0) {
+		return false;
+	}
+
+	// everything is checked once here so lookups and reads don't have to
+	uint64_t tocBytes = static_cast<uint64_t>(header._entryCount) * sizeof(pack::Entry);
+	if (header._tocOffset % alignof(pack::Entry) != 0 || header._tocOffset > size || tocBytes > size - header._tocOffset)
+		return false;
+	if (header._stringsOffset > size || header._stringsBytes > size - header._stringsOffset)
+		return false;
+
+	const pack::Entry *entries = reinterpret_cast<const pack::Entry*>(data + header._tocOffset);
+	const char *strings = reinterpret_cast<const char*>(data + header._stringsOffset);
+
+	for (uint32_t i = 0; i < header._entryCount; ++i) {
+		const pack::Entry &entry = entries[i];
+		if (entry._pathOffset > header._stringsBytes || entry._pathLength > header._stringsBytes - entry._pathOffset)
+			return false;
+		if (blockSize == 0 && (entry._offset > size || entry._size > size - entry._offset))
+			return false;
+		if (blockSize != 0 && !validateBlocks(data, size, entry, blockSize))
+			return false;
+		if (util::hashBytes(strings + entry._pathOffset, entry._pathLength) != entry._pathHash)
+			return false;
+
+		if (i > 0) {
+			const pack::Entry &prev = entries[i - 1];
+			if (!pack::entryLess(prev._pathHash, strings + prev._pathOffset, prev._pathLength, entry._pathHash, strings + entry._pathOffset, entry._pathLength))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+bool PackDevice::validateBlocks(const uint8_t *data, uint64_t size, const pack::Entry &entry, uint32_t blockSize) {
+	uint64_t blocks = pack::blockCount(entry._size, blockSize);
+	if (entry._offset % alignof(uint64_t) != 0 || entry._offset > size || (size - entry._offset) / sizeof(uint64_t) < blocks + 1)
+		return false;
+
+	const uint64_t *table = reinterpret_cast<const uint64_t*>(data + entry._offset);
+	if (table[blocks] > size)
+		return false;
+
+	for (uint64_t i = 0; i < blocks; ++i) {
+		uint64_t blockBytes = std::min<uint64_t>(blockSize, entry._size - i * blockSize);
+		if (table[i] >= table[i + 1] || table[i + 1] - table[i] > blockBytes)
+			return false;
+	}
+
+	return true;
+}
+
+ErrorCode PackDevice::create(Allocator *alloc, const char *path, void **device) {
+	PackDevice *pack = new(alloc->alloc(alloc->allocator, sizeof(PackDevice), alignof(PackDevice))) PackDevice(alloc);
+
+	ErrorCode returnCode = pack->_file.open(path);
+	if (returnCode == LFS_OK && !validate(pack->_file._data, pack->_file._size)) {
+		returnCode = LFS_UNSUPPORTED;
+	}
+
+	if (returnCode != LFS_OK) {
+		destroy(pack);
+		pack = nullptr;
+	} else {
+		pack->init();
+	}
+
+	*device = pack;
+	return returnCode;
+}
+
+void PackDevice::destroy(void *device) {
+	PackDevice *pack = static_cast<PackDevice*>(device);
+	Allocator *alloc = pack->_alloc;
+	pack->~PackDevice();
+	alloc->free(alloc->allocator, device);
+}
+
+const pack::Entry *PackDevice::findEntry(const char *filePath) const {
+	uint32_t pathLength = static_cast<uint32_t>(strlen(filePath));
+	uint64_t hash = util::hashBytes(filePath, pathLength);
+
+	const pack::Entry *entry = std::lower_bound(_entries, _entries + _entryCount, hash, [this, filePath, pathLength](const pack::Entry &e, uint64_t h) {
+		return pack::entryLess(e._pathHash, _strings + e._pathOffset, e._pathLength, h, filePath, pathLength);
+	});
+
+	if (entry != _entries + _entryCount && entry->_pathHash == hash && entry->_pathLength == pathLength && memcmp(_strings + entry->_pathOffset, filePath, pathLength) == 0) {
+		return entry;
+	}
+
+	return nullptr;
+}
+
+bool PackDevice::fileExists(void *device, const char *filePath) {
+	return static_cast<PackDevice*>(device)->findEntry(filePath) != nullptr;
+}
+
+size_t PackDevice::fileSize(void *device, const char *filePath, ErrorCode *outError) {
+	const pack::Entry *entry = static_cast<PackDevice*>(device)->findEntry(filePath);
+	*outError = entry ? LFS_OK : LFS_NOT_FOUND;
+	return entry ? static_cast<size_t>(entry->_size) : 0;
+}
+
+size_t PackDevice::readFile(void *device, const char *filePath, uint64_t offset, uint64_t maxBytes, Allocator *alloc, void **buffer, bool nullTerminate, ErrorCode *outError) {
+	PackDevice *pack = static_cast<PackDevice*>(device);
+	const pack::Entry *entry = pack->findEntry(filePath);
+
+	if (!entry) {
+		*outError = LFS_NOT_FOUND;
+		return 0;
+	}
+
+	uint64_t bytes = offset < entry->_size ? std::min(entry->_size - offset, maxBytes) : 0;
+	*outError = LFS_OK;
+
+	if (bytes == 0) {
+		// Zero-byte read.
+		*buffer = nullptr;
+		return 0;
+	}
+
+	*buffer = alloc->alloc(alloc->allocator, bytes + (nullTerminate ? 1 : 0), 1);
+	if (!*buffer) {
+		*outError = LFS_GENERIC_ERROR;
+		return 0;
+	}
+
+	if (pack->_blockSize == 0) {
+		memcpy(*buffer, pack->_file._data + entry->_offset + offset, bytes);
+	} else if (!pack->readBlocks(*entry, offset, bytes, static_cast<uint8_t*>(*buffer))) {
+		alloc->free(alloc->allocator, *buffer);
+		*buffer = nullptr;
+		*outError = LFS_GENERIC_ERROR;
+		return 0;
+	}
+
+	if (nullTerminate) {
+		static_cast<char*>(*buffer)[bytes] = 0;
+	}
+
+	return static_cast<size_t>(bytes);
+}
+
+const uint64_t *PackDevice::blockTable(const pack::Entry &entry) const {
+	return reinterpret_cast<const uint64_t*>(_file._data + entry._offset);
+}
+
+bool PackDevice::readBlocks(const pack::Entry &entry, uint64_t offset, uint64_t bytes, uint8_t *buffer) {
+	const uint64_t *table = blockTable(entry);
+	uint64_t firstBlock = offset / _blockSize;
+	uint64_t lastBlock = (offset + bytes - 1) / _blockSize;
+	std::atomic<bool> failed{false};
+
+	_workers->parallelFor(static_cast<uint32_t>(lastBlock - firstBlock + 1), [&](uint32_t index) {
+		uint64_t block = firstBlock + index;
+		uint64_t blockStart = block * _blockSize;
+		uint64_t blockBytes = std::min<uint64_t>(_blockSize, entry._size - blockStart);
+		const uint8_t *stored = _file._data + table[block];
+		uint64_t storedBytes = table[block + 1] - table[block];
+
+		// blocks only partly inside the read are decoded on the side
+		uint64_t copyStart = std::max(offset, blockStart);
+		uint64_t copyEnd = std::min(offset + bytes, blockStart + blockBytes);
+		bool partial = copyStart != blockStart || copyEnd != blockStart + blockBytes;
+
+		uint8_t *target = buffer + (copyStart - offset);
+		if (partial) {
+			target = static_cast<uint8_t*>(_alloc->alloc(_alloc->allocator, blockBytes, 1));
+			if (!target) {
+				failed = true;
+				return;
+			}
+		}
+
+		if (storedBytes == blockBytes) {
+			memcpy(target, stored, blockBytes);
+		} else if (!util::lz::decompress(stored, storedBytes, target, blockBytes)) {
+			failed = true;
+		}
+
+		if (partial) {
+			memcpy(buffer + (copyStart - offset), target + (copyStart - blockStart), copyEnd - copyStart);
+			_alloc->free(_alloc->allocator, target);
+		}
+	});
+
+	return !failed;
+}
+
+ErrorCode PackDevice::prefetchFile(void *device, const char *filePath, uint64_t offset, uint64_t bytes) {
+	return adviseFile(device, filePath, offset, bytes, LFS_READ_WILLNEED);
+}
+
+ErrorCode PackDevice::adviseFile(void *device, const char *filePath, uint64_t offset, uint64_t bytes, uint32_t flags) {
+	PackDevice *pack = static_cast<PackDevice*>(device);
+	const pack::Entry *entry = pack->findEntry(filePath);
+
+	if (!entry) {
+		return LFS_NOT_FOUND;
+	}
+
+	if (offset < entry->_size) {
+		uint64_t length = std::min(bytes, entry->_size - offset);
+		uint64_t start = entry->_offset + offset;
+
+		if (pack->_blockSize != 0) {
+			// advise the stored blocks covering the range
+			const uint64_t *table = pack->blockTable(*entry);
+			start = table[offset / pack->_blockSize];
+			length = table[(offset + length - 1) / pack->_blockSize + 1] - start;
+		}
+
+		pack->_file.advise(start, length, flags);
+	}
+
+	return LFS_OK;
+}
+
+ErrorCode PackDevice::mapFile(void *device, const char *filePath, uint64_t offset, uint64_t maxBytes, Allocator *, uint32_t flags, SharedBuffer **buffer) {
+	PackDevice *pack = static_cast<PackDevice*>(device);
+	const pack::Entry *entry = pack->findEntry(filePath);
+	*buffer = nullptr;
+
+	if (!entry) {
+		return LFS_NOT_FOUND;
+	}
+
+	// compressed data has to be decoded into a buffer of its own
+	if (pack->_blockSize != 0) {
+		return LFS_UNSUPPORTED;
+	}
+
+	uint64_t bytes = offset < entry->_size ? std::min(entry->_size - offset, maxBytes) : 0;
+	if (bytes > 0) {
+		pack->_file.advise(entry->_offset + offset, bytes, flags);
+		// views share the mapping, which belongs to the device rather than to the request
+		*buffer = pack->_file.view(*pack->_alloc, entry->_offset + offset, bytes);
+	}
+
+	return LFS_OK;
+}
+
+ErrorCode PackDevice::enumerate(void *device, FileContext::DeviceInterface::EnumerateCallback callback, void *userData) {
+	PackDevice *pack = static_cast<PackDevice*>(device);
+
+	char path[1024];
+	for (uint32_t i = 0; i < pack->_entryCount; ++i) {
+		const pack::Entry &entry = pack->_entries[i];
+		if (entry._pathLength >= sizeof(path))
+			continue;
+
+		memcpy(path, pack->_strings + entry._pathOffset, entry._pathLength);
+		path[entry._pathLength] = 0;
+		callback(path, userData);
+	}
+
+	return LFS_OK;
+}
+
+#endif // LAMINAFS_DISABLE_PACK_DEVICE
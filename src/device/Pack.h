@@ -0,0 +1,63 @@
+#pragma once
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#if !defined(LAMINAFS_DISABLE_PACK_DEVICE)
+
+#include <cstddef>
+#include <cstdint>
+
+#include "FileContext.h"
+#include "device/MappedFile.h"
+#include "device/PackFormat.h"
+#include "util/WorkerPool.h"
+
+namespace laminaFS {
+
+//! Read-only device for pack files (see PackFormat.h). The pack is mapped into memory
+//! once, lookups binary search its table of contents and reads are a single copy.
+//! Compressed packs only decode the blocks a read touches, spread across worker threads.
+class PackDevice {
+public:
+	PackDevice() = delete;
+	PackDevice(Allocator *allocator);
+	~PackDevice();
+
+	static ErrorCode create(Allocator *allocator, const char *path, void **device);
+	static void destroy(void *device);
+
+	static bool fileExists(void *device, const char *filePath);
+	static size_t fileSize(void *device, const char *filePath, ErrorCode *outError);
+	static size_t readFile(void *device, const char *filePath, uint64_t offset, uint64_t maxBytes, lfs_allocator_t *, void **buffer, bool nullTerminate, ErrorCode *outError);
+
+	static ErrorCode prefetchFile(void *device, const char *filePath, uint64_t offset, uint64_t bytes);
+	static ErrorCode adviseFile(void *device, const char *filePath, uint64_t offset, uint64_t bytes, uint32_t flags);
+	static ErrorCode mapFile(void *device, const char *filePath, uint64_t offset, uint64_t maxBytes, lfs_allocator_t *, uint32_t flags, SharedBuffer **buffer);
+	static ErrorCode enumerate(void *device, FileContext::DeviceInterface::EnumerateCallback callback, void *userData);
+
+	//! The most threads, including the calling one, that decompress a single read.
+	static constexpr uint32_t kMaxDecompressThreads = 8;
+
+private:
+	void init();
+	static bool validate(const uint8_t *data, uint64_t size);
+	static bool validateBlocks(const uint8_t *data, uint64_t size, const pack::Entry &entry, uint32_t blockSize);
+	const pack::Entry *findEntry(const char *filePath) const;
+	const uint64_t *blockTable(const pack::Entry &entry) const;
+	bool readBlocks(const pack::Entry &entry, uint64_t offset, uint64_t bytes, uint8_t *buffer);
+
+	Allocator *_alloc;
+	MappedFile _file;
+
+	const pack::Entry *_entries = nullptr;
+	uint32_t _entryCount = 0;
+	const char *_strings = nullptr;
+
+	// non-zero for compressed packs
+	uint32_t _blockSize = 0;
+	util::WorkerPool *_workers = nullptr;
+};
+
+}
+
+#endif // LAMINAFS_DISABLE_PACK_DEVICE
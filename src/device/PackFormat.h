@@ -0,0 +1,83 @@
+#pragma once
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#include <cstdint>
+#include <cstring>
+
+namespace laminaFS {
+namespace pack {
+
+//! Pack files are laid out in host byte order as:
+//!   Header
+//!   TOC:     entryCount Entry structs at tocOffset, which is 8 byte aligned
+//!   strings: stringsBytes of paths at stringsOffset, not null terminated
+//!   data:    file contents, each starting at a multiple of the header's alignment
+//! Paths are device paths starting with a '/', hashed with FNV-1a (see Hash.h).
+//! The TOC is sorted with entryLess() so it can be binary searched.
+constexpr char kMagic[4] = {'L', 'F', 'S', 'p'};
+constexpr uint32_t kVersion = 1;
+
+struct Header {
+	char _magic[4];
+	uint32_t _version;
+	uint32_t _entryCount;
+	uint32_t _alignment;
+	uint64_t _tocOffset;
+	uint64_t _stringsOffset;
+	uint64_t _stringsBytes;
+};
+
+struct Entry {
+	uint64_t _pathHash;
+	uint64_t _offset;
+	uint64_t _size;
+	uint32_t _pathOffset;
+	uint32_t _pathLength;
+};
+
+//! Compressed packs start with a CompressedHeader whose header has kCompressedMagic, and
+//! their TOC starts right after it. Each file's data is split into blockSize blocks that
+//! are compressed independently (see util/Lz.h), and an entry's offset points at an
+//! 8 byte aligned table of blockCount + 1 uint64_t pack offsets. Block i is stored between
+//! table[i] and table[i + 1]; a block stored at its uncompressed size isn't compressed.
+constexpr char kCompressedMagic[4] = {'L', 'F', 'S', 'z'};
+constexpr uint32_t kCodecLZ = 1;
+constexpr uint32_t kMinBlockSize = 4 * 1024;
+constexpr uint32_t kMaxBlockSize = 16 * 1024 * 1024;
+
+struct CompressedHeader {
+	Header _header;
+	uint32_t _blockSize;
+	uint32_t _codec;
+};
+
+static_assert(sizeof(Header) == 40, "pack header must not be padded");
+static_assert(sizeof(Entry) == 32, "pack entries must not be padded");
+static_assert(sizeof(CompressedHeader) == 48, "compressed pack header must not be padded");
+
+//! @param size the uncompressed size of a file
+//! @param blockSize the block size of the pack
+//! @return the number of blocks the file is stored as
+inline uint64_t blockCount(uint64_t size, uint32_t blockSize) {
+	return (size + blockSize - 1) / blockSize;
+}
+
+//! Orders entries by path hash, and then by path.
+//! @param hashA the first path's hash
+//! @param pathA the first path
+//! @param lenA the first path's length
+//! @param hashB the second path's hash
+//! @param pathB the second path
+//! @param lenB the second path's length
+//! @return whether the first path comes before the second one
+inline bool entryLess(uint64_t hashA, const char *pathA, uint32_t lenA, uint64_t hashB, const char *pathB, uint32_t lenB) {
+	if (hashA != hashB)
+		return hashA < hashB;
+
+	int result = memcmp(pathA, pathB, lenA < lenB ? lenA : lenB);
+	return result < 0 || (result == 0 && lenA < lenB);
+}
+
+}
+}
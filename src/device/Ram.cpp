@@ -0,0 +1,469 @@
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+#if !defined(LAMINAFS_DISABLE_RAM_DEVICE)
+
+#include "Ram.h"
+#include "util/Hash.h"
+
+#if !defined(LAMINAFS_DISABLE_DIRECTORY_DEVICE)
+#include "device/Directory.h"
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+using namespace laminaFS;
+
+namespace {
+// paths are handled without their trailing slashes, which leaves the root empty
+uint32_t trimmedLength(const char *path) {
+	size_t length = strlen(path);
+	while (length > 0 && path[length - 1] == '/') {
+		--length;
+	}
+	return static_cast<uint32_t>(length);
+}
+}
+
+RamDevice::RamDevice(Allocator *allocator)
+: _alloc(allocator)
+{
+	for (uint32_t i = 0; i < kShardCount; ++i) {
+		_shards[i] = new(_alloc->alloc(_alloc->allocator, sizeof(Shard), alignof(Shard))) Shard(*_alloc);
+	}
+}
+
+RamDevice::~RamDevice() {
+	for (Shard *shard : _shards) {
+		for (auto &entry : shard->_nodes) {
+			for (Node *node = entry.second; node;) {
+				Node *next = node->_next;
+				freeNode(node);
+				node = next;
+			}
+		}
+
+		shard->~Shard();
+		_alloc->free(_alloc->allocator, shard);
+	}
+}
+
+ErrorCode RamDevice::create(Allocator *alloc, const char *path, void **device) {
+	RamDevice *ram = new(alloc->alloc(alloc->allocator, sizeof(RamDevice), alignof(RamDevice))) RamDevice(alloc);
+
+	ErrorCode returnCode = LFS_OK;
+	if (path && *path) {
+		returnCode = ram->preload(path);
+	}
+
+	if (returnCode != LFS_OK) {
+		destroy(ram);
+		ram = nullptr;
+	}
+
+	*device = ram;
+	return returnCode;
+}
+
+void RamDevice::destroy(void *device) {
+	RamDevice *ram = static_cast<RamDevice*>(device);
+	Allocator *alloc = ram->_alloc;
+	ram->~RamDevice();
+	alloc->free(alloc->allocator, device);
+}
+
+RamDevice::Node *RamDevice::findNode(Shard &shard, uint64_t hash, const char *path, uint32_t pathLength) {
+	auto it = shard._nodes.find(hash);
+	if (it == shard._nodes.end())
+		return nullptr;
+
+	for (Node *node = it->second; node; node = node->_next) {
+		if (node->_pathLength == pathLength && memcmp(node->path(), path, pathLength) == 0)
+			return node;
+	}
+
+	return nullptr;
+}
+
+RamDevice::Node *RamDevice::insertNode(Shard &shard, uint64_t hash, const char *path, uint32_t pathLength, bool directory) {
+	Node *node = static_cast<Node*>(_alloc->alloc(_alloc->allocator, sizeof(Node) + pathLength + 1, alignof(Node)));
+	if (!node)
+		return nullptr;
+
+	node->_data = nullptr;
+	node->_size = 0;
+	node->_capacity = 0;
+	node->_pathLength = pathLength;
+	node->_directory = directory;
+
+	char *nodePath = reinterpret_cast<char*>(node + 1);
+	memcpy(nodePath, path, pathLength);
+	nodePath[pathLength] = 0;
+
+	Node *&head = shard._nodes[hash];
+	node->_next = head;
+	head = node;
+	return node;
+}
+
+void RamDevice::eraseNode(Shard &shard, uint64_t hash, Node *node) {
+	auto it = shard._nodes.find(hash);
+	Node **link = &it->second;
+	while (*link != node) {
+		link = &(*link)->_next;
+	}
+	*link = node->_next;
+
+	if (!it->second) {
+		shard._nodes.erase(it);
+	}
+
+	freeNode(node);
+}
+
+void RamDevice::freeNode(Node *node) {
+	if (node->_data) {
+		_alloc->free(_alloc->allocator, node->_data);
+	}
+	_alloc->free(_alloc->allocator, node);
+}
+
+bool RamDevice::reserve(Node *node, uint64_t capacity) {
+	if (capacity <= node->_capacity)
+		return true;
+
+	// grow geometrically so that files built up by appending don't copy on every write
+	capacity = std::max(capacity, node->_capacity * 2);
+	uint8_t *data = static_cast<uint8_t*>(_alloc->alloc(_alloc->allocator, capacity, 1));
+	if (!data)
+		return false;
+
+	if (node->_data) {
+		memcpy(data, node->_data, node->_size);
+		_alloc->free(_alloc->allocator, node->_data);
+	}
+
+	node->_data = data;
+	node->_capacity = capacity;
+	return true;
+}
+
+bool RamDevice::directoryExists(const char *path, uint32_t pathLength) {
+	if (pathLength == 0)
+		return true;
+
+	uint64_t hash = util::hashBytes(path, pathLength);
+	Shard &shard = shardFor(hash);
+	std::lock_guard<std::mutex> lock(shard._mutex);
+
+	Node *node = findNode(shard, hash, path, pathLength);
+	return node && node->_directory;
+}
+
+bool RamDevice::parentExists(const char *path, uint32_t pathLength) {
+	uint32_t parentLength = pathLength;
+	while (parentLength > 0 && path[parentLength - 1] != '/') {
+		--parentLength;
+	}
+
+	return parentLength <= 1 || directoryExists(path, parentLength - 1);
+}
+
+ErrorCode RamDevice::addDirectories(const char *path, uint32_t pathLength) {
+	for (uint32_t i = 1; i < pathLength; ++i) {
+		if (path[i] != '/')
+			continue;
+
+		uint64_t hash = util::hashBytes(path, i);
+		Shard &shard = shardFor(hash);
+		std::lock_guard<std::mutex> lock(shard._mutex);
+
+		if (!findNode(shard, hash, path, i) && !insertNode(shard, hash, path, i, true))
+			return LFS_OUT_OF_SPACE;
+	}
+
+	return LFS_OK;
+}
+
+ErrorCode RamDevice::preload(const char *path) {
+#if defined(LAMINAFS_DISABLE_DIRECTORY_DEVICE)
+	(void)path;
+	return LFS_UNSUPPORTED;
+#else
+	void *directory = nullptr;
+	ErrorCode returnCode = DirectoryDevice::create(_alloc, path, &directory);
+	if (returnCode != LFS_OK)
+		return returnCode;
+
+	struct PreloadState {
+		RamDevice *_ram;
+		void *_directory;
+		ErrorCode _result;
+	} state = {this, directory, LFS_OK};
+
+	returnCode = DirectoryDevice::enumerate(directory, [](const char *filePath, void *userData) {
+		PreloadState *state = static_cast<PreloadState*>(userData);
+		if (state->_result != LFS_OK)
+			return;
+
+		RamDevice *ram = state->_ram;
+		uint32_t pathLength = trimmedLength(filePath);
+		ErrorCode result = ram->addDirectories(filePath, pathLength);
+
+		void *data = nullptr;
+		size_t bytes = 0;
+		if (result == LFS_OK) {
+			bytes = DirectoryDevice::readFile(state->_directory, filePath, 0, UINT64_MAX, ram->_alloc, &data, false, &result);
+		}
+
+		if (result == LFS_OK) {
+			uint64_t hash = util::hashBytes(filePath, pathLength);
+			Shard &shard = ram->shardFor(hash);
+			std::lock_guard<std::mutex> lock(shard._mutex);
+
+			// the file's buffer is handed over as is
+			Node *node = ram->insertNode(shard, hash, filePath, pathLength, false);
+			if (node) {
+				node->_data = static_cast<uint8_t*>(data);
+				node->_size = bytes;
+				node->_capacity = bytes;
+				data = nullptr;
+			} else {
+				result = LFS_OUT_OF_SPACE;
+			}
+		}
+
+		if (data) {
+			ram->_alloc->free(ram->_alloc->allocator, data);
+		}
+		state->_result = result;
+	}, &state);
+
+	DirectoryDevice::destroy(directory);
+	return returnCode != LFS_OK ? returnCode : state._result;
+#endif
+}
+
+bool RamDevice::fileExists(void *device, const char *filePath) {
+	RamDevice *ram = static_cast<RamDevice*>(device);
+	uint32_t pathLength = trimmedLength(filePath);
+	uint64_t hash = util::hashBytes(filePath, pathLength);
+
+	Shard &shard = ram->shardFor(hash);
+	std::lock_guard<std::mutex> lock(shard._mutex);
+
+	Node *node = ram->findNode(shard, hash, filePath, pathLength);
+	return node && !node->_directory;
+}
+
+size_t RamDevice::fileSize(void *device, const char *filePath, ErrorCode *outError) {
+	RamDevice *ram = static_cast<RamDevice*>(device);
+	uint32_t pathLength = trimmedLength(filePath);
+	uint64_t hash = util::hashBytes(filePath, pathLength);
+
+	Shard &shard = ram->shardFor(hash);
+	std::lock_guard<std::mutex> lock(shard._mutex);
+
+	Node *node = ram->findNode(shard, hash, filePath, pathLength);
+	if (!node || node->_directory) {
+		*outError = LFS_NOT_FOUND;
+		return 0;
+	}
+
+	*outError = LFS_OK;
+	return node->_size;
+}
+
+size_t RamDevice::readFile(void *device, const char *filePath, uint64_t offset, uint64_t maxBytes, Allocator *alloc, void **buffer, bool nullTerminate, ErrorCode *outError) {
+	RamDevice *ram = static_cast<RamDevice*>(device);
+	uint32_t pathLength = trimmedLength(filePath);
+	uint64_t hash = util::hashBytes(filePath, pathLength);
+	*buffer = nullptr;
+
+	Shard &shard = ram->shardFor(hash);
+	std::lock_guard<std::mutex> lock(shard._mutex);
+
+	Node *node = ram->findNode(shard, hash, filePath, pathLength);
+	if (!node || node->_directory) {
+		*outError = LFS_NOT_FOUND;
+		return 0;
+	}
+
+	uint64_t bytes = offset < node->_size ? std::min(node->_size - offset, maxBytes) : 0;
+	*outError = LFS_OK;
+
+	if (bytes == 0) {
+		// Zero-byte read.
+		return 0;
+	}
+
+	uint8_t *result = static_cast<uint8_t*>(alloc->alloc(alloc->allocator, bytes + (nullTerminate ? 1 : 0), 1));
+	if (!result) {
+		*outError = LFS_GENERIC_ERROR;
+		return 0;
+	}
+
+	memcpy(result, node->_data + offset, bytes);
+	if (nullTerminate) {
+		result[bytes] = 0;
+	}
+
+	*buffer = result;
+	return bytes;
+}
+
+size_t RamDevice::writeFile(void *device, const char *filePath, uint64_t offset, void *buffer, size_t bytesToWrite, lfs_write_mode_t writeMode, ErrorCode *outError) {
+	RamDevice *ram = static_cast<RamDevice*>(device);
+	uint32_t pathLength = trimmedLength(filePath);
+	uint64_t hash = util::hashBytes(filePath, pathLength);
+
+	if (pathLength == 0 || !ram->parentExists(filePath, pathLength)) {
+		*outError = LFS_NOT_FOUND;
+		return 0;
+	}
+
+	Shard &shard = ram->shardFor(hash);
+	std::lock_guard<std::mutex> lock(shard._mutex);
+
+	Node *node = ram->findNode(shard, hash, filePath, pathLength);
+	if (node && node->_directory) {
+		*outError = LFS_ALREADY_EXISTS;
+		return 0;
+	}
+
+	if (!node) {
+		if (writeMode == LFS_WRITE_SEGMENT) {
+			*outError = LFS_NOT_FOUND;
+			return 0;
+		}
+
+		node = ram->insertNode(shard, hash, filePath, pathLength, false);
+		if (!node) {
+			*outError = LFS_OUT_OF_SPACE;
+			return 0;
+		}
+	}
+
+	uint64_t start = offset;
+	if (writeMode == LFS_WRITE_TRUNCATE) {
+		node->_size = 0;
+		start = 0;
+	} else if (writeMode == LFS_WRITE_APPEND) {
+		start = node->_size;
+	}
+
+	if (!ram->reserve(node, start + bytesToWrite)) {
+		*outError = LFS_OUT_OF_SPACE;
+		return 0;
+	}
+
+	// segment writes past the end leave a zero-filled gap, like a sparse file
+	if (start > node->_size) {
+		memset(node->_data + node->_size, 0, start - node->_size);
+	}
+
+	if (bytesToWrite > 0) {
+		memcpy(node->_data + start, buffer, bytesToWrite);
+	}
+	node->_size = std::max(node->_size, start + bytesToWrite);
+
+	*outError = LFS_OK;
+	return bytesToWrite;
+}
+
+ErrorCode RamDevice::deleteFile(void *device, const char *filePath) {
+	RamDevice *ram = static_cast<RamDevice*>(device);
+	uint32_t pathLength = trimmedLength(filePath);
+	uint64_t hash = util::hashBytes(filePath, pathLength);
+
+	Shard &shard = ram->shardFor(hash);
+	std::lock_guard<std::mutex> lock(shard._mutex);
+
+	Node *node = ram->findNode(shard, hash, filePath, pathLength);
+	if (!node || node->_directory)
+		return LFS_NOT_FOUND;
+
+	ram->eraseNode(shard, hash, node);
+	return LFS_OK;
+}
+
+ErrorCode RamDevice::createDir(void *device, const char *path) {
+	RamDevice *ram = static_cast<RamDevice*>(device);
+	uint32_t pathLength = trimmedLength(path);
+	uint64_t hash = util::hashBytes(path, pathLength);
+
+	if (pathLength == 0)
+		return LFS_ALREADY_EXISTS;
+
+	if (!ram->parentExists(path, pathLength))
+		return LFS_NOT_FOUND;
+
+	Shard &shard = ram->shardFor(hash);
+	std::lock_guard<std::mutex> lock(shard._mutex);
+
+	if (ram->findNode(shard, hash, path, pathLength))
+		return LFS_ALREADY_EXISTS;
+
+	return ram->insertNode(shard, hash, path, pathLength, true) ? LFS_OK : LFS_OUT_OF_SPACE;
+}
+
+ErrorCode RamDevice::deleteDir(void *device, const char *path) {
+	RamDevice *ram = static_cast<RamDevice*>(device);
+	uint32_t pathLength = trimmedLength(path);
+
+	if (pathLength > 0) {
+		uint64_t hash = util::hashBytes(path, pathLength);
+		Shard &shard = ram->shardFor(hash);
+		std::lock_guard<std::mutex> lock(shard._mutex);
+
+		Node *node = ram->findNode(shard, hash, path, pathLength);
+		if (!node)
+			return LFS_NOT_FOUND;
+		if (!node->_directory)
+			return LFS_GENERIC_ERROR;
+	}
+
+	// the directory's contents can be in any shard, so every one is swept
+	for (Shard *shard : ram->_shards) {
+		std::lock_guard<std::mutex> lock(shard->_mutex);
+
+		for (auto it = shard->_nodes.begin(); it != shard->_nodes.end();) {
+			Node **link = &it->second;
+			while (Node *node = *link) {
+				bool inside = node->_pathLength >= pathLength && memcmp(node->path(), path, pathLength) == 0
+					&& (node->_pathLength == pathLength || node->path()[pathLength] == '/');
+
+				if (inside) {
+					*link = node->_next;
+					ram->freeNode(node);
+				} else {
+					link = &node->_next;
+				}
+			}
+
+			it = it->second ? std::next(it) : shard->_nodes.erase(it);
+		}
+	}
+
+	return LFS_OK;
+}
+
+ErrorCode RamDevice::enumerate(void *device, FileContext::DeviceInterface::EnumerateCallback callback, void *userData) {
+	RamDevice *ram = static_cast<RamDevice*>(device);
+
+	for (Shard *shard : ram->_shards) {
+		std::lock_guard<std::mutex> lock(shard->_mutex);
+
+		for (auto &entry : shard->_nodes) {
+			for (Node *node = entry.second; node; node = node->_next) {
+				if (!node->_directory) {
+					callback(node->path(), userData);
+				}
+			}
+		}
+	}
+
+	return LFS_OK;
+}
+
+#endif // LAMINAFS_DISABLE_RAM_DEVICE
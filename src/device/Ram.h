@@ -0,0 +1,88 @@
+#pragma once
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#if !defined(LAMINAFS_DISABLE_RAM_DEVICE)
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+#include "FileContext.h"
+#include "util/AllocatorAdapter.h"
+
+namespace laminaFS {
+
+//! Device that keeps its files in memory. Paths live in a hash map split into
+//! independently locked shards, so it can be used from several threads. The device path
+//! names a directory to copy into memory at mount time, or is empty for a device that
+//! starts out empty. Nothing is ever written back to disk.
+class RamDevice {
+public:
+	RamDevice() = delete;
+	RamDevice(Allocator *allocator);
+	~RamDevice();
+
+	static ErrorCode create(Allocator *allocator, const char *path, void **device);
+	static void destroy(void *device);
+
+	static bool fileExists(void *device, const char *filePath);
+	static size_t fileSize(void *device, const char *filePath, ErrorCode *outError);
+	static size_t readFile(void *device, const char *filePath, uint64_t offset, uint64_t maxBytes, lfs_allocator_t *, void **buffer, bool nullTerminate, ErrorCode *outError);
+
+	static size_t writeFile(void *device, const char *filePath, uint64_t offset, void *buffer, size_t bytesToWrite, lfs_write_mode_t writeMode, ErrorCode *outError);
+	static ErrorCode deleteFile(void *device, const char *filePath);
+
+	static ErrorCode createDir(void *device, const char *path);
+	static ErrorCode deleteDir(void *device, const char *path);
+
+	//! Enumerates files, not directories. The callback must not call back into the device.
+	static ErrorCode enumerate(void *device, FileContext::DeviceInterface::EnumerateCallback callback, void *userData);
+
+	static constexpr uint32_t kShardCount = 16;
+
+private:
+	// a file or directory, with its path stored right after it
+	struct Node {
+		Node *_next; // other nodes with the same path hash
+		uint8_t *_data;
+		uint64_t _size;
+		uint64_t _capacity;
+		uint32_t _pathLength;
+		bool _directory;
+
+		const char *path() const { return reinterpret_cast<const char*>(this + 1); }
+	};
+
+	typedef std::unordered_map<uint64_t, Node*, std::hash<uint64_t>, std::equal_to<uint64_t>, AllocatorAdapter<std::pair<const uint64_t, Node*>>> NodeMap;
+
+	struct Shard {
+		Shard(Allocator &alloc) : _nodes(AllocatorAdapter<std::pair<const uint64_t, Node*>>(alloc)) {}
+
+		std::mutex _mutex;
+		NodeMap _nodes;
+	};
+
+	Shard &shardFor(uint64_t hash) { return *_shards[hash >> 60]; }
+
+	// the shard's lock must be held for these
+	Node *findNode(Shard &shard, uint64_t hash, const char *path, uint32_t pathLength);
+	Node *insertNode(Shard &shard, uint64_t hash, const char *path, uint32_t pathLength, bool directory);
+	void eraseNode(Shard &shard, uint64_t hash, Node *node);
+	void freeNode(Node *node);
+	bool reserve(Node *node, uint64_t capacity);
+
+	bool directoryExists(const char *path, uint32_t pathLength);
+	bool parentExists(const char *path, uint32_t pathLength);
+	ErrorCode addDirectories(const char *path, uint32_t pathLength);
+	ErrorCode preload(const char *path);
+
+	Allocator *_alloc;
+	Shard *_shards[kShardCount];
+};
+
+}
+
+#endif // LAMINAFS_DISABLE_RAM_DEVICE
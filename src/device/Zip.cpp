@@ -0,0 +1,435 @@
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+#if !defined(LAMINAFS_DISABLE_ZIP_DEVICE)
+
+#include "Zip.h"
+#include "device/PackFormat.h"
+#include "util/Hash.h"
+#include "util/Inflate.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace laminaFS;
+
+namespace {
+constexpr uint32_t kEndOfCentralDirSignature = 0x06054b50;
+constexpr uint32_t kZip64EndOfCentralDirSignature = 0x06064b50;
+constexpr uint32_t kZip64LocatorSignature = 0x07064b50;
+constexpr uint32_t kCentralDirSignature = 0x02014b50;
+constexpr uint32_t kLocalHeaderSignature = 0x04034b50;
+
+constexpr uint64_t kEndOfCentralDirBytes = 22;
+constexpr uint64_t kZip64EndOfCentralDirBytes = 56;
+constexpr uint64_t kZip64LocatorBytes = 20;
+constexpr uint64_t kCentralDirHeaderBytes = 46;
+constexpr uint64_t kLocalHeaderBytes = 30;
+constexpr uint64_t kMaxCommentBytes = 65535;
+
+constexpr uint16_t kZip64ExtraId = 0x0001;
+constexpr uint16_t kFlagEncrypted = 0x0001;
+constexpr uint16_t kMethodStored = 0;
+constexpr uint16_t kMethodDeflated = 8;
+
+// zip fields are little endian
+uint16_t read16(const uint8_t *p) {
+	return static_cast<uint16_t>(p[0] | p[1] << 8);
+}
+
+uint32_t read32(const uint8_t *p) {
+	return static_cast<uint32_t>(read16(p)) | static_cast<uint32_t>(read16(p + 2)) << 16;
+}
+
+uint64_t read64(const uint8_t *p) {
+	return static_cast<uint64_t>(read32(p)) | static_cast<uint64_t>(read32(p + 4)) << 32;
+}
+}
+
+ZipDevice::ZipDevice(Allocator *allocator)
+: _alloc(allocator)
+, _entries(AllocatorAdapter<Entry>(*allocator))
+{
+}
+
+ZipDevice::~ZipDevice() {
+	for (InflatedEntry &inflated : _inflated) {
+		SharedBufferRelease(inflated._data);
+	}
+}
+
+ErrorCode ZipDevice::create(Allocator *alloc, const char *path, void **device) {
+	ZipDevice *zip = new(alloc->alloc(alloc->allocator, sizeof(ZipDevice), alignof(ZipDevice))) ZipDevice(alloc);
+
+	ErrorCode returnCode = zip->_file.open(path);
+	if (returnCode == LFS_OK && !zip->readCentralDirectory()) {
+		returnCode = LFS_UNSUPPORTED;
+	}
+
+	if (returnCode != LFS_OK) {
+		destroy(zip);
+		zip = nullptr;
+	}
+
+	*device = zip;
+	return returnCode;
+}
+
+void ZipDevice::destroy(void *device) {
+	ZipDevice *zip = static_cast<ZipDevice*>(device);
+	Allocator *alloc = zip->_alloc;
+	zip->~ZipDevice();
+	alloc->free(alloc->allocator, device);
+}
+
+bool ZipDevice::readCentralDirectory() {
+	const uint8_t *data = _file._data;
+	uint64_t size = _file._size;
+	if (size < kEndOfCentralDirBytes)
+		return false;
+
+	// the end of central directory record is followed by a comment of up to 64KB
+	uint64_t eocd = size - kEndOfCentralDirBytes;
+	uint64_t searchEnd = eocd > kMaxCommentBytes ? eocd - kMaxCommentBytes : 0;
+	while (read32(data + eocd) != kEndOfCentralDirSignature) {
+		if (eocd == searchEnd)
+			return false;
+		--eocd;
+	}
+
+	uint64_t entryCount = read16(data + eocd + 10);
+	uint64_t dirBytes = read32(data + eocd + 12);
+	uint64_t dirOffset = read32(data + eocd + 16);
+
+	// split archives aren't supported
+	if (read16(data + eocd + 4) != 0 || read16(data + eocd + 6) != 0)
+		return false;
+
+	if (entryCount == 0xffff || dirBytes == 0xffffffff || dirOffset == 0xffffffff) {
+		if (eocd < kZip64LocatorBytes || read32(data + eocd - kZip64LocatorBytes) != kZip64LocatorSignature)
+			return false;
+
+		uint64_t zip64Eocd = read64(data + eocd - kZip64LocatorBytes + 8);
+		if (zip64Eocd > size || size - zip64Eocd < kZip64EndOfCentralDirBytes || read32(data + zip64Eocd) != kZip64EndOfCentralDirSignature)
+			return false;
+
+		entryCount = read64(data + zip64Eocd + 32);
+		dirBytes = read64(data + zip64Eocd + 40);
+		dirOffset = read64(data + zip64Eocd + 48);
+	}
+
+	if (dirOffset > size || dirBytes > size - dirOffset || entryCount > dirBytes / kCentralDirHeaderBytes)
+		return false;
+
+	_entries.reserve(static_cast<size_t>(entryCount));
+
+	const uint8_t *cursor = data + dirOffset;
+	const uint8_t *dirEnd = cursor + dirBytes;
+	for (uint64_t i = 0; i < entryCount; ++i) {
+		if (static_cast<uint64_t>(dirEnd - cursor) < kCentralDirHeaderBytes || read32(cursor) != kCentralDirSignature)
+			return false;
+
+		uint32_t nameLength = read16(cursor + 28);
+		uint32_t extraLength = read16(cursor + 30);
+		uint32_t commentLength = read16(cursor + 32);
+		if (static_cast<uint64_t>(dirEnd - cursor) - kCentralDirHeaderBytes < static_cast<uint64_t>(nameLength) + extraLength + commentLength)
+			return false;
+
+		Entry entry;
+		entry._name = reinterpret_cast<const char*>(cursor + kCentralDirHeaderBytes);
+		entry._nameLength = nameLength;
+		entry._flags = read16(cursor + 8);
+		entry._method = read16(cursor + 10);
+		entry._compressedSize = read32(cursor + 20);
+		entry._size = read32(cursor + 24);
+		entry._localHeaderOffset = read32(cursor + 42);
+
+		// sizes and offsets that don't fit in 32 bits are moved to the zip64 extra field, in this order
+		const uint8_t *extra = cursor + kCentralDirHeaderBytes + nameLength;
+		const uint8_t *extraEnd = extra + extraLength;
+		while (extraEnd - extra >= 4) {
+			uint16_t id = read16(extra);
+			uint16_t fieldLength = read16(extra + 2);
+			const uint8_t *field = extra + 4;
+			if (fieldLength > extraEnd - field)
+				break;
+
+			if (id == kZip64ExtraId) {
+				const uint8_t *fieldEnd = field + fieldLength;
+				uint64_t *values[] = {&entry._size, &entry._compressedSize, &entry._localHeaderOffset};
+				for (uint64_t *value : values) {
+					if (*value != 0xffffffff)
+						continue;
+					if (fieldEnd - field < 8)
+						return false;
+					*value = read64(field);
+					field += 8;
+				}
+			}
+
+			extra += 4 + fieldLength;
+		}
+
+		cursor += kCentralDirHeaderBytes + nameLength + extraLength + commentLength;
+
+		// directories are implied by the files in them
+		if (nameLength == 0 || entry._name[nameLength - 1] == '/')
+			continue;
+
+		entry._pathHash = util::hashBytes(entry._name, nameLength, util::hashBytes("/", 1));
+		_entries.push_back(entry);
+	}
+
+	std::sort(_entries.begin(), _entries.end(), [](const Entry &a, const Entry &b) {
+		return pack::entryLess(a._pathHash, a._name, a._nameLength, b._pathHash, b._name, b._nameLength);
+	});
+
+	return true;
+}
+
+const ZipDevice::Entry *ZipDevice::findEntry(const char *filePath) const {
+	if (filePath[0] != '/')
+		return nullptr;
+
+	const char *name = filePath + 1;
+	uint32_t nameLength = static_cast<uint32_t>(strlen(name));
+	uint64_t hash = util::hashBytes(filePath, nameLength + 1);
+
+	auto it = std::lower_bound(_entries.begin(), _entries.end(), hash, [name, nameLength](const Entry &e, uint64_t h) {
+		return pack::entryLess(e._pathHash, e._name, e._nameLength, h, name, nameLength);
+	});
+
+	if (it != _entries.end() && it->_pathHash == hash && it->_nameLength == nameLength && memcmp(it->_name, name, nameLength) == 0) {
+		return &*it;
+	}
+
+	return nullptr;
+}
+
+bool ZipDevice::dataOffset(const Entry &entry, uint64_t &offset) const {
+	const uint8_t *data = _file._data;
+	uint64_t size = _file._size;
+
+	// the local header's name and extra field lengths can differ from the central directory's
+	uint64_t header = entry._localHeaderOffset;
+	if (header > size || size - header < kLocalHeaderBytes || read32(data + header) != kLocalHeaderSignature)
+		return false;
+
+	offset = header + kLocalHeaderBytes + read16(data + header + 26) + read16(data + header + 28);
+	return offset <= size && entry._compressedSize <= size - offset;
+}
+
+bool ZipDevice::fileExists(void *device, const char *filePath) {
+	return static_cast<ZipDevice*>(device)->findEntry(filePath) != nullptr;
+}
+
+size_t ZipDevice::fileSize(void *device, const char *filePath, ErrorCode *outError) {
+	const Entry *entry = static_cast<ZipDevice*>(device)->findEntry(filePath);
+	*outError = entry ? LFS_OK : LFS_NOT_FOUND;
+	return entry ? static_cast<size_t>(entry->_size) : 0;
+}
+
+size_t ZipDevice::readFile(void *device, const char *filePath, uint64_t offset, uint64_t maxBytes, Allocator *alloc, void **buffer, bool nullTerminate, ErrorCode *outError) {
+	ZipDevice *zip = static_cast<ZipDevice*>(device);
+	const Entry *entry = zip->findEntry(filePath);
+	*buffer = nullptr;
+
+	if (!entry) {
+		*outError = LFS_NOT_FOUND;
+		return 0;
+	}
+
+	if ((entry->_flags & kFlagEncrypted) != 0 || (entry->_method != kMethodStored && entry->_method != kMethodDeflated)) {
+		*outError = LFS_UNSUPPORTED;
+		return 0;
+	}
+
+	uint64_t start = 0;
+	if (!zip->dataOffset(*entry, start) || (entry->_method == kMethodStored && entry->_compressedSize != entry->_size)) {
+		*outError = LFS_GENERIC_ERROR;
+		return 0;
+	}
+
+	uint64_t bytes = offset < entry->_size ? std::min(entry->_size - offset, maxBytes) : 0;
+	*outError = LFS_OK;
+
+	if (bytes == 0) {
+		// Zero-byte read.
+		return 0;
+	}
+
+	uint8_t *result = static_cast<uint8_t*>(alloc->alloc(alloc->allocator, bytes + (nullTerminate ? 1 : 0), 1));
+	if (!result) {
+		*outError = LFS_GENERIC_ERROR;
+		return 0;
+	}
+
+	const uint8_t *compressed = zip->_file._data + start;
+	if (entry->_method == kMethodStored) {
+		memcpy(result, compressed + offset, bytes);
+	} else if (offset == 0) {
+		size_t written = 0;
+		util::Inflater::Result inflated = util::Inflater::inflate(compressed, entry->_compressedSize, result, bytes, &written);
+
+		bool complete = inflated == util::Inflater::Result::Done ? written == entry->_size : inflated == util::Inflater::Result::OutputFull;
+		if (!complete || written != bytes) {
+			alloc->free(alloc->allocator, result);
+			*outError = LFS_GENERIC_ERROR;
+			return 0;
+		}
+	} else {
+		// deflate streams can only be decoded from the start, so the whole entry is decoded
+		// once and the following segments are copied out of it
+		SharedBuffer *inflated = zip->acquireInflated(*entry, start);
+		if (!inflated) {
+			alloc->free(alloc->allocator, result);
+			*outError = LFS_GENERIC_ERROR;
+			return 0;
+		}
+
+		memcpy(result, static_cast<const uint8_t*>(SharedBufferGetData(inflated)) + offset, bytes);
+		SharedBufferRelease(inflated);
+	}
+
+	if (nullTerminate) {
+		result[bytes] = 0;
+	}
+
+	*buffer = result;
+	return static_cast<size_t>(bytes);
+}
+
+SharedBuffer *ZipDevice::acquireInflated(const Entry &entry, uint64_t start) {
+	{
+		std::lock_guard<std::mutex> lock(_inflatedMutex);
+		for (InflatedEntry &inflated : _inflated) {
+			if (inflated._entry == &entry) {
+				inflated._lastUse = ++_inflatedClock;
+				SharedBufferRetain(inflated._data);
+				return inflated._data;
+			}
+		}
+	}
+
+	// decoded without holding the lock, so other entries can be read in the meantime
+	void *data = _alloc->alloc(_alloc->allocator, entry._size, 1);
+	if (!data) {
+		return nullptr;
+	}
+
+	size_t written = 0;
+	util::Inflater::Result result = util::Inflater::inflate(_file._data + start, entry._compressedSize, data, entry._size, &written);
+	if (result == util::Inflater::Result::Malformed || written != entry._size) {
+		_alloc->free(_alloc->allocator, data);
+		return nullptr;
+	}
+
+	SharedBuffer *buffer = SharedBufferCreate(*_alloc, data, entry._size);
+
+	std::lock_guard<std::mutex> lock(_inflatedMutex);
+
+	// replace another thread's copy of the same entry, or else the least recently used one
+	InflatedEntry *slot = nullptr;
+	for (InflatedEntry &inflated : _inflated) {
+		if (inflated._entry == &entry) {
+			slot = &inflated;
+			break;
+		} else if (!slot || inflated._lastUse < slot->_lastUse) {
+			slot = &inflated;
+		}
+	}
+
+	SharedBufferRelease(slot->_data);
+	slot->_entry = &entry;
+	slot->_data = buffer;
+	slot->_lastUse = ++_inflatedClock;
+
+	// the newest entry is always kept, even if it's over budget on its own
+	for (;;) {
+		uint64_t total = 0;
+		InflatedEntry *oldest = nullptr;
+		for (InflatedEntry &inflated : _inflated) {
+			total += SharedBufferGetSize(inflated._data);
+			if (inflated._data && &inflated != slot && (!oldest || inflated._lastUse < oldest->_lastUse)) {
+				oldest = &inflated;
+			}
+		}
+
+		if (total <= kInflatedBudgetBytes || !oldest) {
+			break;
+		}
+
+		SharedBufferRelease(oldest->_data);
+		*oldest = InflatedEntry();
+	}
+
+	SharedBufferRetain(buffer);
+	return buffer;
+}
+
+ErrorCode ZipDevice::prefetchFile(void *device, const char *filePath, uint64_t offset, uint64_t bytes) {
+	return adviseFile(device, filePath, offset, bytes, LFS_READ_WILLNEED);
+}
+
+ErrorCode ZipDevice::adviseFile(void *device, const char *filePath, uint64_t offset, uint64_t bytes, uint32_t flags) {
+	ZipDevice *zip = static_cast<ZipDevice*>(device);
+	const Entry *entry = zip->findEntry(filePath);
+
+	if (!entry) {
+		return LFS_NOT_FOUND;
+	}
+
+	uint64_t start = 0;
+	if (offset < entry->_size && zip->dataOffset(*entry, start)) {
+		if (entry->_method == kMethodStored) {
+			zip->_file.advise(start + offset, std::min(bytes, entry->_size - offset), flags);
+		} else {
+			// compressed ranges don't line up with uncompressed ones, the whole stream up to them is needed
+			zip->_file.advise(start, entry->_compressedSize, flags);
+		}
+	}
+
+	return LFS_OK;
+}
+
+ErrorCode ZipDevice::mapFile(void *device, const char *filePath, uint64_t offset, uint64_t maxBytes, Allocator *, uint32_t flags, SharedBuffer **buffer) {
+	ZipDevice *zip = static_cast<ZipDevice*>(device);
+	const Entry *entry = zip->findEntry(filePath);
+	*buffer = nullptr;
+
+	if (!entry) {
+		return LFS_NOT_FOUND;
+	}
+
+	// only stored entries are in the archive as is, readFile() handles everything else
+	uint64_t start = 0;
+	if ((entry->_flags & kFlagEncrypted) != 0 || entry->_method != kMethodStored || entry->_compressedSize != entry->_size || !zip->dataOffset(*entry, start)) {
+		return LFS_UNSUPPORTED;
+	}
+
+	uint64_t bytes = offset < entry->_size ? std::min(entry->_size - offset, maxBytes) : 0;
+	if (bytes > 0) {
+		zip->_file.advise(start + offset, bytes, flags);
+		*buffer = zip->_file.view(*zip->_alloc, start + offset, bytes);
+	}
+
+	return LFS_OK;
+}
+
+ErrorCode ZipDevice::enumerate(void *device, FileContext::DeviceInterface::EnumerateCallback callback, void *userData) {
+	ZipDevice *zip = static_cast<ZipDevice*>(device);
+
+	char path[1024];
+	path[0] = '/';
+	for (const Entry &entry : zip->_entries) {
+		if (entry._nameLength + 1 >= sizeof(path))
+			continue;
+
+		memcpy(path + 1, entry._name, entry._nameLength);
+		path[entry._nameLength + 1] = 0;
+		callback(path, userData);
+	}
+
+	return LFS_OK;
+}
+
+#endif // LAMINAFS_DISABLE_ZIP_DEVICE
@@ -0,0 +1,80 @@
+#pragma once
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#if !defined(LAMINAFS_DISABLE_ZIP_DEVICE)
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "FileContext.h"
+#include "device/MappedFile.h"
+#include "util/AllocatorAdapter.h"
+
+namespace laminaFS {
+
+//! Read-only device for zip files. The archive is mapped into memory and its central
+//! directory is indexed once at mount time, without touching the file data. Stored
+//! entries are copied straight out of the mapping, deflated ones are inflated into the
+//! result buffer. Reading a deflated entry from an offset inflates all of it, which is kept
+//! for the next few such reads. Encrypted entries and other compression methods can't be read.
+class ZipDevice {
+public:
+	ZipDevice() = delete;
+	ZipDevice(Allocator *allocator);
+	~ZipDevice();
+
+	static ErrorCode create(Allocator *allocator, const char *path, void **device);
+	static void destroy(void *device);
+
+	static bool fileExists(void *device, const char *filePath);
+	static size_t fileSize(void *device, const char *filePath, ErrorCode *outError);
+	static size_t readFile(void *device, const char *filePath, uint64_t offset, uint64_t maxBytes, lfs_allocator_t *, void **buffer, bool nullTerminate, ErrorCode *outError);
+
+	static ErrorCode prefetchFile(void *device, const char *filePath, uint64_t offset, uint64_t bytes);
+	static ErrorCode adviseFile(void *device, const char *filePath, uint64_t offset, uint64_t bytes, uint32_t flags);
+	static ErrorCode mapFile(void *device, const char *filePath, uint64_t offset, uint64_t maxBytes, lfs_allocator_t *, uint32_t flags, SharedBuffer **buffer);
+	static ErrorCode enumerate(void *device, FileContext::DeviceInterface::EnumerateCallback callback, void *userData);
+
+private:
+	struct Entry {
+		uint64_t _pathHash;
+		const char *_name; // in the mapping, without the leading '/'
+		uint32_t _nameLength;
+		uint16_t _method;
+		uint16_t _flags;
+		uint64_t _compressedSize;
+		uint64_t _size;
+		uint64_t _localHeaderOffset;
+	};
+
+	// a whole inflated entry, so that reading it in segments doesn't decode the start of
+	// the stream again for every one of them
+	struct InflatedEntry {
+		const Entry *_entry = nullptr;
+		SharedBuffer *_data = nullptr;
+		uint64_t _lastUse = 0;
+	};
+
+	static constexpr uint32_t kInflatedEntryCount = 4;
+	static constexpr uint64_t kInflatedBudgetBytes = 64 * 1024 * 1024;
+
+	bool readCentralDirectory();
+	const Entry *findEntry(const char *filePath) const;
+	bool dataOffset(const Entry &entry, uint64_t &offset) const;
+	SharedBuffer *acquireInflated(const Entry &entry, uint64_t start);
+
+	Allocator *_alloc;
+	MappedFile _file;
+	std::vector<Entry, AllocatorAdapter<Entry>> _entries;
+
+	std::mutex _inflatedMutex;
+	InflatedEntry _inflated[kInflatedEntryCount];
+	uint64_t _inflatedClock = 0;
+};
+
+}
+
+#endif // LAMINAFS_DISABLE_ZIP_DEVICE
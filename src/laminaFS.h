@@ -3,4 +3,5 @@
 // See LICENSE for license information.
 
 #include "FileContext.h"
+#include "BlockCache.h"
 
@@ -7,6 +7,7 @@
 using namespace laminaFS;
 
 #define CTX(x) static_cast<FileContext*>(x._value)
+#define CACHE(x) static_cast<BlockCache*>(x._value)
 
 lfs_context_t lfs_context_create(lfs_allocator_t *allocator) {
 	void *mem = allocator->alloc(allocator->allocator, sizeof(FileContext), alignof(FileContext));
@@ -28,6 +29,14 @@ int32_t lfs_register_device_interface(lfs_context_t ctx, lfs_device_interface_t
 	return CTX(ctx)->registerDeviceInterface(*reinterpret_cast<FileContext::DeviceInterface*>(interface));
 }
 
+void lfs_complete_device_request(lfs_device_request_t *request, lfs_error_code_t result, uint64_t bytes, void *buffer) {
+	FileContext::completeDeviceRequest(request, result, bytes, buffer);
+}
+
+uint32_t lfs_get_device_capabilities(lfs_context_t ctx, uint32_t deviceType) {
+	return CTX(ctx)->getDeviceCapabilities(deviceType);
+}
+
 lfs_mount_t lfs_create_mount(lfs_context_t ctx, uint32_t deviceType, const char *mountPoint, const char *devicePath, lfs_error_code_t *returnCode) {
 	return CTX(ctx)->createMount(deviceType, mountPoint, devicePath, *returnCode);
 }
@@ -60,6 +69,10 @@ lfs_work_item_t *lfs_read_file_segment(lfs_context_t ctx, const char *filepath,
 	return CTX(ctx)->readFileSegment(filepath, offset, maxBytes, nullTerminate, alloc);
 }
 
+lfs_work_item_t *lfs_read_file_segment_with_flags(lfs_context_t ctx, const char *filepath, uint64_t offset, uint64_t maxBytes, bool nullTerminate, struct lfs_allocator_t *alloc, uint32_t flags) {
+	return CTX(ctx)->readFileSegment(filepath, offset, maxBytes, nullTerminate, alloc, flags);
+}
+
 void lfs_read_file_segment_with_callback(lfs_context_t ctx, const char *filepath, uint64_t offset, uint64_t maxBytes, bool nullTerminate, struct lfs_allocator_t *alloc, lfs_work_item_callback_t callback, lfs_callback_buffer_action_t bufferAction, void *callbackUserData) {
 	CTX(ctx)->readFileSegmentWithCallback(filepath, offset, maxBytes, nullTerminate, callback, bufferAction, callbackUserData, alloc);
 }
@@ -72,6 +85,46 @@ void lfs_read_file_segment_ctx_alloc_with_callback(lfs_context_t ctx, const char
 	CTX(ctx)->readFileSegmentWithCallback(filepath, offset, maxBytes, nullTerminate, callback, bufferAction, callbackUserData, nullptr);
 }
 
+lfs_work_item_t *lfs_read_file_shared(lfs_context_t ctx, const char *filepath, lfs_allocator_t *alloc) {
+	return CTX(ctx)->readFileShared(filepath, alloc);
+}
+
+lfs_work_item_t *lfs_read_file_segment_shared(lfs_context_t ctx, const char *filepath, uint64_t offset, uint64_t maxBytes, lfs_allocator_t *alloc) {
+	return CTX(ctx)->readFileSegmentShared(filepath, offset, maxBytes, alloc);
+}
+
+lfs_work_item_t *lfs_read_file_segment_shared_with_flags(lfs_context_t ctx, const char *filepath, uint64_t offset, uint64_t maxBytes, lfs_allocator_t *alloc, uint32_t flags) {
+	return CTX(ctx)->readFileSegmentShared(filepath, offset, maxBytes, alloc, flags);
+}
+
+void lfs_read_file_segment_shared_with_callback(lfs_context_t ctx, const char *filepath, uint64_t offset, uint64_t maxBytes, lfs_allocator_t *alloc, lfs_work_item_callback_t callback, void *callbackUserData) {
+	CTX(ctx)->readFileSegmentSharedWithCallback(filepath, offset, maxBytes, callback, callbackUserData, alloc);
+}
+
+lfs_work_item_t *lfs_prefetch(lfs_context_t ctx, const char **paths, uint32_t count, lfs_priority_t priority) {
+	return CTX(ctx)->prefetch(paths, count, priority);
+}
+
+void lfs_prefetch_with_callback(lfs_context_t ctx, const char **paths, uint32_t count, lfs_priority_t priority, lfs_work_item_callback_t callback, void *callbackUserData) {
+	CTX(ctx)->prefetchWithCallback(paths, count, priority, callback, callbackUserData);
+}
+
+void lfs_begin_access_trace(lfs_context_t ctx, uint32_t maxEntries) {
+	CTX(ctx)->beginAccessTrace(maxEntries);
+}
+
+uint64_t lfs_end_access_trace(lfs_context_t ctx, void **buffer, lfs_allocator_t *alloc) {
+	return CTX(ctx)->endAccessTrace(buffer, alloc);
+}
+
+lfs_work_item_t *lfs_replay_access_trace(lfs_context_t ctx, const void *trace, uint64_t traceBytes, lfs_priority_t priority) {
+	return CTX(ctx)->replayAccessTrace(trace, traceBytes, priority);
+}
+
+void lfs_replay_access_trace_with_callback(lfs_context_t ctx, const void *trace, uint64_t traceBytes, lfs_priority_t priority, lfs_work_item_callback_t callback, void *callbackUserData) {
+	CTX(ctx)->replayAccessTraceWithCallback(trace, traceBytes, priority, callback, callbackUserData);
+}
+
 lfs_work_item_t *lfs_write_file(lfs_context_t ctx, const char *filepath, const void *buffer, uint64_t bufferBytes) {
 	return CTX(ctx)->writeFile(filepath, buffer, bufferBytes);
 }
@@ -112,6 +165,62 @@ void lfs_file_size_with_callback(lfs_context_t ctx, const char *filepath, lfs_wo
 	CTX(ctx)->fileSizeWithCallback(filepath, callback, callbackUserData);
 }
 
+const lfs_path_t *lfs_intern_path(lfs_context_t ctx, const char *path) {
+	return CTX(ctx)->internPath(path);
+}
+
+const char *lfs_path_get_string(const lfs_path_t *path) {
+	return FileContext::getPathString(path);
+}
+
+uint64_t lfs_path_get_hash(const lfs_path_t *path) {
+	return FileContext::getPathHash(path);
+}
+
+lfs_work_item_t *lfs_read_file_segment_path(lfs_context_t ctx, const lfs_path_t *path, uint64_t offset, uint64_t maxBytes, bool nullTerminate, lfs_allocator_t *alloc) {
+	return CTX(ctx)->readFileSegment(path, offset, maxBytes, nullTerminate, alloc);
+}
+
+void lfs_read_file_segment_path_with_callback(lfs_context_t ctx, const lfs_path_t *path, uint64_t offset, uint64_t maxBytes, bool nullTerminate, lfs_allocator_t *alloc, lfs_work_item_callback_t callback, lfs_callback_buffer_action_t bufferAction, void *callbackUserData) {
+	CTX(ctx)->readFileSegmentWithCallback(path, offset, maxBytes, nullTerminate, callback, bufferAction, callbackUserData, alloc);
+}
+
+lfs_work_item_t *lfs_read_file_segment_shared_path(lfs_context_t ctx, const lfs_path_t *path, uint64_t offset, uint64_t maxBytes, lfs_allocator_t *alloc) {
+	return CTX(ctx)->readFileSegmentShared(path, offset, maxBytes, alloc);
+}
+
+lfs_work_item_t *lfs_write_file_path(lfs_context_t ctx, const lfs_path_t *path, const void *buffer, uint64_t bufferBytes) {
+	return CTX(ctx)->writeFile(path, buffer, bufferBytes);
+}
+
+lfs_work_item_t *lfs_write_file_segment_path(lfs_context_t ctx, const lfs_path_t *path, uint64_t offset, const void *buffer, uint64_t bufferBytes) {
+	return CTX(ctx)->writeFileSegment(path, offset, buffer, bufferBytes);
+}
+
+void lfs_write_file_segment_path_with_callback(lfs_context_t ctx, const lfs_path_t *path, uint64_t offset, const void *buffer, uint64_t bufferBytes, lfs_work_item_callback_t callback, lfs_callback_buffer_action_t bufferAction, void *callbackUserData) {
+	CTX(ctx)->writeFileSegmentWithCallback(path, offset, buffer, bufferBytes, callback, bufferAction, callbackUserData);
+}
+
+lfs_work_item_t *lfs_append_file_path(lfs_context_t ctx, const lfs_path_t *path, const void *buffer, uint64_t bufferBytes) {
+	return CTX(ctx)->appendFile(path, buffer, bufferBytes);
+}
+
+lfs_work_item_t *lfs_file_exists_path(lfs_context_t ctx, const lfs_path_t *path) {
+	return CTX(ctx)->fileExists(path);
+}
+
+void lfs_file_exists_path_with_callback(lfs_context_t ctx, const lfs_path_t *path, lfs_work_item_callback_t callback, void *callbackUserData) {
+	CTX(ctx)->fileExistsWithCallback(path, callback, callbackUserData);
+}
+
+lfs_work_item_t *lfs_file_size_path(lfs_context_t ctx, const lfs_path_t *path) {
+	return CTX(ctx)->fileSize(path);
+}
+
+void lfs_file_size_path_with_callback(lfs_context_t ctx, const lfs_path_t *path, lfs_work_item_callback_t callback, void *callbackUserData) {
+	CTX(ctx)->fileSizeWithCallback(path, callback, callbackUserData);
+}
+
 lfs_work_item_t *lfs_delete_file(lfs_context_t ctx, const char *filepath) {
 	return CTX(ctx)->deleteFile(filepath);
 }
@@ -136,6 +245,42 @@ void lfs_delete_dir_with_callback(lfs_context_t ctx, const char *path, lfs_work_
 	CTX(ctx)->deleteDirWithCallback(path, callback, callbackUserData);
 }
 
+lfs_work_item_t *lfs_open_file(lfs_context_t ctx, const char *filepath, lfs_open_mode_t mode, uint64_t bufferBytes) {
+	return CTX(ctx)->openFile(filepath, mode, bufferBytes);
+}
+
+lfs_work_item_t *lfs_open_file_with_flags(lfs_context_t ctx, const char *filepath, lfs_open_mode_t mode, uint64_t bufferBytes, uint32_t flags) {
+	return CTX(ctx)->openFile(filepath, mode, bufferBytes, flags);
+}
+
+void lfs_open_file_with_callback(lfs_context_t ctx, const char *filepath, lfs_open_mode_t mode, uint64_t bufferBytes, lfs_work_item_callback_t callback, void *callbackUserData) {
+	CTX(ctx)->openFileWithCallback(filepath, mode, bufferBytes, callback, callbackUserData);
+}
+
+lfs_work_item_t *lfs_read_file_handle(lfs_context_t ctx, lfs_file_handle_t file, uint64_t maxBytes, lfs_allocator_t *alloc) {
+	return CTX(ctx)->readFileHandle(file, maxBytes, alloc);
+}
+
+void lfs_read_file_handle_with_callback(lfs_context_t ctx, lfs_file_handle_t file, uint64_t maxBytes, lfs_allocator_t *alloc, lfs_work_item_callback_t callback, lfs_callback_buffer_action_t bufferAction, void *callbackUserData) {
+	CTX(ctx)->readFileHandleWithCallback(file, maxBytes, callback, bufferAction, callbackUserData, alloc);
+}
+
+lfs_work_item_t *lfs_write_file_handle(lfs_context_t ctx, lfs_file_handle_t file, const void *buffer, uint64_t bufferBytes) {
+	return CTX(ctx)->writeFileHandle(file, buffer, bufferBytes);
+}
+
+void lfs_write_file_handle_with_callback(lfs_context_t ctx, lfs_file_handle_t file, const void *buffer, uint64_t bufferBytes, lfs_work_item_callback_t callback, lfs_callback_buffer_action_t bufferAction, void *callbackUserData) {
+	CTX(ctx)->writeFileHandleWithCallback(file, buffer, bufferBytes, callback, bufferAction, callbackUserData);
+}
+
+lfs_work_item_t *lfs_close_file_handle(lfs_context_t ctx, lfs_file_handle_t file) {
+	return CTX(ctx)->closeFileHandle(file);
+}
+
+void lfs_close_file_handle_with_callback(lfs_context_t ctx, lfs_file_handle_t file, lfs_work_item_callback_t callback, void *callbackUserData) {
+	CTX(ctx)->closeFileHandleWithCallback(file, callback, callbackUserData);
+}
+
 lfs_error_code_t lfs_work_item_get_result(const lfs_work_item_t *workItem) {
 	return WorkItemGetResult(workItem);
 }
@@ -148,10 +293,18 @@ uint64_t lfs_work_item_get_bytes(const lfs_work_item_t *workItem) {
 	return WorkItemGetBytes(workItem);
 }
 
+lfs_file_handle_t lfs_work_item_get_file_handle(const lfs_work_item_t *workItem) {
+	return WorkItemGetFileHandle(workItem);
+}
+
 void lfs_work_item_free_buffer(lfs_work_item_t *workItem) {
 	WorkItemFreeBuffer(workItem);
 }
 
+lfs_shared_buffer_t *lfs_work_item_acquire_shared_buffer(const lfs_work_item_t *workItem) {
+	return WorkItemAcquireSharedBuffer(workItem);
+}
+
 bool lfs_work_item_completed(const lfs_work_item_t *workItem) {
 	return WorkItemCompleted(workItem);
 }
@@ -164,6 +317,75 @@ void lfs_release_work_item(lfs_context_t ctx, lfs_work_item_t *workItem) {
 	CTX(ctx)->releaseWorkItem(workItem);
 }
 
+void lfs_set_metadata_cache_ttl(lfs_context_t ctx, uint32_t milliseconds, uint32_t maxEntries) {
+	CTX(ctx)->setMetadataCacheTTL(milliseconds, maxEntries);
+}
+
+lfs_metadata_cache_stats_t lfs_get_metadata_cache_stats(lfs_context_t ctx) {
+	return CTX(ctx)->getMetadataCacheStats();
+}
+
+void lfs_clear_metadata_cache(lfs_context_t ctx) {
+	CTX(ctx)->clearMetadataCache();
+}
+
+lfs_error_code_t lfs_write_path_filter(lfs_context_t ctx, lfs_mount_t mount) {
+	return CTX(ctx)->writePathFilter(mount);
+}
+
+lfs_path_filter_stats_t lfs_get_path_filter_stats(lfs_context_t ctx) {
+	return CTX(ctx)->getPathFilterStats();
+}
+
+lfs_shared_buffer_t *lfs_shared_buffer_create(lfs_allocator_t *allocator, void *data, uint64_t bytes) {
+	return SharedBufferCreate(*allocator, data, bytes);
+}
+
+void lfs_shared_buffer_retain(lfs_shared_buffer_t *buffer) {
+	SharedBufferRetain(buffer);
+}
+
+void lfs_shared_buffer_release(lfs_shared_buffer_t *buffer) {
+	SharedBufferRelease(buffer);
+}
+
+const void *lfs_shared_buffer_get_data(const lfs_shared_buffer_t *buffer) {
+	return SharedBufferGetData(buffer);
+}
+
+uint64_t lfs_shared_buffer_get_size(const lfs_shared_buffer_t *buffer) {
+	return SharedBufferGetSize(buffer);
+}
+
+void lfs_set_block_cache(lfs_context_t ctx, lfs_block_cache_t cache) {
+	CTX(ctx)->setBlockCache(CACHE(cache));
+}
+
+void lfs_set_parallel_reads(lfs_context_t ctx, uint32_t threads, uint64_t chunkBytes) {
+	CTX(ctx)->setParallelReads(threads, chunkBytes);
+}
+
+lfs_block_cache_t lfs_block_cache_create(lfs_allocator_t *allocator, uint64_t budgetBytes, uint32_t blockSize, uint32_t shardCount) {
+	void *mem = allocator->alloc(allocator->allocator, sizeof(BlockCache), alignof(BlockCache));
+	return lfs_block_cache_t{ new(mem) BlockCache(*allocator, budgetBytes,
+		blockSize ? blockSize : BlockCache::kDefaultBlockSize,
+		shardCount ? shardCount : BlockCache::kDefaultShardCount) };
+}
+
+void lfs_block_cache_destroy(lfs_block_cache_t cache) {
+	lfs_allocator_t alloc = CACHE(cache)->getAllocator();
+	CACHE(cache)->~BlockCache();
+	alloc.free(alloc.allocator, CACHE(cache));
+}
+
+lfs_block_cache_stats_t lfs_block_cache_get_stats(lfs_block_cache_t cache) {
+	return CACHE(cache)->getStats();
+}
+
+void lfs_block_cache_clear(lfs_block_cache_t cache) {
+	CACHE(cache)->clear();
+}
+
 void lfs_set_log_func(lfs_context_t ctx, lfs_log_func_t func) {
 	CTX(ctx)->setLogFunc(func);
 }
@@ -16,6 +16,7 @@
 
 // typedefs
 typedef struct lfs_file_context_s { void *_value; } lfs_context_t;
+typedef struct lfs_block_cache_s { void *_value; } lfs_block_cache_t;
 typedef void* lfs_file_handle_t;
 typedef int (*lfs_log_func_t)(const char *, ...);
 typedef void* lfs_mount_t;
@@ -30,9 +31,28 @@ typedef size_t (*lfs_device_write_file_func_t)(void *, const char *, uint64_t, v
 typedef enum lfs_error_code_t (*lfs_device_delete_file_func_t)(void *, const char *);
 typedef enum lfs_error_code_t (*lfs_device_create_dir_func_t)(void *, const char *);
 typedef enum lfs_error_code_t (*lfs_device_delete_dir_func_t)(void *, const char *);
+typedef enum lfs_error_code_t (*lfs_device_prefetch_file_func_t)(void *, const char *, uint64_t, uint64_t);
+typedef enum lfs_error_code_t (*lfs_device_enumerate_func_t)(void *, lfs_enumerate_callback_t, void *);
+typedef enum lfs_error_code_t (*lfs_device_map_file_func_t)(void *, const char *, uint64_t, uint64_t, struct lfs_allocator_t *, uint32_t, struct lfs_shared_buffer_t **);
+typedef enum lfs_error_code_t (*lfs_device_open_handle_func_t)(void *, const char *, enum lfs_open_mode_t, void **);
+typedef size_t (*lfs_device_read_handle_func_t)(void *, void *, uint64_t, uint64_t, void *, enum lfs_error_code_t *);
+typedef size_t (*lfs_device_write_handle_func_t)(void *, void *, uint64_t, const void *, size_t, enum lfs_error_code_t *);
+typedef void (*lfs_device_close_handle_func_t)(void *, void *);
+typedef size_t (*lfs_device_read_handle_v_func_t)(void *, void *, uint64_t, const struct lfs_io_vec_t *, uint32_t, enum lfs_error_code_t *);
+typedef size_t (*lfs_device_read_file_async_func_t)(void *, const char *, uint64_t, uint64_t, struct lfs_allocator_t *, void **, bool, struct lfs_device_request_t *, enum lfs_error_code_t *);
+typedef size_t (*lfs_device_write_file_async_func_t)(void *, const char *, uint64_t, void *, size_t, enum lfs_write_mode_t, struct lfs_device_request_t *, enum lfs_error_code_t *);
+typedef enum lfs_error_code_t (*lfs_device_set_direct_io_func_t)(void *, bool);
+typedef enum lfs_error_code_t (*lfs_device_advise_file_func_t)(void *, const char *, uint64_t, uint64_t, uint32_t);
+typedef void (*lfs_device_advise_handle_func_t)(void *, void *, uint32_t);
 
 // structs
 struct lfs_device_interface_t {
+	// Set to LFS_DEVICE_INTERFACE_VERSION, always the first member. Zero means an interface
+	// from before handles, which isn't read past _mapFile; for 2 nothing past _capabilities
+	// is read, for 3 nothing past _writeFileAsync, and for 4 nothing past _setDirectIO.
+	// Devices built against headers that had it anywhere else need to be rebuilt.
+	uint32_t _version;
+
 	// required
 	lfs_device_create_func_t _create;
 	lfs_device_destroy_func_t _destroy;
@@ -46,6 +66,45 @@ struct lfs_device_interface_t {
 	lfs_device_delete_file_func_t _deleteFile;
 	lfs_device_create_dir_func_t _createDir;
 	lfs_device_delete_dir_func_t _deleteDir;
+
+	// Hints that a range of a file will be read soon. Returns LFS_NOT_FOUND
+	// if the file doesn't exist on the device.
+	lfs_device_prefetch_file_func_t _prefetchFile;
+
+	// Calls the callback with the path of every file on the device.
+	// Required for LFS_MOUNT_CASE_INSENSITIVE mounts.
+	lfs_device_enumerate_func_t _enumerate;
+
+	// Maps a range of a file into a shared buffer for LFS_READ_MAPPED reads, passing
+	// on the read flags as hints. The buffer is NULL for empty ranges. Returns
+	// LFS_UNSUPPORTED for files that can't be mapped, which are read normally instead.
+	lfs_device_map_file_func_t _mapFile;
+
+	// Keeps a file open for a handle from lfs_open_file(), reading and writing at an offset
+	// with caller-owned buffers. All four or none; without them streams use _readFile and _writeFile.
+	lfs_device_open_handle_func_t _openHandle;
+	lfs_device_read_handle_func_t _readHandle;
+	lfs_device_write_handle_func_t _writeHandle;
+	lfs_device_close_handle_func_t _closeHandle;
+
+	// Reads consecutive bytes of a handle into several buffers, optional even with handles.
+	lfs_device_read_handle_v_func_t _readHandleV;
+
+	// Filled in by lfs_register_device_interface().
+	uint32_t _capabilities;
+
+	// Whole file reads and writes that may set LFS_PENDING and finish later through
+	// lfs_complete_device_request(). Missing files must still be reported right away.
+	lfs_device_read_file_async_func_t _readFileAsync;
+	lfs_device_write_file_async_func_t _writeFileAsync;
+
+	// Bypasses the OS file cache for LFS_MOUNT_DIRECT_IO mounts, called right after _create.
+	lfs_device_set_direct_io_func_t _setDirectIO;
+
+	// Best effort lfs_read_flags_t access hints for a range of a file or a handle, given
+	// before a read, or after it for LFS_READ_DONTNEED.
+	lfs_device_advise_file_func_t _adviseFile;
+	lfs_device_advise_handle_func_t _adviseHandle;
 };
 
 // FileContext functions
@@ -71,6 +130,19 @@ LFS_C_API void lfs_context_destroy(lfs_context_t ctx);
 //! @param interface the device interface to register
 LFS_C_API int32_t lfs_register_device_interface(lfs_context_t ctx, struct lfs_device_interface_t *interface);
 
+//! Finishes a request a device's _readFileAsync or _writeFileAsync left pending, from any thread.
+//! @param request the request passed to the device function
+//! @param result the result of the request
+//! @param bytes the bytes read or written
+//! @param buffer for reads, the buffer allocated with the allocator passed to the device function
+LFS_C_API void lfs_complete_device_request(struct lfs_device_request_t *request, enum lfs_error_code_t result, uint64_t bytes, void *buffer);
+
+//! Gets the features a device type provides natively.
+//! @param ctx the context
+//! @param deviceType the device type, as returned by lfs_register_device_interface()
+//! @return a combination of lfs_device_capabilities_t flags, 0 for an unknown device type
+LFS_C_API uint32_t lfs_get_device_capabilities(lfs_context_t ctx, uint32_t deviceType);
+
 //! Creates a mount on a context
 //! @param ctx the context
 //! @param deviceType the type index of the device to create the mount with
@@ -91,7 +163,10 @@ LFS_C_API lfs_mount_t lfs_create_mount(lfs_context_t ctx, uint32_t deviceType, c
 LFS_C_API lfs_mount_t lfs_create_mount_with_permissions(lfs_context_t ctx, uint32_t deviceType, const char *mountPoint, const char *devicePath, enum lfs_error_code_t *returnCode, uint32_t permissions);
 
 //! Removes a mount from a context.
-//! Finishes all processing work items and suspends processing while it runs.
+//! The mount is removed from a new copy of the mount table, so processing carries on while
+//! this runs. Work already resolving paths against the old table finishes before this
+//! returns. Open file handles and pending requests that use the mount keep it alive, and
+//! the device is destroyed once the last of them is done.
 //! @param ctx the context
 //! @param mount the mount to remove
 //! @return whether or not the mount was found and removed
@@ -141,6 +216,17 @@ LFS_C_API void lfs_read_file_ctx_alloc_with_callback(lfs_context_t ctx, const ch
 //! @return a lfs_work_item_t representing the work to be done
 LFS_C_API struct lfs_work_item_t *lfs_read_file_segment(lfs_context_t ctx, const char *filepath, uint64_t offset, uint64_t maxBytes, bool nullTerminate, struct lfs_allocator_t *alloc);
 
+//! Reads a portion of a file, passing access hints on to the device.
+//! @param ctx the context
+//! @param filepath the path to the file to read
+//! @param offset the offset to start reading from
+//! @param maxBytes the maximum number of bytes to read
+//! @param nullTerminate whether or not to null-terminate the input so it can be directly used as a C-string
+//! @param alloc the allocator to use.
+//! @param flags LFS_READ_SEQUENTIAL, LFS_READ_RANDOM, LFS_READ_WILLNEED and LFS_READ_DONTNEED
+//! @return a lfs_work_item_t representing the work to be done
+LFS_C_API struct lfs_work_item_t *lfs_read_file_segment_with_flags(lfs_context_t ctx, const char *filepath, uint64_t offset, uint64_t maxBytes, bool nullTerminate, struct lfs_allocator_t *alloc, uint32_t flags);
+
 //! Reads a portion of a file.
 //! @param ctx the context
 //! @param filepath the path to the file to read
@@ -173,6 +259,93 @@ LFS_C_API struct lfs_work_item_t *lfs_read_file_segment_ctx_alloc(lfs_context_t
 //! @param callbackUserData optional user data pointer for callback
 LFS_C_API void lfs_read_file_segment_ctx_alloc_with_callback(lfs_context_t ctx, const char *filepath, uint64_t offset, uint64_t maxBytes, bool nullTerminate, lfs_work_item_callback_t callback, enum lfs_callback_buffer_action_t bufferAction, void *callbackUserData);
 
+//! Reads the entirety of a file into a shared buffer. The buffer must be released with
+//! lfs_work_item_free_buffer() or obtained with lfs_work_item_acquire_shared_buffer(), never freed directly.
+//! @param ctx the context
+//! @param filepath the path to the file to read
+//! @param alloc the allocator to use if a new buffer is needed, or NULL for the context's allocator
+//! @return a lfs_work_item_t representing the work to be done
+LFS_C_API struct lfs_work_item_t *lfs_read_file_shared(lfs_context_t ctx, const char *filepath, struct lfs_allocator_t *alloc);
+
+//! Reads a portion of a file into a shared buffer. The buffer must be released with
+//! lfs_work_item_free_buffer() or obtained with lfs_work_item_acquire_shared_buffer(), never freed directly.
+//! @param ctx the context
+//! @param filepath the path to the file to read
+//! @param offset the offset to start reading from
+//! @param maxBytes the maximum number of bytes to read
+//! @param alloc the allocator to use if a new buffer is needed, or NULL for the context's allocator
+//! @return a lfs_work_item_t representing the work to be done
+LFS_C_API struct lfs_work_item_t *lfs_read_file_segment_shared(lfs_context_t ctx, const char *filepath, uint64_t offset, uint64_t maxBytes, struct lfs_allocator_t *alloc);
+
+//! Reads a portion of a file into a shared buffer, with read flags. LFS_READ_MAPPED maps the file
+//! instead of copying it, and keeps it mapped until the last reference to the buffer is released.
+//! @param ctx the context
+//! @param filepath the path to the file to read
+//! @param offset the offset to start reading from
+//! @param maxBytes the maximum number of bytes to read
+//! @param alloc the allocator to use if a new buffer is needed, or NULL for the context's allocator
+//! @param flags lfs_read_flags_t values, access hints included
+//! @return a lfs_work_item_t representing the work to be done
+LFS_C_API struct lfs_work_item_t *lfs_read_file_segment_shared_with_flags(lfs_context_t ctx, const char *filepath, uint64_t offset, uint64_t maxBytes, struct lfs_allocator_t *alloc, uint32_t flags);
+
+//! Reads a portion of a file into a shared buffer.
+//! @param ctx the context
+//! @param filepath the path to the file to read
+//! @param offset the offset to start reading from
+//! @param maxBytes the maximum number of bytes to read
+//! @param alloc the allocator to use if a new buffer is needed, or NULL for the context's allocator
+//! @param callback callback, which can acquire a reference to the buffer with lfs_work_item_acquire_shared_buffer()
+//! @param callbackUserData optional user data pointer for callback
+LFS_C_API void lfs_read_file_segment_shared_with_callback(lfs_context_t ctx, const char *filepath, uint64_t offset, uint64_t maxBytes, struct lfs_allocator_t *alloc, lfs_work_item_callback_t callback, void *callbackUserData);
+
+//! Warms up a set of files so that later reads complete faster, without producing
+//! any result buffers. The number of files found is available through lfs_work_item_get_bytes().
+//! @param ctx the context
+//! @param paths the paths of the files to prefetch
+//! @param count the number of paths
+//! @param priority the priority of the prefetch
+//! @return a lfs_work_item_t representing the work to be done
+LFS_C_API struct lfs_work_item_t *lfs_prefetch(lfs_context_t ctx, const char **paths, uint32_t count, enum lfs_priority_t priority);
+
+//! Warms up a set of files so that later reads complete faster.
+//! @param ctx the context
+//! @param paths the paths of the files to prefetch
+//! @param count the number of paths
+//! @param priority the priority of the prefetch
+//! @param callback callback
+//! @param callbackUserData optional user data pointer for callback
+LFS_C_API void lfs_prefetch_with_callback(lfs_context_t ctx, const char **paths, uint32_t count, enum lfs_priority_t priority, lfs_work_item_callback_t callback, void *callbackUserData);
+
+//! Starts recording every successful read into an access trace, discarding any
+//! previous recording.
+//! @param ctx the context
+//! @param maxEntries the maximum number of reads to record
+LFS_C_API void lfs_begin_access_trace(lfs_context_t ctx, uint32_t maxEntries);
+
+//! Stops recording and returns the access trace.
+//! @param ctx the context
+//! @param buffer output buffer containing the trace, NULL if nothing was recorded
+//! @param alloc the allocator to allocate the buffer with. If NULL will use the context's allocator.
+//! @return the size of the trace in bytes
+LFS_C_API uint64_t lfs_end_access_trace(lfs_context_t ctx, void **buffer, struct lfs_allocator_t *alloc);
+
+//! Prefetches the reads recorded in an access trace, in the order they happened.
+//! @param ctx the context
+//! @param trace the trace
+//! @param traceBytes the size of the trace
+//! @param priority the priority of the prefetch
+//! @return a lfs_work_item_t representing the work to be done
+LFS_C_API struct lfs_work_item_t *lfs_replay_access_trace(lfs_context_t ctx, const void *trace, uint64_t traceBytes, enum lfs_priority_t priority);
+
+//! Prefetches the reads recorded in an access trace, in the order they happened.
+//! @param ctx the context
+//! @param trace the trace
+//! @param traceBytes the size of the trace
+//! @param priority the priority of the prefetch
+//! @param callback callback
+//! @param callbackUserData optional user data pointer for callback
+LFS_C_API void lfs_replay_access_trace_with_callback(lfs_context_t ctx, const void *trace, uint64_t traceBytes, enum lfs_priority_t priority, lfs_work_item_callback_t callback, void *callbackUserData);
+
 //! Writes a buffer to a file.
 //! @param ctx the context
 //! @param filepath the path to the file to write
@@ -255,6 +428,67 @@ LFS_C_API struct lfs_work_item_t *lfs_file_size(lfs_context_t ctx, const char *f
 //! @param callbackUserData optional user data pointer for callback
 LFS_C_API void lfs_file_size_with_callback(lfs_context_t ctx, const char *filepath, lfs_work_item_callback_t callback, void *callbackUserData);
 
+//! Interns a path, so that it only has to be normalized, hashed and resolved once.
+//! Equivalent paths return the same handle. Handles stay valid for the lifetime of the context.
+//! @param ctx the context
+//! @param path the path to intern
+//! @return the path handle
+LFS_C_API const struct lfs_path_t *lfs_intern_path(lfs_context_t ctx, const char *path);
+
+//! Gets the normalized path of a path handle.
+//! @param path the path handle
+//! @return the normalized path
+LFS_C_API const char *lfs_path_get_string(const struct lfs_path_t *path);
+
+//! Gets the hash of a path handle's normalized path.
+//! @param path the path handle
+//! @return the hash
+LFS_C_API uint64_t lfs_path_get_hash(const struct lfs_path_t *path);
+
+//! Reads a portion of a file using a path handle. See lfs_read_file_segment().
+//! @param path a path handle from lfs_intern_path()
+LFS_C_API struct lfs_work_item_t *lfs_read_file_segment_path(lfs_context_t ctx, const struct lfs_path_t *path, uint64_t offset, uint64_t maxBytes, bool nullTerminate, struct lfs_allocator_t *alloc);
+
+//! Reads a portion of a file using a path handle. See lfs_read_file_segment_with_callback().
+//! @param path a path handle from lfs_intern_path()
+LFS_C_API void lfs_read_file_segment_path_with_callback(lfs_context_t ctx, const struct lfs_path_t *path, uint64_t offset, uint64_t maxBytes, bool nullTerminate, struct lfs_allocator_t *alloc, lfs_work_item_callback_t callback, enum lfs_callback_buffer_action_t bufferAction, void *callbackUserData);
+
+//! Reads a portion of a file into a shared buffer using a path handle. See lfs_read_file_segment_shared().
+//! @param path a path handle from lfs_intern_path()
+LFS_C_API struct lfs_work_item_t *lfs_read_file_segment_shared_path(lfs_context_t ctx, const struct lfs_path_t *path, uint64_t offset, uint64_t maxBytes, struct lfs_allocator_t *alloc);
+
+//! Writes a buffer to a file using a path handle. See lfs_write_file().
+//! @param path a path handle from lfs_intern_path()
+LFS_C_API struct lfs_work_item_t *lfs_write_file_path(lfs_context_t ctx, const struct lfs_path_t *path, const void *buffer, uint64_t bufferBytes);
+
+//! Writes a buffer to a portion of a file using a path handle. See lfs_write_file_segment().
+//! @param path a path handle from lfs_intern_path()
+LFS_C_API struct lfs_work_item_t *lfs_write_file_segment_path(lfs_context_t ctx, const struct lfs_path_t *path, uint64_t offset, const void *buffer, uint64_t bufferBytes);
+
+//! Writes a buffer to a portion of a file using a path handle. See lfs_write_file_segment_with_callback().
+//! @param path a path handle from lfs_intern_path()
+LFS_C_API void lfs_write_file_segment_path_with_callback(lfs_context_t ctx, const struct lfs_path_t *path, uint64_t offset, const void *buffer, uint64_t bufferBytes, lfs_work_item_callback_t callback, enum lfs_callback_buffer_action_t bufferAction, void *callbackUserData);
+
+//! Appends a buffer to a file using a path handle. See lfs_append_file().
+//! @param path a path handle from lfs_intern_path()
+LFS_C_API struct lfs_work_item_t *lfs_append_file_path(lfs_context_t ctx, const struct lfs_path_t *path, const void *buffer, uint64_t bufferBytes);
+
+//! Determines if a file exists using a path handle. See lfs_file_exists().
+//! @param path a path handle from lfs_intern_path()
+LFS_C_API struct lfs_work_item_t *lfs_file_exists_path(lfs_context_t ctx, const struct lfs_path_t *path);
+
+//! Determines if a file exists using a path handle. See lfs_file_exists_with_callback().
+//! @param path a path handle from lfs_intern_path()
+LFS_C_API void lfs_file_exists_path_with_callback(lfs_context_t ctx, const struct lfs_path_t *path, lfs_work_item_callback_t callback, void *callbackUserData);
+
+//! Gets the size of a file using a path handle. See lfs_file_size().
+//! @param path a path handle from lfs_intern_path()
+LFS_C_API struct lfs_work_item_t *lfs_file_size_path(lfs_context_t ctx, const struct lfs_path_t *path);
+
+//! Gets the size of a file using a path handle. See lfs_file_size_with_callback().
+//! @param path a path handle from lfs_intern_path()
+LFS_C_API void lfs_file_size_path_with_callback(lfs_context_t ctx, const struct lfs_path_t *path, lfs_work_item_callback_t callback, void *callbackUserData);
+
 //! Deletes a file.
 //! @param ctx the context
 //! @param filepath the path to the file to delete
@@ -294,6 +528,84 @@ LFS_C_API struct lfs_work_item_t *lfs_delete_dir(lfs_context_t ctx, const char *
 //! @param callbackUserData optional user data pointer for callback
 LFS_C_API void lfs_delete_dir_with_callback(lfs_context_t ctx, const char *path, lfs_work_item_callback_t callback, void *callbackUserData);
 
+//! Opens a file for streaming, with two readahead buffers for reading. The handle is
+//! available through lfs_work_item_get_file_handle() and the size of the file through
+//! lfs_work_item_get_bytes(). Handles must be closed before the context is destroyed.
+//! @param ctx the context
+//! @param filepath the path to the file to open
+//! @param mode LFS_OPEN_READ, LFS_OPEN_WRITE or LFS_OPEN_APPEND
+//! @param bufferBytes the size of each readahead buffer, 0 reads straight from the device
+//! @return a WorkItem representing the work to be done
+LFS_C_API struct lfs_work_item_t *lfs_open_file(lfs_context_t ctx, const char *filepath, enum lfs_open_mode_t mode, uint64_t bufferBytes);
+
+//! Opens a file for streaming with access hints for everything done through the handle.
+//! LFS_READ_DONTNEED is given when the handle is closed.
+//! @param ctx the context
+//! @param filepath the path to the file to open
+//! @param mode LFS_OPEN_READ, LFS_OPEN_WRITE or LFS_OPEN_APPEND
+//! @param bufferBytes the size of each readahead buffer, 0 reads straight from the device
+//! @param flags LFS_READ_SEQUENTIAL, LFS_READ_RANDOM, LFS_READ_WILLNEED and LFS_READ_DONTNEED
+//! @return a WorkItem representing the work to be done
+LFS_C_API struct lfs_work_item_t *lfs_open_file_with_flags(lfs_context_t ctx, const char *filepath, enum lfs_open_mode_t mode, uint64_t bufferBytes, uint32_t flags);
+
+//! Opens a file for streaming.
+//! @param ctx the context
+//! @param filepath the path to the file to open
+//! @param mode LFS_OPEN_READ, LFS_OPEN_WRITE or LFS_OPEN_APPEND
+//! @param bufferBytes the size of each readahead buffer, 0 reads straight from the device
+//! @param callback callback, which gets the handle with lfs_work_item_get_file_handle()
+//! @param callbackUserData optional user data pointer for callback
+LFS_C_API void lfs_open_file_with_callback(lfs_context_t ctx, const char *filepath, enum lfs_open_mode_t mode, uint64_t bufferBytes, lfs_work_item_callback_t callback, void *callbackUserData);
+
+//! Reads the next part of a file opened with LFS_OPEN_READ.
+//! @param ctx the context
+//! @param file the file handle
+//! @param maxBytes the maximum number of bytes to read
+//! @param alloc the allocator to use, or NULL for the context's allocator
+//! @return a WorkItem representing the work to be done
+LFS_C_API struct lfs_work_item_t *lfs_read_file_handle(lfs_context_t ctx, lfs_file_handle_t file, uint64_t maxBytes, struct lfs_allocator_t *alloc);
+
+//! Reads the next part of a file opened with LFS_OPEN_READ.
+//! @param ctx the context
+//! @param file the file handle
+//! @param maxBytes the maximum number of bytes to read
+//! @param alloc the allocator to use, or NULL for the context's allocator
+//! @param callback callback
+//! @param bufferAction what to do with the buffer after the callback completes execution
+//! @param callbackUserData optional user data pointer for callback
+LFS_C_API void lfs_read_file_handle_with_callback(lfs_context_t ctx, lfs_file_handle_t file, uint64_t maxBytes, struct lfs_allocator_t *alloc, lfs_work_item_callback_t callback, enum lfs_callback_buffer_action_t bufferAction, void *callbackUserData);
+
+//! Writes a buffer after the data previously written through a handle.
+//! @param ctx the context
+//! @param file the file handle
+//! @param buffer the buffer to write
+//! @param bufferBytes the number of bytes to write
+//! @return a WorkItem representing the work to be done
+LFS_C_API struct lfs_work_item_t *lfs_write_file_handle(lfs_context_t ctx, lfs_file_handle_t file, const void *buffer, uint64_t bufferBytes);
+
+//! Writes a buffer after the data previously written through a handle.
+//! @param ctx the context
+//! @param file the file handle
+//! @param buffer the buffer to write
+//! @param bufferBytes the number of bytes to write
+//! @param callback callback
+//! @param bufferAction what to do with the buffer after the callback completes execution
+//! @param callbackUserData optional user data pointer for callback
+LFS_C_API void lfs_write_file_handle_with_callback(lfs_context_t ctx, lfs_file_handle_t file, const void *buffer, uint64_t bufferBytes, lfs_work_item_callback_t callback, enum lfs_callback_buffer_action_t bufferAction, void *callbackUserData);
+
+//! Closes a file handle once the work issued on it before has been processed.
+//! @param ctx the context
+//! @param file the file handle
+//! @return a WorkItem representing the work to be done
+LFS_C_API struct lfs_work_item_t *lfs_close_file_handle(lfs_context_t ctx, lfs_file_handle_t file);
+
+//! Closes a file handle.
+//! @param ctx the context
+//! @param file the file handle
+//! @param callback callback
+//! @param callbackUserData optional user data pointer for callback
+LFS_C_API void lfs_close_file_handle_with_callback(lfs_context_t ctx, lfs_file_handle_t file, lfs_work_item_callback_t callback, void *callbackUserData);
+
 //! Gets the result code from a WorkItem
 //! @param workItem the WorkItem
 //! @return the result code
@@ -309,10 +621,22 @@ LFS_C_API void *lfs_work_item_get_buffer(const struct lfs_work_item_t *workItem)
 //! @return the bytes read/written
 LFS_C_API uint64_t lfs_work_item_get_bytes(const struct lfs_work_item_t *workItem);
 
+//! Gets the file handle opened by a lfs_open_file() WorkItem.
+//! @param workItem the WorkItem
+//! @return the handle, or NULL if the open failed
+LFS_C_API lfs_file_handle_t lfs_work_item_get_file_handle(const struct lfs_work_item_t *workItem);
+
 //! Frees the output buffer that was allocated by the work item.
 //! @param workItem the WorkItem
 LFS_C_API void lfs_work_item_free_buffer(struct lfs_work_item_t *workItem);
 
+//! Gets a reference counted handle to the output buffer of a WorkItem.
+//! The WorkItem keeps one reference, which is released by lfs_work_item_free_buffer().
+//! Each call adds a reference that must be released with lfs_shared_buffer_release().
+//! @param workItem the WorkItem
+//! @return the shared buffer, or NULL if there is no output buffer
+LFS_C_API struct lfs_shared_buffer_t *lfs_work_item_acquire_shared_buffer(const struct lfs_work_item_t *workItem);
+
 //! Waits for a WorkItem to finish processing.
 //! @param workItem the WorkItem to wait for
 LFS_C_API void lfs_wait_for_work_item(const struct lfs_work_item_t *workItem);
@@ -326,6 +650,97 @@ LFS_C_API bool lfs_work_item_completed(const struct lfs_work_item_t *workItem);
 //! @param workItem the WorkItem to release.
 LFS_C_API void lfs_release_work_item(lfs_context_t ctx, struct lfs_work_item_t *workItem);
 
+//! Configures the metadata cache used by lfs_file_exists() and lfs_file_size().
+//! Cache hits complete immediately on the calling thread without being queued.
+//! @param ctx the context
+//! @param milliseconds the time-to-live of a cache entry; 0 disables the cache
+//! @param maxEntries the maximum number of entries to cache
+LFS_C_API void lfs_set_metadata_cache_ttl(lfs_context_t ctx, uint32_t milliseconds, uint32_t maxEntries);
+
+//! Gets the metadata cache hit/miss statistics.
+//! @param ctx the context
+//! @return the statistics
+LFS_C_API struct lfs_metadata_cache_stats_t lfs_get_metadata_cache_stats(lfs_context_t ctx);
+
+//! Removes all entries from the metadata cache.
+//! @param ctx the context
+LFS_C_API void lfs_clear_metadata_cache(lfs_context_t ctx);
+
+//! Saves the path filter of a mount created with LFS_MOUNT_PATH_FILTER to
+//! LFS_PATH_FILTER_FILE on its device, so later mounts can load it. Writing a new file
+//! through the mount deletes it again; files added by anything else aren't noticed.
+//! @param ctx the context
+//! @param mount the mount
+//! @return the result code, LFS_UNSUPPORTED if the mount has no filter or can't be written to
+LFS_C_API enum lfs_error_code_t lfs_write_path_filter(lfs_context_t ctx, lfs_mount_t mount);
+
+//! Gets the path filter statistics.
+//! @param ctx the context
+//! @return the statistics
+LFS_C_API struct lfs_path_filter_stats_t lfs_get_path_filter_stats(lfs_context_t ctx);
+
+//! Attaches a block cache to a context. The cache must outlive the context.
+//! @param ctx the context
+//! @param cache the cache, or a cache with a NULL value to detach the current cache
+LFS_C_API void lfs_set_block_cache(lfs_context_t ctx, lfs_block_cache_t cache);
+
+//! Splits large reads into chunks that are read at the same time, on devices with handles.
+//! Reads of at least two chunks are split. This should be called before any reads are issued.
+//! @param ctx the context
+//! @param threads the number of threads reading alongside the processing thread, 0 to turn parallel reads off
+//! @param chunkBytes the size of the chunks
+LFS_C_API void lfs_set_parallel_reads(lfs_context_t ctx, uint32_t threads, uint64_t chunkBytes);
+
+// SharedBuffer functions
+
+//! Creates a reference counted buffer that takes ownership of memory allocated with an allocator.
+//! @param allocator the allocator the data was allocated with
+//! @param data the data
+//! @param bytes the size of the data in bytes
+//! @return the buffer, with a reference count of one
+LFS_C_API struct lfs_shared_buffer_t *lfs_shared_buffer_create(struct lfs_allocator_t *allocator, void *data, uint64_t bytes);
+
+//! Adds a reference to a shared buffer.
+//! @param buffer the buffer
+LFS_C_API void lfs_shared_buffer_retain(struct lfs_shared_buffer_t *buffer);
+
+//! Removes a reference from a shared buffer, freeing it once no references remain.
+//! @param buffer the buffer
+LFS_C_API void lfs_shared_buffer_release(struct lfs_shared_buffer_t *buffer);
+
+//! Gets the data of a shared buffer. Shared data must be treated as read-only.
+//! @param buffer the buffer
+//! @return the data
+LFS_C_API const void *lfs_shared_buffer_get_data(const struct lfs_shared_buffer_t *buffer);
+
+//! Gets the size of a shared buffer.
+//! @param buffer the buffer
+//! @return the size in bytes
+LFS_C_API uint64_t lfs_shared_buffer_get_size(const struct lfs_shared_buffer_t *buffer);
+
+// BlockCache functions
+
+//! Creates a block cache that can be shared between contexts.
+//! @param allocator the allocator interface to use
+//! @param budgetBytes the maximum number of bytes to cache
+//! @param blockSize the size of a cached block, 0 for the default
+//! @param shardCount the number of independently locked shards, 0 for the default
+//! @return the cache
+LFS_C_API lfs_block_cache_t lfs_block_cache_create(struct lfs_allocator_t *allocator, uint64_t budgetBytes, uint32_t blockSize, uint32_t shardCount);
+
+//! Destroys a block cache.
+//! @param cache the cache to destroy
+LFS_C_API void lfs_block_cache_destroy(lfs_block_cache_t cache);
+
+//! Gets hit ratio and eviction statistics for a block cache.
+//! @param cache the cache
+//! @return the statistics
+LFS_C_API struct lfs_block_cache_stats_t lfs_block_cache_get_stats(lfs_block_cache_t cache);
+
+//! Removes all blocks from a block cache.
+//! @param cache the cache
+LFS_C_API void lfs_block_cache_clear(lfs_block_cache_t cache);
+
 //! Sets the log function.
 //! @param ctx the context
 //! @param func the logging function
@@ -3,9 +3,13 @@
 // See LICENSE for license information.
 
 #include <stddef.h>
+#include <stdint.h>
 
 // opaque types
 struct lfs_work_item_t;
+struct lfs_shared_buffer_t;
+struct lfs_path_t;
+struct lfs_device_request_t;
 
 enum lfs_callback_buffer_action_t {
 	LFS_DO_NOT_FREE_BUFFER,
@@ -15,6 +19,13 @@ enum lfs_callback_buffer_action_t {
 // typedefs
 typedef void (*lfs_work_item_callback_t)(const struct lfs_work_item_t *, void *);
 
+//! Releases the memory backing a shared buffer. Params are the data pointer, size in bytes, and userdata pointer.
+typedef void (*lfs_shared_buffer_release_func_t)(void *, uint64_t, void *);
+
+//! Receives the paths found by a device's enumerate function. Params are the path of a file
+//! relative to the device, starting with a '/', and the userdata pointer.
+typedef void (*lfs_enumerate_callback_t)(const char *, void *);
+
 //! Memory allocation function. Params are userdata pointer, size in bytes, and alignment in bytes.
 typedef void *(*lfs_mem_alloc_t)(void *, size_t, size_t);
 //! Memory free function. Params are userdata pointer and pointer to memory to free
@@ -35,7 +46,15 @@ enum lfs_error_code_t {
 	LFS_PERMISSIONS_ERROR,
 	LFS_OUT_OF_SPACE,
 	LFS_INVALID_DEVICE,
-	LFS_OUT_OF_WORK_ITEMS
+	LFS_OUT_OF_WORK_ITEMS,
+
+	// only from devices: the request finishes later, see FileContext::completeDeviceRequest()
+	LFS_PENDING
+};
+
+enum lfs_priority_t {
+	LFS_PRIORITY_BACKGROUND,
+	LFS_PRIORITY_NORMAL
 };
 
 enum lfs_write_mode_t {
@@ -44,6 +63,30 @@ enum lfs_write_mode_t {
 	LFS_WRITE_SEGMENT
 };
 
+enum lfs_open_mode_t {
+	LFS_OPEN_READ,
+	LFS_OPEN_WRITE, // creates the file, or truncates it if it exists
+	LFS_OPEN_APPEND // creates the file, writes go to the end of it
+};
+
+enum lfs_read_flags_t {
+	LFS_READ_DEFAULT = 0,
+
+	// map the file into memory instead of copying it, on devices that can; the shared
+	// buffer then refers to the mapping and unmaps it once the last reference is released
+	LFS_READ_MAPPED = 1 << 0,
+
+	// access hints, passed on to the device: the data will be read front to back, or will
+	// be needed soon
+	LFS_READ_SEQUENTIAL = 1 << 1,
+	LFS_READ_WILLNEED = 1 << 2,
+
+	// access hints: reads will jump around the file, so reading ahead is wasted, or the
+	// data won't be read again once this read is done
+	LFS_READ_RANDOM = 1 << 3,
+	LFS_READ_DONTNEED = 1 << 4
+};
+
 enum lfs_mount_permissions_t {
 	LFS_MOUNT_DEFAULT = 0,
 	LFS_MOUNT_READ = 1 << 0,
@@ -52,7 +95,94 @@ enum lfs_mount_permissions_t {
 	LFS_MOUNT_CREATE_DIR = 1 << 3,
 	LFS_MOUNT_DELETE_DIR = 1 << 4,
 	LFS_MOUNT_WRITE = LFS_MOUNT_WRITE_FILE | LFS_MOUNT_DELETE_FILE | LFS_MOUNT_CREATE_DIR | LFS_MOUNT_DELETE_DIR,
-	LFS_MOUNT_ALL_PERMISSIONS = LFS_MOUNT_READ | LFS_MOUNT_WRITE
+	LFS_MOUNT_ALL_PERMISSIONS = LFS_MOUNT_READ | LFS_MOUNT_WRITE,
+
+	// not a permission: resolve paths on the mount ignoring the case of ASCII letters,
+	// requires a device that can enumerate its files
+	LFS_MOUNT_CASE_INSENSITIVE = 1 << 5,
+
+	// not a permission: skip the mount for paths it definitely doesn't contain, using a
+	// Bloom filter loaded from LFS_PATH_FILTER_FILE on the device or built by enumerating it.
+	// A loaded filter isn't checked against the device, so files added to it outside of
+	// LaminaFS since the filter was saved are reported as missing.
+	LFS_MOUNT_PATH_FILTER = 1 << 6,
+
+	// not a permission: read and write around the OS file cache, so bulk transfers don't
+	// evict everything else from it, requires a device with LFS_DEVICE_CAP_DIRECT_IO
+	LFS_MOUNT_DIRECT_IO = 1 << 7
+};
+
+//! Features a device provides natively, as returned by FileContext::getDeviceCapabilities().
+//! Anything a device lacks is emulated with the functions it does have.
+enum lfs_device_capabilities_t {
+	// files can be kept open and accessed through device handles
+	LFS_DEVICE_CAP_HANDLES = 1 << 0,
+
+	// reads land directly in the caller's buffer instead of one the device allocates
+	LFS_DEVICE_CAP_READ_INTO = 1 << 1,
+
+	// one call can read into several buffers
+	LFS_DEVICE_CAP_VECTORED = 1 << 2,
+
+	// files can be mapped for LFS_READ_MAPPED reads
+	LFS_DEVICE_CAP_MMAP = 1 << 3,
+
+	// whole file reads and writes can finish after the device function returns
+	LFS_DEVICE_CAP_ASYNC = 1 << 4,
+
+	// mounts can bypass the OS file cache with LFS_MOUNT_DIRECT_IO
+	LFS_DEVICE_CAP_DIRECT_IO = 1 << 5,
+
+	// access hints from read flags and file handles are passed on to the device's cache
+	LFS_DEVICE_CAP_ACCESS_HINTS = 1 << 6
+};
+
+//! One buffer of a vectored read.
+struct lfs_io_vec_t {
+	void *buffer;
+	uint64_t bytes;
+};
+
+//! The current device interface version, the first member of the interface. Interfaces
+//! from before version 2 end at the map file function, version 2 ones end at the
+//! capabilities, version 3 ones at the async functions and version 4 ones at the direct
+//! I/O switch.
+#define LFS_DEVICE_INTERFACE_VERSION 5
+
+//! Buffer and offset alignment that lets direct I/O mounts transfer data in place.
+//! Anything else still works, but goes through an aligned copy.
+#define LFS_DIRECT_IO_ALIGNMENT 4096
+
+//! The device path of a mount's saved path filter, see FileContext::writePathFilter()
+#define LFS_PATH_FILTER_FILE "/.lfs_path_filter"
+
+//! Metadata cache statistics, as returned by FileContext::getMetadataCacheStats()
+struct lfs_metadata_cache_stats_t {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t entries;
+};
+
+//! Path filter statistics, as returned by FileContext::getPathFilterStats().
+//! Queries are mount checks, rejected ones skipped the mount and false positives are
+//! accepted ones where the mount turned out not to have the path. Entries and bytes
+//! cover the filters of the current mounts.
+struct lfs_path_filter_stats_t {
+	uint64_t queries;
+	uint64_t rejected;
+	uint64_t falsePositives;
+	uint64_t entries;
+	uint64_t bytes;
+};
+
+//! Block cache statistics, as returned by BlockCache::getStats()
+struct lfs_block_cache_stats_t {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t bytesUsed;
+	uint64_t budgetBytes;
+	double hitRatio;
 };
 
 // default allocator
@@ -0,0 +1,241 @@
+#pragma once
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "shared_types.h"
+#include "util/AllocatorAdapter.h"
+#include "util/Hash.h"
+
+namespace laminaFS {
+namespace util {
+
+//! Records the reads resolved by a context so they can be replayed as prefetches later.
+//!
+//! The serialized trace is laid out in host byte order as:
+//!   header:  char[4] magic "LFSt", uint32_t version, uint32_t pathCount, uint32_t entryCount
+//!   paths:   pathCount times [uint16_t length][length bytes, not null terminated]
+//!   entries: entryCount times [uint32_t pathIndex][uint32_t milliseconds][uint64_t offset][uint64_t bytes]
+//! Each path is only stored once, entries are in the order the reads completed.
+class AccessTrace {
+public:
+	static constexpr uint32_t kVersion = 1;
+
+	struct Entry {
+		uint32_t _pathIndex;
+		uint32_t _milliseconds;
+		uint64_t _offset;
+		uint64_t _bytes;
+	};
+
+	AccessTrace(lfs_allocator_t &alloc)
+	: _entries(AllocatorAdapter<Entry>(alloc))
+	, _paths(AllocatorAdapter<char>(alloc))
+	, _pathOffsets(AllocatorAdapter<uint32_t>(alloc))
+	, _pathIndices(AllocatorAdapter<std::pair<const uint64_t, uint32_t>>(alloc))
+	{
+	}
+
+	//! Starts recording, discarding anything recorded previously.
+	//! @param maxEntries the maximum number of reads to record
+	void begin(uint32_t maxEntries) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		clearInternal();
+		_maxEntries = maxEntries;
+		_start = Clock::now();
+		_recording = maxEntries != 0;
+	}
+
+	//! Stops recording and serializes the trace.
+	//! @param alloc the allocator to allocate the trace with
+	//! @param buffer output trace buffer, nullptr if nothing was recorded
+	//! @return the size of the trace in bytes
+	uint64_t end(lfs_allocator_t &alloc, void **buffer) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_recording = false;
+		*buffer = nullptr;
+
+		if (_entries.empty()) {
+			return 0;
+		}
+
+		uint32_t pathCount = static_cast<uint32_t>(_pathOffsets.size());
+		uint32_t entryCount = static_cast<uint32_t>(_entries.size());
+		uint64_t bytes = kHeaderBytes + (_paths.size() - pathCount + pathCount * sizeof(uint16_t)) + entryCount * kEntryBytes;
+
+		uint8_t *out = static_cast<uint8_t*>(alloc.alloc(alloc.allocator, bytes, alignof(uint64_t)));
+		if (!out) {
+			clearInternal();
+			return 0;
+		}
+
+		uint8_t *cursor = out;
+		uint32_t version = kVersion;
+		write(cursor, kMagic, sizeof(kMagic));
+		write(cursor, &version, sizeof(version));
+		write(cursor, &pathCount, sizeof(pathCount));
+		write(cursor, &entryCount, sizeof(entryCount));
+
+		for (uint32_t offset : _pathOffsets) {
+			uint16_t len = static_cast<uint16_t>(strlen(&_paths[offset]));
+			write(cursor, &len, sizeof(len));
+			write(cursor, &_paths[offset], len);
+		}
+
+		for (const Entry &entry : _entries) {
+			write(cursor, &entry._pathIndex, sizeof(entry._pathIndex));
+			write(cursor, &entry._milliseconds, sizeof(entry._milliseconds));
+			write(cursor, &entry._offset, sizeof(entry._offset));
+			write(cursor, &entry._bytes, sizeof(entry._bytes));
+		}
+
+		clearInternal();
+		*buffer = out;
+		return bytes;
+	}
+
+	//! Whether or not reads are being recorded.
+	bool isRecording() const { return _recording; }
+
+	//! Records a read.
+	//! @param path the normalized path
+	//! @param offset the offset of the read
+	//! @param bytes the number of bytes read
+	void record(const char *path, uint64_t offset, uint64_t bytes) {
+		if (!_recording)
+			return;
+
+		size_t len = strlen(path);
+		if (len > UINT16_MAX)
+			return;
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (!_recording || _entries.size() >= _maxEntries)
+			return;
+
+		uint64_t hash = hashString(path);
+		auto it = _pathIndices.find(hash);
+		uint32_t pathIndex;
+
+		if (it != _pathIndices.end() && strcmp(&_paths[_pathOffsets[it->second]], path) == 0) {
+			pathIndex = it->second;
+		} else {
+			// on a hash collision the path is just stored again
+			pathIndex = static_cast<uint32_t>(_pathOffsets.size());
+			_pathOffsets.push_back(static_cast<uint32_t>(_paths.size()));
+			_paths.insert(_paths.end(), path, path + len + 1);
+
+			if (it == _pathIndices.end()) {
+				_pathIndices.emplace(hash, pathIndex);
+			}
+		}
+
+		uint32_t milliseconds = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - _start).count());
+		_entries.push_back(Entry{pathIndex, milliseconds, offset, bytes});
+	}
+
+	//! Walks the entries of a serialized trace.
+	//! @param alloc allocator for temporary storage
+	//! @param trace the trace
+	//! @param traceBytes the size of the trace
+	//! @param visitor called with each entry's path, path length and the entry itself
+	//! @return false if the trace is malformed, in which case the visitor is never called
+	template <typename Visitor>
+	static bool forEach(lfs_allocator_t &alloc, const void *trace, uint64_t traceBytes, Visitor &&visitor) {
+		const uint8_t *data = static_cast<const uint8_t*>(trace);
+
+		if (!trace || traceBytes < kHeaderBytes || memcmp(data, kMagic, sizeof(kMagic)) != 0) {
+			return false;
+		}
+
+		uint32_t header[3];
+		memcpy(header, data + sizeof(kMagic), sizeof(header));
+		if (header[0] != kVersion) {
+			return false;
+		}
+
+		// validate everything up front so a truncated trace doesn't get half replayed
+		std::vector<const uint8_t*, AllocatorAdapter<const uint8_t*>> paths{AllocatorAdapter<const uint8_t*>(alloc)};
+		const uint8_t *dataEnd = data + traceBytes;
+		const uint8_t *cursor = data + kHeaderBytes;
+		for (uint32_t i = 0; i < header[1]; ++i) {
+			uint16_t len;
+			if (static_cast<uint64_t>(dataEnd - cursor) < sizeof(len))
+				return false;
+			memcpy(&len, cursor, sizeof(len));
+
+			if (static_cast<uint64_t>(dataEnd - cursor) - sizeof(len) < len)
+				return false;
+			paths.push_back(cursor);
+			cursor += sizeof(len) + len;
+		}
+
+		const uint8_t *entries = cursor;
+		if (static_cast<uint64_t>(dataEnd - entries) != static_cast<uint64_t>(header[2]) * kEntryBytes) {
+			return false;
+		}
+
+		for (uint32_t i = 0; i < header[2]; ++i) {
+			if (readEntry(entries + i * kEntryBytes)._pathIndex >= header[1])
+				return false;
+		}
+
+		for (uint32_t i = 0; i < header[2]; ++i) {
+			Entry entry = readEntry(entries + i * kEntryBytes);
+
+			uint16_t len;
+			memcpy(&len, paths[entry._pathIndex], sizeof(len));
+			visitor(reinterpret_cast<const char*>(paths[entry._pathIndex] + sizeof(len)), len, entry);
+		}
+
+		return true;
+	}
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	static constexpr char kMagic[4] = {'L', 'F', 'S', 't'};
+	static constexpr uint64_t kHeaderBytes = sizeof(kMagic) + sizeof(uint32_t) * 3;
+	static constexpr uint64_t kEntryBytes = sizeof(uint32_t) * 2 + sizeof(uint64_t) * 2;
+
+	static void write(uint8_t *&cursor, const void *data, size_t bytes) {
+		memcpy(cursor, data, bytes);
+		cursor += bytes;
+	}
+
+	static Entry readEntry(const uint8_t *data) {
+		Entry entry;
+		memcpy(&entry._pathIndex, data, sizeof(entry._pathIndex));
+		memcpy(&entry._milliseconds, data + 4, sizeof(entry._milliseconds));
+		memcpy(&entry._offset, data + 8, sizeof(entry._offset));
+		memcpy(&entry._bytes, data + 16, sizeof(entry._bytes));
+		return entry;
+	}
+
+	void clearInternal() {
+		_entries.clear();
+		_paths.clear();
+		_pathOffsets.clear();
+		_pathIndices.clear();
+	}
+
+	std::vector<Entry, AllocatorAdapter<Entry>> _entries;
+	std::vector<char, AllocatorAdapter<char>> _paths;
+	std::vector<uint32_t, AllocatorAdapter<uint32_t>> _pathOffsets;
+	std::unordered_map<uint64_t, uint32_t, std::hash<uint64_t>, std::equal_to<uint64_t>, AllocatorAdapter<std::pair<const uint64_t, uint32_t>>> _pathIndices;
+	std::mutex _mutex;
+	Clock::time_point _start;
+	uint32_t _maxEntries = 0;
+	std::atomic<bool> _recording{false};
+};
+
+}
+}
@@ -0,0 +1,46 @@
+#pragma once
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#include <cstddef>
+
+#include "shared_types.h"
+
+namespace laminaFS {
+
+extern lfs_allocator_t DefaultAllocator;
+
+// C++ Allocator Adapter
+template <class T>
+struct AllocatorAdapter {
+	typedef T value_type;
+	AllocatorAdapter() noexcept : _alloc(DefaultAllocator) {}
+	AllocatorAdapter(lfs_allocator_t &alloc) noexcept : _alloc(alloc) {}
+
+	template <class U>
+	AllocatorAdapter(const AllocatorAdapter<U>& other) noexcept {
+		_alloc = other._alloc;
+	}
+
+	T* allocate(std::size_t n) {
+		return static_cast<T*>(_alloc.alloc(_alloc.allocator, sizeof(T) * n, alignof(T)));
+	}
+
+	void deallocate(T* p, std::size_t) {
+		_alloc.free(_alloc.allocator, p);
+	}
+
+	lfs_allocator_t _alloc;
+};
+
+template <class T, class U>
+bool operator==(const AllocatorAdapter<T> &a, const AllocatorAdapter<U> &b) {
+	return a._alloc.alloc == b._alloc.alloc && a._alloc.free == b._alloc.free && a._alloc.allocator == b._alloc.allocator;
+}
+
+template <class T, class U>
+bool operator!=(const AllocatorAdapter<T> &a, const AllocatorAdapter<U> &b) {
+	return !(a == b);
+}
+
+}
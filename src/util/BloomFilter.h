@@ -0,0 +1,183 @@
+#pragma once
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include "shared_types.h"
+
+namespace laminaFS {
+namespace util {
+
+//! A Bloom filter over 64-bit hashes, used to rule out mounts that can't contain a path.
+//!
+//! The serialized filter is laid out in host byte order as:
+//!   header: char[4] magic "LFSf", uint32_t version, uint32_t hashCount, uint32_t padding,
+//!           uint64_t entryCount, uint64_t bitCount
+//!   bits:   bitCount / 8 bytes
+//! The hashes are FNV-1a (see Hash.h) of device paths, starting with a '/'.
+//! Adding and checking hashes is safe from multiple threads.
+class BloomFilter {
+public:
+	static constexpr uint32_t kVersion = 1;
+
+	//! About 10 bits and 7 probes per entry gives a false positive rate under 1%.
+	static constexpr uint32_t kBitsPerEntry = 10;
+	static constexpr uint32_t kHashCount = 7;
+	static constexpr uint32_t kMaxHashCount = 32;
+
+	BloomFilter(lfs_allocator_t &alloc)
+	: _alloc(alloc)
+	{
+	}
+
+	~BloomFilter() {
+		freeBits();
+	}
+
+	BloomFilter(const BloomFilter &) = delete;
+	BloomFilter &operator=(const BloomFilter &) = delete;
+
+	//! Clears the filter and sizes it for a number of entries.
+	//! @param expectedEntries the number of entries that will be added
+	//! @return false if the bits couldn't be allocated
+	bool reset(uint64_t expectedEntries) {
+		uint64_t bitCount = 64;
+		while (bitCount < expectedEntries * kBitsPerEntry) {
+			bitCount <<= 1;
+		}
+
+		return allocBits(bitCount, kHashCount);
+	}
+
+	//! Adds a hash to the filter.
+	//! @param hash the hash
+	void add(uint64_t hash) {
+		uint64_t h2 = secondHash(hash);
+		for (uint32_t i = 0; i < _hashCount; ++i) {
+			uint64_t bit = (hash + i * h2) & _bitMask;
+			_bits[bit >> 6].fetch_or(1ULL << (bit & 63), std::memory_order_relaxed);
+		}
+		_entryCount.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	//! Checks whether a hash may have been added to the filter.
+	//! @param hash the hash
+	//! @return false if the hash was definitely never added
+	bool mayContain(uint64_t hash) const {
+		uint64_t h2 = secondHash(hash);
+		for (uint32_t i = 0; i < _hashCount; ++i) {
+			uint64_t bit = (hash + i * h2) & _bitMask;
+			if ((_bits[bit >> 6].load(std::memory_order_relaxed) & (1ULL << (bit & 63))) == 0)
+				return false;
+		}
+		return true;
+	}
+
+	//! @return the number of entries added
+	uint64_t entries() const { return _entryCount.load(std::memory_order_relaxed); }
+
+	//! @return the size of the filter's bits in bytes
+	uint64_t bytes() const { return _bits ? (_bitMask + 1) / 8 : 0; }
+
+	//! @return the size of the serialized filter in bytes
+	uint64_t serializedSize() const { return kHeaderBytes + bytes(); }
+
+	//! Serializes the filter.
+	//! @param buffer output buffer, at least serializedSize() bytes
+	void serialize(void *buffer) const {
+		uint8_t *out = static_cast<uint8_t*>(buffer);
+		uint32_t header[3] = {kVersion, _hashCount, 0};
+		uint64_t counts[2] = {entries(), _bitMask + 1};
+
+		memcpy(out, kMagic, sizeof(kMagic));
+		memcpy(out + sizeof(kMagic), header, sizeof(header));
+		memcpy(out + sizeof(kMagic) + sizeof(header), counts, sizeof(counts));
+
+		for (uint64_t i = 0; i < bytes() / sizeof(uint64_t); ++i) {
+			uint64_t word = _bits[i].load(std::memory_order_relaxed);
+			memcpy(out + kHeaderBytes + i * sizeof(word), &word, sizeof(word));
+		}
+	}
+
+	//! Replaces the filter with a serialized one.
+	//! @param buffer the serialized filter
+	//! @param bufferBytes the size of the serialized filter
+	//! @return false if the serialized filter is malformed, in which case the filter is unchanged
+	bool deserialize(const void *buffer, uint64_t bufferBytes) {
+		const uint8_t *in = static_cast<const uint8_t*>(buffer);
+		if (!buffer || bufferBytes < kHeaderBytes || memcmp(in, kMagic, sizeof(kMagic)) != 0)
+			return false;
+
+		uint32_t header[3];
+		uint64_t counts[2];
+		memcpy(header, in + sizeof(kMagic), sizeof(header));
+		memcpy(counts, in + sizeof(kMagic) + sizeof(header), sizeof(counts));
+
+		uint64_t bitCount = counts[1];
+		bool powerOfTwo = bitCount >= 64 && (bitCount & (bitCount - 1)) == 0;
+		if (header[0] != kVersion || header[1] == 0 || header[1] > kMaxHashCount || !powerOfTwo || bufferBytes - kHeaderBytes != bitCount / 8)
+			return false;
+
+		if (!allocBits(bitCount, header[1]))
+			return false;
+
+		for (uint64_t i = 0; i < bytes() / sizeof(uint64_t); ++i) {
+			uint64_t word;
+			memcpy(&word, in + kHeaderBytes + i * sizeof(word), sizeof(word));
+			_bits[i].store(word, std::memory_order_relaxed);
+		}
+
+		_entryCount = counts[0];
+		return true;
+	}
+
+private:
+	static constexpr char kMagic[4] = {'L', 'F', 'S', 'f'};
+	static constexpr uint64_t kHeaderBytes = sizeof(kMagic) + sizeof(uint32_t) * 3 + sizeof(uint64_t) * 2;
+
+	// double hashing, the second hash is remixed so that it's independent of the low bits
+	static uint64_t secondHash(uint64_t hash) {
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdULL;
+		hash ^= hash >> 33;
+		return hash | 1;
+	}
+
+	// not safe to call while the filter is in use
+	bool allocBits(uint64_t bitCount, uint32_t hashCount) {
+		void *memory = _alloc.alloc(_alloc.allocator, bitCount / 8, alignof(std::atomic<uint64_t>));
+		if (!memory)
+			return false;
+
+		freeBits();
+		_bits = static_cast<std::atomic<uint64_t>*>(memory);
+		for (uint64_t i = 0; i < bitCount / 64; ++i) {
+			new(&_bits[i]) std::atomic<uint64_t>(0);
+		}
+
+		_bitMask = bitCount - 1;
+		_hashCount = hashCount;
+		_entryCount = 0;
+		return true;
+	}
+
+	void freeBits() {
+		if (_bits) {
+			_alloc.free(_alloc.allocator, _bits);
+			_bits = nullptr;
+		}
+	}
+
+	lfs_allocator_t &_alloc;
+	std::atomic<uint64_t> *_bits = nullptr;
+	uint64_t _bitMask = 0;
+	std::atomic<uint64_t> _entryCount{0};
+	uint32_t _hashCount = 0;
+};
+
+}
+}
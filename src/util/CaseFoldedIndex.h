@@ -0,0 +1,180 @@
+#pragma once
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <unordered_map>
+
+#include "shared_types.h"
+#include "util/AllocatorAdapter.h"
+#include "util/Hash.h"
+
+namespace laminaFS {
+namespace util {
+
+//! Maps paths to the case they actually have on a device, so lookups using the wrong
+//! case can be resolved with a single hash lookup instead of scanning directories.
+//! Only ASCII letters are folded. Not thread safe.
+class CaseFoldedIndex {
+public:
+	CaseFoldedIndex(lfs_allocator_t &alloc)
+	: _alloc(alloc)
+	, _entries(AllocatorAdapter<std::pair<const uint64_t, Entry*>>(alloc))
+	{
+	}
+
+	~CaseFoldedIndex() {
+		clear();
+	}
+
+	//! Adds a path. Does nothing if the exact path is already present.
+	//! @param path the path, in the case it has on the device
+	void insert(const char *path) {
+		uint64_t hash = foldedHash(path);
+		auto it = _entries.find(hash);
+
+		if (it != _entries.end()) {
+			for (Entry *entry = it->second; entry; entry = entry->_next) {
+				if (strcmp(entry->_path, path) == 0)
+					return;
+			}
+		}
+
+		size_t len = strlen(path);
+		Entry *entry = static_cast<Entry*>(_alloc.alloc(_alloc.allocator, sizeof(Entry) + len + 1, alignof(Entry)));
+		entry->_path = reinterpret_cast<char*>(entry + 1);
+		memcpy(entry->_path, path, len + 1);
+
+		if (it != _entries.end()) {
+			entry->_next = it->second;
+			it->second = entry;
+		} else {
+			entry->_next = nullptr;
+			_entries.emplace(hash, entry);
+		}
+
+		++_count;
+	}
+
+	//! Finds the indexed path that matches a path ignoring case. If several paths only
+	//! differ by case, an exact match is preferred.
+	//! @param path the path to look up
+	//! @return the indexed path, or nullptr if there is none. Valid until it's erased.
+	const char *find(const char *path) const {
+		auto it = _entries.find(foldedHash(path));
+		if (it == _entries.end())
+			return nullptr;
+
+		const char *match = nullptr;
+		for (Entry *entry = it->second; entry; entry = entry->_next) {
+			if (strcmp(entry->_path, path) == 0)
+				return entry->_path;
+			if (!match && equalsFolded(entry->_path, path))
+				match = entry->_path;
+		}
+
+		return match;
+	}
+
+	//! Removes a path.
+	//! @param path the path, in the case it has on the device
+	void erase(const char *path) {
+		auto it = _entries.find(foldedHash(path));
+		if (it == _entries.end())
+			return;
+
+		for (Entry **link = &it->second; *link; link = &(*link)->_next) {
+			Entry *entry = *link;
+			if (strcmp(entry->_path, path) == 0) {
+				*link = entry->_next;
+				_alloc.free(_alloc.allocator, entry);
+				--_count;
+				break;
+			}
+		}
+
+		if (!it->second) {
+			_entries.erase(it);
+		}
+	}
+
+	//! Removes every path inside a directory. This walks the whole index.
+	//! @param path the directory, in the case it has on the device
+	void eraseDirectory(const char *path) {
+		size_t len = strlen(path);
+
+		for (auto it = _entries.begin(); it != _entries.end();) {
+			for (Entry **link = &it->second; *link;) {
+				Entry *entry = *link;
+				if (strncmp(entry->_path, path, len) == 0 && entry->_path[len] == '/') {
+					*link = entry->_next;
+					_alloc.free(_alloc.allocator, entry);
+					--_count;
+				} else {
+					link = &entry->_next;
+				}
+			}
+
+			it = it->second ? std::next(it) : _entries.erase(it);
+		}
+	}
+
+	//! Removes all paths.
+	void clear() {
+		for (auto &bucket : _entries) {
+			Entry *entry = bucket.second;
+			while (entry) {
+				Entry *next = entry->_next;
+				_alloc.free(_alloc.allocator, entry);
+				entry = next;
+			}
+		}
+
+		_entries.clear();
+		_count = 0;
+	}
+
+	//! @return the number of indexed paths
+	uint64_t size() const { return _count; }
+
+	//! Hashes a path the same regardless of the case of its ASCII letters.
+	//! @param path the path
+	//! @return the hash
+	static uint64_t foldedHash(const char *path) {
+		uint64_t hash = kFNVOffsetBasis;
+		for (; *path; ++path) {
+			hash = (hash ^ static_cast<uint8_t>(fold(*path))) * kFNVPrime;
+		}
+		return hash;
+	}
+
+	//! Compares two paths ignoring the case of ASCII letters.
+	//! @param a the first path
+	//! @param b the second path
+	//! @return whether the paths are equal
+	static bool equalsFolded(const char *a, const char *b) {
+		for (; *a && fold(*a) == fold(*b); ++a, ++b) {
+		}
+		return fold(*a) == fold(*b);
+	}
+
+private:
+	struct Entry {
+		Entry *_next;
+		char *_path;
+	};
+
+	static char fold(char c) {
+		return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+	}
+
+	lfs_allocator_t &_alloc;
+	std::unordered_map<uint64_t, Entry*, std::hash<uint64_t>, std::equal_to<uint64_t>, AllocatorAdapter<std::pair<const uint64_t, Entry*>>> _entries;
+	uint64_t _count = 0;
+};
+
+}
+}
@@ -0,0 +1,215 @@
+#pragma once
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#if !defined(_WIN32)
+
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+
+#include <unistd.h>
+
+#include "shared_types.h"
+
+namespace laminaFS {
+namespace util {
+
+//! A small, bounded cache of open file descriptors keyed by path, evicting the least
+//! recently used descriptor when full. Descriptors handed out by acquire() or insert() stay
+//! open until they're given back with release(), even if the entry is invalidated or
+//! evicted in the meantime. Callers should only use positioned I/O on them, since the file
+//! offset is shared between everyone holding the descriptor.
+class FileDescriptorCache {
+public:
+	static constexpr uint32_t kDefaultCapacity = 32;
+
+	FileDescriptorCache(lfs_allocator_t &alloc, uint32_t capacity = kDefaultCapacity)
+	: _alloc(alloc)
+	, _capacity(capacity)
+	{
+		_entries = static_cast<Entry*>(_alloc.alloc(_alloc.allocator, sizeof(Entry) * _capacity, alignof(Entry)));
+		if (!_entries) {
+			_capacity = 0;
+		}
+
+		for (uint32_t i = 0; i < _capacity; ++i) {
+			_entries[i] = Entry();
+		}
+	}
+
+	~FileDescriptorCache() {
+		clear();
+		_alloc.free(_alloc.allocator, _entries);
+	}
+
+	FileDescriptorCache(const FileDescriptorCache &) = delete;
+	FileDescriptorCache &operator=(const FileDescriptorCache &) = delete;
+
+	//! Looks up an open descriptor for a path.
+	//! @param path the path
+	//! @param hash the hash of the path
+	//! @return the descriptor, or -1 on a miss. Hits must be given back with release().
+	int acquire(const char *path, uint64_t hash) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		Entry *entry = find(path, hash);
+		if (!entry) {
+			++_misses;
+			return -1;
+		}
+
+		++_hits;
+		++entry->_users;
+		entry->_lastUse = ++_clock;
+		return entry->_fd;
+	}
+
+	//! Adds a freshly opened descriptor to the cache. If every slot is in use the descriptor
+	//! simply isn't cached, and release() closes it.
+	//! @param path the path
+	//! @param hash the hash of the path
+	//! @param fd the descriptor, now owned by the cache
+	//! @return the descriptor to use, which must be given back with release()
+	int insert(const char *path, uint64_t hash, int fd) {
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		// another thread may have opened the same file in the meantime
+		if (Entry *entry = find(path, hash)) {
+			++entry->_users;
+			entry->_lastUse = ++_clock;
+			close(fd);
+			return entry->_fd;
+		}
+
+		Entry *slot = nullptr;
+		for (uint32_t i = 0; i < _capacity; ++i) {
+			Entry &entry = _entries[i];
+			if (entry._fd == -1) {
+				slot = &entry;
+				break;
+			} else if (entry._users == 0 && (!slot || entry._lastUse < slot->_lastUse)) {
+				slot = &entry;
+			}
+		}
+
+		if (!slot) {
+			return fd;
+		}
+
+		size_t len = strlen(path) + 1;
+		char *pathCopy = static_cast<char*>(_alloc.alloc(_alloc.allocator, len, alignof(char)));
+		if (!pathCopy) {
+			return fd;
+		}
+		memcpy(pathCopy, path, len);
+
+		if (slot->_fd != -1) {
+			drop(*slot);
+		}
+
+		slot->_path = pathCopy;
+		slot->_hash = hash;
+		slot->_fd = fd;
+		slot->_users = 1;
+		slot->_lastUse = ++_clock;
+		slot->_stale = false;
+		return fd;
+	}
+
+	//! Gives back a descriptor from acquire() or insert().
+	//! @param fd the descriptor
+	void release(int fd) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (uint32_t i = 0; i < _capacity; ++i) {
+			Entry &entry = _entries[i];
+			if (entry._fd == fd) {
+				if (--entry._users == 0 && entry._stale) {
+					drop(entry);
+				}
+				return;
+			}
+		}
+
+		// never made it into the cache
+		close(fd);
+	}
+
+	//! Removes a path from the cache. Its descriptor is closed once nobody is using it.
+	//! @param path the path
+	//! @param hash the hash of the path
+	void invalidate(const char *path, uint64_t hash) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (Entry *entry = find(path, hash)) {
+			retire(*entry);
+		}
+	}
+
+	//! Removes every path from the cache.
+	void clear() {
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (uint32_t i = 0; i < _capacity; ++i) {
+			if (_entries[i]._fd != -1 && !_entries[i]._stale) {
+				retire(_entries[i]);
+			}
+		}
+	}
+
+	//! Number of lookups that found an open descriptor.
+	uint64_t hits() {
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _hits;
+	}
+
+	//! Number of lookups that had to open the file.
+	uint64_t misses() {
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _misses;
+	}
+
+private:
+	struct Entry {
+		char *_path = nullptr;
+		uint64_t _hash = 0;
+		uint64_t _lastUse = 0;
+		int _fd = -1;
+		uint32_t _users = 0;
+		bool _stale = false; // invalidated while in use, closed on the last release()
+	};
+
+	Entry *find(const char *path, uint64_t hash) {
+		for (uint32_t i = 0; i < _capacity; ++i) {
+			Entry &entry = _entries[i];
+			if (entry._fd != -1 && !entry._stale && entry._hash == hash && strcmp(entry._path, path) == 0) {
+				return &entry;
+			}
+		}
+		return nullptr;
+	}
+
+	void retire(Entry &entry) {
+		if (entry._users == 0) {
+			drop(entry);
+		} else {
+			entry._stale = true;
+		}
+	}
+
+	void drop(Entry &entry) {
+		close(entry._fd);
+		_alloc.free(_alloc.allocator, entry._path);
+		entry = Entry();
+	}
+
+	lfs_allocator_t &_alloc;
+	Entry *_entries = nullptr;
+	std::mutex _mutex;
+	uint64_t _clock = 0;
+	uint64_t _hits = 0;
+	uint64_t _misses = 0;
+	uint32_t _capacity;
+};
+
+}
+}
+
+#endif // _WIN32
@@ -0,0 +1,39 @@
+#pragma once
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#include <cstddef>
+#include <cstdint>
+
+namespace laminaFS {
+namespace util {
+
+constexpr uint64_t kFNVOffsetBasis = 0xcbf29ce484222325ULL;
+constexpr uint64_t kFNVPrime = 0x100000001b3ULL;
+
+//! 64-bit FNV-1a hash of a null-terminated string. Usable in constant expressions.
+//! @param str the string to hash
+//! @return the hash
+constexpr uint64_t hashString(const char *str) {
+	uint64_t hash = kFNVOffsetBasis;
+	for (; *str; ++str) {
+		hash = (hash ^ static_cast<uint8_t>(*str)) * kFNVPrime;
+	}
+	return hash;
+}
+
+//! 64-bit FNV-1a hash of a buffer.
+//! @param data the data to hash
+//! @param len the length of the data in bytes
+//! @param hash the hash to continue from
+//! @return the hash
+inline uint64_t hashBytes(const void *data, size_t len, uint64_t hash = kFNVOffsetBasis) {
+	const uint8_t *bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < len; ++i) {
+		hash = (hash ^ bytes[i]) * kFNVPrime;
+	}
+	return hash;
+}
+
+}
+}
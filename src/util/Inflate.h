@@ -0,0 +1,371 @@
+#pragma once
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace laminaFS {
+namespace util {
+
+//! Decoder for raw DEFLATE streams (RFC 1951), as stored in zip files. The whole output
+//! buffer doubles as the history window, so there's no state beyond a single call.
+//! Malformed input is detected rather than read or written out of bounds.
+class Inflater {
+public:
+	enum class Result {
+		//! The final block was decoded.
+		Done,
+		//! The output buffer filled up before the end of the stream.
+		OutputFull,
+		//! The stream is malformed or truncated.
+		Malformed
+	};
+
+	//! Decodes a stream.
+	//! @param src the compressed stream
+	//! @param srcBytes the size of the compressed stream
+	//! @param dst output buffer
+	//! @param dstBytes the size of the output buffer, decoding stops once it's full
+	//! @param written output number of bytes written
+	//! @return the result
+	static Result inflate(const void *src, size_t srcBytes, void *dst, size_t dstBytes, size_t *written) {
+		Inflater state(static_cast<const uint8_t*>(src), srcBytes, static_cast<uint8_t*>(dst), dstBytes);
+		Result result = state.run();
+		*written = static_cast<size_t>(state._out - state._outStart);
+		return result;
+	}
+
+private:
+	static constexpr uint32_t kMaxBits = 15;
+	static constexpr uint32_t kFastBits = 9;
+	static constexpr uint32_t kMaxLitLenCodes = 288;
+	static constexpr uint32_t kMaxDistCodes = 30;
+
+	// canonical Huffman code, with a table for decoding short codes in one step
+	struct Huffman {
+		uint16_t _count[kMaxBits + 1];
+		uint16_t _symbol[kMaxLitLenCodes];
+		// symbol | length << 9, 0 if the code is longer than kFastBits
+		uint16_t _fast[1 << kFastBits];
+	};
+
+	Inflater(const uint8_t *in, size_t inBytes, uint8_t *out, size_t outBytes)
+	: _in(in)
+	, _inEnd(in + inBytes)
+	, _out(out)
+	, _outStart(out)
+	, _outEnd(out + outBytes)
+	{
+	}
+
+	// makes sure at least 57 bits are buffered, or all of the remaining input
+	void refill() {
+		while (_bitCount <= 56 && _in < _inEnd) {
+			_bits |= static_cast<uint64_t>(*_in++) << _bitCount;
+			_bitCount += 8;
+		}
+	}
+
+	bool getBits(uint32_t count, uint32_t &value) {
+		refill();
+		if (_bitCount < count)
+			return false;
+
+		value = static_cast<uint32_t>(_bits & ((1ULL << count) - 1));
+		_bits >>= count;
+		_bitCount -= count;
+		return true;
+	}
+
+	// returns false for over-subscribed codes, incomplete ones are allowed by the format
+	static bool build(Huffman &h, const uint8_t *lengths, uint32_t count) {
+		memset(h._count, 0, sizeof(h._count));
+		memset(h._fast, 0, sizeof(h._fast));
+		for (uint32_t i = 0; i < count; ++i) {
+			++h._count[lengths[i]];
+		}
+		h._count[0] = 0;
+
+		int32_t left = 1;
+		for (uint32_t len = 1; len <= kMaxBits; ++len) {
+			left = (left << 1) - h._count[len];
+			if (left < 0)
+				return false;
+		}
+
+		uint16_t offsets[kMaxBits + 2];
+		uint32_t codes[kMaxBits + 2];
+		offsets[1] = 0;
+		codes[1] = 0;
+		for (uint32_t len = 1; len <= kMaxBits; ++len) {
+			offsets[len + 1] = static_cast<uint16_t>(offsets[len] + h._count[len]);
+			codes[len + 1] = (codes[len] + h._count[len]) << 1;
+		}
+
+		for (uint32_t symbol = 0; symbol < count; ++symbol) {
+			uint32_t len = lengths[symbol];
+			if (len == 0)
+				continue;
+
+			h._symbol[offsets[len]++] = static_cast<uint16_t>(symbol);
+			uint32_t code = codes[len]++;
+			if (len > kFastBits)
+				continue;
+
+			// codes are sent most significant bit first, so the table is indexed by the reversed code
+			uint32_t reversed = 0;
+			for (uint32_t i = 0; i < len; ++i) {
+				reversed |= ((code >> i) & 1) << (len - 1 - i);
+			}
+			for (uint32_t fill = reversed; fill < (1u << kFastBits); fill += 1u << len) {
+				h._fast[fill] = static_cast<uint16_t>(symbol | len << 9);
+			}
+		}
+
+		return true;
+	}
+
+	bool decode(const Huffman &h, uint32_t &symbol) {
+		refill();
+
+		uint16_t fast = h._fast[_bits & ((1u << kFastBits) - 1)];
+		if (fast != 0) {
+			uint32_t len = fast >> 9;
+			if (len > _bitCount)
+				return false;
+
+			symbol = fast & 511u;
+			_bits >>= len;
+			_bitCount -= len;
+			return true;
+		}
+
+		// long codes are decoded a bit at a time
+		int32_t code = 0;
+		int32_t first = 0;
+		int32_t index = 0;
+		for (uint32_t len = 1; len <= kMaxBits && len <= _bitCount; ++len) {
+			code |= static_cast<int32_t>((_bits >> (len - 1)) & 1);
+			int32_t count = h._count[len];
+			if (code - count < first) {
+				symbol = h._symbol[index + (code - first)];
+				_bits >>= len;
+				_bitCount -= len;
+				return true;
+			}
+
+			index += count;
+			first = (first + count) << 1;
+			code <<= 1;
+		}
+
+		return false;
+	}
+
+	Result stored() {
+		// stored blocks start on a byte boundary, give back the buffered whole bytes
+		_bits >>= _bitCount & 7;
+		_bitCount -= _bitCount & 7;
+		_in -= _bitCount / 8;
+		_bits = 0;
+		_bitCount = 0;
+
+		if (_inEnd - _in < 4)
+			return Result::Malformed;
+
+		uint32_t len = _in[0] | static_cast<uint32_t>(_in[1]) << 8;
+		uint32_t nlen = _in[2] | static_cast<uint32_t>(_in[3]) << 8;
+		_in += 4;
+		if (len != (~nlen & 0xffff) || static_cast<size_t>(_inEnd - _in) < len)
+			return Result::Malformed;
+
+		size_t space = static_cast<size_t>(_outEnd - _out);
+		size_t bytes = len < space ? len : space;
+		if (bytes > 0) {
+			memcpy(_out, _in, bytes);
+			_out += bytes;
+		}
+		_in += bytes;
+		return bytes < len ? Result::OutputFull : Result::Done;
+	}
+
+	Result codes(const Huffman &litLen, const Huffman &dist) {
+		static const uint16_t kLengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+		static const uint8_t kLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+		static const uint16_t kDistBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+		static const uint8_t kDistExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+		for (;;) {
+			uint32_t symbol;
+			if (!decode(litLen, symbol))
+				return Result::Malformed;
+
+			if (symbol < 256) {
+				if (_out == _outEnd)
+					return Result::OutputFull;
+				*_out++ = static_cast<uint8_t>(symbol);
+				continue;
+			}
+
+			if (symbol == 256)
+				return Result::Done;
+
+			symbol -= 257;
+			uint32_t extra;
+			if (symbol >= 29 || !getBits(kLengthExtra[symbol], extra))
+				return Result::Malformed;
+			size_t length = kLengthBase[symbol] + extra;
+
+			if (!decode(dist, symbol) || symbol >= 30 || !getBits(kDistExtra[symbol], extra))
+				return Result::Malformed;
+			size_t distance = kDistBase[symbol] + extra;
+			if (distance > static_cast<size_t>(_out - _outStart))
+				return Result::Malformed;
+
+			size_t space = static_cast<size_t>(_outEnd - _out);
+			size_t bytes = length < space ? length : space;
+			const uint8_t *match = _out - distance;
+			if (bytes == 0) {
+				return Result::OutputFull;
+			} else if (distance >= bytes) {
+				memcpy(_out, match, bytes);
+				_out += bytes;
+			} else {
+				// overlapping matches repeat the bytes being written
+				for (size_t i = 0; i < bytes; ++i) {
+					*_out++ = match[i];
+				}
+			}
+
+			if (bytes < length)
+				return Result::OutputFull;
+		}
+	}
+
+	Result fixed() {
+		static const FixedCodes fixedCodes;
+		return codes(fixedCodes._litLen, fixedCodes._dist);
+	}
+
+	Result dynamic() {
+		static const uint8_t kOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+		uint32_t litLenCount, distCount, codeLenCount;
+		if (!getBits(5, litLenCount) || !getBits(5, distCount) || !getBits(4, codeLenCount))
+			return Result::Malformed;
+		litLenCount += 257;
+		distCount += 1;
+		codeLenCount += 4;
+		if (litLenCount > 286 || distCount > kMaxDistCodes)
+			return Result::Malformed;
+
+		uint8_t lengths[kMaxLitLenCodes + kMaxDistCodes] = {};
+		for (uint32_t i = 0; i < codeLenCount; ++i) {
+			uint32_t len;
+			if (!getBits(3, len))
+				return Result::Malformed;
+			lengths[kOrder[i]] = static_cast<uint8_t>(len);
+		}
+
+		Huffman lenCode;
+		if (!build(lenCode, lengths, 19))
+			return Result::Malformed;
+
+		for (uint32_t index = 0; index < litLenCount + distCount;) {
+			uint32_t symbol;
+			if (!decode(lenCode, symbol))
+				return Result::Malformed;
+
+			if (symbol < 16) {
+				lengths[index++] = static_cast<uint8_t>(symbol);
+				continue;
+			}
+
+			uint32_t repeat;
+			uint8_t len = 0;
+			if (symbol == 16) {
+				if (index == 0 || !getBits(2, repeat))
+					return Result::Malformed;
+				len = lengths[index - 1];
+				repeat += 3;
+			} else if (symbol == 17) {
+				if (!getBits(3, repeat))
+					return Result::Malformed;
+				repeat += 3;
+			} else {
+				if (!getBits(7, repeat))
+					return Result::Malformed;
+				repeat += 11;
+			}
+
+			if (index + repeat > litLenCount + distCount)
+				return Result::Malformed;
+			while (repeat--) {
+				lengths[index++] = len;
+			}
+		}
+
+		// the end of block code has to be decodable
+		if (lengths[256] == 0)
+			return Result::Malformed;
+
+		Huffman litLen, dist;
+		if (!build(litLen, lengths, litLenCount) || !build(dist, lengths + litLenCount, distCount))
+			return Result::Malformed;
+
+		return codes(litLen, dist);
+	}
+
+	Result run() {
+		uint32_t last = 0;
+		while (!last) {
+			uint32_t type;
+			if (!getBits(1, last) || !getBits(2, type))
+				return Result::Malformed;
+
+			Result result = Result::Malformed;
+			switch (type) {
+			case 0: result = stored(); break;
+			case 1: result = fixed(); break;
+			case 2: result = dynamic(); break;
+			default: break;
+			}
+
+			if (result != Result::Done)
+				return result;
+		}
+
+		return Result::Done;
+	}
+
+	struct FixedCodes {
+		FixedCodes() {
+			uint8_t lengths[kMaxLitLenCodes];
+			uint32_t symbol = 0;
+			for (; symbol < 144; ++symbol) lengths[symbol] = 8;
+			for (; symbol < 256; ++symbol) lengths[symbol] = 9;
+			for (; symbol < 280; ++symbol) lengths[symbol] = 7;
+			for (; symbol < kMaxLitLenCodes; ++symbol) lengths[symbol] = 8;
+			build(_litLen, lengths, kMaxLitLenCodes);
+
+			memset(lengths, 5, kMaxDistCodes);
+			build(_dist, lengths, kMaxDistCodes);
+		}
+
+		Huffman _litLen;
+		Huffman _dist;
+	};
+
+	const uint8_t *_in;
+	const uint8_t *_inEnd;
+	uint8_t *_out;
+	uint8_t *_outStart;
+	uint8_t *_outEnd;
+	uint64_t _bits = 0;
+	uint32_t _bitCount = 0;
+};
+
+}
+}
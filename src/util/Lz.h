@@ -0,0 +1,207 @@
+#pragma once
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace laminaFS {
+namespace util {
+namespace lz {
+
+//! A small byte-oriented LZ77 codec for independently compressed blocks.
+//!
+//! A compressed block is a series of sequences, each laid out as:
+//!   token:   uint8_t, literal count in the high nibble, match length - kMinMatch in the low one
+//!   [literal count - 15 as bytes of 255 terminated by a smaller byte, if the nibble is 15]
+//!   literals
+//!   offset:  uint16_t little endian, distance back to the start of the match, never 0
+//!   [match length - kMinMatch - 15 encoded like the literal count, if the nibble is 15]
+//! The last sequence only has a token and literals, and ends the block.
+constexpr uint32_t kMinMatch = 4;
+constexpr uint32_t kMaxOffset = 65535;
+
+//! @param bytes the size of the uncompressed data
+//! @return the largest size the compressed data can have
+constexpr size_t compressBound(size_t bytes) {
+	return bytes + bytes / 255 + 16;
+}
+
+namespace detail {
+constexpr uint32_t kHashBits = 12;
+
+inline uint32_t read32(const uint8_t *p) {
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+inline uint32_t hash4(uint32_t value) {
+	return (value * 2654435761u) >> (32 - kHashBits);
+}
+
+// writes the part of a length that doesn't fit in a token nibble
+inline bool writeLength(uint8_t *&out, const uint8_t *outEnd, size_t length) {
+	for (; length >= 255; length -= 255) {
+		if (out >= outEnd)
+			return false;
+		*out++ = 255;
+	}
+	if (out >= outEnd)
+		return false;
+	*out++ = static_cast<uint8_t>(length);
+	return true;
+}
+
+inline bool readLength(const uint8_t *&in, const uint8_t *inEnd, size_t &length) {
+	uint8_t byte;
+	do {
+		if (in >= inEnd)
+			return false;
+		byte = *in++;
+		length += byte;
+	} while (byte == 255);
+	return true;
+}
+
+inline bool writeSequence(uint8_t *&out, const uint8_t *outEnd, const uint8_t *literals, size_t literalCount, uint32_t offset, size_t matchLength) {
+	if (out >= outEnd)
+		return false;
+
+	uint8_t *token = out++;
+	*token = static_cast<uint8_t>((literalCount < 15 ? literalCount : 15) << 4);
+	if (literalCount >= 15 && !writeLength(out, outEnd, literalCount - 15))
+		return false;
+
+	if (static_cast<size_t>(outEnd - out) < literalCount)
+		return false;
+	memcpy(out, literals, literalCount);
+	out += literalCount;
+
+	if (matchLength == 0)
+		return true;
+
+	if (outEnd - out < 2)
+		return false;
+	*out++ = static_cast<uint8_t>(offset);
+	*out++ = static_cast<uint8_t>(offset >> 8);
+
+	size_t matchCode = matchLength - kMinMatch;
+	*token |= static_cast<uint8_t>(matchCode < 15 ? matchCode : 15);
+	return matchCode < 15 || writeLength(out, outEnd, matchCode - 15);
+}
+}
+
+//! Compresses a block.
+//! @param src the data to compress
+//! @param srcBytes the size of the data
+//! @param dst output buffer
+//! @param dstCapacity the size of the output buffer, compressBound(srcBytes) always suffices
+//! @return the compressed size, or 0 if it didn't fit in the output buffer
+inline size_t compress(const void *src, size_t srcBytes, void *dst, size_t dstCapacity) {
+	using namespace detail;
+
+	const uint8_t *in = static_cast<const uint8_t*>(src);
+	const uint8_t *inEnd = in + srcBytes;
+	uint8_t *out = static_cast<uint8_t*>(dst);
+	const uint8_t *outEnd = out + dstCapacity;
+
+	// positions are stored plus one so that zero means empty
+	uint32_t table[1 << kHashBits] = {};
+
+	const uint8_t *literals = in;
+	const uint8_t *cursor = in;
+	while (inEnd - cursor >= static_cast<ptrdiff_t>(kMinMatch)) {
+		uint32_t value = read32(cursor);
+		uint32_t &slot = table[hash4(value)];
+		const uint8_t *candidate = slot ? in + slot - 1 : nullptr;
+		slot = static_cast<uint32_t>(cursor - in) + 1;
+
+		if (!candidate || cursor - candidate > static_cast<ptrdiff_t>(kMaxOffset) || read32(candidate) != value) {
+			++cursor;
+			continue;
+		}
+
+		const uint8_t *matchEnd = cursor + kMinMatch;
+		const uint8_t *candidateEnd = candidate + kMinMatch;
+		while (matchEnd < inEnd && *matchEnd == *candidateEnd) {
+			++matchEnd;
+			++candidateEnd;
+		}
+
+		if (!writeSequence(out, outEnd, literals, static_cast<size_t>(cursor - literals), static_cast<uint32_t>(cursor - candidate), static_cast<size_t>(matchEnd - cursor)))
+			return 0;
+
+		cursor = matchEnd;
+		literals = cursor;
+	}
+
+	if (!writeSequence(out, outEnd, literals, static_cast<size_t>(inEnd - literals), 0, 0))
+		return 0;
+
+	return static_cast<size_t>(out - static_cast<uint8_t*>(dst));
+}
+
+//! Decompresses a block. Malformed input is detected rather than read or written out of bounds.
+//! @param src the compressed data
+//! @param srcBytes the size of the compressed data
+//! @param dst output buffer
+//! @param dstBytes the exact size of the uncompressed data
+//! @return whether the block decompressed to exactly dstBytes
+inline bool decompress(const void *src, size_t srcBytes, void *dst, size_t dstBytes) {
+	using namespace detail;
+
+	const uint8_t *in = static_cast<const uint8_t*>(src);
+	const uint8_t *inEnd = in + srcBytes;
+	uint8_t *out = static_cast<uint8_t*>(dst);
+	uint8_t *outStart = out;
+	uint8_t *outEnd = out + dstBytes;
+
+	while (in < inEnd) {
+		uint8_t token = *in++;
+
+		size_t literalCount = token >> 4;
+		if (literalCount == 15 && !readLength(in, inEnd, literalCount))
+			return false;
+		if (static_cast<size_t>(inEnd - in) < literalCount || static_cast<size_t>(outEnd - out) < literalCount)
+			return false;
+
+		memcpy(out, in, literalCount);
+		in += literalCount;
+		out += literalCount;
+
+		if (in == inEnd)
+			return (token & 15) == 0 && out == outEnd;
+
+		if (inEnd - in < 2)
+			return false;
+		size_t offset = in[0] | static_cast<size_t>(in[1]) << 8;
+		in += 2;
+
+		size_t matchLength = token & 15;
+		if (matchLength == 15 && !readLength(in, inEnd, matchLength))
+			return false;
+		matchLength += kMinMatch;
+
+		if (offset == 0 || offset > static_cast<size_t>(out - outStart) || static_cast<size_t>(outEnd - out) < matchLength)
+			return false;
+
+		const uint8_t *match = out - offset;
+		if (offset >= matchLength) {
+			memcpy(out, match, matchLength);
+			out += matchLength;
+		} else {
+			// overlapping matches repeat the bytes being written
+			for (size_t i = 0; i < matchLength; ++i) {
+				*out++ = match[i];
+			}
+		}
+	}
+
+	return false;
+}
+
+}
+}
+}
@@ -0,0 +1,291 @@
+#pragma once
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+#include "shared_types.h"
+#include "util/AllocatorAdapter.h"
+
+namespace laminaFS {
+namespace util {
+
+//! Caches the results of file existence and size queries by virtual path.
+//! Entries expire after a configurable time-to-live and are explicitly
+//! invalidated by operations that modify the filesystem through the context.
+//! While such an operation is queued, its path isn't served from the cache
+//! and queries queued before it don't store their results.
+class MetadataCache {
+public:
+	MetadataCache(lfs_allocator_t &alloc)
+	: _entries(AllocatorAdapter<std::pair<const uint64_t, Entry>>(alloc))
+	, _pendingChanges(AllocatorAdapter<std::pair<const uint64_t, uint32_t>>(alloc))
+	, _alloc(alloc)
+	{
+	}
+
+	~MetadataCache() {
+		clear();
+	}
+
+	//! Sets the time-to-live of cache entries. A TTL of zero disables the cache.
+	//! @param milliseconds the time-to-live in milliseconds
+	//! @param maxEntries the maximum number of entries to keep
+	void configure(uint32_t milliseconds, uint32_t maxEntries) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_ttl = std::chrono::milliseconds(milliseconds);
+		_maxEntries = maxEntries;
+		_enabled = milliseconds != 0 && maxEntries != 0;
+		++_generation;
+		clearInternal();
+	}
+
+	//! Whether or not the cache is enabled.
+	bool isEnabled() const { return _enabled; }
+
+	//! Looks up whether or not a path exists.
+	//! @param path the normalized path
+	//! @param hash the hash of the path
+	//! @param exists output existence
+	//! @return true on cache hit
+	bool lookupExists(const char *path, uint64_t hash, bool &exists) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		Entry *entry = find(path, hash);
+		if (entry) {
+			exists = entry->_exists;
+			++_hits;
+			return true;
+		}
+
+		++_misses;
+		return false;
+	}
+
+	//! Looks up the size of a file.
+	//! @param path the normalized path
+	//! @param hash the hash of the path
+	//! @param exists output existence
+	//! @param size output size, only valid if the file exists
+	//! @return true on cache hit
+	bool lookupSize(const char *path, uint64_t hash, bool &exists, uint64_t &size) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		Entry *entry = find(path, hash);
+		if (entry && (entry->_sizeKnown || !entry->_exists)) {
+			exists = entry->_exists;
+			size = entry->_size;
+			++_hits;
+			return true;
+		}
+
+		++_misses;
+		return false;
+	}
+
+	//! Gets the current generation, which changes whenever a change to the filesystem
+	//! starts or finishes. Queries take it when they're queued.
+	//! @return the generation
+	uint64_t generation() {
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _generation;
+	}
+
+	//! Stores the existence of a file.
+	//! @param path the normalized path
+	//! @param hash the hash of the path
+	//! @param generation the generation when the query was queued
+	//! @param exists whether or not the file exists
+	void storeExists(const char *path, uint64_t hash, uint64_t generation, bool exists) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		Entry *entry = generation == _generation ? insert(path, hash) : nullptr;
+		if (entry) {
+			if (entry->_exists != exists) {
+				entry->_sizeKnown = false;
+			}
+			entry->_exists = exists;
+		}
+	}
+
+	//! Stores the size of a file. Also implies existence.
+	//! @param path the normalized path
+	//! @param hash the hash of the path
+	//! @param generation the generation when the query was queued
+	//! @param exists whether or not the file exists
+	//! @param size the size of the file
+	void storeSize(const char *path, uint64_t hash, uint64_t generation, bool exists, uint64_t size) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		Entry *entry = generation == _generation ? insert(path, hash) : nullptr;
+		if (entry) {
+			entry->_exists = exists;
+			entry->_sizeKnown = exists;
+			entry->_size = exists ? size : 0;
+		}
+	}
+
+	//! Removes a path from the cache when a change to it is queued, and keeps it out
+	//! until the matching endChange().
+	//! @param hash the hash of the normalized path
+	void beginChange(uint64_t hash) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		++_pendingChanges[hash];
+		++_generation;
+		erase(hash);
+	}
+
+	//! Finishes a change started with beginChange().
+	//! @param hash the hash of the normalized path
+	void endChange(uint64_t hash) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto it = _pendingChanges.find(hash);
+		if (it != _pendingChanges.end() && --it->second == 0) {
+			_pendingChanges.erase(it);
+		}
+		++_generation;
+		erase(hash);
+	}
+
+	//! Removes all entries from the cache when a change that could affect any path is
+	//! queued, and keeps the cache empty until the matching endClear().
+	void beginClear() {
+		std::lock_guard<std::mutex> lock(_mutex);
+		++_pendingClears;
+		++_generation;
+		clearInternal();
+	}
+
+	//! Finishes a change started with beginClear().
+	void endClear() {
+		std::lock_guard<std::mutex> lock(_mutex);
+		--_pendingClears;
+		++_generation;
+		clearInternal();
+	}
+
+	//! Removes all entries from the cache.
+	void clear() {
+		std::lock_guard<std::mutex> lock(_mutex);
+		clearInternal();
+	}
+
+	//! Gets the cache statistics.
+	//! @return the statistics
+	lfs_metadata_cache_stats_t getStats() {
+		std::lock_guard<std::mutex> lock(_mutex);
+		return lfs_metadata_cache_stats_t{ _hits, _misses, static_cast<uint64_t>(_entries.size()) };
+	}
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Entry {
+		char *_path;
+		Clock::time_point _expires;
+		uint64_t _size;
+		bool _exists;
+		bool _sizeKnown;
+	};
+
+	Entry *find(const char *path, uint64_t hash) {
+		if (!_enabled || _pendingClears || _pendingChanges.count(hash))
+			return nullptr;
+
+		auto it = _entries.find(hash);
+		if (it != _entries.end() && strcmp(it->second._path, path) == 0) {
+			if (Clock::now() < it->second._expires) {
+				return &it->second;
+			}
+
+			_alloc.free(_alloc.allocator, it->second._path);
+			_entries.erase(it);
+		}
+
+		return nullptr;
+	}
+
+	Entry *insert(const char *path, uint64_t hash) {
+		if (!_enabled || _pendingClears || _pendingChanges.count(hash))
+			return nullptr;
+
+		Clock::time_point now = Clock::now();
+		auto it = _entries.find(hash);
+
+		if (it == _entries.end()) {
+			if (_entries.size() >= _maxEntries) {
+				purge(now);
+			}
+
+			size_t len = strlen(path) + 1;
+			Entry entry;
+			entry._path = static_cast<char*>(_alloc.alloc(_alloc.allocator, len, alignof(char)));
+			memcpy(entry._path, path, len);
+			entry._size = 0;
+			entry._exists = false;
+			entry._sizeKnown = false;
+			it = _entries.emplace(hash, entry).first;
+		} else if (strcmp(it->second._path, path) != 0) {
+			// hash collision, newest path wins
+			size_t len = strlen(path) + 1;
+			_alloc.free(_alloc.allocator, it->second._path);
+			it->second._path = static_cast<char*>(_alloc.alloc(_alloc.allocator, len, alignof(char)));
+			memcpy(it->second._path, path, len);
+			it->second._sizeKnown = false;
+		}
+
+		it->second._expires = now + _ttl;
+		return &it->second;
+	}
+
+	void erase(uint64_t hash) {
+		auto it = _entries.find(hash);
+		if (it != _entries.end()) {
+			_alloc.free(_alloc.allocator, it->second._path);
+			_entries.erase(it);
+		}
+	}
+
+	void purge(Clock::time_point now) {
+		for (auto it = _entries.begin(); it != _entries.end();) {
+			if (it->second._expires <= now) {
+				_alloc.free(_alloc.allocator, it->second._path);
+				it = _entries.erase(it);
+			} else {
+				++it;
+			}
+		}
+
+		// everything is still live, so just start over
+		if (_entries.size() >= _maxEntries) {
+			clearInternal();
+		}
+	}
+
+	void clearInternal() {
+		for (auto &entry : _entries) {
+			_alloc.free(_alloc.allocator, entry.second._path);
+		}
+		_entries.clear();
+	}
+
+	std::unordered_map<uint64_t, Entry, std::hash<uint64_t>, std::equal_to<uint64_t>, AllocatorAdapter<std::pair<const uint64_t, Entry>>> _entries;
+
+	// queued changes by path hash, and queued changes that could affect any path
+	std::unordered_map<uint64_t, uint32_t, std::hash<uint64_t>, std::equal_to<uint64_t>, AllocatorAdapter<std::pair<const uint64_t, uint32_t>>> _pendingChanges;
+	uint32_t _pendingClears = 0;
+	uint64_t _generation = 0;
+
+	std::mutex _mutex;
+	lfs_allocator_t _alloc;
+	Clock::duration _ttl = Clock::duration::zero();
+	uint64_t _hits = 0;
+	uint64_t _misses = 0;
+	uint32_t _maxEntries = 0;
+	std::atomic<bool> _enabled{false};
+};
+
+}
+}
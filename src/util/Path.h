@@ -0,0 +1,114 @@
+#pragma once
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "util/Hash.h"
+
+namespace laminaFS {
+namespace util {
+
+//! Destructively normalizes a path, starting from a position everything before which
+//! is known to already be normalized. Usable in constant expressions.
+//! @param path the path to normalize
+//! @param start where to start normalizing, see findSeparatorRun()
+//! @param inputLen the length of the path
+constexpr void normalizePathFrom(char *path, uint32_t start, uint32_t inputLen) {
+	uint32_t writePos = start;
+	uint32_t readPos = start;
+
+	while (writePos < inputLen) {
+		bool found = false;
+		do {
+			found = false;
+
+			if (path[readPos] == '/') {
+				if (path[readPos + 1] == '/') {
+					// handle multiple slashes "//", "///", etc...
+					++readPos;
+					found = true;
+				} else if (path[readPos + 1] == '.') {
+					if (path[readPos + 2] == '.' && (path[readPos + 3] == 0 || path[readPos + 3] == '/')) {
+						// handle parent directory "/.."
+						readPos += 3;
+						while (writePos > 0 && path[writePos - 1] != '/') {
+							--writePos;
+						}
+
+						if (writePos != 0) {
+							--writePos;
+						}
+						found = true;
+					} else if (path[readPos + 2] == '/' || path[readPos + 2] == 0) {
+						// handle "this" directory "/."
+						readPos += 2;
+						found = true;
+					}
+				}
+			}
+		} while (found);
+
+		path[writePos] = path[readPos];
+
+		if (path[writePos] == 0) {
+			break;
+		}
+
+		++writePos;
+		++readPos;
+	}
+
+	// remove trailing slash
+	if (writePos > 1 && path[writePos - 1] == '/') {
+		path[writePos - 1] = 0;
+	}
+
+	// fixup root slash
+	if (path[0] == 0 && inputLen >= 1) {
+		path[0] = '/';
+		path[1] = 0;
+	}
+}
+
+//! Destructively normalizes a path one byte at a time. Usable in constant expressions.
+//! @param path the path to normalize
+constexpr void normalizePath(char *path) {
+	uint32_t inputLen = 0;
+	while (path[inputLen]) {
+		++inputLen;
+	}
+
+	normalizePathFrom(path, 0, inputLen);
+}
+
+//! A path that is normalized and hashed at compile time.
+//! Normally created through LFS_PATH() rather than directly.
+template <size_t N>
+class StaticPath {
+public:
+	//! @param literal the path, normalized the same way as FileContext::normalizePath()
+	constexpr StaticPath(const char (&literal)[N]) {
+		for (size_t i = 0; i < N; ++i) {
+			_path[i] = literal[i];
+		}
+
+		normalizePath(_path);
+		_hash = hashString(_path);
+	}
+
+	//! @return the normalized path
+	constexpr const char *c_str() const { return _path; }
+
+	//! @return the hash of the normalized path
+	constexpr uint64_t hash() const { return _hash; }
+
+private:
+	// normalization never makes a path longer
+	char _path[N] = {};
+	uint64_t _hash = 0;
+};
+
+}
+}
@@ -0,0 +1,199 @@
+#pragma once
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#include <cstdint>
+#include <cstring>
+
+#include "util/Path.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define LFS_PATH_SCAN_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define LFS_TARGET_AVX2
+#else
+#define LFS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace laminaFS {
+namespace util {
+
+//! Instruction sets the path scanning functions can use.
+enum class SimdLevel {
+	Scalar,
+	SSE2,
+	AVX2
+};
+
+//! Detects the best instruction set supported by the CPU and OS.
+//! @return the SimdLevel
+inline SimdLevel detectSimdLevel() {
+#ifdef LFS_PATH_SCAN_X86
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] >= 7) {
+		__cpuid(info, 1);
+		bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+
+		__cpuidex(info, 7, 0);
+		if (osSavesYmm && (info[1] & (1 << 5)) != 0)
+			return SimdLevel::AVX2;
+	}
+#else
+	if (__builtin_cpu_supports("avx2"))
+		return SimdLevel::AVX2;
+#endif
+	// SSE2 is part of the x86-64 baseline
+	return SimdLevel::SSE2;
+#else
+	return SimdLevel::Scalar;
+#endif
+}
+
+//! The best instruction set supported by the CPU and OS, detected once.
+//! @return the SimdLevel
+inline SimdLevel simdLevel() {
+	static const SimdLevel level = detectSimdLevel();
+	return level;
+}
+
+namespace detail {
+inline uint32_t countTrailingZeros(uint32_t mask) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return static_cast<uint32_t>(index);
+#else
+	return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif
+}
+
+inline uint32_t findSeparatorRunScalar(const char *path, uint32_t start, uint32_t len) {
+	for (uint32_t i = start; i < len; ++i) {
+		if (path[i] == '/' && (path[i + 1] == '/' || path[i + 1] == '.'))
+			return i;
+	}
+	return len;
+}
+
+inline bool prefixEqualsScalar(const char *a, const char *b, uint32_t start, uint32_t len) {
+	for (uint32_t i = start; i < len; ++i) {
+		if (a[i] != b[i])
+			return false;
+	}
+	return true;
+}
+
+#ifdef LFS_PATH_SCAN_X86
+inline uint32_t findSeparatorRunSSE2(const char *path, uint32_t len) {
+	const __m128i slash = _mm_set1_epi8('/');
+	const __m128i dot = _mm_set1_epi8('.');
+
+	// each block also looks at the byte after it, which at worst is the terminator
+	uint32_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(path + i));
+		__m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(path + i + 1));
+		__m128i nextMatches = _mm_or_si128(_mm_cmpeq_epi8(next, slash), _mm_cmpeq_epi8(next, dot));
+		uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(current, slash), nextMatches)));
+		if (mask)
+			return i + countTrailingZeros(mask);
+	}
+
+	return findSeparatorRunScalar(path, i, len);
+}
+
+LFS_TARGET_AVX2 inline uint32_t findSeparatorRunAVX2(const char *path, uint32_t len) {
+	const __m256i slash = _mm256_set1_epi8('/');
+	const __m256i dot = _mm256_set1_epi8('.');
+
+	uint32_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m256i current = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(path + i));
+		__m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(path + i + 1));
+		__m256i nextMatches = _mm256_or_si256(_mm256_cmpeq_epi8(next, slash), _mm256_cmpeq_epi8(next, dot));
+		uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(current, slash), nextMatches)));
+		if (mask)
+			return i + countTrailingZeros(mask);
+	}
+
+	return findSeparatorRunScalar(path, i, len);
+}
+
+inline bool prefixEqualsSSE2(const char *a, const char *b, uint32_t len) {
+	uint32_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i blockA = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+		__m128i blockB = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(blockA, blockB)) != 0xFFFF)
+			return false;
+	}
+
+	return prefixEqualsScalar(a, b, i, len);
+}
+
+LFS_TARGET_AVX2 inline bool prefixEqualsAVX2(const char *a, const char *b, uint32_t len) {
+	uint32_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m256i blockA = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+		__m256i blockB = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+		if (static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(blockA, blockB))) != 0xFFFFFFFFu)
+			return false;
+	}
+
+	return prefixEqualsSSE2(a + i, b + i, len - i);
+}
+#endif
+}
+
+//! Finds the first separator that normalization might have to rewrite, a '/' followed
+//! by another '/' or a '.'. Everything before it is already normalized.
+//! @param path the path, path[len] must be readable
+//! @param len the length of the path
+//! @param level the instruction set to use, must be supported by the CPU
+//! @return the index of the separator, or len if there is none
+inline uint32_t findSeparatorRun(const char *path, uint32_t len, SimdLevel level = simdLevel()) {
+#ifdef LFS_PATH_SCAN_X86
+	if (level == SimdLevel::AVX2)
+		return detail::findSeparatorRunAVX2(path, len);
+	if (level == SimdLevel::SSE2)
+		return detail::findSeparatorRunSSE2(path, len);
+#else
+	(void)level;
+#endif
+	return detail::findSeparatorRunScalar(path, 0, len);
+}
+
+//! Compares the first len bytes of two strings.
+//! @param a the first string, must have at least len readable bytes
+//! @param b the second string, must have at least len readable bytes
+//! @param len the number of bytes to compare
+//! @param level the instruction set to use, must be supported by the CPU
+//! @return whether the bytes are equal
+inline bool prefixEquals(const char *a, const char *b, uint32_t len, SimdLevel level = simdLevel()) {
+#ifdef LFS_PATH_SCAN_X86
+	if (level == SimdLevel::AVX2)
+		return detail::prefixEqualsAVX2(a, b, len);
+	if (level == SimdLevel::SSE2)
+		return detail::prefixEqualsSSE2(a, b, len);
+#else
+	(void)level;
+#endif
+	return detail::prefixEqualsScalar(a, b, 0, len);
+}
+
+//! Destructively normalizes a path, skipping over the already normalized part with
+//! vector instructions. Produces the same result as normalizePath().
+//! @param path the path to normalize
+//! @param level the instruction set to use, must be supported by the CPU
+inline void normalizePathFast(char *path, SimdLevel level = simdLevel()) {
+	uint32_t len = static_cast<uint32_t>(strlen(path));
+	normalizePathFrom(path, findSeparatorRun(path, len, level), len);
+}
+
+}
+}
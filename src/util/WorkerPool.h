@@ -0,0 +1,137 @@
+#pragma once
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "shared_types.h"
+#include "util/AllocatorAdapter.h"
+
+namespace laminaFS {
+namespace util {
+
+//! A fixed set of threads for splitting CPU-bound work, like decompression, across cores.
+//! The thread calling parallelFor() works alongside the pool, so a pool without threads
+//! just runs everything inline.
+class WorkerPool {
+public:
+	WorkerPool(lfs_allocator_t &alloc, uint32_t threadCount)
+	: _threads(AllocatorAdapter<std::thread>(alloc))
+	{
+		_threads.reserve(threadCount);
+		for (uint32_t i = 0; i < threadCount; ++i) {
+			_threads.emplace_back(&WorkerPool::workerFunc, this);
+		}
+	}
+
+	~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_wake.notify_all();
+
+		for (std::thread &thread : _threads) {
+			thread.join();
+		}
+	}
+
+	WorkerPool(const WorkerPool &) = delete;
+	WorkerPool &operator=(const WorkerPool &) = delete;
+
+	//! Calls func(index) for every index in [0, count) and waits for all of them to finish.
+	//! Calls from several threads are run one after the other.
+	//! @param count the number of indices
+	//! @param func the function to call
+	template <typename Func>
+	void parallelFor(uint32_t count, Func &&func) {
+		typedef typename std::remove_reference<Func>::type FuncType;
+
+		if (count <= 1 || _threads.empty()) {
+			for (uint32_t i = 0; i < count; ++i) {
+				func(i);
+			}
+			return;
+		}
+
+		std::lock_guard<std::mutex> runLock(_runMutex);
+		{
+			// a worker that woke up late for the previous job may still be looking at it
+			std::unique_lock<std::mutex> lock(_mutex);
+			_done.wait(lock, [this]() { return _busy == 0; });
+
+			_job = [](void *data, uint32_t index) { (*static_cast<FuncType*>(data))(index); };
+			_jobData = const_cast<void*>(static_cast<const void*>(&func));
+			_jobCount = count;
+			_next = 0;
+			++_generation;
+		}
+		_wake.notify_all();
+
+		runJob(_job, _jobData, count);
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		_done.wait(lock, [this]() { return _busy == 0; });
+		_jobCount = 0;
+	}
+
+	//! @return the number of threads in the pool, not counting the caller
+	uint32_t threadCount() const { return static_cast<uint32_t>(_threads.size()); }
+
+private:
+	typedef void (*JobFunc)(void *, uint32_t);
+
+	void runJob(JobFunc job, void *data, uint32_t count) {
+		for (uint32_t i = _next++; i < count; i = _next++) {
+			job(data, i);
+		}
+	}
+
+	void workerFunc() {
+		uint64_t seen = 0;
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		for (;;) {
+			_wake.wait(lock, [this, &seen]() { return _stop || _generation != seen; });
+			if (_stop)
+				return;
+
+			seen = _generation;
+			JobFunc job = _job;
+			void *data = _jobData;
+			uint32_t count = _jobCount;
+			++_busy;
+
+			lock.unlock();
+			runJob(job, data, count);
+			lock.lock();
+
+			if (--_busy == 0) {
+				_done.notify_all();
+			}
+		}
+	}
+
+	std::vector<std::thread, AllocatorAdapter<std::thread>> _threads;
+	std::mutex _runMutex;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::condition_variable _done;
+
+	JobFunc _job = nullptr;
+	void *_jobData = nullptr;
+	uint32_t _jobCount = 0;
+	std::atomic<uint32_t> _next{0};
+	uint32_t _busy = 0;
+	uint64_t _generation = 0;
+	bool _stop = false;
+};
+
+}
+}
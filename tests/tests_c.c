@@ -148,6 +148,188 @@ int test_c_api() {
 		lfs_release_work_item(ctx, dirDeleteTest);
 	}
 
+	// test shared buffers
+	{
+		struct lfs_work_item_t *readTest = lfs_read_file_shared(ctx, "/four/four.txt", NULL);
+		lfs_wait_for_work_item(readTest);
+		TEST(LFS_OK, lfs_work_item_get_result(readTest), "Read shared file /four/four.txt");
+
+		struct lfs_shared_buffer_t *shared = lfs_work_item_acquire_shared_buffer(readTest);
+		TEST(lfs_work_item_get_bytes(readTest), lfs_shared_buffer_get_size(shared), "Shared buffer size");
+		lfs_work_item_free_buffer(readTest);
+		lfs_release_work_item(ctx, readTest);
+
+		TEST(true, lfs_shared_buffer_get_data(shared) != NULL, "Shared buffer outlives work item");
+		lfs_shared_buffer_release(shared);
+
+		struct lfs_work_item_t *mappedTest = lfs_read_file_segment_shared_with_flags(ctx, "/four/four.txt", 5, 10, NULL, LFS_READ_MAPPED);
+		lfs_wait_for_work_item(mappedTest);
+		TEST(10, lfs_work_item_get_bytes(mappedTest), "Map file segment /four/four.txt");
+		lfs_work_item_free_buffer(mappedTest);
+		lfs_release_work_item(ctx, mappedTest);
+	}
+
+	// test metadata cache
+	{
+		lfs_set_metadata_cache_ttl(ctx, 60000, 16);
+
+		struct lfs_work_item_t *sizeTest = lfs_file_size(ctx, "/four/four.txt");
+		lfs_wait_for_work_item(sizeTest);
+		uint64_t size = lfs_work_item_get_bytes(sizeTest);
+		lfs_release_work_item(ctx, sizeTest);
+
+		struct lfs_work_item_t *cachedTest = lfs_file_size(ctx, "/four/four.txt");
+		TEST(true, lfs_work_item_completed(cachedTest), "Cached file size completes inline");
+		TEST(size, lfs_work_item_get_bytes(cachedTest), "Cached file size /four/four.txt");
+		lfs_release_work_item(ctx, cachedTest);
+
+		struct lfs_metadata_cache_stats_t stats = lfs_get_metadata_cache_stats(ctx);
+		TEST(1, stats.hits, "Metadata cache hits");
+
+		lfs_set_metadata_cache_ttl(ctx, 0, 0);
+	}
+
+	// test block cache
+	{
+		lfs_block_cache_t cache = lfs_block_cache_create(&lfs_default_allocator, 64 * 1024, 0, 0);
+		lfs_set_block_cache(ctx, cache);
+
+		for (int i = 0; i < 2; ++i) {
+			struct lfs_work_item_t *readTest = lfs_read_file_ctx_alloc(ctx, "/four/four.txt", true);
+			lfs_wait_for_work_item(readTest);
+			TEST(LFS_OK, lfs_work_item_get_result(readTest), "Read file /four/four.txt through block cache");
+			lfs_work_item_free_buffer(readTest);
+			lfs_release_work_item(ctx, readTest);
+		}
+
+		struct lfs_block_cache_stats_t stats = lfs_block_cache_get_stats(cache);
+		TEST(1, stats.hits, "Block cache hits");
+		TEST(1, stats.misses, "Block cache misses");
+
+		lfs_block_cache_t noCache = { NULL };
+		lfs_set_block_cache(ctx, noCache);
+		lfs_block_cache_destroy(cache);
+	}
+
+	// test path handles
+	{
+		const struct lfs_path_t *path = lfs_intern_path(ctx, "/four/../four/four.txt");
+		TEST(0, strcmp(lfs_path_get_string(path), "/four/four.txt"), "Interned path is normalized");
+
+		struct lfs_work_item_t *readTest = lfs_read_file_segment_path(ctx, path, 0, UINT64_MAX, true, NULL);
+		lfs_wait_for_work_item(readTest);
+		TEST(LFS_OK, lfs_work_item_get_result(readTest), "Read file through path handle");
+		lfs_work_item_free_buffer(readTest);
+		lfs_release_work_item(ctx, readTest);
+	}
+
+	// test case-insensitive mounts
+	{
+		lfs_mount_t ciMount = lfs_create_mount_with_permissions(ctx, 0, "/ci", "testData/testroot", &resultCode, LFS_MOUNT_READ | LFS_MOUNT_CASE_INSENSITIVE);
+		TEST(LFS_OK, resultCode, "Mount testData/testroot -> /ci case-insensitive");
+
+		struct lfs_work_item_t *existsTest = lfs_file_exists(ctx, "/ci/THREE/Three.txt");
+		lfs_wait_for_work_item(existsTest);
+		TEST(LFS_OK, lfs_work_item_get_result(existsTest), "File exists with wrong case");
+		lfs_release_work_item(ctx, existsTest);
+
+		TEST(true, lfs_release_mount(ctx, ciMount), "Unmount testData/testroot -> /ci");
+	}
+
+	// test path filters
+	{
+		lfs_mount_t filtered = lfs_create_mount_with_permissions(ctx, 0, "/", "testData/testroot2", &resultCode, LFS_MOUNT_READ | LFS_MOUNT_PATH_FILTER);
+		TEST(LFS_OK, resultCode, "Mount filtered testData/testroot2 -> /");
+
+		struct lfs_work_item_t *existsTest = lfs_file_exists(ctx, "/three/three.txt");
+		lfs_wait_for_work_item(existsTest);
+		TEST(LFS_OK, lfs_work_item_get_result(existsTest), "File exists under filtered mount");
+		lfs_release_work_item(ctx, existsTest);
+
+		struct lfs_path_filter_stats_t stats = lfs_get_path_filter_stats(ctx);
+		TEST(1, stats.rejected, "Path filter skips mount");
+
+		lfs_release_mount(ctx, filtered);
+	}
+
+	// test prefetching
+	{
+		const char *prefetchPaths[] = { "/four/four.txt", "/nope.txt" };
+		struct lfs_work_item_t *prefetchTest = lfs_prefetch(ctx, prefetchPaths, 2, LFS_PRIORITY_BACKGROUND);
+		lfs_wait_for_work_item(prefetchTest);
+		TEST(LFS_OK, lfs_work_item_get_result(prefetchTest), "Prefetch files");
+		TEST(1, lfs_work_item_get_bytes(prefetchTest), "Prefetch files found");
+		lfs_release_work_item(ctx, prefetchTest);
+	}
+
+	// test access trace recording and replay
+	{
+		lfs_begin_access_trace(ctx, 16);
+
+		struct lfs_work_item_t *readTest = lfs_read_file_ctx_alloc(ctx, "/four/four.txt", false);
+		lfs_wait_for_work_item(readTest);
+		lfs_work_item_free_buffer(readTest);
+		lfs_release_work_item(ctx, readTest);
+
+		void *trace = NULL;
+		uint64_t traceBytes = lfs_end_access_trace(ctx, &trace, NULL);
+		TEST(true, trace != NULL, "Record access trace");
+
+		struct lfs_work_item_t *replayTest = lfs_replay_access_trace(ctx, trace, traceBytes, LFS_PRIORITY_NORMAL);
+		lfs_wait_for_work_item(replayTest);
+		TEST(1, lfs_work_item_get_bytes(replayTest), "Replay access trace");
+		lfs_release_work_item(ctx, replayTest);
+
+		lfs_default_allocator.free(lfs_default_allocator.allocator, trace);
+	}
+
+	// test device capabilities
+	TEST(true, (lfs_get_device_capabilities(ctx, 0) & LFS_DEVICE_CAP_HANDLES) != 0, "Directory device capabilities");
+	TEST(true, (lfs_get_device_capabilities(ctx, 0) & LFS_DEVICE_CAP_DIRECT_IO) != 0, "Directory device supports direct I/O");
+	TEST(0, lfs_get_device_capabilities(ctx, 1000), "Unknown device capabilities");
+
+	// test file handles
+	{
+		struct lfs_work_item_t *openTest = lfs_open_file(ctx, "/four/four.txt", LFS_OPEN_READ, 16);
+		lfs_wait_for_work_item(openTest);
+		TEST(LFS_OK, lfs_work_item_get_result(openTest), "Open file handle for reading /four/four.txt");
+		lfs_file_handle_t file = lfs_work_item_get_file_handle(openTest);
+		lfs_release_work_item(ctx, openTest);
+
+		struct lfs_work_item_t *readTest = lfs_read_file_handle(ctx, file, 8, NULL);
+		lfs_wait_for_work_item(readTest);
+		TEST(8, lfs_work_item_get_bytes(readTest), "Read file handle");
+		TEST(0, memcmp(lfs_work_item_get_buffer(readTest), "This is ", 8), "Compare file read through a handle");
+		lfs_work_item_free_buffer(readTest);
+		lfs_release_work_item(ctx, readTest);
+
+		struct lfs_work_item_t *closeTest = lfs_close_file_handle(ctx, file);
+		lfs_wait_for_work_item(closeTest);
+		TEST(LFS_OK, lfs_work_item_get_result(closeTest), "Close file handle");
+		lfs_release_work_item(ctx, closeTest);
+	}
+
+	// test access hints
+	{
+		TEST(true, (lfs_get_device_capabilities(ctx, 0) & LFS_DEVICE_CAP_ACCESS_HINTS) != 0, "Directory device takes access hints");
+
+		struct lfs_work_item_t *readTest = lfs_read_file_segment_with_flags(ctx, "/four/four.txt", 0, 4, false, NULL, LFS_READ_RANDOM | LFS_READ_DONTNEED);
+		lfs_wait_for_work_item(readTest);
+		TEST(4, lfs_work_item_get_bytes(readTest), "Read file segment with access hints");
+		lfs_work_item_free_buffer(readTest);
+		lfs_release_work_item(ctx, readTest);
+
+		struct lfs_work_item_t *openTest = lfs_open_file_with_flags(ctx, "/four/four.txt", LFS_OPEN_READ, 16, LFS_READ_SEQUENTIAL);
+		lfs_wait_for_work_item(openTest);
+		TEST(LFS_OK, lfs_work_item_get_result(openTest), "Open file handle with access hints");
+		lfs_file_handle_t file = lfs_work_item_get_file_handle(openTest);
+		lfs_release_work_item(ctx, openTest);
+
+		struct lfs_work_item_t *closeTest = lfs_close_file_handle(ctx, file);
+		lfs_wait_for_work_item(closeTest);
+		lfs_release_work_item(ctx, closeTest);
+	}
+
 	TEST(true, lfs_release_mount(ctx, mount2), "Unmount testData/testroot2 -> /four");
 	TEST(false, lfs_release_mount(ctx, mount3), "Unmount testData/nonexistentdir -> /five (expected fail)");
 
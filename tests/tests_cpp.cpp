@@ -4,12 +4,32 @@
 #include <laminaFS.h>
 #include "macros.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
 #include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "device/Directory.h"
+#include "device/PackFormat.h"
+#include "util/FileDescriptorCache.h"
+#include "util/Hash.h"
+#include "util/Lz.h"
+#include "util/PathScan.h"
+#include "util/WorkerPool.h"
 
 using namespace laminaFS;
 
 #ifdef _WIN32
 #define strdup _strdup
+#else
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 #ifndef _countof
@@ -49,6 +69,193 @@ const char *normalizationTestResults[] = {
 	"/..first/second"
 };
 
+constexpr util::StaticPath<sizeof("///path//with/a/////../lot/of/../../slashes///file.txt")> staticNormalizationTest("///path//with/a/////../lot/of/../../slashes///file.txt");
+static_assert(staticNormalizationTest.hash() == util::hashString("/path/with/slashes/file.txt"), "compile-time normalization");
+
+// builds a pack file in memory, compressed if blockSize isn't 0
+std::string buildPack(std::vector<std::pair<std::string, std::string>> files, uint32_t alignment, uint32_t blockSize = 0) {
+	std::sort(files.begin(), files.end(), [](const std::pair<std::string, std::string> &a, const std::pair<std::string, std::string> &b) {
+		return pack::entryLess(util::hashString(a.first.c_str()), a.first.c_str(), static_cast<uint32_t>(a.first.size()),
+			util::hashString(b.first.c_str()), b.first.c_str(), static_cast<uint32_t>(b.first.size()));
+	});
+
+	pack::Header header;
+	memcpy(header._magic, pack::kMagic, sizeof(header._magic));
+	header._version = pack::kVersion;
+	header._entryCount = static_cast<uint32_t>(files.size());
+	header._alignment = alignment;
+	header._tocOffset = blockSize ? sizeof(pack::CompressedHeader) : sizeof(header);
+	if (blockSize) {
+		memcpy(header._magic, pack::kCompressedMagic, sizeof(header._magic));
+	}
+
+	std::string strings;
+	std::vector<pack::Entry> entries;
+	for (auto &file : files) {
+		pack::Entry entry;
+		entry._pathHash = util::hashString(file.first.c_str());
+		entry._pathOffset = static_cast<uint32_t>(strings.size());
+		entry._pathLength = static_cast<uint32_t>(file.first.size());
+		strings += file.first;
+		entries.push_back(entry);
+	}
+
+	header._stringsOffset = header._tocOffset + entries.size() * sizeof(pack::Entry);
+	header._stringsBytes = strings.size();
+
+	std::string data;
+	uint64_t offset = header._stringsOffset + header._stringsBytes;
+	for (size_t i = 0; i < files.size(); ++i) {
+		uint64_t aligned = (offset + alignment - 1) / alignment * alignment;
+		data.append(aligned - offset, '\0');
+		entries[i]._offset = aligned;
+		entries[i]._size = files[i].second.size();
+
+		if (!blockSize) {
+			data += files[i].second;
+			offset = aligned + files[i].second.size();
+			continue;
+		}
+
+		// block table, then the blocks
+		const std::string &contents = files[i].second;
+		std::vector<uint64_t> table(1, aligned + (pack::blockCount(contents.size(), blockSize) + 1) * sizeof(uint64_t));
+		std::string blocks;
+		for (size_t start = 0; start < contents.size(); start += blockSize) {
+			size_t blockBytes = std::min<size_t>(blockSize, contents.size() - start);
+			std::string compressed(util::lz::compressBound(blockBytes), '\0');
+			size_t compressedBytes = util::lz::compress(contents.data() + start, blockBytes, &compressed[0], compressed.size());
+			blocks += compressedBytes < blockBytes ? compressed.substr(0, compressedBytes) : contents.substr(start, blockBytes);
+			table.push_back(table[0] + blocks.size());
+		}
+
+		data.append(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(uint64_t));
+		data += blocks;
+		offset = table.back();
+	}
+
+	std::string result(reinterpret_cast<const char*>(&header), sizeof(header));
+	if (blockSize) {
+		uint32_t compression[2] = {blockSize, pack::kCodecLZ};
+		result.append(reinterpret_cast<const char*>(compression), sizeof(compression));
+	}
+	result.append(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(pack::Entry));
+	return result + strings + data;
+}
+
+// a device whose files contain their own path, leaving every read and write pending until
+// the test finishes them
+struct AsyncTestDevice {
+	struct Request {
+		DeviceRequest *_request;
+		std::string _contents;
+		lfs_allocator_t *_alloc; // only for reads
+		uint64_t _bytes;
+	};
+
+	std::mutex _mutex;
+	std::vector<Request> _pending;
+
+	size_t pending() {
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _pending.size();
+	}
+
+	void completeAll() {
+		std::vector<Request> requests;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			requests.swap(_pending);
+		}
+
+		for (Request &r : requests) {
+			void *buffer = nullptr;
+			if (r._alloc) {
+				r._bytes = r._contents.size();
+				buffer = r._alloc->alloc(r._alloc->allocator, r._bytes, 1);
+				memcpy(buffer, r._contents.data(), r._bytes);
+			}
+			FileContext::completeDeviceRequest(r._request, LFS_OK, r._bytes, buffer);
+		}
+	}
+
+	static AsyncTestDevice *instance;
+	static bool destroyed;
+
+	static ErrorCode create(Allocator *, const char *, void **device) {
+		*device = instance = new AsyncTestDevice();
+		destroyed = false;
+		return LFS_OK;
+	}
+
+	static void destroy(void *device) {
+		delete static_cast<AsyncTestDevice*>(device);
+		destroyed = true;
+	}
+
+	static bool fileExists(void *, const char *filePath) {
+		return strstr(filePath, "missing") == nullptr;
+	}
+
+	static size_t fileSize(void *device, const char *filePath, ErrorCode *outError) {
+		*outError = fileExists(device, filePath) ? LFS_OK : LFS_NOT_FOUND;
+		return *outError == LFS_OK ? strlen(filePath) : 0;
+	}
+
+	static size_t readFile(void *, const char *, uint64_t, uint64_t, Allocator *, void **, bool, ErrorCode *outError) {
+		*outError = LFS_UNSUPPORTED;
+		return 0;
+	}
+
+	static size_t writeFile(void *, const char *, uint64_t, void *, size_t, lfs_write_mode_t, ErrorCode *outError) {
+		*outError = LFS_UNSUPPORTED;
+		return 0;
+	}
+
+	static size_t readFileAsync(void *device, const char *filePath, uint64_t, uint64_t, Allocator *alloc, void **, bool, DeviceRequest *request, ErrorCode *outError) {
+		if (!fileExists(device, filePath)) {
+			*outError = LFS_NOT_FOUND;
+			return 0;
+		}
+
+		AsyncTestDevice *dev = static_cast<AsyncTestDevice*>(device);
+		std::lock_guard<std::mutex> lock(dev->_mutex);
+		dev->_pending.push_back({request, filePath, alloc, 0});
+		*outError = LFS_PENDING;
+		return 0;
+	}
+
+	static size_t writeFileAsync(void *device, const char *, uint64_t, void *, size_t bytesToWrite, lfs_write_mode_t, DeviceRequest *request, ErrorCode *outError) {
+		AsyncTestDevice *dev = static_cast<AsyncTestDevice*>(device);
+		std::lock_guard<std::mutex> lock(dev->_mutex);
+		dev->_pending.push_back({request, "", nullptr, bytesToWrite});
+		*outError = LFS_PENDING;
+		return 0;
+	}
+};
+
+AsyncTestDevice *AsyncTestDevice::instance = nullptr;
+bool AsyncTestDevice::destroyed = false;
+
+// the directory device, recording the access hints it's given
+struct HintRecorder {
+	static std::vector<uint32_t> fileHints;
+	static std::vector<uint32_t> handleHints;
+
+	static ErrorCode adviseFile(void *device, const char *filePath, uint64_t offset, uint64_t bytes, uint32_t flags) {
+		fileHints.push_back(flags);
+		return DirectoryDevice::adviseFile(device, filePath, offset, bytes, flags);
+	}
+
+	static void adviseHandle(void *device, void *handle, uint32_t flags) {
+		handleHints.push_back(flags);
+		DirectoryDevice::adviseHandle(device, handle, flags);
+	}
+};
+
+std::vector<uint32_t> HintRecorder::fileHints;
+std::vector<uint32_t> HintRecorder::handleHints;
+
 }
 
 int test_cpp_api() {
@@ -68,6 +275,44 @@ int test_cpp_api() {
 		free(testStr);
 	}
 
+	// test vectorized path scanning against the scalar implementation
+	{
+		const util::SimdLevel levels[] = {util::SimdLevel::Scalar, util::SimdLevel::SSE2, util::SimdLevel::AVX2};
+		const char *levelNames[] = {"scalar", "SSE2", "AVX2"};
+		const char alphabet[] = {'/', '/', '/', '.', '.', 'a', 'b', '_'};
+
+		for (uint32_t level = 0; level < _countof(levels) && levels[level] <= util::simdLevel(); ++level) {
+			std::mt19937 rng(1234);
+			bool normalizeMatches = true;
+			bool prefixMatches = true;
+
+			for (uint32_t i = 0; i < 20000; ++i) {
+				std::string path(rng() % 200, 'a');
+				for (char &c : path) {
+					c = alphabet[rng() % sizeof(alphabet)];
+				}
+
+				std::string expected = path;
+				util::normalizePath(&expected[0]);
+				std::string actual = path;
+				util::normalizePathFast(&actual[0], levels[level]);
+				normalizeMatches = normalizeMatches && strcmp(expected.c_str(), actual.c_str()) == 0;
+
+				std::string other = path;
+				if (!other.empty() && rng() % 2) {
+					other[rng() % other.size()] ^= 1;
+				}
+				uint32_t len = path.empty() ? 0 : static_cast<uint32_t>(rng() % (path.size() + 1));
+				prefixMatches = prefixMatches && util::prefixEquals(path.c_str(), other.c_str(), len, levels[level]) == (memcmp(path.c_str(), other.c_str(), len) == 0);
+			}
+
+			printf("[%s]: Normalize random paths (%s)\n", normalizeMatches ? PASS_STRING : FAIL_STRING, levelNames[level]);
+			printf("[%s]: Compare random prefixes (%s)\n", prefixMatches ? PASS_STRING : FAIL_STRING, levelNames[level]);
+			testCount += 2;
+			testsPassed += (normalizeMatches ? 1 : 0) + (prefixMatches ? 1 : 0);
+		}
+	}
+
 	FileContext ctx(laminaFS::DefaultAllocator);
 
 	// test creating mounts
@@ -82,6 +327,9 @@ int test_cpp_api() {
 	Mount mount3 = ctx.createMount(0, "/five", "testData/nonexistentdir", resultCode);
 	TEST(LFS_NOT_FOUND, resultCode, "Mount testData/nonexistentdir -> /five (expected fail)");
 
+	ctx.createMount(0, "/six", "testData/test.zip", resultCode);
+	TEST(LFS_NOT_FOUND, resultCode, "Mount file testData/test.zip as a directory -> /six (expected fail)");
+
 	// test reading
 	{
 		WorkItem *readTest = ctx.readFile("/one/random.txt", false);
@@ -228,6 +476,1390 @@ int test_cpp_api() {
 		ctx.releaseWorkItem(deleteTest);
 	}
 
+	// test metadata cache
+	{
+		ctx.setMetadataCacheTTL(60000);
+
+		WorkItem *existsTest = ctx.fileExists("/four/four.txt");
+		WaitForWorkItem(existsTest);
+		ctx.releaseWorkItem(existsTest);
+
+		WorkItem *cachedTest = ctx.fileExists("/four//four.txt");
+		TEST(true, WorkItemCompleted(cachedTest), "Cached file existence completes inline");
+		TEST(LFS_OK, WorkItemGetResult(cachedTest), "Cached file existence /four/four.txt");
+		ctx.releaseWorkItem(cachedTest);
+
+		WorkItem *writeTest = ctx.writeFile("/two/cached.txt", const_cast<char *>(testString), strlen(testString));
+		WorkItem *sizeTest = ctx.fileSize("/two/cached.txt");
+		WaitForWorkItem(sizeTest);
+		TEST(strlen(testString), WorkItemGetBytes(sizeTest), "Check file size /two/cached.txt");
+		ctx.releaseWorkItem(writeTest);
+		ctx.releaseWorkItem(sizeTest);
+
+		WorkItem *deleteTest = ctx.deleteFile("/two/cached.txt");
+		WorkItem *deletedTest = ctx.fileExists("/two/cached.txt");
+		WaitForWorkItem(deletedTest);
+		TEST(LFS_NOT_FOUND, WorkItemGetResult(deletedTest), "Delete invalidates cached existence");
+		ctx.releaseWorkItem(deleteTest);
+		ctx.releaseWorkItem(deletedTest);
+
+		MetadataCacheStats stats = ctx.getMetadataCacheStats();
+		TEST(1, stats.hits, "Metadata cache hits");
+		TEST(3, stats.misses, "Metadata cache misses");
+
+		// a query answered ahead of a queued delete mustn't be cached for queries after the delete
+		writeTest = ctx.writeFile("/two/cached.txt", const_cast<char *>(testString), strlen(testString));
+		WaitForWorkItem(writeTest);
+		ctx.releaseWorkItem(writeTest);
+
+		existsTest = ctx.fileExists("/two/cached.txt");
+		deleteTest = ctx.deleteFile("/two/cached.txt");
+		WaitForWorkItem(existsTest);
+		deletedTest = ctx.fileExists("/two/cached.txt");
+		WaitForWorkItem(deletedTest);
+		TEST(LFS_OK, WorkItemGetResult(existsTest), "Existence queued before delete");
+		TEST(LFS_NOT_FOUND, WorkItemGetResult(deletedTest), "Existence queued after delete");
+		WaitForWorkItem(deleteTest);
+		ctx.releaseWorkItem(existsTest);
+		ctx.releaseWorkItem(deleteTest);
+		ctx.releaseWorkItem(deletedTest);
+
+		ctx.setMetadataCacheTTL(0);
+	}
+
+	// test shared buffers
+	{
+		WorkItem *readTest = ctx.readFile("/three/three.txt", false);
+		WaitForWorkItem(readTest);
+
+		SharedBuffer *first = WorkItemAcquireSharedBuffer(readTest);
+		SharedBuffer *second = WorkItemAcquireSharedBuffer(readTest);
+		TEST(first, second, "Acquire shared buffer twice");
+		TEST(3, SharedBufferGetRefCount(first), "Shared buffer reference count");
+		TEST(WorkItemGetBuffer(readTest), SharedBufferGetData(first), "Shared buffer references work item buffer");
+
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+		SharedBufferRelease(second);
+
+		TEST(1, SharedBufferGetRefCount(first), "Shared buffer outlives work item");
+		TEST(12, SharedBufferGetSize(first), "Shared buffer size");
+		SharedBufferRelease(first);
+	}
+
+	// test block cache
+	{
+		BlockCache cache(laminaFS::DefaultAllocator, 64 * 1024, 512, 4);
+		ctx.setBlockCache(&cache);
+
+		char blockData[2000];
+		for (uint32_t i = 0; i < sizeof(blockData); ++i) {
+			blockData[i] = static_cast<char>('a' + (i % 26));
+		}
+
+		WorkItem *writeTest = ctx.writeFile("/two/blocks.txt", blockData, sizeof(blockData));
+		WaitForWorkItem(writeTest);
+		ctx.releaseWorkItem(writeTest);
+
+		WorkItem *readTest = ctx.readFile("/two/blocks.txt", false);
+		WaitForWorkItem(readTest);
+		TEST(sizeof(blockData), WorkItemGetBytes(readTest), "Read file through block cache");
+		TEST(0, memcmp(WorkItemGetBuffer(readTest), blockData, sizeof(blockData)), "Compare block cache read");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+
+		WorkItem *segmentTest = ctx.readFileSegment("/two/blocks.txt", 500, 1000, false);
+		WaitForWorkItem(segmentTest);
+		TEST(1000, WorkItemGetBytes(segmentTest), "Read file segment through block cache");
+		TEST(0, memcmp(WorkItemGetBuffer(segmentTest), blockData + 500, 1000), "Compare block cache segment");
+		WorkItemFreeBuffer(segmentTest);
+		ctx.releaseWorkItem(segmentTest);
+
+		BlockCacheStats stats = cache.getStats();
+		TEST(4, stats.misses, "Block cache misses");
+		TEST(3, stats.hits, "Block cache hits");
+
+		WorkItem *segmentWriteTest = ctx.writeFileSegment("/two/blocks.txt", 1024, "ZZ", 2);
+		WaitForWorkItem(segmentWriteTest);
+		ctx.releaseWorkItem(segmentWriteTest);
+
+		WorkItem *invalidatedTest = ctx.readFileSegment("/two/blocks.txt", 1024, 2, true);
+		WaitForWorkItem(invalidatedTest);
+		TEST(0, strcmp(static_cast<char*>(WorkItemGetBuffer(invalidatedTest)), "ZZ"), "Write invalidates block cache");
+		WorkItemFreeBuffer(invalidatedTest);
+		ctx.releaseWorkItem(invalidatedTest);
+
+		WorkItem *sharedTest = ctx.readFileSegmentShared("/two/blocks.txt", 600, 100);
+		WorkItem *sharedTest2 = ctx.readFileSegmentShared("/two/blocks.txt", 600, 100);
+		WaitForWorkItem(sharedTest2);
+		TEST(0, memcmp(WorkItemGetBuffer(sharedTest2), blockData + 600, 100), "Compare shared block cache read");
+		TEST(WorkItemGetBuffer(sharedTest), WorkItemGetBuffer(sharedTest2), "Shared reads reference cached block");
+
+		SharedBuffer *shared = WorkItemAcquireSharedBuffer(sharedTest);
+		WorkItemFreeBuffer(sharedTest);
+		WorkItemFreeBuffer(sharedTest2);
+		cache.clear();
+		TEST(0, memcmp(SharedBufferGetData(shared), blockData + 600, 100), "Shared buffer outlives cache eviction");
+		SharedBufferRelease(shared);
+
+		ctx.releaseWorkItem(sharedTest);
+		ctx.releaseWorkItem(sharedTest2);
+
+		const char *prefetchPaths[] = { "/two/blocks.txt", "/two/missing.txt" };
+		WorkItem *prefetchTest = ctx.prefetch(prefetchPaths, 2);
+		WaitForWorkItem(prefetchTest);
+		TEST(1, WorkItemGetBytes(prefetchTest), "Prefetch into block cache");
+		ctx.releaseWorkItem(prefetchTest);
+
+		stats = cache.getStats();
+		WorkItem *prefetchedTest = ctx.readFile("/two/blocks.txt", false);
+		WaitForWorkItem(prefetchedTest);
+		TEST(0, memcmp(WorkItemGetBuffer(prefetchedTest), blockData, 1024), "Compare prefetched read");
+		TEST(stats.misses, cache.getStats().misses, "Prefetched read hits block cache");
+		WorkItemFreeBuffer(prefetchedTest);
+		ctx.releaseWorkItem(prefetchedTest);
+
+		WorkItem *deleteTest = ctx.deleteFile("/two/blocks.txt");
+		WaitForWorkItem(deleteTest);
+		ctx.releaseWorkItem(deleteTest);
+
+		// a file that shrank behind the cache's back is read from the device instead
+		writeTest = ctx.writeFile("/two/shrinking.txt", blockData, sizeof(blockData));
+		WaitForWorkItem(writeTest);
+		ctx.releaseWorkItem(writeTest);
+
+		WorkItem *headTest = ctx.readFileSegment("/two/shrinking.txt", 0, 100, false);
+		WaitForWorkItem(headTest);
+		WorkItemFreeBuffer(headTest);
+		ctx.releaseWorkItem(headTest);
+
+		{
+			FileContext otherCtx(laminaFS::DefaultAllocator);
+			otherCtx.createMount(0, "/", "testData/testroot", resultCode);
+			WorkItem *shrinkTest = otherCtx.writeFile("/two/shrinking.txt", blockData, 1100);
+			WaitForWorkItem(shrinkTest);
+			otherCtx.releaseWorkItem(shrinkTest);
+		}
+
+		WorkItem *shrunkTest = ctx.readFileSegment("/two/shrinking.txt", 1000, 200, false);
+		WaitForWorkItem(shrunkTest);
+		TEST(LFS_OK, WorkItemGetResult(shrunkTest), "Read file that changed behind the block cache");
+		TEST(100, WorkItemGetBytes(shrunkTest), "Read size of file that changed behind the block cache");
+		TEST(0, memcmp(WorkItemGetBuffer(shrunkTest), blockData + 1000, 100), "Compare file that changed behind the block cache");
+		WorkItemFreeBuffer(shrunkTest);
+		ctx.releaseWorkItem(shrunkTest);
+
+		deleteTest = ctx.deleteFile("/two/shrinking.txt");
+		WaitForWorkItem(deleteTest);
+		ctx.releaseWorkItem(deleteTest);
+
+		// paths with the same hash must not see each other's blocks
+		int owner = 0;
+		void *collisionData = laminaFS::DefaultAllocator.alloc(laminaFS::DefaultAllocator.allocator, 16, 1);
+		memset(collisionData, 'c', 16);
+		cache.insertFile(&owner, 42, "/first", true, 16);
+		SharedBuffer *collisionBlock = SharedBufferCreate(laminaFS::DefaultAllocator, collisionData, 16);
+		cache.insertBlock(&owner, 42, "/first", 0, collisionBlock);
+		SharedBufferRelease(collisionBlock);
+
+		uint64_t collisionSize = 0;
+		TEST(BlockCache::FILE_PRESENT, cache.lookupFile(&owner, 42, "/first", collisionSize), "Block cache file info");
+		TEST(BlockCache::FILE_UNKNOWN, cache.lookupFile(&owner, 42, "/second", collisionSize), "Block cache hash collision file info");
+		TEST(true, cache.hasBlock(&owner, 42, "/first", 0), "Block cache block");
+		TEST(false, cache.hasBlock(&owner, 42, "/second", 0), "Block cache hash collision block");
+		cache.invalidateFile(42);
+		TEST(BlockCache::FILE_UNKNOWN, cache.lookupFile(&owner, 42, "/first", collisionSize), "Invalidate file in block cache");
+
+		ctx.setBlockCache(nullptr);
+	}
+
+	// test prefetching without a block cache
+	{
+		const char *prefetchPaths[] = { "/one/random.txt", "/two/two.txt", "/four/four.txt", "/nope.txt" };
+		WorkItem *prefetchTest = ctx.prefetch(prefetchPaths, 4, LFS_PRIORITY_NORMAL);
+		WorkItem *readTest = ctx.readFile("/two/two.txt", true);
+		WaitForWorkItem(prefetchTest);
+		WaitForWorkItem(readTest);
+		TEST(LFS_OK, WorkItemGetResult(prefetchTest), "Prefetch files");
+		TEST(3, WorkItemGetBytes(prefetchTest), "Prefetch files found");
+		TEST(LFS_OK, WorkItemGetResult(readTest), "Read alongside prefetch");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+		ctx.releaseWorkItem(prefetchTest);
+
+		// paths shortened by normalizing mustn't throw off the entries after them
+		const char *unnormalizedPaths[] = { "/one//random.txt", "/two/two.txt", "/one/////random.txt", "/three/three.txt" };
+		prefetchTest = ctx.prefetch(unnormalizedPaths, 4, LFS_PRIORITY_NORMAL);
+		WaitForWorkItem(prefetchTest);
+		TEST(LFS_OK, WorkItemGetResult(prefetchTest), "Prefetch unnormalized paths");
+		TEST(4, WorkItemGetBytes(prefetchTest), "Prefetch unnormalized paths found");
+		ctx.releaseWorkItem(prefetchTest);
+	}
+
+	// test access trace recording and replay
+	{
+		ctx.beginAccessTrace();
+
+		const char *tracedPaths[] = { "/one/random.txt", "/two/two.txt", "/two/two.txt" };
+		const uint64_t tracedOffsets[] = { 0, 0, 4 };
+		const uint64_t tracedBytes[] = { UINT64_MAX, 4, 4 };
+		for (uint32_t i = 0; i < 3; ++i) {
+			WorkItem *readTest = ctx.readFileSegment(tracedPaths[i], tracedOffsets[i], tracedBytes[i], false);
+			WaitForWorkItem(readTest);
+			WorkItemFreeBuffer(readTest);
+			ctx.releaseWorkItem(readTest);
+		}
+
+		void *trace = nullptr;
+		uint64_t traceBytes = ctx.endAccessTrace(&trace);
+		TEST(true, trace != nullptr && traceBytes > 0, "Record access trace");
+
+		WorkItem *writeTest = ctx.writeFile("/startup.trace", trace, traceBytes);
+		WaitForWorkItem(writeTest);
+		ctx.releaseWorkItem(writeTest);
+		laminaFS::DefaultAllocator.free(laminaFS::DefaultAllocator.allocator, trace);
+
+		WorkItem *readTest = ctx.readFile("/startup.trace", false);
+		WaitForWorkItem(readTest);
+		TEST(traceBytes, WorkItemGetBytes(readTest), "Read access trace");
+
+		WorkItem *replayTest = ctx.replayAccessTrace(WorkItemGetBuffer(readTest), WorkItemGetBytes(readTest));
+		WaitForWorkItem(replayTest);
+		TEST(LFS_OK, WorkItemGetResult(replayTest), "Replay access trace");
+		TEST(2, WorkItemGetBytes(replayTest), "Replay merges adjoining reads");
+		ctx.releaseWorkItem(replayTest);
+
+		WorkItem *badReplayTest = ctx.replayAccessTrace(WorkItemGetBuffer(readTest), WorkItemGetBytes(readTest) - 1);
+		WaitForWorkItem(badReplayTest);
+		TEST(LFS_GENERIC_ERROR, WorkItemGetResult(badReplayTest), "Replay truncated access trace (expected fail)");
+		ctx.releaseWorkItem(badReplayTest);
+
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+
+		WorkItem *deleteTest = ctx.deleteFile("/startup.trace");
+		WaitForWorkItem(deleteTest);
+		ctx.releaseWorkItem(deleteTest);
+	}
+
+	// test path handles
+	{
+		PathHandle path = ctx.internPath("/four//./four.txt");
+		TEST(path, ctx.internPath("/four/four.txt"), "Intern equivalent paths");
+		TEST(0, strcmp(FileContext::getPathString(path), "/four/four.txt"), "Interned path is normalized");
+
+		WorkItem *existsTest = ctx.fileExists(path);
+		WaitForWorkItem(existsTest);
+		TEST(LFS_OK, WorkItemGetResult(existsTest), "File exists through path handle");
+		ctx.releaseWorkItem(existsTest);
+
+		WorkItem *sizeTest = ctx.fileSize(path);
+		WaitForWorkItem(sizeTest);
+		uint64_t size = WorkItemGetBytes(sizeTest);
+		ctx.releaseWorkItem(sizeTest);
+
+		// the second read uses the cached mount
+		for (uint32_t i = 0; i < 2; ++i) {
+			WorkItem *readTest = ctx.readFile(path, false);
+			WaitForWorkItem(readTest);
+			TEST(size, WorkItemGetBytes(readTest), "Read file through path handle");
+			WorkItemFreeBuffer(readTest);
+			ctx.releaseWorkItem(readTest);
+		}
+
+		// the cached mount must not survive a mount change
+		Mount shadowMount = ctx.createMount(0, "/four", "testData/testroot", resultCode);
+		WorkItem *shadowedTest = ctx.fileExists(path);
+		WaitForWorkItem(shadowedTest);
+		TEST(LFS_OK, WorkItemGetResult(shadowedTest), "Path handle falls through new mount");
+		ctx.releaseWorkItem(shadowedTest);
+		ctx.releaseMount(shadowMount);
+
+		PathHandle writePath = ctx.internPath("/handle.txt");
+		WorkItem *writeTest = ctx.writeFile(writePath, "handle", 6);
+		WaitForWorkItem(writeTest);
+		TEST(6, WorkItemGetBytes(writeTest), "Write file through path handle");
+		ctx.releaseWorkItem(writeTest);
+
+		WorkItem *deleteTest = ctx.deleteFile("/handle.txt");
+		WaitForWorkItem(deleteTest);
+		ctx.releaseWorkItem(deleteTest);
+
+		WorkItem *goneTest = ctx.fileExists(writePath);
+		WaitForWorkItem(goneTest);
+		TEST(LFS_NOT_FOUND, WorkItemGetResult(goneTest), "Path handle sees deleted file");
+		ctx.releaseWorkItem(goneTest);
+	}
+
+	// test compile-time path handles
+	{
+		PathHandle path = LFS_PATH("/four//./four.txt");
+		TEST(0, strcmp(FileContext::getPathString(path), "/four/four.txt"), "Literal path is normalized");
+		TEST(FileContext::getPathHash(ctx.internPath("/four/four.txt")), FileContext::getPathHash(path), "Literal path hash matches interned path");
+
+		WorkItem *readTest = ctx.readFile(path, false);
+		WaitForWorkItem(readTest);
+		TEST(LFS_OK, WorkItemGetResult(readTest), "Read file through literal path");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+
+		// the same handle must resolve against each context's own mounts
+		FileContext otherCtx(laminaFS::DefaultAllocator);
+		otherCtx.createMount(0, "/four", "testData/testroot", resultCode);
+		WorkItem *otherTest = otherCtx.fileExists(path);
+		WaitForWorkItem(otherTest);
+		TEST(LFS_NOT_FOUND, WorkItemGetResult(otherTest), "Literal path resolves per context");
+		otherCtx.releaseWorkItem(otherTest);
+	}
+
+	// test case-insensitive mounts
+	{
+		WorkItem *sensitiveTest = ctx.fileExists("/four/FOUR.TXT");
+		WaitForWorkItem(sensitiveTest);
+		TEST(LFS_NOT_FOUND, WorkItemGetResult(sensitiveTest), "Wrong case on case-sensitive mount (expected fail)");
+		ctx.releaseWorkItem(sensitiveTest);
+
+		Mount ciMount = ctx.createMount(0, "/ci", "testData/testroot2", resultCode, LFS_MOUNT_ALL_PERMISSIONS | LFS_MOUNT_CASE_INSENSITIVE);
+		TEST(LFS_OK, resultCode, "Mount testData/testroot2 -> /ci case-insensitive");
+
+		WorkItem *readTest = ctx.readFile("/ci/Four.TXT", false);
+		WaitForWorkItem(readTest);
+		TEST(LFS_OK, WorkItemGetResult(readTest), "Read file with wrong case");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+
+		WorkItem *writeTest = ctx.writeFile("/ci/Mixed.txt", "mixed", 5);
+		WaitForWorkItem(writeTest);
+		ctx.releaseWorkItem(writeTest);
+
+		WorkItem *existsTest = ctx.fileExists("/ci/MIXED.TXT");
+		WaitForWorkItem(existsTest);
+		TEST(LFS_OK, WorkItemGetResult(existsTest), "New file found with wrong case");
+		ctx.releaseWorkItem(existsTest);
+
+		WorkItem *deleteTest = ctx.deleteFile("/ci/mixed.txt");
+		WaitForWorkItem(deleteTest);
+		TEST(LFS_OK, WorkItemGetResult(deleteTest), "Delete file with wrong case");
+		ctx.releaseWorkItem(deleteTest);
+
+		WorkItem *goneTest = ctx.fileExists("/ci/MIXED.TXT");
+		WaitForWorkItem(goneTest);
+		TEST(LFS_NOT_FOUND, WorkItemGetResult(goneTest), "Deleted file is gone from the index");
+		ctx.releaseWorkItem(goneTest);
+
+		TEST(true, ctx.releaseMount(ciMount), "Unmount testData/testroot2 -> /ci");
+	}
+
+	// test path filters on overlay mounts
+	{
+		Mount overlays[4];
+		for (Mount &overlay : overlays) {
+			overlay = ctx.createMount(0, "/", "testData/testroot2", resultCode, LFS_MOUNT_READ | LFS_MOUNT_PATH_FILTER);
+		}
+		TEST(LFS_OK, resultCode, "Mount filtered overlays of testData/testroot2 -> /");
+
+		PathFilterStats before = ctx.getPathFilterStats();
+		WorkItem *readTest = ctx.readFile("/one/random.txt", false);
+		WaitForWorkItem(readTest);
+		TEST(LFS_OK, WorkItemGetResult(readTest), "Read file under filtered overlays");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+
+		WorkItem *overlayTest = ctx.fileExists("/four.txt");
+		WaitForWorkItem(overlayTest);
+		TEST(LFS_OK, WorkItemGetResult(overlayTest), "File exists in filtered overlay");
+		ctx.releaseWorkItem(overlayTest);
+
+		PathFilterStats after = ctx.getPathFilterStats();
+		TEST(4, after.rejected - before.rejected, "Path filters skip overlays");
+		TEST(4, after.entries, "Path filter entries");
+
+		// a saved filter is loaded instead of enumerating the device, which would now include the saved filter
+		Mount writable = ctx.createMount(0, "/filtered", "testData/testroot2", resultCode, LFS_MOUNT_ALL_PERMISSIONS | LFS_MOUNT_PATH_FILTER);
+		TEST(LFS_OK, ctx.writePathFilter(writable), "Write path filter");
+		Mount loaded = ctx.createMount(0, "/loaded", "testData/testroot2", resultCode, LFS_MOUNT_READ | LFS_MOUNT_PATH_FILTER);
+		TEST(6, ctx.getPathFilterStats().entries, "Load saved path filter");
+		TEST(LFS_UNSUPPORTED, ctx.writePathFilter(loaded), "Write path filter of read-only mount (expected fail)");
+
+		// a new file written through the mount isn't in the saved filter, so the filter is deleted
+		WorkItem *newFileTest = ctx.writeFile("/filtered/unfiltered.txt", "new", 3);
+		WaitForWorkItem(newFileTest);
+		ctx.releaseWorkItem(newFileTest);
+
+		WorkItem *savedTest = ctx.fileExists("/four" LFS_PATH_FILTER_FILE);
+		WaitForWorkItem(savedTest);
+		TEST(LFS_NOT_FOUND, WorkItemGetResult(savedTest), "New file deletes saved path filter");
+		ctx.releaseWorkItem(savedTest);
+
+		Mount rebuilt = ctx.createMount(0, "/rebuilt", "testData/testroot2", resultCode, LFS_MOUNT_READ | LFS_MOUNT_PATH_FILTER);
+		WorkItem *rebuiltTest = ctx.fileExists("/rebuilt/unfiltered.txt");
+		WaitForWorkItem(rebuiltTest);
+		TEST(LFS_OK, WorkItemGetResult(rebuiltTest), "Rebuilt path filter includes new file");
+		ctx.releaseWorkItem(rebuiltTest);
+
+		WorkItem *deleteTest = ctx.deleteFile("/filtered/unfiltered.txt");
+		WaitForWorkItem(deleteTest);
+		ctx.releaseWorkItem(deleteTest);
+
+		ctx.releaseMount(rebuilt);
+		ctx.releaseMount(loaded);
+		ctx.releaseMount(writable);
+		for (Mount overlay : overlays) {
+			ctx.releaseMount(overlay);
+		}
+	}
+
+	// test pack device
+	{
+		std::string packBytes = buildPack({{"/a.txt", testString}, {"/dir/b.txt", testString2}, {"/empty.txt", ""}}, 64);
+		WorkItem *packWrite = ctx.writeFile("/four/test.pack", packBytes.data(), packBytes.size());
+		WaitForWorkItem(packWrite);
+		ctx.releaseWorkItem(packWrite);
+
+		Mount packMount = ctx.createMount(FileContext::kPackDeviceIndex, "/pack", "testData/testroot2/test.pack", resultCode);
+		TEST(LFS_OK, resultCode, "Mount testData/testroot2/test.pack -> /pack");
+
+		WorkItem *existsTest = ctx.fileExists("/pack/dir/b.txt");
+		WaitForWorkItem(existsTest);
+		TEST(LFS_OK, WorkItemGetResult(existsTest), "Pack file exists");
+		ctx.releaseWorkItem(existsTest);
+
+		WorkItem *missingTest = ctx.fileExists("/pack/dir/c.txt");
+		WaitForWorkItem(missingTest);
+		TEST(LFS_NOT_FOUND, WorkItemGetResult(missingTest), "Pack file exists (expected fail)");
+		ctx.releaseWorkItem(missingTest);
+
+		WorkItem *sizeTest = ctx.fileSize("/pack/a.txt");
+		WaitForWorkItem(sizeTest);
+		TEST(strlen(testString), WorkItemGetBytes(sizeTest), "Pack file size");
+		ctx.releaseWorkItem(sizeTest);
+
+		WorkItem *readTest = ctx.readFile("/pack/dir/b.txt", true);
+		WaitForWorkItem(readTest);
+		TEST(0, strcmp(testString2, static_cast<const char*>(WorkItemGetBuffer(readTest))), "Read pack file");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+
+		WorkItem *segmentTest = ctx.readFileSegment("/pack/a.txt", testStringOffset, 4, false);
+		WaitForWorkItem(segmentTest);
+		TEST(0, memcmp(testString + testStringOffset, WorkItemGetBuffer(segmentTest), 4), "Read pack file segment");
+		WorkItemFreeBuffer(segmentTest);
+		ctx.releaseWorkItem(segmentTest);
+
+		WorkItem *emptyTest = ctx.readFile("/pack/empty.txt", false);
+		WaitForWorkItem(emptyTest);
+		TEST(LFS_OK, WorkItemGetResult(emptyTest), "Read empty pack file");
+		ctx.releaseWorkItem(emptyTest);
+
+		WorkItem *writeTest = ctx.writeFile("/pack/a.txt", testString, strlen(testString));
+		WaitForWorkItem(writeTest);
+		TEST(LFS_NOT_FOUND, WorkItemGetResult(writeTest), "Write pack file (expected fail)");
+		ctx.releaseWorkItem(writeTest);
+
+		WorkItem *mappedTest = ctx.readFileShared("/pack/dir/b.txt", nullptr, LFS_READ_MAPPED | LFS_READ_WILLNEED);
+		WaitForWorkItem(mappedTest);
+		SharedBuffer *mapped = WorkItemAcquireSharedBuffer(mappedTest);
+		WorkItemFreeBuffer(mappedTest);
+		ctx.releaseWorkItem(mappedTest);
+
+		TEST(true, ctx.releaseMount(packMount), "Unmount testData/testroot2/test.pack -> /pack");
+
+		TEST(strlen(testString2), SharedBufferGetSize(mapped), "Mapped pack file size");
+		TEST(0, memcmp(testString2, SharedBufferGetData(mapped), strlen(testString2)), "Mapped pack file outlives mount");
+		SharedBufferRelease(mapped);
+
+		// corrupt the TOC so that an entry points past the end of the pack
+		packBytes[sizeof(pack::Header) + offsetof(pack::Entry, _size) + sizeof(uint64_t) - 1] = '\x7f';
+		WorkItem *corruptWrite = ctx.writeFile("/four/test.pack", packBytes.data(), packBytes.size());
+		WaitForWorkItem(corruptWrite);
+		ctx.releaseWorkItem(corruptWrite);
+
+		ctx.createMount(FileContext::kPackDeviceIndex, "/pack", "testData/testroot2/test.pack", resultCode);
+		TEST(LFS_UNSUPPORTED, resultCode, "Mount corrupt pack (expected fail)");
+
+		// compressible contents spanning several blocks, plus one incompressible block
+		std::string compressible;
+		for (uint32_t i = 0; compressible.size() < 5 * pack::kMinBlockSize; ++i) {
+			compressible += "block " + std::to_string(i % 100) + " of compressible data. ";
+		}
+		std::string incompressible;
+		std::mt19937 rng(7);
+		for (uint32_t i = 0; i < pack::kMinBlockSize; ++i) {
+			incompressible += static_cast<char>(rng());
+		}
+
+		packBytes = buildPack({{"/compressible.txt", compressible}, {"/random.bin", incompressible}, {"/empty.txt", ""}}, 8, pack::kMinBlockSize);
+		TEST(true, packBytes.size() < compressible.size(), "Compress pack");
+		WorkItem *compressedWrite = ctx.writeFile("/four/test.pack", packBytes.data(), packBytes.size());
+		WaitForWorkItem(compressedWrite);
+		ctx.releaseWorkItem(compressedWrite);
+
+		packMount = ctx.createMount(FileContext::kPackDeviceIndex, "/pack", "testData/testroot2/test.pack", resultCode);
+		TEST(LFS_OK, resultCode, "Mount compressed pack");
+
+		WorkItem *compressedRead = ctx.readFile("/pack/compressible.txt", false);
+		WaitForWorkItem(compressedRead);
+		TEST(true, WorkItemGetBytes(compressedRead) == compressible.size() && memcmp(compressible.data(), WorkItemGetBuffer(compressedRead), compressible.size()) == 0, "Read compressed pack file");
+		WorkItemFreeBuffer(compressedRead);
+		ctx.releaseWorkItem(compressedRead);
+
+		// crosses a block boundary without starting or ending on one
+		uint64_t segmentOffset = pack::kMinBlockSize - 100;
+		WorkItem *compressedSegment = ctx.readFileSegment("/pack/compressible.txt", segmentOffset, pack::kMinBlockSize + 200, false);
+		WaitForWorkItem(compressedSegment);
+		TEST(0, memcmp(compressible.data() + segmentOffset, WorkItemGetBuffer(compressedSegment), pack::kMinBlockSize + 200), "Read compressed pack file segment");
+		WorkItemFreeBuffer(compressedSegment);
+		ctx.releaseWorkItem(compressedSegment);
+
+		WorkItem *storedRead = ctx.readFile("/pack/random.bin", false);
+		WaitForWorkItem(storedRead);
+		TEST(0, memcmp(incompressible.data(), WorkItemGetBuffer(storedRead), incompressible.size()), "Read uncompressed block");
+		WorkItemFreeBuffer(storedRead);
+		ctx.releaseWorkItem(storedRead);
+
+		TEST(true, ctx.releaseMount(packMount), "Unmount compressed pack");
+
+		WorkItem *deleteTest = ctx.deleteFile("/four/test.pack");
+		WaitForWorkItem(deleteTest);
+		ctx.releaseWorkItem(deleteTest);
+	}
+
+	// test packs built by lfspack, the test scripts say where to find it
+	if (const char *lfspack = getenv("LFSPACK")) {
+		const char *packedPaths[] = { "/one/random.txt", "/two/two.txt", "/three/three.txt" };
+		struct { const char *_options; const char *_magic; std::string _name; } formats[] = {
+			{"", pack::kMagic, "plain"},
+			{"--compress ", pack::kCompressedMagic, "compressed"}
+		};
+
+		for (const auto &format : formats) {
+#ifdef _WIN32
+			const char *quiet = " > NUL";
+#else
+			const char *quiet = " > /dev/null";
+#endif
+			std::string command = std::string("\"") + lfspack + "\" " + format._options + "testData/testroot testData/testroot2/lfspack.pack" + quiet;
+			TEST(0, system(command.c_str()), ("Build " + format._name + " pack with lfspack").c_str());
+
+			WorkItem *magicTest = ctx.readFileSegment("/four/lfspack.pack", 0, 4, false);
+			WaitForWorkItem(magicTest);
+			TEST(0, memcmp(WorkItemGetBuffer(magicTest), format._magic, 4), ("Pack format of " + format._name + " lfspack output").c_str());
+			WorkItemFreeBuffer(magicTest);
+			ctx.releaseWorkItem(magicTest);
+
+			Mount packMount = ctx.createMount(FileContext::kPackDeviceIndex, "/lfspack", "testData/testroot2/lfspack.pack", resultCode);
+			TEST(LFS_OK, resultCode, ("Mount " + format._name + " lfspack output").c_str());
+
+			// every file reads back the same as from the directory it was packed from
+			bool matches = true;
+			for (const char *path : packedPaths) {
+				WorkItem *directoryRead = ctx.readFile(path, false);
+				WorkItem *packRead = ctx.readFile((std::string("/lfspack") + path).c_str(), false);
+				WaitForWorkItem(directoryRead);
+				WaitForWorkItem(packRead);
+
+				matches = matches && WorkItemGetResult(packRead) == LFS_OK && WorkItemGetBytes(packRead) == WorkItemGetBytes(directoryRead)
+					&& memcmp(WorkItemGetBuffer(packRead), WorkItemGetBuffer(directoryRead), WorkItemGetBytes(packRead)) == 0;
+
+				WorkItemFreeBuffer(directoryRead);
+				WorkItemFreeBuffer(packRead);
+				ctx.releaseWorkItem(directoryRead);
+				ctx.releaseWorkItem(packRead);
+			}
+			TEST(true, matches, ("Compare " + format._name + " lfspack output with its directory").c_str());
+
+			ctx.releaseMount(packMount);
+
+			WorkItem *deleteTest = ctx.deleteFile("/four/lfspack.pack");
+			WaitForWorkItem(deleteTest);
+			ctx.releaseWorkItem(deleteTest);
+		}
+	} else {
+		printf("LFSPACK isn't set, skipping lfspack tests\n");
+	}
+
+	// test zip device
+	{
+		Mount zipMount = ctx.createMount(FileContext::kZipDeviceIndex, "/zip", "testData/test.zip", resultCode);
+		TEST(LFS_OK, resultCode, "Mount testData/test.zip -> /zip");
+
+		WorkItem *existsTest = ctx.fileExists("/zip/dir/deflated.txt");
+		WaitForWorkItem(existsTest);
+		TEST(LFS_OK, WorkItemGetResult(existsTest), "Zip file exists");
+		ctx.releaseWorkItem(existsTest);
+
+		WorkItem *dirTest = ctx.fileExists("/zip/dir");
+		WaitForWorkItem(dirTest);
+		TEST(LFS_NOT_FOUND, WorkItemGetResult(dirTest), "Zip directory isn't a file (expected fail)");
+		ctx.releaseWorkItem(dirTest);
+
+		WorkItem *storedTest = ctx.readFile("/zip/stored.txt", true);
+		WaitForWorkItem(storedTest);
+		TEST(0, strcmp("this is a stored zip entry.", static_cast<const char*>(WorkItemGetBuffer(storedTest))), "Read stored zip file");
+		WorkItemFreeBuffer(storedTest);
+		ctx.releaseWorkItem(storedTest);
+
+		WorkItem *deflatedTest = ctx.readFile("/zip/dir/deflated.txt", false);
+		WaitForWorkItem(deflatedTest);
+		TEST(19756, WorkItemGetBytes(deflatedTest), "Read deflated zip file");
+
+		WorkItem *segmentTest = ctx.readFileSegment("/zip/dir/deflated.txt", 10000, 500, false);
+		WaitForWorkItem(segmentTest);
+		TEST(0, memcmp(static_cast<const char*>(WorkItemGetBuffer(deflatedTest)) + 10000, WorkItemGetBuffer(segmentTest), 500), "Read deflated zip file segment");
+		WorkItemFreeBuffer(segmentTest);
+		ctx.releaseWorkItem(segmentTest);
+
+		// later segments are copied out of the entry inflated for the first one
+		bool segmentsMatch = true;
+		for (uint64_t offset = 0; offset < WorkItemGetBytes(deflatedTest); offset += 3000) {
+			segmentTest = ctx.readFileSegment("/zip/dir/deflated.txt", offset, 3000, false);
+			WaitForWorkItem(segmentTest);
+			uint64_t expectedBytes = std::min<uint64_t>(3000, WorkItemGetBytes(deflatedTest) - offset);
+			segmentsMatch = segmentsMatch && WorkItemGetBytes(segmentTest) == expectedBytes
+				&& memcmp(static_cast<const char*>(WorkItemGetBuffer(deflatedTest)) + offset, WorkItemGetBuffer(segmentTest), expectedBytes) == 0;
+			WorkItemFreeBuffer(segmentTest);
+			ctx.releaseWorkItem(segmentTest);
+		}
+		TEST(true, segmentsMatch, "Read deflated zip file in segments");
+		WorkItemFreeBuffer(deflatedTest);
+		ctx.releaseWorkItem(deflatedTest);
+
+		WorkItem *mappedTest = ctx.readFileShared("/zip/stored.txt", nullptr, LFS_READ_MAPPED);
+		WaitForWorkItem(mappedTest);
+		TEST(0, memcmp("this is a stored zip entry.", WorkItemGetBuffer(mappedTest), WorkItemGetBytes(mappedTest)), "Map stored zip file");
+		WorkItemFreeBuffer(mappedTest);
+		ctx.releaseWorkItem(mappedTest);
+
+		mappedTest = ctx.readFileSegmentShared("/zip/dir/deflated.txt", 100, 50, nullptr, LFS_READ_MAPPED);
+		WaitForWorkItem(mappedTest);
+		TEST(50, WorkItemGetBytes(mappedTest), "Map deflated zip file falls back to reading it");
+		WorkItemFreeBuffer(mappedTest);
+		ctx.releaseWorkItem(mappedTest);
+
+		WorkItem *zip64Test = ctx.readFile("/zip/dir/zip64.txt", true);
+		WaitForWorkItem(zip64Test);
+		TEST(0, strncmp("zip64 extra fields. zip64", static_cast<const char*>(WorkItemGetBuffer(zip64Test)), 25), "Read zip64 zip file");
+		WorkItemFreeBuffer(zip64Test);
+		ctx.releaseWorkItem(zip64Test);
+
+		TEST(true, ctx.releaseMount(zipMount), "Unmount testData/test.zip -> /zip");
+
+		ctx.createMount(FileContext::kZipDeviceIndex, "/zip", "testData/testroot2/four.txt", resultCode);
+		TEST(LFS_UNSUPPORTED, resultCode, "Mount non-zip file (expected fail)");
+	}
+
+	// test mapped reads
+	{
+		WorkItem *readTest = ctx.readFile("/four/four.txt", false);
+		WaitForWorkItem(readTest);
+
+		WorkItem *mappedTest = ctx.readFileShared("/four/four.txt", nullptr, LFS_READ_MAPPED | LFS_READ_SEQUENTIAL);
+		WaitForWorkItem(mappedTest);
+		TEST(WorkItemGetBytes(readTest), WorkItemGetBytes(mappedTest), "Map file size");
+		TEST(0, memcmp(WorkItemGetBuffer(readTest), WorkItemGetBuffer(mappedTest), WorkItemGetBytes(readTest)), "Map file contents");
+		WorkItemFreeBuffer(mappedTest);
+		ctx.releaseWorkItem(mappedTest);
+
+		// the mapping has to start on a page boundary, the view doesn't
+		WorkItem *segmentTest = ctx.readFileSegmentShared("/four/four.txt", 5, 10, nullptr, LFS_READ_MAPPED);
+		WaitForWorkItem(segmentTest);
+		TEST(0, memcmp(static_cast<const char*>(WorkItemGetBuffer(readTest)) + 5, WorkItemGetBuffer(segmentTest), 10), "Map file segment");
+		WorkItemFreeBuffer(segmentTest);
+		ctx.releaseWorkItem(segmentTest);
+
+		WorkItem *pastEndTest = ctx.readFileSegmentShared("/four/four.txt", 1 << 20, 10, nullptr, LFS_READ_MAPPED);
+		WaitForWorkItem(pastEndTest);
+		TEST(LFS_OK, WorkItemGetResult(pastEndTest), "Map past the end of a file");
+		TEST(0, WorkItemGetBytes(pastEndTest), "Map past the end of a file is empty");
+		ctx.releaseWorkItem(pastEndTest);
+
+		WorkItem *missingTest = ctx.readFileShared("/four/missing.txt", nullptr, LFS_READ_MAPPED);
+		WaitForWorkItem(missingTest);
+		TEST(LFS_NOT_FOUND, WorkItemGetResult(missingTest), "Map missing file (expected fail)");
+		ctx.releaseWorkItem(missingTest);
+
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+	}
+
+	// test RAM device
+	{
+		Mount ramMount = ctx.createMount(FileContext::kRamDeviceIndex, "/ram", "", resultCode);
+		TEST(LFS_OK, resultCode, "Mount empty RAM device -> /ram");
+
+		WorkItem *noParentTest = ctx.writeFile("/ram/dir/file.txt", "abc", 3);
+		WaitForWorkItem(noParentTest);
+		TEST(LFS_NOT_FOUND, WorkItemGetResult(noParentTest), "Write RAM file without parent directory (expected fail)");
+		ctx.releaseWorkItem(noParentTest);
+
+		WorkItem *createDirTest = ctx.createDir("/ram/dir");
+		WaitForWorkItem(createDirTest);
+		TEST(LFS_OK, WorkItemGetResult(createDirTest), "Create RAM directory");
+		ctx.releaseWorkItem(createDirTest);
+
+		createDirTest = ctx.createDir("/ram/dir");
+		WaitForWorkItem(createDirTest);
+		TEST(LFS_ALREADY_EXISTS, WorkItemGetResult(createDirTest), "Create existing RAM directory (expected fail)");
+		ctx.releaseWorkItem(createDirTest);
+
+		WorkItem *writeTest = ctx.writeFile("/ram/dir/file.txt", "abc", 3);
+		WaitForWorkItem(writeTest);
+		TEST(LFS_OK, WorkItemGetResult(writeTest), "Write RAM file");
+		ctx.releaseWorkItem(writeTest);
+
+		WorkItem *appendTest = ctx.appendFile("/ram/dir/file.txt", "def", 3);
+		WaitForWorkItem(appendTest);
+		TEST(LFS_OK, WorkItemGetResult(appendTest), "Append RAM file");
+		ctx.releaseWorkItem(appendTest);
+
+		WorkItem *segmentTest = ctx.writeFileSegment("/ram/dir/file.txt", 8, "gh", 2);
+		WaitForWorkItem(segmentTest);
+		TEST(LFS_OK, WorkItemGetResult(segmentTest), "Write RAM file segment past the end");
+		ctx.releaseWorkItem(segmentTest);
+
+		WorkItem *readTest = ctx.readFile("/ram/dir/file.txt", false);
+		WaitForWorkItem(readTest);
+		TEST(10, WorkItemGetBytes(readTest), "Read RAM file size");
+		TEST(0, memcmp("abcdef\0\0gh", WorkItemGetBuffer(readTest), 10), "Read RAM file contents");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+
+		segmentTest = ctx.writeFileSegment("/ram/dir/missing.txt", 0, "gh", 2);
+		WaitForWorkItem(segmentTest);
+		TEST(LFS_NOT_FOUND, WorkItemGetResult(segmentTest), "Write segment of missing RAM file (expected fail)");
+		ctx.releaseWorkItem(segmentTest);
+
+		WorkItem *deleteDirTest = ctx.deleteDir("/ram/dir");
+		WaitForWorkItem(deleteDirTest);
+		TEST(LFS_OK, WorkItemGetResult(deleteDirTest), "Delete RAM directory");
+		ctx.releaseWorkItem(deleteDirTest);
+
+		WorkItem *existsTest = ctx.fileExists("/ram/dir/file.txt");
+		WaitForWorkItem(existsTest);
+		TEST(LFS_NOT_FOUND, WorkItemGetResult(existsTest), "RAM directory contents deleted");
+		ctx.releaseWorkItem(existsTest);
+
+		TEST(true, ctx.releaseMount(ramMount), "Unmount empty RAM device -> /ram");
+
+		ramMount = ctx.createMount(FileContext::kRamDeviceIndex, "/ram", "testData/testroot", resultCode);
+		TEST(LFS_OK, resultCode, "Mount preloaded RAM device testData/testroot -> /ram");
+
+		readTest = ctx.readFile("/ram/two/two.txt", true);
+		WaitForWorkItem(readTest);
+		TEST(LFS_OK, WorkItemGetResult(readTest), "Read preloaded RAM file");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+
+		WorkItem *deleteTest = ctx.deleteFile("/ram/two/two.txt");
+		WaitForWorkItem(deleteTest);
+		TEST(LFS_OK, WorkItemGetResult(deleteTest), "Delete preloaded RAM file");
+		ctx.releaseWorkItem(deleteTest);
+
+		existsTest = ctx.fileExists("/ram/two/two.txt");
+		WaitForWorkItem(existsTest);
+		TEST(LFS_NOT_FOUND, WorkItemGetResult(existsTest), "Deleted RAM file is gone");
+		ctx.releaseWorkItem(existsTest);
+
+		TEST(true, ctx.releaseMount(ramMount), "Unmount preloaded RAM device -> /ram");
+
+		existsTest = ctx.fileExists("/two/two.txt");
+		WaitForWorkItem(existsTest);
+		TEST(LFS_OK, WorkItemGetResult(existsTest), "Preloaded directory is untouched");
+		ctx.releaseWorkItem(existsTest);
+
+		ctx.createMount(FileContext::kRamDeviceIndex, "/ram", "testData/nonexistentdir", resultCode);
+		TEST(LFS_NOT_FOUND, resultCode, "Mount RAM device preloaded from missing directory (expected fail)");
+	}
+
+	// test worker pool
+	{
+		util::WorkerPool pool(DefaultAllocator, 3);
+		std::atomic<uint64_t> sum{0};
+		uint64_t expected = 0;
+		for (uint32_t round = 0; round < 200; ++round) {
+			pool.parallelFor(round % 17, [&sum](uint32_t index) { sum += index + 1; });
+			expected += (round % 17) * (round % 17 + 1) / 2;
+		}
+		TEST(expected, sum.load(), "Worker pool runs every index once");
+	}
+
+	// test cached file descriptors
+	{
+#ifndef _WIN32
+		util::FileDescriptorCache cache(DefaultAllocator, 2);
+		const char *paths[] = {"testData/testroot/one/random.txt", "testData/testroot/two/two.txt", "testData/testroot2/four.txt"};
+		uint64_t hashes[3];
+		int files[3];
+		for (uint32_t i = 0; i < 3; ++i) {
+			hashes[i] = util::hashString(paths[i]);
+			files[i] = cache.insert(paths[i], hashes[i], open(paths[i], O_RDONLY));
+			cache.release(files[i]);
+		}
+
+		TEST(-1, cache.acquire(paths[0], hashes[0]), "Descriptor cache evicts the least recently used file");
+		int file = cache.acquire(paths[2], hashes[2]);
+		TEST(files[2], file, "Descriptor cache hit");
+
+		// invalidating a descriptor that's in use must not close it
+		cache.invalidate(paths[2], hashes[2]);
+		TEST(-1, cache.acquire(paths[2], hashes[2]), "Descriptor cache invalidation");
+		char byte = 0;
+		TEST(1, static_cast<int>(pread(file, &byte, 1, 0)), "Invalidated descriptor stays open until released");
+		cache.release(file);
+		TEST(1u, static_cast<uint32_t>(cache.hits()), "Descriptor cache hit count");
+#endif
+
+		const char *first = "first contents";
+		WorkItem *writeTest = ctx.writeFile("/two/fdcache.txt", const_cast<char *>(first), strlen(first));
+		WaitForWorkItem(writeTest);
+		ctx.releaseWorkItem(writeTest);
+
+		WorkItem *readTest = ctx.readFile("/two/fdcache.txt", true);
+		WaitForWorkItem(readTest);
+		TEST(0, strcmp(static_cast<char*>(WorkItemGetBuffer(readTest)), first), "Read file through descriptor cache");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+
+		writeTest = ctx.writeFile("/two/fdcache.txt", const_cast<char *>("second"), 6);
+		WaitForWorkItem(writeTest);
+		ctx.releaseWorkItem(writeTest);
+
+		readTest = ctx.readFile("/two/fdcache.txt", true);
+		WaitForWorkItem(readTest);
+		TEST(0, strcmp(static_cast<char*>(WorkItemGetBuffer(readTest)), "second"), "Read file after overwriting a cached file");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+
+#ifndef _WIN32
+		// hits don't resolve the path again, so a file moved away outside of LaminaFS is still
+		// read through the cached descriptor
+		TEST(0, rename("testData/testroot/two/fdcache.txt", "testData/testroot/two/fdcache_moved.txt"), "Move cached file outside of LaminaFS");
+
+		readTest = ctx.readFile("/two/fdcache.txt", true);
+		WaitForWorkItem(readTest);
+		TEST(LFS_OK, WorkItemGetResult(readTest), "Read moved file through descriptor cache");
+		TEST(true, WorkItemGetBuffer(readTest) && strcmp(static_cast<char*>(WorkItemGetBuffer(readTest)), "second") == 0, "Compare moved file read through descriptor cache");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+
+		remove("testData/testroot/two/fdcache_moved.txt");
+#endif
+
+		WorkItem *deleteTest = ctx.deleteFile("/two/fdcache.txt");
+		WaitForWorkItem(deleteTest);
+		ctx.releaseWorkItem(deleteTest);
+
+		readTest = ctx.readFile("/two/fdcache.txt", false);
+		WaitForWorkItem(readTest);
+		TEST(LFS_NOT_FOUND, WorkItemGetResult(readTest), "Read file after deleting a cached file (expected fail)");
+		ctx.releaseWorkItem(readTest);
+	}
+
+	// test file handles
+	{
+		std::string contents;
+		for (uint32_t i = 0; contents.size() < 100000; ++i) {
+			contents += std::to_string(i) + ",";
+		}
+
+		WorkItem *openTest = ctx.openFile("/two/stream.txt", LFS_OPEN_WRITE);
+		WaitForWorkItem(openTest);
+		TEST(LFS_OK, WorkItemGetResult(openTest), "Open file handle for writing /two/stream.txt");
+		FileHandle file = WorkItemGetFileHandle(openTest);
+		ctx.releaseWorkItem(openTest);
+
+		// writes are issued without waiting, they're processed in order
+		WorkItem *writeTests[4];
+		uint64_t quarter = contents.size() / 4;
+		for (uint32_t i = 0; i < 4; ++i) {
+			uint64_t bytes = i == 3 ? contents.size() - quarter * 3 : quarter;
+			writeTests[i] = ctx.writeFileHandle(file, contents.data() + quarter * i, bytes);
+		}
+
+		WorkItem *readTest = ctx.readFileHandle(file, 16);
+		WaitForWorkItem(readTest);
+		TEST(LFS_UNSUPPORTED, WorkItemGetResult(readTest), "Read file handle opened for writing (expected fail)");
+		ctx.releaseWorkItem(readTest);
+
+		uint64_t written = 0;
+		for (WorkItem *item : writeTests) {
+			written += WorkItemGetBytes(item);
+			ctx.releaseWorkItem(item);
+		}
+		TEST(contents.size(), written, "Write file handle");
+
+		WorkItem *closeTest = ctx.closeFileHandle(file);
+		WaitForWorkItem(closeTest);
+		TEST(LFS_OK, WorkItemGetResult(closeTest), "Close file handle");
+		ctx.releaseWorkItem(closeTest);
+
+		// small buffers, so reads go through several rounds of readahead
+		openTest = ctx.openFile("/two/stream.txt", LFS_OPEN_READ, 4096);
+		WaitForWorkItem(openTest);
+		TEST(LFS_OK, WorkItemGetResult(openTest), "Open file handle for reading /two/stream.txt");
+		TEST(contents.size(), WorkItemGetBytes(openTest), "Open file handle size");
+		file = WorkItemGetFileHandle(openTest);
+		ctx.releaseWorkItem(openTest);
+
+		std::string streamed;
+		const uint64_t readSizes[] = {1000, 3000, 5000, 8192, 100};
+		for (uint32_t i = 0; ; ++i) {
+			readTest = ctx.readFileHandle(file, readSizes[i % _countof(readSizes)]);
+			WaitForWorkItem(readTest);
+			if (WorkItemGetResult(readTest) != LFS_OK || WorkItemGetBytes(readTest) == 0) {
+				TEST(LFS_OK, WorkItemGetResult(readTest), "Read file handle to the end");
+				ctx.releaseWorkItem(readTest);
+				break;
+			}
+
+			streamed.append(static_cast<char*>(WorkItemGetBuffer(readTest)), WorkItemGetBytes(readTest));
+			WorkItemFreeBuffer(readTest);
+			ctx.releaseWorkItem(readTest);
+		}
+		TEST(true, streamed == contents, "Compare file read through a handle");
+
+		closeTest = ctx.closeFileHandle(file);
+		WaitForWorkItem(closeTest);
+		ctx.releaseWorkItem(closeTest);
+
+		openTest = ctx.openFile("/two/nonexistent.txt");
+		WaitForWorkItem(openTest);
+		TEST(LFS_NOT_FOUND, WorkItemGetResult(openTest), "Open missing file handle (expected fail)");
+		TEST(true, WorkItemGetFileHandle(openTest) == nullptr, "Failed open has no handle");
+		ctx.releaseWorkItem(openTest);
+
+		WorkItem *deleteTest = ctx.deleteFile("/two/stream.txt");
+		WaitForWorkItem(deleteTest);
+		ctx.releaseWorkItem(deleteTest);
+
+		// devices without handle functions are streamed by path, and handles outlive a released mount
+		Mount ramMount = ctx.createMount(FileContext::kRamDeviceIndex, "/ramstream", "", resultCode);
+		openTest = ctx.openFile("/ramstream/log.txt", LFS_OPEN_APPEND);
+		WaitForWorkItem(openTest);
+		TEST(LFS_OK, WorkItemGetResult(openTest), "Open RAM file handle for appending");
+		file = WorkItemGetFileHandle(openTest);
+		ctx.releaseWorkItem(openTest);
+
+		WorkItem *writeTest = ctx.writeFileHandle(file, "first,", 6);
+		WaitForWorkItem(writeTest);
+		ctx.releaseWorkItem(writeTest);
+		writeTest = ctx.writeFileHandle(file, "second", 6);
+		WaitForWorkItem(writeTest);
+		ctx.releaseWorkItem(writeTest);
+		closeTest = ctx.closeFileHandle(file);
+		WaitForWorkItem(closeTest);
+		ctx.releaseWorkItem(closeTest);
+
+		openTest = ctx.openFile("/ramstream/log.txt", LFS_OPEN_READ, 4);
+		WaitForWorkItem(openTest);
+		file = WorkItemGetFileHandle(openTest);
+		ctx.releaseWorkItem(openTest);
+
+		TEST(true, ctx.releaseMount(ramMount), "Release mount with an open file handle");
+
+		readTest = ctx.readFileHandle(file, 64);
+		WaitForWorkItem(readTest);
+		TEST(LFS_OK, WorkItemGetResult(readTest), "Read file handle after releasing its mount");
+		TEST(12, WorkItemGetBytes(readTest), "Read file handle after releasing its mount size");
+		TEST(0, memcmp(WorkItemGetBuffer(readTest), "first,second", 12), "Compare RAM file read through a handle");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+
+		closeTest = ctx.closeFileHandle(file);
+		WaitForWorkItem(closeTest);
+		ctx.releaseWorkItem(closeTest);
+	}
+
+	// test device capabilities
+	{
+		const uint32_t directoryCaps = LFS_DEVICE_CAP_HANDLES | LFS_DEVICE_CAP_READ_INTO | LFS_DEVICE_CAP_VECTORED | LFS_DEVICE_CAP_MMAP | LFS_DEVICE_CAP_DIRECT_IO | LFS_DEVICE_CAP_ACCESS_HINTS;
+		TEST(directoryCaps, ctx.getDeviceCapabilities(FileContext::kDirectoryDeviceIndex), "Directory device capabilities");
+		TEST((LFS_DEVICE_CAP_MMAP | LFS_DEVICE_CAP_ACCESS_HINTS), ctx.getDeviceCapabilities(FileContext::kPackDeviceIndex), "Pack device capabilities");
+		TEST(0, ctx.getDeviceCapabilities(FileContext::kRamDeviceIndex), "RAM device capabilities");
+		TEST(0, ctx.getDeviceCapabilities(1000), "Unknown device capabilities");
+
+		// an interface from before version 2 only gets the functions it knew about
+		FileContext::DeviceInterface old;
+		old._create = &DirectoryDevice::create;
+		old._destroy = &DirectoryDevice::destroy;
+		old._fileExists = &DirectoryDevice::fileExists;
+		old._fileSize = &DirectoryDevice::fileSize;
+		old._readFile = &DirectoryDevice::readFile;
+		old._openHandle = &DirectoryDevice::openHandle;
+		old._readHandle = &DirectoryDevice::readHandle;
+		old._writeHandle = &DirectoryDevice::writeHandle;
+		old._closeHandle = &DirectoryDevice::closeHandle;
+		old._version = 1;
+		old._capabilities = LFS_DEVICE_CAP_ASYNC;
+		int32_t oldIndex = ctx.registerDeviceInterface(old);
+		TEST(0, ctx.getDeviceCapabilities(oldIndex), "Version 1 device capabilities");
+
+		// a device built against the version 1 layout passes a smaller struct, which must not be read past its end
+		size_t oldBytes = offsetof(FileContext::DeviceInterface, _openHandle);
+		void *oldLayout = DefaultAllocator.alloc(DefaultAllocator.allocator, oldBytes, alignof(FileContext::DeviceInterface));
+		memcpy(oldLayout, static_cast<void*>(&old), oldBytes);
+		int32_t oldLayoutIndex = ctx.registerDeviceInterface(*static_cast<FileContext::DeviceInterface*>(oldLayout));
+		TEST(true, oldLayoutIndex >= 0 && ctx.getDeviceCapabilities(oldLayoutIndex) == 0, "Register version 1 sized device interface");
+		DefaultAllocator.free(DefaultAllocator.allocator, oldLayout);
+
+		Mount oldMount = ctx.createMount(oldIndex, "/v1", "testData/testroot", resultCode);
+		WorkItem *openTest = ctx.openFile("/v1/one/random.txt", LFS_OPEN_READ, 16);
+		WaitForWorkItem(openTest);
+		TEST(LFS_OK, WorkItemGetResult(openTest), "Open file handle on a version 1 device");
+		FileHandle file = WorkItemGetFileHandle(openTest);
+		ctx.releaseWorkItem(openTest);
+
+		WorkItem *readTest = ctx.readFileHandle(file, 64);
+		WaitForWorkItem(readTest);
+		TEST(LFS_OK, WorkItemGetResult(readTest), "Read file handle on a version 1 device");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+
+		WorkItem *closeTest = ctx.closeFileHandle(file);
+		WaitForWorkItem(closeTest);
+		ctx.releaseWorkItem(closeTest);
+		ctx.releaseMount(oldMount);
+	}
+
+	// test asynchronous device requests
+	{
+		FileContext::DeviceInterface async;
+		async._create = &AsyncTestDevice::create;
+		async._destroy = &AsyncTestDevice::destroy;
+		async._fileExists = &AsyncTestDevice::fileExists;
+		async._fileSize = &AsyncTestDevice::fileSize;
+		async._readFile = &AsyncTestDevice::readFile;
+		async._writeFile = &AsyncTestDevice::writeFile;
+		async._readFileAsync = &AsyncTestDevice::readFileAsync;
+		async._writeFileAsync = &AsyncTestDevice::writeFileAsync;
+		int32_t asyncIndex = ctx.registerDeviceInterface(async);
+		TEST(LFS_DEVICE_CAP_ASYNC, ctx.getDeviceCapabilities(asyncIndex), "Async device capabilities");
+
+		Mount asyncMount = ctx.createMount(asyncIndex, "/async", "", resultCode);
+
+		// requests are processed in order, so once the missing file is reported everything
+		// before it has reached the device
+		WorkItem *readTests[8];
+		for (uint32_t i = 0; i < _countof(readTests); ++i) {
+			readTests[i] = ctx.readFile(("/async/file" + std::to_string(i)).c_str(), false);
+		}
+		WorkItem *writeTest = ctx.writeFile("/async/written.txt", testString, strlen(testString));
+
+		WorkItem *missingTest = ctx.readFile("/async/missing.txt", false);
+		WaitForWorkItem(missingTest);
+		TEST(LFS_NOT_FOUND, WorkItemGetResult(missingTest), "Read missing file from async device (expected fail)");
+		ctx.releaseWorkItem(missingTest);
+
+		TEST(9, AsyncTestDevice::instance->pending(), "Requests pending on async device");
+		TEST(false, WorkItemCompleted(readTests[0]), "Pending request isn't completed");
+
+		AsyncTestDevice::instance->completeAll();
+
+		bool readsMatch = true;
+		for (uint32_t i = 0; i < _countof(readTests); ++i) {
+			WaitForWorkItem(readTests[i]);
+			std::string expected = "/file" + std::to_string(i);
+			readsMatch = readsMatch && WorkItemGetResult(readTests[i]) == LFS_OK && WorkItemGetBytes(readTests[i]) == expected.size()
+				&& memcmp(WorkItemGetBuffer(readTests[i]), expected.data(), expected.size()) == 0;
+			WorkItemFreeBuffer(readTests[i]);
+			ctx.releaseWorkItem(readTests[i]);
+		}
+		TEST(true, readsMatch, "Complete async reads");
+
+		WaitForWorkItem(writeTest);
+		TEST(LFS_OK, WorkItemGetResult(writeTest), "Complete async write");
+		TEST(strlen(testString), WorkItemGetBytes(writeTest), "Complete async write size");
+		ctx.releaseWorkItem(writeTest);
+
+		// a released mount lives on until its pending requests are done
+		WorkItem *lateTest = ctx.readFile("/async/late.txt", false);
+		missingTest = ctx.readFile("/async/missing.txt", false);
+		WaitForWorkItem(missingTest);
+		ctx.releaseWorkItem(missingTest);
+
+		TEST(true, ctx.releaseMount(asyncMount), "Release mount with a pending request");
+		TEST(false, AsyncTestDevice::destroyed, "Released mount kept for pending request");
+
+		AsyncTestDevice::instance->completeAll();
+		WaitForWorkItem(lateTest);
+		TEST(LFS_OK, WorkItemGetResult(lateTest), "Complete async read after releasing its mount");
+		TEST(true, AsyncTestDevice::destroyed, "Released mount destroyed after pending request");
+		WorkItemFreeBuffer(lateTest);
+		ctx.releaseWorkItem(lateTest);
+	}
+
+	// test parallel chunked reads
+	{
+		std::string contents;
+		for (uint32_t i = 0; contents.size() < 100000; ++i) {
+			contents += std::to_string(i * 7) + ";";
+		}
+
+		WorkItem *writeTest = ctx.writeFile("/two/chunked.txt", contents.data(), contents.size());
+		WaitForWorkItem(writeTest);
+		ctx.releaseWorkItem(writeTest);
+
+		ctx.setParallelReads(3, 4096);
+
+		WorkItem *readTest = ctx.readFile("/two/chunked.txt", true);
+		WaitForWorkItem(readTest);
+		TEST(LFS_OK, WorkItemGetResult(readTest), "Parallel read /two/chunked.txt");
+		TEST(contents.size(), WorkItemGetBytes(readTest), "Parallel read size");
+		TEST(0, strcmp(static_cast<char*>(WorkItemGetBuffer(readTest)), contents.c_str()), "Compare parallel read");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+
+		readTest = ctx.readFileSegment("/two/chunked.txt", 1001, 50000, false);
+		WaitForWorkItem(readTest);
+		TEST(50000, WorkItemGetBytes(readTest), "Parallel read segment size");
+		TEST(0, memcmp(WorkItemGetBuffer(readTest), contents.data() + 1001, 50000), "Compare parallel read segment");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+
+		readTest = ctx.readFile("/two/nonexistent.txt", false);
+		WaitForWorkItem(readTest);
+		TEST(LFS_NOT_FOUND, WorkItemGetResult(readTest), "Parallel read missing file (expected fail)");
+		ctx.releaseWorkItem(readTest);
+
+		// changing the setting with reads queued up mustn't pull the workers out from under them
+		WorkItem *queuedReads[8];
+		for (uint32_t i = 0; i < 8; ++i) {
+			queuedReads[i] = ctx.readFile("/two/chunked.txt", false);
+			ctx.setParallelReads(i % 2 ? 3 : 2, 4096 * (i + 1));
+		}
+
+		uint32_t queuedMatches = 0;
+		for (uint32_t i = 0; i < 8; ++i) {
+			WaitForWorkItem(queuedReads[i]);
+			if (WorkItemGetResult(queuedReads[i]) == LFS_OK && WorkItemGetBytes(queuedReads[i]) == contents.size() && memcmp(WorkItemGetBuffer(queuedReads[i]), contents.data(), contents.size()) == 0) {
+				++queuedMatches;
+			}
+			WorkItemFreeBuffer(queuedReads[i]);
+			ctx.releaseWorkItem(queuedReads[i]);
+		}
+		TEST(8, queuedMatches, "Parallel reads while changing the setting");
+
+		ctx.setParallelReads(0);
+
+		WorkItem *deleteTest = ctx.deleteFile("/two/chunked.txt");
+		WaitForWorkItem(deleteTest);
+		ctx.releaseWorkItem(deleteTest);
+	}
+
+	// test direct I/O mounts
+	{
+		Mount directMount = ctx.createMount(FileContext::kDirectoryDeviceIndex, "/direct", "testData/testroot/two", resultCode, LFS_MOUNT_ALL_PERMISSIONS | LFS_MOUNT_DIRECT_IO);
+		TEST(LFS_OK, resultCode, "Mount testData/testroot/two -> /direct with direct I/O");
+
+		// nothing here is a whole number of blocks, so every transfer has unaligned ends
+		std::string contents;
+		for (uint32_t i = 0; contents.size() < 10000; ++i) {
+			contents += std::to_string(i * 3) + "|";
+		}
+
+		WorkItem *writeTest = ctx.writeFile("/direct/direct.txt", contents.data(), contents.size());
+		WaitForWorkItem(writeTest);
+		TEST(LFS_OK, WorkItemGetResult(writeTest), "Direct write /direct/direct.txt");
+		TEST(contents.size(), WorkItemGetBytes(writeTest), "Direct write size");
+		ctx.releaseWorkItem(writeTest);
+
+		writeTest = ctx.writeFileSegment("/direct/direct.txt", 4090, "0123456789ab", 12);
+		WaitForWorkItem(writeTest);
+		TEST(LFS_OK, WorkItemGetResult(writeTest), "Direct write segment across a block boundary");
+		ctx.releaseWorkItem(writeTest);
+		contents.replace(4090, 12, "0123456789ab");
+
+		writeTest = ctx.appendFile("/direct/direct.txt", "tail", 4);
+		WaitForWorkItem(writeTest);
+		TEST(LFS_OK, WorkItemGetResult(writeTest), "Direct append");
+		ctx.releaseWorkItem(writeTest);
+		contents += "tail";
+
+		WorkItem *readTest = ctx.readFile("/direct/direct.txt", true);
+		WaitForWorkItem(readTest);
+		TEST(LFS_OK, WorkItemGetResult(readTest), "Direct read /direct/direct.txt");
+		TEST(contents.size(), WorkItemGetBytes(readTest), "Direct read size");
+		TEST(0, strcmp(static_cast<char*>(WorkItemGetBuffer(readTest)), contents.c_str()), "Compare direct read");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+
+		readTest = ctx.readFileSegment("/direct/direct.txt", 1001, 8000, false);
+		WaitForWorkItem(readTest);
+		TEST(8000, WorkItemGetBytes(readTest), "Direct read segment size");
+		TEST(0, memcmp(WorkItemGetBuffer(readTest), contents.data() + 1001, 8000), "Compare direct read segment");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+
+		// the same file through the cache, padding from the block writes must be gone
+		readTest = ctx.readFile("/two/direct.txt", false);
+		WaitForWorkItem(readTest);
+		TEST(contents.size(), WorkItemGetBytes(readTest), "Cached read of a direct write");
+		TEST(0, memcmp(WorkItemGetBuffer(readTest), contents.data(), contents.size()), "Compare cached read of a direct write");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+
+		WorkItem *deleteTest = ctx.deleteFile("/direct/direct.txt");
+		WaitForWorkItem(deleteTest);
+		ctx.releaseWorkItem(deleteTest);
+
+		TEST(true, ctx.releaseMount(directMount), "Unmount testData/testroot/two -> /direct");
+
+		ctx.createMount(FileContext::kRamDeviceIndex, "/ramdirect", "", resultCode, LFS_MOUNT_DIRECT_IO);
+		TEST(LFS_UNSUPPORTED, resultCode, "Mount RAM device with direct I/O (expected fail)");
+	}
+
+	// test access hints
+	{
+		FileContext::DeviceInterface hinted;
+		hinted._create = &DirectoryDevice::create;
+		hinted._destroy = &DirectoryDevice::destroy;
+		hinted._fileExists = &DirectoryDevice::fileExists;
+		hinted._fileSize = &DirectoryDevice::fileSize;
+		hinted._readFile = &DirectoryDevice::readFile;
+		hinted._openHandle = &DirectoryDevice::openHandle;
+		hinted._readHandle = &DirectoryDevice::readHandle;
+		hinted._writeHandle = &DirectoryDevice::writeHandle;
+		hinted._closeHandle = &DirectoryDevice::closeHandle;
+		hinted._adviseFile = &HintRecorder::adviseFile;
+		hinted._adviseHandle = &HintRecorder::adviseHandle;
+		int32_t hintedIndex = ctx.registerDeviceInterface(hinted);
+		TEST((LFS_DEVICE_CAP_HANDLES | LFS_DEVICE_CAP_READ_INTO | LFS_DEVICE_CAP_ACCESS_HINTS), ctx.getDeviceCapabilities(hintedIndex), "Hinted device capabilities");
+
+		Mount hintedMount = ctx.createMount(hintedIndex, "/hinted", "testData/testroot2", resultCode);
+
+		WorkItem *readTest = ctx.readFile("/hinted/four.txt", false);
+		WaitForWorkItem(readTest);
+		uint64_t fileBytes = WorkItemGetBytes(readTest);
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+		TEST(true, HintRecorder::fileHints.empty(), "Reads without hints don't advise the device");
+
+		// the access pattern goes to the device before the read, dropping the data after it
+		readTest = ctx.readFile("/hinted/four.txt", false, nullptr, LFS_READ_RANDOM | LFS_READ_DONTNEED);
+		WaitForWorkItem(readTest);
+		TEST(LFS_OK, WorkItemGetResult(readTest), "Read /hinted/four.txt with hints");
+		TEST(fileBytes, WorkItemGetBytes(readTest), "Read with hints size");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+		TEST(true, HintRecorder::fileHints == std::vector<uint32_t>({LFS_READ_RANDOM, LFS_READ_DONTNEED}), "Read hints given in order");
+
+		WorkItem *openTest = ctx.openFile("/hinted/four.txt", LFS_OPEN_READ, 16, LFS_READ_SEQUENTIAL | LFS_READ_DONTNEED);
+		WaitForWorkItem(openTest);
+		TEST(LFS_OK, WorkItemGetResult(openTest), "Open file handle with hints");
+		FileHandle file = WorkItemGetFileHandle(openTest);
+		ctx.releaseWorkItem(openTest);
+
+		readTest = ctx.readFileHandle(file, fileBytes);
+		WaitForWorkItem(readTest);
+		TEST(fileBytes, WorkItemGetBytes(readTest), "Read file handle with hints");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+
+		WorkItem *closeTest = ctx.closeFileHandle(file);
+		WaitForWorkItem(closeTest);
+		ctx.releaseWorkItem(closeTest);
+		TEST(true, HintRecorder::handleHints == std::vector<uint32_t>({LFS_READ_SEQUENTIAL, LFS_READ_DONTNEED}), "Handle hints given on open and close");
+
+		ctx.releaseMount(hintedMount);
+
+		// the archive devices advise their mapping, which has to leave reads intact
+		std::string packBytes = buildPack({{"/a.txt", "random access"}}, 64);
+		WorkItem *packWrite = ctx.writeFile("/four/hints.pack", packBytes.data(), packBytes.size());
+		WaitForWorkItem(packWrite);
+		ctx.releaseWorkItem(packWrite);
+
+		Mount packMount = ctx.createMount(FileContext::kPackDeviceIndex, "/hintpack", "testData/testroot2/hints.pack", resultCode);
+		readTest = ctx.readFile("/hintpack/a.txt", true, nullptr, LFS_READ_RANDOM | LFS_READ_WILLNEED | LFS_READ_DONTNEED);
+		WaitForWorkItem(readTest);
+		TEST(0, strcmp(static_cast<char*>(WorkItemGetBuffer(readTest)), "random access"), "Read pack file with hints");
+		WorkItemFreeBuffer(readTest);
+		ctx.releaseWorkItem(readTest);
+		ctx.releaseMount(packMount);
+
+		WorkItem *deleteTest = ctx.deleteFile("/four/hints.pack");
+		WaitForWorkItem(deleteTest);
+		ctx.releaseWorkItem(deleteTest);
+	}
+
+	// test changing mounts while work is in flight
+	{
+		Mount hotMount = ctx.createMount(0, "/hot", "testData/testroot2", resultCode);
+		TEST(LFS_OK, resultCode, "Mount testData/testroot2 -> /hot");
+
+		WorkItem *readTests[16];
+		for (uint32_t i = 0; i < _countof(readTests); ++i) {
+			readTests[i] = ctx.readFile(i % 2 ? "/hot/four.txt" : "/four/four.txt", false);
+		}
+
+		// unmounting from a callback used to deadlock on the processing thread
+		std::pair<FileContext*, Mount> unmount(&ctx, hotMount);
+		ctx.fileExistsWithCallback("/hot/four.txt", [](const WorkItem *, void *userData) {
+			auto *unmount = static_cast<std::pair<FileContext*, Mount>*>(userData);
+			unmount->first->releaseMount(unmount->second);
+		}, &unmount);
+
+		Mount swapMount = ctx.createMount(0, "/swap", "testData/testroot2", resultCode);
+
+		uint32_t readsOk = 0;
+		for (uint32_t i = 0; i < _countof(readTests); ++i) {
+			WaitForWorkItem(readTests[i]);
+			readsOk += WorkItemGetResult(readTests[i]) == LFS_OK ? 1 : 0;
+			WorkItemFreeBuffer(readTests[i]);
+			ctx.releaseWorkItem(readTests[i]);
+		}
+		TEST(_countof(readTests), readsOk, "Reads complete while mounts change");
+
+		WorkItem *goneTest = ctx.fileExists("/hot/four.txt");
+		WaitForWorkItem(goneTest);
+		TEST(LFS_NOT_FOUND, WorkItemGetResult(goneTest), "Unmount from callback");
+		ctx.releaseWorkItem(goneTest);
+
+		TEST(true, ctx.releaseMount(swapMount), "Unmount testData/testroot2 -> /swap");
+	}
+
+	// stress mounting and unmounting against concurrent lookups, back to back table swaps used
+	// to free a table out from under a reader that announced itself late
+	{
+		std::atomic<bool> churning{true};
+		std::atomic<uint32_t> lookupFailures{0};
+
+		auto lookups = [&]() {
+			while (churning) {
+				ctx.getPathFilterStats();
+
+				WorkItem *readTest = ctx.readFile("/four/four.txt", false);
+				WaitForWorkItem(readTest);
+				if (WorkItemGetResult(readTest) != LFS_OK) {
+					++lookupFailures;
+				}
+				WorkItemFreeBuffer(readTest);
+				ctx.releaseWorkItem(readTest);
+			}
+		};
+
+		auto churn = [&](const char *mountPoint) {
+			for (uint32_t i = 0; i < 200; ++i) {
+				ErrorCode churnResult = LFS_OK;
+				Mount churnMount = ctx.createMount(0, mountPoint, "testData/testroot2", churnResult);
+				if (churnResult != LFS_OK || !ctx.releaseMount(churnMount)) {
+					++lookupFailures;
+				}
+			}
+		};
+
+		std::thread readers[] = {std::thread(lookups), std::thread(lookups)};
+		std::thread writers[] = {std::thread(churn, "/churn1"), std::thread(churn, "/churn2")};
+		for (std::thread &writer : writers) {
+			writer.join();
+		}
+		churning = false;
+		for (std::thread &reader : readers) {
+			reader.join();
+		}
+
+		TEST(0, lookupFailures, "Lookups while mounts churn");
+	}
+
 	// remove mount
 	TEST(true, ctx.releaseMount(mount2), "Unmount testData/testroot2 -> /four");
 	TEST(false, ctx.releaseMount(mount3), "Unmount testData/nonexistentdir -> /five (expected fail)");
@@ -0,0 +1,551 @@
+// LaminaFS is Copyright (c) 2016 Brett Lajzer
+// See LICENSE for license information.
+
+// Builds a pack file (see device/PackFormat.h) out of a directory tree.
+//
+// Files named by an access trace or a manifest are laid out first, in the order they were
+// read, so that replaying startup touches the pack nearly sequentially. Everything else
+// follows in path order. Files with identical contents share their data. Hashing and
+// copying are spread over worker threads, so each file is read twice: once to hash it,
+// and once to copy it. Compressed packs compress every block in both passes, the first
+// pass only to learn the compressed sizes so that memory use doesn't grow with the tree.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <laminaFS.h>
+#include "device/PackFormat.h"
+#include "util/AccessTrace.h"
+#include "util/Hash.h"
+#include "util/Lz.h"
+
+using namespace laminaFS;
+namespace fs = std::filesystem;
+
+namespace {
+constexpr uint64_t kCopyBufferBytes = 1 << 20;
+constexpr uint64_t kPageBytes = 4096;
+constexpr uint32_t kNoRank = UINT32_MAX;
+constexpr uint32_t kDefaultBlockSize = 64 * 1024;
+
+struct Options {
+	fs::path _input;
+	fs::path _output;
+	std::vector<std::pair<bool, std::string>> _orderSources; // (isTrace, file)
+	std::string _mountPoint = "/";
+	uint64_t _alignment = 16;
+	uint64_t _pageAlignMin = 64 * 1024;
+	uint32_t _jobs = 0;
+	uint32_t _blockSize = 0; // compressed if not 0
+	bool _dedup = true;
+};
+
+struct SourceFile {
+	std::string _path; // device path, starting with a '/'
+	fs::path _diskPath;
+	uint64_t _size = 0;
+	uint64_t _contentHash = 0;
+	uint64_t _offset = 0;
+	uint64_t _storedSize = 0; // including the block table in compressed packs
+	std::vector<uint32_t> _blockBytes; // compressed size of each block
+	uint32_t _rank = kNoRank;
+	bool _duplicate = false;
+	bool _failed = false;
+};
+
+void printUsage(const char *program) {
+	fprintf(stderr,
+		"usage: %s [options] <input dir> <output pack>\n"
+		"  --trace <file>         lay files out in the order an access trace read them\n"
+		"  --mount <path>         mount point the trace was recorded with (default /)\n"
+		"  --manifest <file>      lay files out in the order listed, one path per line\n"
+		"  --align <bytes>        alignment of file data, a power of two (default 16)\n"
+		"  --page-align <bytes>   page align files at least this big, 0 to disable (default 65536)\n"
+		"  --no-dedup             store files with identical contents separately\n"
+		"  --compress             compress files in independent blocks\n"
+		"  --block-size <bytes>   block size of compressed packs, a power of two (default 65536)\n"
+		"  --jobs <count>         worker threads (default: one per core)\n"
+		"Order sources are applied in the order given; the earliest position wins.\n",
+		program);
+}
+
+bool parseNumber(const char *str, uint64_t &value) {
+	char *end = nullptr;
+	value = strtoull(str, &end, 10);
+	return end != str && *end == 0;
+}
+
+bool parseOptions(int argc, char *argv[], Options &options) {
+	std::vector<const char*> positional;
+
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+		uint64_t number = 0;
+
+		if (strcmp(arg, "--no-dedup") == 0) {
+			options._dedup = false;
+		} else if (strcmp(arg, "--compress") == 0) {
+			options._blockSize = options._blockSize ? options._blockSize : kDefaultBlockSize;
+		} else if (arg[0] == '-' && arg[1] == '-' && !value) {
+			fprintf(stderr, "%s needs a value\n", arg);
+			return false;
+		} else if (strcmp(arg, "--trace") == 0 || strcmp(arg, "--manifest") == 0) {
+			options._orderSources.emplace_back(strcmp(arg, "--trace") == 0, value);
+			++i;
+		} else if (strcmp(arg, "--mount") == 0) {
+			options._mountPoint = value;
+			while (options._mountPoint.size() > 1 && options._mountPoint.back() == '/') {
+				options._mountPoint.pop_back();
+			}
+			++i;
+		} else if (strcmp(arg, "--align") == 0) {
+			if (!parseNumber(value, number) || number == 0 || (number & (number - 1)) != 0) {
+				fprintf(stderr, "--align must be a power of two\n");
+				return false;
+			}
+			options._alignment = number;
+			++i;
+		} else if (strcmp(arg, "--page-align") == 0) {
+			if (!parseNumber(value, number)) {
+				fprintf(stderr, "--page-align must be a number\n");
+				return false;
+			}
+			options._pageAlignMin = number;
+			++i;
+		} else if (strcmp(arg, "--block-size") == 0) {
+			if (!parseNumber(value, number) || number < pack::kMinBlockSize || number > pack::kMaxBlockSize || (number & (number - 1)) != 0) {
+				fprintf(stderr, "--block-size must be a power of two between %u and %u\n", pack::kMinBlockSize, pack::kMaxBlockSize);
+				return false;
+			}
+			options._blockSize = static_cast<uint32_t>(number);
+			++i;
+		} else if (strcmp(arg, "--jobs") == 0) {
+			if (!parseNumber(value, number) || number == 0 || number > 1024) {
+				fprintf(stderr, "--jobs must be between 1 and 1024\n");
+				return false;
+			}
+			options._jobs = static_cast<uint32_t>(number);
+			++i;
+		} else if (arg[0] == '-' && arg[1] == '-') {
+			fprintf(stderr, "unknown option %s\n", arg);
+			return false;
+		} else {
+			positional.push_back(arg);
+		}
+	}
+
+	if (positional.size() != 2) {
+		return false;
+	}
+
+	options._input = positional[0];
+	options._output = positional[1];
+	if (options._jobs == 0) {
+		options._jobs = std::max(1u, std::thread::hardware_concurrency());
+	}
+	return true;
+}
+
+// calls func(index, worker) for every index in [0, count) from a pool of threads,
+// worker is in [0, jobs) and identifies the calling thread
+template <typename Func>
+void parallelFor(size_t count, uint32_t jobs, Func &&func) {
+	std::atomic<size_t> next{0};
+	auto worker = [&](uint32_t workerIndex) {
+		for (size_t i = next++; i < count; i = next++) {
+			func(i, workerIndex);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (uint32_t i = 1; i < std::min<size_t>(jobs, count); ++i) {
+		threads.emplace_back(worker, i);
+	}
+	worker(0);
+
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+}
+
+uint64_t alignUp(uint64_t value, uint64_t alignment) {
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+bool collectFiles(const fs::path &root, const fs::path &output, std::vector<SourceFile> &files) {
+	std::error_code error;
+	fs::path outputPath = fs::weakly_canonical(output, error);
+
+	for (fs::recursive_directory_iterator it(root, error), end; !error && it != end; it.increment(error)) {
+		if (!it->is_regular_file(error) || (!outputPath.empty() && fs::equivalent(it->path(), outputPath, error))) {
+			continue;
+		}
+
+		SourceFile file;
+		file._path = "/" + it->path().lexically_relative(root).generic_u8string();
+		file._diskPath = it->path();
+		files.push_back(std::move(file));
+	}
+
+	if (error) {
+		fprintf(stderr, "error reading %s: %s\n", root.u8string().c_str(), error.message().c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool readFileToString(const fs::path &path, std::string &contents) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+		return false;
+
+	contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	return !in.bad();
+}
+
+// Assigns every file its position in the first order source that names it.
+bool applyOrderSources(const Options &options, std::vector<SourceFile> &files) {
+	std::unordered_map<std::string, SourceFile*> byPath;
+	for (SourceFile &file : files) {
+		byPath.emplace(file._path, &file);
+	}
+
+	uint32_t rank = 0;
+	auto rankPath = [&](std::string path) {
+		auto it = byPath.find(path);
+		if (it != byPath.end() && it->second->_rank == kNoRank) {
+			it->second->_rank = rank++;
+		}
+	};
+
+	for (const auto &source : options._orderSources) {
+		std::string contents;
+		if (!readFileToString(source.second, contents)) {
+			fprintf(stderr, "couldn't read %s\n", source.second.c_str());
+			return false;
+		}
+
+		if (source.first) {
+			const std::string &mount = options._mountPoint;
+			bool valid = util::AccessTrace::forEach(DefaultAllocator, contents.data(), contents.size(), [&](const char *path, uint16_t len, const util::AccessTrace::Entry &) {
+				// trace paths are context paths, only the ones under the mount point belong to the pack
+				if (mount == "/") {
+					rankPath(std::string(path, len));
+				} else if (len > mount.size() && memcmp(path, mount.data(), mount.size()) == 0 && path[mount.size()] == '/') {
+					rankPath(std::string(path + mount.size(), len - mount.size()));
+				}
+			});
+
+			if (!valid) {
+				fprintf(stderr, "%s is not a valid access trace\n", source.second.c_str());
+				return false;
+			}
+		} else {
+			size_t lineStart = 0;
+			while (lineStart < contents.size()) {
+				size_t lineEnd = contents.find('\n', lineStart);
+				if (lineEnd == std::string::npos)
+					lineEnd = contents.size();
+
+				std::string line = contents.substr(lineStart, lineEnd - lineStart);
+				while (!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t')) {
+					line.pop_back();
+				}
+
+				if (!line.empty() && line[0] != '#') {
+					rankPath(line[0] == '/' ? line : "/" + line);
+				}
+				lineStart = lineEnd + 1;
+			}
+		}
+	}
+
+	return true;
+}
+
+// per worker buffers
+struct Scratch {
+	std::vector<char> _buffer;
+	std::vector<char> _compressed;
+};
+
+// compresses a block, returning its stored size, which is its size if it didn't shrink
+uint32_t compressBlock(const char *data, uint32_t bytes, Scratch &scratch) {
+	size_t compressed = util::lz::compress(data, bytes, scratch._compressed.data(), scratch._compressed.size());
+	return compressed > 0 && compressed < bytes ? static_cast<uint32_t>(compressed) : bytes;
+}
+
+bool hashContents(SourceFile &file, uint32_t blockSize, Scratch &scratch) {
+	std::ifstream in(file._diskPath, std::ios::binary);
+	if (!in)
+		return false;
+
+	uint64_t hash = util::kFNVOffsetBasis;
+	uint64_t size = 0;
+	uint64_t storedSize = 0;
+	while (in) {
+		in.read(scratch._buffer.data(), blockSize ? blockSize : scratch._buffer.size());
+		uint32_t bytes = static_cast<uint32_t>(in.gcount());
+		hash = util::hashBytes(scratch._buffer.data(), bytes, hash);
+		size += bytes;
+
+		if (blockSize && bytes > 0) {
+			file._blockBytes.push_back(compressBlock(scratch._buffer.data(), bytes, scratch));
+			storedSize += file._blockBytes.back();
+		}
+	}
+
+	file._contentHash = hash;
+	file._size = size;
+	file._storedSize = blockSize ? (file._blockBytes.size() + 1) * sizeof(uint64_t) + storedSize : size;
+	return !in.bad();
+}
+
+bool sameContents(const SourceFile &a, const SourceFile &b) {
+	std::ifstream inA(a._diskPath, std::ios::binary);
+	std::ifstream inB(b._diskPath, std::ios::binary);
+	std::vector<char> bufferA(kCopyBufferBytes);
+	std::vector<char> bufferB(kCopyBufferBytes);
+
+	while (inA && inB) {
+		inA.read(bufferA.data(), bufferA.size());
+		inB.read(bufferB.data(), bufferB.size());
+		if (inA.gcount() != inB.gcount() || memcmp(bufferA.data(), bufferB.data(), static_cast<size_t>(inA.gcount())) != 0)
+			return false;
+	}
+
+	return !inA.bad() && !inB.bad() && inA.eof() && inB.eof();
+}
+
+bool copyContents(const SourceFile &file, uint32_t blockSize, std::fstream &out, Scratch &scratch) {
+	std::ifstream in(file._diskPath, std::ios::binary);
+	if (!in)
+		return false;
+
+	out.seekp(static_cast<std::streamoff>(file._offset));
+	uint64_t remaining = file._size;
+
+	if (blockSize) {
+		std::vector<uint64_t> table(1, file._offset + (file._blockBytes.size() + 1) * sizeof(uint64_t));
+		for (uint32_t stored : file._blockBytes) {
+			table.push_back(table.back() + stored);
+		}
+		out.write(reinterpret_cast<const char*>(table.data()), static_cast<std::streamsize>(table.size() * sizeof(uint64_t)));
+
+		for (size_t block = 0; remaining > 0 && in; ++block) {
+			in.read(scratch._buffer.data(), static_cast<std::streamsize>(std::min<uint64_t>(remaining, blockSize)));
+			uint32_t bytes = static_cast<uint32_t>(in.gcount());
+			remaining -= bytes;
+
+			// compression is deterministic, so a different size means the file changed
+			uint32_t stored = compressBlock(scratch._buffer.data(), bytes, scratch);
+			if (block >= file._blockBytes.size() || stored != file._blockBytes[block])
+				return false;
+			out.write(stored < bytes ? scratch._compressed.data() : scratch._buffer.data(), stored);
+		}
+	}
+
+	while (remaining > 0 && in) {
+		in.read(scratch._buffer.data(), static_cast<std::streamsize>(std::min<uint64_t>(remaining, scratch._buffer.size())));
+		out.write(scratch._buffer.data(), in.gcount());
+		remaining -= static_cast<uint64_t>(in.gcount());
+	}
+
+	// the file changing size since it was hashed would corrupt the pack
+	return remaining == 0 && in.peek() == std::ifstream::traits_type::eof() && out.good();
+}
+}
+
+int main(int argc, char *argv[]) {
+	Options options;
+	if (!parseOptions(argc, argv, options)) {
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<SourceFile> files;
+	if (!collectFiles(options._input, options._output, files) || !applyOrderSources(options, files)) {
+		return 1;
+	}
+
+	// hash contents and gather sizes
+	std::vector<Scratch> scratch(options._jobs);
+	for (Scratch &s : scratch) {
+		s._buffer.resize(std::max<uint64_t>(kCopyBufferBytes, options._blockSize));
+		s._compressed.resize(util::lz::compressBound(options._blockSize));
+	}
+
+	parallelFor(files.size(), options._jobs, [&](size_t i, uint32_t worker) {
+		files[i]._failed = !hashContents(files[i], options._blockSize, scratch[worker]);
+	});
+
+	for (const SourceFile &file : files) {
+		if (file._failed) {
+			fprintf(stderr, "couldn't read %s\n", file._diskPath.u8string().c_str());
+			return 1;
+		}
+	}
+
+	// data layout: access order first, then everything else by path
+	std::vector<SourceFile*> layout;
+	for (SourceFile &file : files) {
+		layout.push_back(&file);
+	}
+	std::sort(layout.begin(), layout.end(), [](const SourceFile *a, const SourceFile *b) {
+		return a->_rank != b->_rank ? a->_rank < b->_rank : a->_path < b->_path;
+	});
+
+	// the TOC is sorted for lookups, see pack::entryLess()
+	std::vector<SourceFile*> toc(layout);
+	std::vector<uint64_t> pathHashes(files.size());
+	for (size_t i = 0; i < files.size(); ++i) {
+		pathHashes[i] = util::hashString(files[i]._path.c_str());
+	}
+	auto pathHash = [&](const SourceFile *file) { return pathHashes[static_cast<size_t>(file - files.data())]; };
+	std::sort(toc.begin(), toc.end(), [&](const SourceFile *a, const SourceFile *b) {
+		return pack::entryLess(pathHash(a), a->_path.data(), static_cast<uint32_t>(a->_path.size()), pathHash(b), b->_path.data(), static_cast<uint32_t>(b->_path.size()));
+	});
+
+	pack::CompressedHeader compressedHeader;
+	compressedHeader._blockSize = options._blockSize;
+	compressedHeader._codec = pack::kCodecLZ;
+
+	// block tables are read in place, so they need 8 byte alignment
+	uint64_t alignment = options._blockSize ? std::max<uint64_t>(options._alignment, alignof(uint64_t)) : options._alignment;
+
+	pack::Header &header = compressedHeader._header;
+	memcpy(header._magic, options._blockSize ? pack::kCompressedMagic : pack::kMagic, sizeof(header._magic));
+	header._version = pack::kVersion;
+	header._entryCount = static_cast<uint32_t>(files.size());
+	header._alignment = static_cast<uint32_t>(alignment);
+	header._tocOffset = options._blockSize ? sizeof(compressedHeader) : sizeof(header);
+	header._stringsOffset = header._tocOffset + files.size() * sizeof(pack::Entry);
+
+	std::string strings;
+	std::vector<pack::Entry> entries(toc.size());
+	for (size_t i = 0; i < toc.size(); ++i) {
+		entries[i]._pathHash = pathHash(toc[i]);
+		entries[i]._pathOffset = static_cast<uint32_t>(strings.size());
+		entries[i]._pathLength = static_cast<uint32_t>(toc[i]->_path.size());
+		strings += toc[i]->_path;
+	}
+	header._stringsBytes = strings.size();
+
+	// assign data offsets, pointing duplicates at the first copy
+	std::unordered_map<uint64_t, std::vector<SourceFile*>> byContent;
+	uint64_t cursor = header._stringsOffset + header._stringsBytes;
+	uint64_t duplicateCount = 0;
+	uint64_t duplicateBytes = 0;
+
+	for (SourceFile *file : layout) {
+		if (options._dedup && file->_size > 0) {
+			std::vector<SourceFile*> &candidates = byContent[file->_contentHash ^ file->_size];
+			for (SourceFile *candidate : candidates) {
+				if (candidate->_size == file->_size && candidate->_contentHash == file->_contentHash && sameContents(*candidate, *file)) {
+					file->_offset = candidate->_offset;
+					file->_duplicate = true;
+					break;
+				}
+			}
+
+			if (file->_duplicate) {
+				++duplicateCount;
+				duplicateBytes += file->_storedSize;
+				continue;
+			}
+			candidates.push_back(file);
+		}
+
+		bool pageAlign = options._pageAlignMin > 0 && file->_storedSize >= options._pageAlignMin;
+		file->_offset = alignUp(cursor, pageAlign ? std::max(alignment, kPageBytes) : alignment);
+		cursor = file->_offset + file->_storedSize;
+	}
+
+	for (size_t i = 0; i < toc.size(); ++i) {
+		entries[i]._offset = toc[i]->_offset;
+		entries[i]._size = toc[i]->_size;
+	}
+
+	// write the header, TOC and strings, then copy file data in parallel
+	{
+		std::ofstream out(options._output, std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char*>(&compressedHeader), static_cast<std::streamsize>(header._tocOffset));
+		out.write(reinterpret_cast<const char*>(entries.data()), static_cast<std::streamsize>(entries.size() * sizeof(pack::Entry)));
+		out.write(strings.data(), static_cast<std::streamsize>(strings.size()));
+		if (!out) {
+			fprintf(stderr, "couldn't write %s\n", options._output.u8string().c_str());
+			return 1;
+		}
+	}
+
+	std::error_code error;
+	fs::resize_file(options._output, cursor, error);
+	if (error) {
+		fprintf(stderr, "couldn't resize %s: %s\n", options._output.u8string().c_str(), error.message().c_str());
+		return 1;
+	}
+
+	// each worker writes through its own stream, at offsets that never overlap
+	std::atomic<bool> copyFailed{false};
+	std::vector<std::fstream> streams(options._jobs);
+	parallelFor(layout.size(), options._jobs, [&](size_t i, uint32_t worker) {
+		const SourceFile &file = *layout[i];
+		if (file._duplicate || file._storedSize == 0)
+			return;
+
+		std::fstream &out = streams[worker];
+		if (!out.is_open()) {
+			out.open(options._output, std::ios::binary | std::ios::in | std::ios::out);
+		}
+
+		if (!copyContents(file, options._blockSize, out, scratch[worker])) {
+			fprintf(stderr, "couldn't copy %s\n", file._diskPath.u8string().c_str());
+			copyFailed = true;
+		}
+	});
+
+	for (std::fstream &out : streams) {
+		if (out.is_open()) {
+			out.close();
+			copyFailed = copyFailed || out.fail();
+		}
+	}
+
+	if (copyFailed) {
+		fs::remove(options._output, error);
+		return 1;
+	}
+
+	uint64_t ordered = static_cast<uint64_t>(std::count_if(files.begin(), files.end(), [](const SourceFile &file) { return file._rank != kNoRank; }));
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%s: %zu files (%llu in access order), %llu bytes\n", options._output.u8string().c_str(), files.size(),
+		static_cast<unsigned long long>(ordered), static_cast<unsigned long long>(cursor));
+	printf("%llu duplicates sharing data, %llu bytes saved\n", static_cast<unsigned long long>(duplicateCount), static_cast<unsigned long long>(duplicateBytes));
+	if (options._blockSize) {
+		uint64_t rawBytes = 0;
+		uint64_t storedBytes = 0;
+		for (const SourceFile &file : files) {
+			rawBytes += file._duplicate ? 0 : file._size;
+			storedBytes += file._duplicate ? 0 : file._storedSize;
+		}
+		printf("compressed %llu bytes to %llu in %u byte blocks\n", static_cast<unsigned long long>(rawBytes), static_cast<unsigned long long>(storedBytes), options._blockSize);
+	}
+	printf("built in %.2fs with %u threads\n", seconds, options._jobs);
+
+	return 0;
+}